@@ -0,0 +1,99 @@
+#include "arena.h"
+
+// Each chunk starts with one of these, padded to a cache line so pieces stay
+// aligned
+typedef struct _arena_chunk {
+	struct _arena_chunk *next;
+	// Size of the whole chunk, header included
+	size_t size;
+	// Bytes carved so far, header included
+	size_t used;
+	// Bytes that have ever been carved since the chunk was mapped. Past this,
+	// the pages are still fresh from mmap, and so already zero.
+	size_t dirty;
+	char _pad[32];
+} _arena_chunk;
+
+static const size_t _ARENA_CHUNK_SIZE = 4 << 20;
+static const size_t _ARENA_ALIGN = 64;
+
+void arena_init(arena *a, size_t chunk_size) {
+	a->_chunks = NULL;
+	a->chunk_size = chunk_size ? chunk_size : _ARENA_CHUNK_SIZE;
+	a->allocs = 0;
+	a->maps = 0;
+	a->mapped = 0;
+}
+
+// Maps a chunk of at least size bytes, rounded up to whole pages, and makes it
+// the current one
+void _arena_map(arena *a, size_t size) {
+	long page = sysconf(_SC_PAGESIZE);
+	size = (size + page - 1) / page * page;
+	_arena_chunk *chunk = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(chunk == MAP_FAILED) {
+		printf("arena map failed\n");
+		exit(62);
+	}
+	advise_huge_pages(chunk, size);
+	chunk->next = a->_chunks;
+	chunk->size = size;
+	chunk->used = sizeof(_arena_chunk);
+	chunk->dirty = sizeof(_arena_chunk);
+	a->_chunks = chunk;
+	a->maps++;
+	a->mapped += size;
+}
+
+// Whatever is left of the current chunk is abandoned when a piece doesn't fit,
+// since pieces are carved in order
+void *arena_alloc(arena *a, size_t size) {
+	size = (size + _ARENA_ALIGN - 1) / _ARENA_ALIGN * _ARENA_ALIGN;
+	_arena_chunk *chunk = a->_chunks;
+	if(chunk == NULL || chunk->size - chunk->used < size) {
+		size_t need = size + sizeof(_arena_chunk);
+		_arena_map(a, need > a->chunk_size ? need : a->chunk_size);
+		chunk = a->_chunks;
+	}
+	char *piece = (char*) chunk + chunk->used;
+	// Memory given out before the last reset has to be cleared again
+	size_t end = chunk->used + size;
+	char *clear_end = (char*) chunk + (end < chunk->dirty ? end : chunk->dirty);
+	for(char *p = piece; p < clear_end; p++) {
+		*p = 0;
+	}
+	chunk->used = end;
+	if(end > chunk->dirty) chunk->dirty = end;
+	a->allocs++;
+	return piece;
+}
+
+void _arena_unmap_all(arena *a) {
+	_arena_chunk *chunk = a->_chunks;
+	while(chunk != NULL) {
+		_arena_chunk *next = chunk->next;
+		if(munmap(chunk, chunk->size)) {
+			perror("arena munmap");
+			exit(63);
+		}
+		chunk = next;
+	}
+	a->_chunks = NULL;
+	a->mapped = 0;
+}
+
+void arena_reset(arena *a) {
+	if(a->_chunks == NULL) return;
+	if(a->_chunks->next == NULL) {
+		a->_chunks->used = sizeof(_arena_chunk);
+		return;
+	}
+	size_t total = a->mapped;
+	_arena_unmap_all(a);
+	_arena_map(a, total);
+}
+
+void arena_destroy(arena *a) {
+	_arena_unmap_all(a);
+}
@@ -0,0 +1,69 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "util.h"
+
+/**
+ * A bump allocator for things that are made and thrown away together, like
+ * the views of a k-fold split and the networks trained on them. Without one,
+ * every view's index and every network's block is a mapping of its own, which
+ * costs a system call (and a whole page, however small the object) to make
+ * and another to free. An arena maps memory in large chunks and hands out
+ * pieces of them, so making an object costs a pointer bump, and everything is
+ * released at once with arena_reset or arena_destroy.
+ *
+ * Datasets (ds_train_test_split_arena, ds_kfold) and networks
+ * (nn_options.arena) can be carved from an arena. Their destroy functions then
+ * leave their memory alone, and the arena frees it. An arena must outlive
+ * everything carved from it, and is not for sharing between threads: carve on
+ * one thread, and hand the objects out to the others.
+ *
+ * Chunks of 2 MB or more are advised to use transparent huge pages.
+ */
+typedef struct arena {
+	// The chunk pieces are being carved from, which links back to the ones
+	// before it
+	struct _arena_chunk *_chunks;
+	// The size of the chunks mapped when the current one fills up
+	size_t chunk_size;
+	// Number of arena_alloc calls served, and of chunks mapped (each one an
+	// mmap system call), since arena_init. These are for checking how well an
+	// arena is saving system calls.
+	long allocs;
+	long maps;
+	// Total size of the chunks currently mapped, in bytes
+	size_t mapped;
+} arena;
+
+/**
+ * Starts an empty arena. Nothing is mapped until the first arena_alloc.
+ *
+ * @param a the uninitialized arena to start
+ * @param chunk_size the size of the chunks to map, or 0 for 4 MB. Bigger
+ * 	allocations get a chunk of their own size.
+ */
+void arena_init(arena *a, size_t chunk_size);
+
+/**
+ * Carves a zeroed piece of memory out of an arena, aligned to a cache line.
+ *
+ * @param a the arena to carve from
+ * @param size the size of the piece, in bytes
+ * @return the piece, valid until the arena is reset or destroyed
+ */
+void *arena_alloc(arena *a, size_t size);
+
+/**
+ * Frees everything carved from an arena at once, keeping one chunk, as big as
+ * all of the chunks were together, mapped for the next round of allocations.
+ * Reusing an arena like this, e.g. once per epoch, costs no system calls from
+ * the second round on.
+ */
+void arena_reset(arena *a);
+
+/**
+ * Frees everything carved from an arena, and all of its chunks.
+ */
+void arena_destroy(arena *a);
+
+#endif
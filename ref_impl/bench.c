@@ -0,0 +1,113 @@
+#include "bench.h"
+
+// The CSV bench_inflate_csv repeats
+static char *_INFLATE_SOURCE = "../test_sets/breast-cancer-wisconsin.csv";
+
+// Where say and friends write
+static int _report_fd = STDOUT_FILENO;
+
+void bench_quiet() {
+	_report_fd = dup(STDOUT_FILENO);
+	int devnull = open("/dev/null", O_WRONLY);
+	if(_report_fd < 0 || devnull < 0 || dup2(devnull, STDOUT_FILENO) < 0) {
+		perror("bench_quiet");
+		exit(1);
+	}
+	close(devnull);
+}
+
+void say(char *s) {
+	int len = 0;
+	while(s[len]) len++;
+	write(_report_fd, s, len);
+}
+
+void say_int(int x) {
+	char buf[16];
+	write(_report_fd, buf, itoa(buf, x));
+}
+
+void say_double(double x, int precision) {
+	char buf[48];
+	write(_report_fd, buf, dtoa(buf, x, precision));
+}
+
+void bench_write_csv(char *path, int rows, int cols, double threshold) {
+	if(cols < 2) {
+		printf("bench_write_csv: need at least 2 attributes\n");
+		exit(1);
+	}
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		perror("bench_write_csv");
+		exit(1);
+	}
+	writer w;
+	writer_init(&w, fd, NULL, 0);
+	writer_str(&w, "y", 1);
+	for(int j = 0; j < cols; j++) writer_str(&w, ",x", 2);
+	writer_str(&w, "\n", 1);
+	rng r;
+	rng_init(&r, 1, 0);
+	for(int i = 0; i < rows; i++) {
+		// The label comes first, so the two attributes it depends on are drawn
+		// before it and the rest as they are written
+		double x0 = 2 * rng_double(&r) - 1;
+		double x1 = 2 * rng_double(&r) - 1;
+		writer_int(&w, x0 + x1 > threshold);
+		writer_str(&w, ",", 1);
+		writer_double(&w, x0, 4);
+		writer_str(&w, ",", 1);
+		writer_double(&w, x1, 4);
+		for(int j = 2; j < cols; j++) {
+			writer_str(&w, ",", 1);
+			writer_double(&w, 2 * rng_double(&r) - 1, 4);
+		}
+		writer_str(&w, "\n", 1);
+	}
+	writer_destroy(&w);
+	close(fd);
+}
+
+long bench_inflate_csv(char *dst, int megabytes, long *rows) {
+	// Read the source file whole, and find where its header ends
+	int fd = open(_INFLATE_SOURCE, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) < 0) {
+		perror("bench_inflate_csv");
+		exit(1);
+	}
+	char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(text == MAP_FAILED) {
+		perror("bench_inflate_csv");
+		exit(1);
+	}
+	char *body = text;
+	while(*body != '\n') body++;
+	body++;
+	long body_size = st.st_size - (body - text);
+	long body_rows = 0;
+	for(char *p = body; p < text + st.st_size; p++) {
+		if(*p == '\n') body_rows++;
+	}
+
+	// Header once, then the body over and over until we reach the target size
+	fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		perror("bench_inflate_csv");
+		exit(1);
+	}
+	write_all(fd, text, body - text);
+	long total = body - text;
+	long written = 0;
+	while(total < (long) megabytes << 20) {
+		write_all(fd, body, body_size);
+		total += body_size;
+		written += body_rows;
+	}
+	close(fd);
+	munmap(text, st.st_size);
+	if(rows) *rows = written;
+	return total;
+}
@@ -0,0 +1,64 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "rng.h"
+
+/**
+ * Reporting for the benchmarks (bench*.c), so they all print their results
+ * the same way. Everything goes to the report, which is stdout to begin with.
+ * The trainers log every epoch to stdout, so benches that train call
+ * bench_quiet first, which points stdout at /dev/null and keeps the report on
+ * a copy of the original stdout.
+ */
+
+/**
+ * Points stdout at /dev/null, and the report at what stdout was.
+ */
+void bench_quiet();
+
+/**
+ * Adds a string to the report.
+ */
+void say(char *s);
+
+/**
+ * Adds an int to the report, as itoa formats it.
+ */
+void say_int(int x);
+
+/**
+ * Adds a double to the report, as dtoa formats it.
+ */
+void say_double(double x, int precision);
+
+/**
+ * Writes a synthetic CSV for the benches that train: a header, then rows of
+ * uniform random attributes in [-1, 1], each labelled 1 if its first two
+ * attributes sum to more than threshold, and 0 otherwise. The attributes come
+ * from an rng with a fixed seed, so every run writes the same file.
+ *
+ * @param path where to write the CSV
+ * @param rows the number of rows, not counting the header
+ * @param cols the number of attributes, at least 2
+ * @param threshold the label threshold: 0 labels half of the rows positive,
+ * 	and 1 about one in eight
+ */
+void bench_write_csv(char *path, int rows, int cols, double threshold);
+
+/**
+ * Builds a large CSV out of the breast cancer dataset in test_sets: its header
+ * once, then its rows over and over until the file is at least megabytes long.
+ * Benches that use it are run from this directory, like the demos.
+ *
+ * @param dst where to write the large CSV
+ * @param megabytes the smallest size to make it
+ * @param rows where to store the number of rows written, not counting the
+ * 	header, or NULL
+ * @returns the size of the large CSV in bytes.
+ */
+long bench_inflate_csv(char *dst, int megabytes, long *rows);
+
+#endif
@@ -0,0 +1,65 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 1: Time-to-target-loss of serial SGD (nn_train) against asynchronous
+ * Hogwild SGD (nn_train_hogwild) on the breast cancer dataset. Both start from
+ * the same initial weights and train one epoch at a time until the average
+ * training loss drops below the target.
+ *
+ * Usage: ./bench1 [num_threads]   (defaults to the number of online CPUs)
+ */
+
+static const double TARGET_LOSS = 0.03;
+static const int MAX_EPOCHS = 500;
+
+static void report(char *label, int epochs, double seconds) {
+  say(label);
+  say(": ");
+  say_int(epochs);
+  say(" epochs, ");
+  say_double(seconds, 4);
+  say(" s\n");
+}
+
+int main(int argc, char **argv) {
+  int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (argc > 1) num_threads = atoi(argv[1]);
+
+  bench_quiet();
+
+  dataset ds;
+  ds_load("../test_sets/breast-cancer-wisconsin.csv", 570, 31, &ds);
+  ds_normalize(&ds);
+
+  // Serial SGD. Both trainers return the running loss, so the exact loss
+  // after each epoch is asked of nn_train_ex here, and measured by hand for
+  // Hogwild.
+  nn net;
+  rng_seed(1);
+  nn_init(&net, 30, 32, 0.005);
+  nn_train_options opts;
+  nn_default_train_options(&opts);
+  opts.eval_interval = 1;
+  int epochs = 1;
+  double start = clock_seconds();
+  while (nn_train_ex(&net, &ds, 1, &opts) > TARGET_LOSS && epochs < MAX_EPOCHS)
+    epochs++;
+  report("serial", epochs, clock_seconds() - start);
+  nn_destroy(&net);
+
+  // Hogwild, from the same starting weights
+  rng_seed(1);
+  nn_init(&net, 30, 32, 0.005);
+  epochs = 1;
+  start = clock_seconds();
+  nn_train_hogwild(&net, &ds, 1, num_threads);
+  while (nn_average_loss(&net, &ds) > TARGET_LOSS && epochs < MAX_EPOCHS) {
+    nn_train_hogwild(&net, &ds, 1, num_threads);
+    epochs++;
+  }
+  report("hogwild", epochs, clock_seconds() - start);
+  nn_destroy(&net);
+
+  ds_deep_destroy(&ds);
+}
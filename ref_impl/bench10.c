@@ -0,0 +1,88 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 10: Generated fixed-shape passes (shapes.h) against the generic ones.
+ * For the shapes the Makefile generates by default, in both layouts, times
+ * nn_predict, and one nn_forward + nn_backward (the nn_train inner loop), with
+ * the network's generated passes and then with net.shape set to NULL, and
+ * prints nanoseconds per example for each and the generated speedup.
+ */
+
+static const int STEPS = 2000000;
+
+// Nanoseconds per example, predicting or training, with or without the
+// generated passes
+static double time_steps(int input_size, int hidden_size, nn_layout layout,
+  int generated, int train, double *x) {
+  nn_options opts;
+  nn_default_options(&opts);
+  opts.layout = layout;
+  nn net;
+  rng_seed(1);
+  nn_init_opts(&net, input_size, hidden_size, 0.0001, &opts);
+  if (!generated) net.shape = NULL;
+
+  double *scratch = mmap(NULL, sizeof(double) * hidden_size,
+    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  double sum = 0;
+  double start = clock_seconds();
+  for (int s = 0; s < STEPS; s++) {
+    if (train) {
+      nn_forward(&net, x);
+      nn_backward(&net, x, s & 1);
+    } else {
+      sum += nn_predict(&net, x, scratch);
+    }
+  }
+  double elapsed = clock_seconds() - start;
+  // So the predictions can't be thrown away
+  if (sum == 1234.5) say("");
+  munmap(scratch, sizeof(double) * hidden_size);
+  nn_destroy(&net);
+  return elapsed / STEPS * 1e9;
+}
+
+static void report(int input_size, int hidden_size, nn_layout layout,
+  int train, double *x) {
+  double generic = time_steps(input_size, hidden_size, layout, 0, train, x);
+  double fixed = time_steps(input_size, hidden_size, layout, 1, train, x);
+  say_int(input_size);
+  say("x");
+  say_int(hidden_size);
+  say(layout == NN_LAYOUT_INPUT_MAJOR ? "\tinput \t" : "\thidden\t");
+  say(train ? "train  \t" : "predict\t");
+  say_double(generic, 1);
+  say("\t");
+  say_double(fixed, 1);
+  say("\t");
+  say_double(generic / fixed, 2);
+  say("\n");
+}
+
+int main(void) {
+  int inputs[2] = { 13, 4 };
+  int hiddens[2] = { 18, 2 };
+
+  double x[13];
+  for (int j = 0; j < 13; j++) x[j] = 2.0 * rand() / RAND_MAX - 1;
+
+  for (int s = 0; s < 2; s++) {
+    if (nn_find_shape(inputs[s], hiddens[s], NN_LAYOUT_INPUT_MAJOR) == NULL) {
+      say("bench10: shapes.c was generated without ");
+      say_int(inputs[s]);
+      say("x");
+      say_int(hiddens[s]);
+      say("\n");
+      return 1;
+    }
+  }
+
+  say("shape\tlayout\tpass\tgeneric ns\tgenerated ns\tspeedup\n");
+  for (int s = 0; s < 2; s++) {
+    for (int train = 0; train < 2; train++) {
+      report(inputs[s], hiddens[s], NN_LAYOUT_INPUT_MAJOR, train, x);
+      report(inputs[s], hiddens[s], NN_LAYOUT_HIDDEN_MAJOR, train, x);
+    }
+  }
+}
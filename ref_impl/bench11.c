@@ -0,0 +1,68 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 11: Cold start of a prediction worker, for each nn_load_mode. Saves a
+ * big randomly initialized network, then, for each mode, times nn_load_opts,
+ * the first prediction after it (which, for the mapped modes, is when the
+ * weights are actually read from the page cache), and a prediction once
+ * everything is in place, averaged over several loads. The file is freshly
+ * written, so it is in the page cache, as it would be for a fleet of workers
+ * serving the same model.
+ *
+ * Usage: ./bench11 [input_size] [hidden_size]   (defaults to 4096 and 1024,
+ * 	a 32 MB network)
+ */
+
+static char *SAVED = "/tmp/bench11.nn";
+static const int LOADS = 5;
+
+int main(int argc, char **argv) {
+  int input = 4096;
+  int hidden = 1024;
+  if (argc > 1) input = atoi(argv[1]);
+  if (argc > 2) hidden = atoi(argv[2]);
+
+  rng_seed(1);
+  nn net;
+  nn_init(&net, input, hidden, 0.01);
+  nn_save(&net, SAVED);
+  nn_destroy(&net);
+
+  size_t size = sizeof(double) * input;
+  double *x = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  for (int j = 0; j < input; j++) x[j] = 2.0 * rand() / RAND_MAX - 1;
+
+  char *labels[] = {"copy    ", "private ", "readonly"};
+  say("mode\t\tload ms\tfirst predict ms\tpredict ms\n");
+  for (int mode = 0; mode < 3; mode++) {
+    nn_options opts;
+    nn_default_options(&opts);
+    opts.load = mode;
+    double load = 0, first = 0, warm = 0;
+    for (int l = 0; l < LOADS; l++) {
+      double start = clock_seconds();
+      nn_load_opts(&net, SAVED, &opts);
+      double loaded = clock_seconds();
+      nn_predict(&net, x, NULL);
+      double predicted = clock_seconds();
+      nn_predict(&net, x, NULL);
+      warm += clock_seconds() - predicted;
+      load += loaded - start;
+      first += predicted - loaded;
+      nn_destroy(&net);
+    }
+    say(labels[mode]);
+    say("\t");
+    say_double(load / LOADS * 1e3, 3);
+    say("\t");
+    say_double(first / LOADS * 1e3, 3);
+    say("\t\t\t");
+    say_double(warm / LOADS * 1e3, 3);
+    say("\n");
+  }
+
+  unlink(SAVED);
+  munmap(x, size);
+}
@@ -0,0 +1,112 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 12: A hyperparameter sweep, run one network at a time with nn_train
+ * and all at once with nn_train_ensemble. Writes the same kind of synthetic
+ * CSV as bench9, then trains 16 networks on it: hidden sizes 16 and 32, four
+ * learning rates and two initial weights each, from the same shuffles both
+ * times. Reports the time each way, the ensemble's best network, and the
+ * largest difference between the two ways' final losses.
+ *
+ * Usage: ./bench12 [input_size] [rows] [epochs]   (defaults to 64, 20000 and 3)
+ */
+
+static char *SCRATCH = "/tmp/bench12.csv";
+static const int MODELS = 16;
+
+// Model m's hidden size, learning rate and seed
+static void config(int m, int input, int *hidden, double *rate, int *seed) {
+  double rates[4] = { 0.1, 0.2, 0.5, 1.0 };
+  *hidden = m & 1 ? 32 : 16;
+  *rate = rates[(m >> 1) & 3] / input;
+  *seed = 1 + (m >> 3);
+}
+
+static void init_models(nn *nets, int input) {
+  for (int m = 0; m < MODELS; m++) {
+    int hidden, seed;
+    double rate;
+    config(m, input, &hidden, &rate, &seed);
+    rng_seed(seed);
+    nn_init(&nets[m], input, hidden, rate);
+  }
+}
+
+int main(int argc, char **argv) {
+  int input = 64;
+  int rows = 20000;
+  int epochs = 3;
+  if (argc > 1) input = atoi(argv[1]);
+  if (argc > 2) rows = atoi(argv[2]);
+  if (argc > 3) epochs = atoi(argv[3]);
+
+  bench_write_csv(SCRATCH, rows, input, 0);
+
+  // The trainers log every epoch, so stdout goes to /dev/null while they run
+  bench_quiet();
+
+  dataset ds;
+  ds_load_parallel(SCRATCH, 1, &ds);
+  unlink(SCRATCH);
+  // Every run starts from the same order
+  int *order = mmap(NULL, rows * sizeof(int), PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  for (int r = 0; r < rows; r++) order[r] = ds.index[r];
+
+  nn one[MODELS];
+  nn all[MODELS];
+  double one_loss[MODELS];
+  double all_loss[MODELS];
+  init_models(one, input);
+  init_models(all, input);
+
+  double start = clock_seconds();
+  for (int m = 0; m < MODELS; m++) {
+    for (int r = 0; r < rows; r++) ds.index[r] = order[r];
+    rng_seed(7);
+    one_loss[m] = nn_train(&one[m], &ds, epochs);
+  }
+  double sequential = clock_seconds() - start;
+
+  for (int r = 0; r < rows; r++) ds.index[r] = order[r];
+  rng_seed(7);
+  start = clock_seconds();
+  int best = nn_train_ensemble(all, MODELS, &ds, epochs, all_loss);
+  double fused = clock_seconds() - start;
+
+  double diff = 0;
+  for (int m = 0; m < MODELS; m++) {
+    if (fabs(one_loss[m] - all_loss[m]) > diff) {
+      diff = fabs(one_loss[m] - all_loss[m]);
+    }
+  }
+  int hidden, seed;
+  double rate;
+  config(best, input, &hidden, &rate, &seed);
+
+  say("one at a time: ");
+  say_double(sequential, 3);
+  say(" s\nensemble     : ");
+  say_double(fused, 3);
+  say(" s (");
+  say_double(sequential / fused, 2);
+  say("x)\nbest: hidden ");
+  say_int(hidden);
+  say(", rate ");
+  say_double(rate, 5);
+  say(", seed ");
+  say_int(seed);
+  say(", loss ");
+  say_double(all_loss[best], 8);
+  say("\nlargest loss difference: ");
+  say_double(diff, 12);
+  say("\n");
+
+  for (int m = 0; m < MODELS; m++) {
+    nn_destroy(&one[m]);
+    nn_destroy(&all[m]);
+  }
+  munmap(order, rows * sizeof(int));
+  ds_deep_destroy(&ds);
+}
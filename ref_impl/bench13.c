@@ -0,0 +1,111 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 13: k-fold cross-validation with nn_cross_validate, one fold at a time
+ * and then with the folds running concurrently. Writes a synthetic CSV whose
+ * positive label is rare (about 1 row in 8), then cross-validates on it with
+ * and without stratification. Reports the time of each run, the mean and
+ * variance of the fold losses, the largest difference between the fold losses
+ * of the serial and concurrent runs (which should be 0), and the spread of the
+ * share of positive labels over the validation folds from ds_kfold.
+ *
+ * Usage: ./bench13 [threads] [folds] [rows]   (defaults to 4, 5 and 20000)
+ */
+
+static char *SCRATCH = "/tmp/bench13.csv";
+static const int INPUTS = 32;
+static const int HIDDEN = 32;
+static const int EPOCHS = 3;
+
+// Largest minus smallest share of positive labels over the validation folds
+static double label_spread(dataset *ds, int k, int stratify) {
+  dataset train[k];
+  dataset valid[k];
+  ds_kfold(ds, k, stratify, train, valid, NULL);
+  double lo = 1, hi = 0;
+  for (int f = 0; f < k; f++) {
+    int positive = 0;
+    for (int i = 0; i < valid[f].num_examples; i++) {
+      positive += ds_label(&valid[f], i);
+    }
+    double share = (double) positive / valid[f].num_examples;
+    if (share < lo) lo = share;
+    if (share > hi) hi = share;
+    ds_destroy(&train[f]);
+    ds_destroy(&valid[f]);
+  }
+  return hi - lo;
+}
+
+static void report(dataset *ds, int k, int stratify, int threads) {
+  double serial_loss[k];
+  double fold_loss[k];
+  double variance;
+
+  rng_seed(3);
+  double start = clock_seconds();
+  nn_cross_validate(ds, k, stratify, HIDDEN, 0.01, NULL, EPOCHS, 1,
+    serial_loss, NULL);
+  double serial = clock_seconds() - start;
+
+  rng_seed(3);
+  start = clock_seconds();
+  double mean = nn_cross_validate(ds, k, stratify, HIDDEN, 0.01, NULL, EPOCHS,
+    threads, fold_loss, &variance);
+  double concurrent = clock_seconds() - start;
+
+  double diff = 0;
+  for (int f = 0; f < k; f++) {
+    if (fabs(serial_loss[f] - fold_loss[f]) > diff) {
+      diff = fabs(serial_loss[f] - fold_loss[f]);
+    }
+  }
+
+  say(stratify ? "stratified:\n" : "plain:\n");
+  say("  1 thread  : ");
+  say_double(serial, 3);
+  say(" s\n  ");
+  say_int(threads);
+  say(" threads : ");
+  say_double(concurrent, 3);
+  say(" s (");
+  say_double(serial / concurrent, 2);
+  say("x)\n  loss mean ");
+  say_double(mean, 6);
+  say(", variance ");
+  say_double(variance, 10);
+  say("\n  largest loss difference: ");
+  say_double(diff, 12);
+  say("\n  positive share spread over folds: ");
+  say_double(label_spread(ds, k, stratify), 6);
+  say("\n");
+}
+
+int main(int argc, char **argv) {
+  int threads = 4;
+  int k = 5;
+  int rows = 20000;
+  if (argc > 1) threads = atoi(argv[1]);
+  if (argc > 2) k = atoi(argv[2]);
+  if (argc > 3) rows = atoi(argv[3]);
+  if (k < 2) k = 2;
+
+  bench_write_csv(SCRATCH, rows, INPUTS, 1);
+  dataset ds;
+  ds_load_parallel(SCRATCH, 1, &ds);
+  unlink(SCRATCH);
+  ds_normalize(&ds);
+
+  say("cores: ");
+  say_int(sysconf(_SC_NPROCESSORS_ONLN));
+  say(", ");
+  say_int(k);
+  say(" folds of ");
+  say_int(rows);
+  say(" rows\n");
+  report(&ds, k, 0, threads);
+  report(&ds, k, 1, threads);
+
+  ds_deep_destroy(&ds);
+}
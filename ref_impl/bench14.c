@@ -0,0 +1,74 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 14: Uniform random doubles, from rand() as nn_init used to draw them,
+ * one at a time from rng_double, and in bulk from rng_fill with each kernel
+ * table this CPU supports. Prints nanoseconds per double for each, and checks
+ * that every table's rng_fill gives exactly what rng_double does. Then times
+ * nn_init of a big network, which draws its weights with rng_fill.
+ *
+ * Usage: ./bench14 [count]   (defaults to 16M doubles)
+ */
+
+static void report(char *name, double seconds, int count) {
+  say(name);
+  say("\t");
+  say_double(seconds / count * 1e9, 2);
+  say("\n");
+}
+
+int main(int argc, char **argv) {
+  int count = 16 << 20;
+  if (argc > 1) count = atoi(argv[1]);
+
+  size_t size = sizeof(double) * count;
+  double *expected = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  double *out = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  say("generator\tns per double\n");
+  double start = clock_seconds();
+  for (int i = 0; i < count; i++) out[i] = (double) rand() / RAND_MAX;
+  report("rand()    ", clock_seconds() - start, count);
+
+  rng r;
+  rng_init(&r, 1, 0);
+  start = clock_seconds();
+  for (int i = 0; i < count; i++) expected[i] = rng_double(&r);
+  report("rng_double", clock_seconds() - start, count);
+
+  const kernels *tables[4] = {
+    &kernels_scalar, &kernels_sse2, &kernels_avx2, &kernels_avx512
+  };
+  char *names[4] = {
+    "fill scalar", "fill sse2 ", "fill avx2 ", "fill avx512"
+  };
+  const kernels *best = kern;
+  int mismatches = 0;
+  for (int t = 0; t < 4; t++) {
+    if (!kernels_supported(tables[t])) continue;
+    kern = tables[t];
+    rng_init(&r, 1, 0);
+    start = clock_seconds();
+    rng_fill(&r, count, out);
+    report(names[t], clock_seconds() - start, count);
+    for (int i = 0; i < count; i++) mismatches += out[i] != expected[i];
+  }
+  kern = best;
+  say(mismatches ? "rng_fill MISMATCHES rng_double\n"
+    : "rng_fill matches rng_double\n");
+
+  nn net;
+  start = clock_seconds();
+  nn_init(&net, 4096, 1024, 0.01);
+  say("nn_init 4096x1024: ");
+  say_double((clock_seconds() - start) * 1e3, 2);
+  say(" ms\n");
+  nn_destroy(&net);
+
+  munmap(expected, size);
+  munmap(out, size);
+  return mismatches != 0;
+}
@@ -0,0 +1,133 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 15: Text output. Loads a synthetic dataset, then emits every row of
+ * it three ways, and prints rows per second for each: the way ds_show used to,
+ * with a write per piece of every cell, and ds_show itself, both into
+ * /dev/null, and ds_save_csv, into a file. ds_save_csv goes twice: to 4
+ * digits, and then in full, after every attribute has been replaced with a
+ * random full-precision double (one column of them from random bits, so from
+ * every exponent). That file is read back, and any double that doesn't come
+ * back exactly is printed and fails the bench.
+ *
+ * Usage: ./bench15 [rows] [attributes]   (defaults to 200000 and 50)
+ */
+
+static char *SCRATCH = "/tmp/bench15.csv";
+
+static void report(char *name, double seconds, int rows) {
+  say(name);
+  say("\t");
+  say_int(rows / seconds);
+  say("\n");
+}
+
+// A double with random bits, skipping infinities and NaN
+static double random_double(rng *r) {
+  union { double d; unsigned long long u; } bits;
+  do {
+    bits.u = rng_next64(r);
+  } while (((bits.u >> 52) & 0x7ff) == 0x7ff);
+  return bits.d;
+}
+
+// ds_show as it was, a write per number and per separator
+static void show_unbuffered(dataset *ds) {
+  char buf[64];
+  for (int i = 0; i < ds->num_examples; i++) {
+    double *x = ds_example(ds, i);
+    write(STDOUT_FILENO, buf, itoa(buf, i));
+    write(STDOUT_FILENO, " | ", 3);
+    write(STDOUT_FILENO, buf, itoa(buf, ds_label(ds, i)));
+    for (int j = 0; j < ds->num_attributes; j++) {
+      write(STDOUT_FILENO, ",", 1);
+      write(STDOUT_FILENO, buf, dtoa(buf, x[j], 1));
+    }
+    write(STDOUT_FILENO, "\n", 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  int rows = 200000;
+  int cols = 50;
+  if (argc > 1) rows = atoi(argv[1]);
+  if (argc > 2) cols = atoi(argv[2]);
+
+  // The input, written with a writer of its own
+  int fd = open(SCRATCH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  writer w;
+  writer_init(&w, fd, NULL, 0);
+  writer_str(&w, "y", 1);
+  for (int j = 0; j < cols; j++) writer_str(&w, ",x", 2);
+  writer_str(&w, "\n", 1);
+  rng r;
+  rng_init(&r, 1, 0);
+  for (int i = 0; i < rows; i++) {
+    writer_int(&w, rng_below(&r, 2));
+    for (int j = 0; j < cols; j++) {
+      writer_str(&w, ",", 1);
+      writer_double(&w, 200 * rng_double(&r) - 100, 4);
+    }
+    writer_str(&w, "\n", 1);
+  }
+  writer_destroy(&w);
+  close(fd);
+  dataset ds;
+  ds_load_parallel(SCRATCH, 1, &ds);
+
+  bench_quiet();
+
+  say("output\t\trows per second\n");
+  double start = clock_seconds();
+  show_unbuffered(&ds);
+  report("write per piece", clock_seconds() - start, rows);
+
+  start = clock_seconds();
+  ds_show(&ds);
+  report("ds_show       ", clock_seconds() - start, rows);
+
+  start = clock_seconds();
+  ds_save_csv(&ds, SCRATCH, 4);
+  report("ds_save_csv 4 ", clock_seconds() - start, rows);
+
+  for (int i = 0; i < rows; i++) {
+    double *x = ds_example(&ds, i);
+    x[0] = random_double(&r);
+    for (int j = 1; j < cols; j++) x[j] = 200 * rng_double(&r) - 100;
+  }
+  start = clock_seconds();
+  ds_save_csv(&ds, SCRATCH, -1);
+  report("ds_save_csv -1", clock_seconds() - start, rows);
+
+  dataset back;
+  ds_load_parallel(SCRATCH, 1, &back);
+  unlink(SCRATCH);
+  int mismatches = back.num_examples != ds.num_examples;
+  for (int i = 0; !mismatches && i < rows; i++) {
+    mismatches += ds_label(&back, i) != ds_label(&ds, i);
+    for (int j = 0; j < cols; j++) {
+      double wrote = ds_example(&ds, i)[j];
+      double read = ds_example(&back, i)[j];
+      if (read == wrote) continue;
+      if (mismatches++ < 5) {
+        say("  wrote ");
+        say_double(wrote, -1);
+        say(", read back ");
+        say_double(read, -1);
+        say("\n");
+      }
+    }
+  }
+  if (mismatches) {
+    say("ds_save_csv round trip: ");
+    say_int(mismatches);
+    say(" MISMATCHES\n");
+  } else {
+    say("ds_save_csv round trip matches\n");
+  }
+
+  ds_deep_destroy(&back);
+  ds_deep_destroy(&ds);
+  return mismatches != 0;
+}
@@ -0,0 +1,193 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 16: Arenas and huge pages.
+ *
+ * First, re-splitting a dataset into k folds every epoch (as a randomized
+ * cross-validation would), with every view mapped on its own and then with the
+ * views carved from an arena that is reset every epoch, and then making a
+ * batch of small networks each way. Prints the time of each, and the mappings
+ * made: counted by the arena, and worked out from the number of objects
+ * without one.
+ *
+ * Then, an epoch of training on a big dataset whose rows are in huge pages, as
+ * the loaders now ask for, against a copy of it in regular pages. Prints the
+ * time per epoch of each and how much of the process is in huge pages, from
+ * /proc/self/smaps_rollup.
+ *
+ * Usage: ./bench16 [rows] [attributes]   (defaults to 400000 and 32)
+ */
+
+static char *SCRATCH = "/tmp/bench16.csv";
+static const int FOLDS = 10;
+static const int ROUNDS = 50;
+static const int NETS = 2000;
+
+// The AnonHugePages line of /proc/self/smaps_rollup, in kilobytes
+static int huge_kb() {
+  char text[4096];
+  int fd = open("/proc/self/smaps_rollup", O_RDONLY);
+  if (fd < 0) return -1;
+  int len = read(fd, text, sizeof(text) - 1);
+  close(fd);
+  if (len < 0) return -1;
+  text[len] = 0;
+  char *key = "AnonHugePages:";
+  for (int i = 0; i < len; i++) {
+    int j = 0;
+    while (key[j] && text[i + j] == key[j]) j++;
+    if (key[j]) continue;
+    int kb = 0;
+    for (i += j; text[i] == ' '; i++) {}
+    for (; text[i] >= '0' && text[i] <= '9'; i++) kb = kb * 10 + text[i] - '0';
+    return kb;
+  }
+  return -1;
+}
+
+static void resplit(dataset *ds) {
+  dataset train[FOLDS];
+  dataset valid[FOLDS];
+  double start = clock_seconds();
+  for (int r = 0; r < ROUNDS; r++) {
+    ds_shuffle(ds);
+    ds_kfold(ds, FOLDS, 0, train, valid, NULL);
+    for (int f = 0; f < FOLDS; f++) {
+      ds_destroy(&train[f]);
+      ds_destroy(&valid[f]);
+    }
+  }
+  double mapped = clock_seconds() - start;
+
+  arena mem;
+  arena_init(&mem, 0);
+  start = clock_seconds();
+  for (int r = 0; r < ROUNDS; r++) {
+    arena_reset(&mem);
+    ds_shuffle(ds);
+    ds_kfold(ds, FOLDS, 0, train, valid, &mem);
+  }
+  double carved = clock_seconds() - start;
+
+  say("k-fold views, ");
+  say_int(ROUNDS);
+  say(" rounds of ");
+  say_int(FOLDS);
+  say(" folds\n  mapped: ");
+  say_double(mapped * 1e3, 2);
+  say(" ms, ");
+  say_int(ROUNDS * (2 * FOLDS + 1));
+  say(" mappings\n  arena : ");
+  say_double(carved * 1e3, 2);
+  say(" ms, ");
+  say_int(mem.maps);
+  say(" mappings for ");
+  say_int(mem.allocs);
+  say(" allocations\n");
+  arena_destroy(&mem);
+}
+
+static void networks(int input) {
+  nn nets[NETS];
+  nn_options opts;
+  nn_default_options(&opts);
+  double start = clock_seconds();
+  for (int i = 0; i < NETS; i++) nn_init_opts(&nets[i], input, 18, 0.1, &opts);
+  for (int i = 0; i < NETS; i++) nn_destroy(&nets[i]);
+  double mapped = clock_seconds() - start;
+
+  arena mem;
+  arena_init(&mem, 0);
+  opts.arena = &mem;
+  start = clock_seconds();
+  for (int i = 0; i < NETS; i++) nn_init_opts(&nets[i], input, 18, 0.1, &opts);
+  arena_destroy(&mem);
+  double carved = clock_seconds() - start;
+
+  say_int(NETS);
+  say(" networks\n  mapped: ");
+  say_double(mapped * 1e3, 2);
+  say(" ms, ");
+  say_int(NETS);
+  say(" mappings\n  arena : ");
+  say_double(carved * 1e3, 2);
+  say(" ms, ");
+  say_int(mem.maps);
+  say(" mappings\n");
+}
+
+// A copy of ds in regular pages, built by hand the way _alloc_dataset would
+static void copy_small_pages(dataset *ds, dataset *copy) {
+  int n = ds->num_examples;
+  int cols = ds->num_attributes;
+  size_t labels_size = (sizeof(int) * n + 63) / 64 * 64;
+  size_t size = labels_size + sizeof(double) * n * cols;
+  char *block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  madvise(block, size, MADV_NOHUGEPAGE);
+  *copy = *ds;
+  copy->_mmap_ptr = block;
+  copy->_mmap_size = size;
+  copy->labels = (int*) block;
+  copy->features = (double*) (block + labels_size);
+  copy->index = mmap(NULL, sizeof(int) * n, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  for (int i = 0; i < n; i++) {
+    copy->labels[i] = ds->labels[i];
+    copy->index[i] = ds->index[i];
+    for (int j = 0; j < cols; j++) {
+      copy->features[(size_t) i * cols + j] = ds->features[(size_t) i * cols + j];
+    }
+  }
+}
+
+static double epoch_seconds(dataset *ds) {
+  rng_seed(5);
+  nn net;
+  nn_init(&net, ds->num_attributes, 64, 0.01);
+  ds_shuffle(ds);
+  double start = clock_seconds();
+  nn_train(&net, ds, 1);
+  double elapsed = clock_seconds() - start;
+  nn_destroy(&net);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  int rows = 400000;
+  int cols = 32;
+  if (argc > 1) rows = atoi(argv[1]);
+  if (argc > 2) cols = atoi(argv[2]);
+
+  bench_write_csv(SCRATCH, rows, cols, 0);
+  dataset ds;
+  ds_load_parallel(SCRATCH, 1, &ds);
+  unlink(SCRATCH);
+
+  // nn_train logs its epoch, so stdout goes to /dev/null while it runs
+  bench_quiet();
+
+  resplit(&ds);
+  networks(13);
+
+  say("training epoch, ");
+  say_int(rows);
+  say(" rows of ");
+  say_int(cols);
+  say("\n  huge pages   : ");
+  int before = huge_kb();
+  say_double(epoch_seconds(&ds), 3);
+  say(" s, ");
+  say_int(before);
+  say(" kB of the process in huge pages\n  regular pages: ");
+  dataset copy;
+  copy_small_pages(&ds, &copy);
+  ds_deep_destroy(&ds);
+  say_double(epoch_seconds(&copy), 3);
+  say(" s, ");
+  say_int(huge_kb());
+  say(" kB of the process in huge pages\n");
+
+  ds_deep_destroy(&copy);
+}
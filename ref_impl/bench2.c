@@ -0,0 +1,292 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 2: Every kernel table this CPU supports, against the scalar table.
+ * For each table we check each kernel against the scalar results on random
+ * inputs (sigmoid_fast against the exact sigmoid, and the float and mixed
+ * kernels against doubles), within a tolerance of its own (the int8 kernels
+ * have to match exactly), and then time nn_predict and nn_backward on a
+ * 256x256 network. Prints the largest relative difference of each table's
+ * double kernels, and every kernel that goes over its tolerance, and exits
+ * with 1 if any does.
+ */
+
+static const int ROWS = 256;
+static const int COLS = 256;
+static const int REPS = 2000;
+
+// Kernels that went over their tolerance, over every table
+static int failures = 0;
+
+static double rel_err(double got, double want) {
+  double d = fabs(got - want);
+  return fabs(want) > 1 ? d / fabs(want) : d;
+}
+
+// Records one kernel's largest difference from the reference, reporting it if
+// it is over the kernel's tolerance, and returns it
+static double expect(const kernels *k, char *kernel, double err, double tol) {
+  if (err > tol) {
+    failures++;
+    say("FAIL ");
+    say(k->name);
+    say(" ");
+    say(kernel);
+    say(": rel err ");
+    say_double(err * 1e15, 4);
+    say("e-15, tolerance ");
+    say_double(tol * 1e15, 4);
+    say("e-15\n");
+  }
+  return err;
+}
+
+// Largest relative difference between two arrays
+static double max_err(int n, const double *got, const double *want) {
+  double worst = 0;
+  for (int i = 0; i < n; i++) {
+    double e = rel_err(got[i], want[i]);
+    if (e > worst) worst = e;
+  }
+  return worst;
+}
+
+// Largest relative difference between k and the scalar kernels, over every
+// output of every kernel. Sizes are deliberately not multiples of any vector
+// width so the tails get exercised too. Sums of a couple of hundred terms come
+// out in a different order per table, so matvec and dot are allowed a few
+// hundred ulp; sigmoid a few ulp, and rank1, one multiply-add per weight,
+// one or two.
+static double check(const kernels *k, double *x, double *w, double *g,
+  double *a, double *b) {
+  int rows = ROWS - 3, cols = COLS - 5;
+  double worst = 0;
+
+  kernels_scalar.matvec(rows, cols, x, w, a);
+  k->matvec(rows, cols, x, w, b);
+  worst = fmax(worst, expect(k, "matvec", max_err(cols, b, a), 1e-13));
+
+  // Pre-activations between -40 and 40 cover both tails of the sigmoid
+  for (int j = 0; j < cols; j++) {
+    a[j] = b[j] = 80 * w[j] - 40;
+  }
+  kernels_scalar.sigmoid(cols, a, g);
+  k->sigmoid(cols, b, g);
+  worst = fmax(worst, expect(k, "sigmoid", max_err(cols, b, a), 1e-15));
+
+  // sigmoid_fast is checked against the exact sigmoid rather than the scalar
+  // table, within the 5e-8 its polynomial exp is documented to keep it to,
+  // and is left out of the largest difference
+  for (int j = 0; j < cols; j++) {
+    b[j] = 80 * w[j] - 40;
+    a[j] = 1 / (1 + exp(-(b[j] + g[j])));
+  }
+  k->sigmoid_fast(cols, b, g);
+  expect(k, "sigmoid_fast", max_err(cols, b, a), 5e-8);
+
+  double e = rel_err(k->dot(cols, x, g), kernels_scalar.dot(cols, x, g));
+  worst = fmax(worst, expect(k, "dot", e, 1e-13));
+
+  // rank1 modifies w in place, so compare on two copies of it
+  double *w2 = w + ROWS * COLS;
+  for (int i = 0; i < ROWS * COLS; i++) {
+    w2[i] = w[i];
+  }
+  kernels_scalar.rank1(rows, cols, x, g, w, 0.01);
+  k->rank1(rows, cols, x, g, w2, 0.01);
+  e = max_err(rows * cols, w2, w);
+  worst = fmax(worst, expect(k, "rank1", e, 1e-15));
+  return worst;
+}
+
+// Largest error of each float and mixed kernel of k, on floats rounded from
+// x, w and g, against the same computation done in doubles. Float sums can be
+// off by up to about (terms) * 2^-24 of the sum of their terms' magnitudes, in
+// any order, so that is what matvec_f32 and dot_f32 are held to (as a fraction
+// of that sum). A mixed sum is only rounded to a float at the end, and a float
+// sigmoid or weight update rounds once or twice, so those get a float ulp or
+// two.
+// f has room for a float copy of x, w and g, and an output vector. ref has
+// room for rows * cols doubles.
+static void check_f32(const kernels *k, double *x, double *w, double *g,
+  float *f, double *ref, double *mag) {
+  int rows = ROWS - 3, cols = COLS - 5;
+  float *fx = f;
+  float *fw = fx + ROWS;
+  float *fg = fw + ROWS * COLS;
+  float *out = fg + COLS;
+  for (int i = 0; i < rows; i++) fx[i] = x[i];
+  for (int i = 0; i < rows * cols; i++) fw[i] = w[i];
+  for (int j = 0; j < cols; j++) fg[j] = g[j];
+  double sum_tol = (rows + 1) * 0x1p-24;
+
+  for (int j = 0; j < cols; j++) {
+    ref[j] = mag[j] = 0;
+    for (int i = 0; i < rows; i++) {
+      double term = (double) fx[i] * fw[i * cols + j];
+      ref[j] += term;
+      mag[j] += fabs(term);
+    }
+  }
+  k->matvec_f32(rows, cols, fx, fw, out);
+  double e = 0;
+  for (int j = 0; j < cols; j++) e = fmax(e, fabs(out[j] - ref[j]) / mag[j]);
+  expect(k, "matvec_f32", e, sum_tol);
+
+  k->matvec_mixed(rows, cols, fx, fw, out);
+  e = 0;
+  for (int j = 0; j < cols; j++) e = fmax(e, rel_err(out[j], ref[j]));
+  expect(k, "matvec_mixed", e, 0x1p-23);
+
+  double dot = 0, dot_mag = 0;
+  for (int i = 0; i < cols; i++) {
+    dot += (double) fx[i] * fg[i];
+    dot_mag += fabs((double) fx[i] * fg[i]);
+  }
+  e = fabs(k->dot_f32(cols, fx, fg) - dot) / dot_mag;
+  expect(k, "dot_f32", e, sum_tol);
+  expect(k, "dot_mixed", rel_err(k->dot_mixed(cols, fx, fg), dot), 1e-13);
+
+  // The same pre-activations as for sigmoid. The sum of a float pre-activation
+  // and bias is exact in a double, as the kernels take it.
+  for (int j = 0; j < cols; j++) {
+    out[j] = 80 * fw[j] - 40;
+    ref[j] = 1 / (1 + exp(-((double) out[j] + fg[j])));
+  }
+  k->sigmoid_f32(cols, out, fg);
+  e = 0;
+  for (int j = 0; j < cols; j++) e = fmax(e, rel_err(out[j], ref[j]));
+  expect(k, "sigmoid_f32", e, 0x1p-23);
+
+  for (int j = 0; j < cols; j++) out[j] = 80 * fw[j] - 40;
+  k->sigmoid_fast_f32(cols, out, fg);
+  e = 0;
+  for (int j = 0; j < cols; j++) e = fmax(e, rel_err(out[j], ref[j]));
+  expect(k, "sigmoid_fast_f32", e, 5e-8 + 0x1p-23);
+
+  float scale = 0.01f;
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      ref[i * cols + j] = fw[i * cols + j] - (double) scale * fx[i] * fg[j];
+    }
+  }
+  k->rank1_f32(rows, cols, fx, fg, fw, scale);
+  e = 0;
+  for (int i = 0; i < rows * cols; i++) e = fmax(e, rel_err(fw[i], ref[i]));
+  expect(k, "rank1_f32", e, 0x1p-22);
+}
+
+// Compares k's int8 kernels with the scalar ones, which have to agree
+// exactly, for a few shapes with an odd number of inputs, padded to an even
+// number of rows with a zero row the way quant.c pads them. Reports any
+// difference.
+static void check_i8(const kernels *k, double *x, int8_t *q, float *f) {
+  int inputs[3] = { 1, 13, ROWS - 3 };
+  int hiddens[3] = { 1, 18, COLS - 5 };
+  float *in_scale = f;
+  float *w_scale = in_scale + ROWS;
+  float *a = w_scale + COLS;
+  float *b = a + COLS;
+  int8_t *qa = q;
+  int8_t *qb = qa + ROWS;
+  int8_t *w = qb + ROWS;
+  for (int s = 0; s < 3; s++) {
+    int in = inputs[s], hid = hiddens[s];
+    int padded = (in + 1) / 2 * 2;
+    // Scales big enough that some inputs clamp to +-127, and every few
+    // inputs an exact tie, to check rounding to even
+    for (int i = 0; i < in; i++) {
+      in_scale[i] = i % 5 == 0 ? 1 : 20 + 200 * fabs(x[i]);
+      if (i % 5 == 0) x[i] = (i % 7) - 3.5;
+    }
+    kernels_scalar.quantize_i8(in, x, in_scale, qa);
+    k->quantize_i8(in, x, in_scale, qb);
+    int bad = 0;
+    for (int i = 0; i < in; i++) bad += qa[i] != qb[i];
+    qa[padded - 1] = qb[padded - 1] = 0;
+
+    for (int i = 0; i < padded; i++) {
+      for (int j = 0; j < hid; j++) {
+        int v = i < in ? rand() % 255 - 127 : 0;
+        w[(size_t) (i & ~1) * hid + 2 * j + (i & 1)] = v;
+      }
+    }
+    for (int j = 0; j < hid; j++) w_scale[j] = 1e-3 * (j + 1);
+    kernels_scalar.matvec_i8(padded, hid, qa, w, w_scale, a);
+    k->matvec_i8(padded, hid, qa, w, w_scale, b);
+    for (int j = 0; j < hid; j++) bad += a[j] != b[j];
+
+    if (bad) {
+      say("FAIL ");
+      say(k->name);
+      say(" quantize_i8/matvec_i8: ");
+      say_int(bad);
+      say(" outputs differ at ");
+      say_int(in);
+      say("x");
+      say_int(hid);
+      say("\n");
+      failures++;
+    }
+  }
+}
+
+int main(void) {
+  srand(1);
+  const kernels *tables[4] = {
+    &kernels_scalar, &kernels_sse2, &kernels_avx2, &kernels_avx512
+  };
+
+  // Room for x, two copies of w, g, and two output vectors
+  size_t mem_size = sizeof(double) * (ROWS + 2 * ROWS * COLS + 3 * COLS);
+  double *x = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  double *w = x + ROWS;
+  double *g = w + 2 * ROWS * COLS;
+  double *a = g + COLS;
+  double *b = a + COLS;
+  for (int i = 0; i < ROWS; i++) x[i] = 2.0 * rand() / RAND_MAX - 1;
+  for (int i = 0; i < ROWS * COLS; i++) w[i] = (double) rand() / RAND_MAX;
+  for (int i = 0; i < COLS; i++) g[i] = 2.0 * rand() / RAND_MAX - 1;
+  // Float copies of x, w and g, and an output vector
+  size_t f32_size = sizeof(float) * (ROWS + ROWS * COLS + 2 * COLS);
+  float *f = mmap(NULL, f32_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  // Two quantized inputs and an int8 weight matrix
+  size_t i8_size = 2 * ROWS + ROWS * COLS;
+  int8_t *q = mmap(NULL, i8_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  const kernels *best = kern;
+  nn net;
+  nn_init(&net, ROWS, COLS, 0.001);
+  for (int t = 0; t < 4; t++) {
+    if (!kernels_supported(tables[t])) continue;
+    kern = tables[t];
+    double worst = check(kern, x, w, g, a, b);
+    check_f32(kern, x, w, g, f, w + ROWS * COLS, a);
+    check_i8(kern, w + ROWS * COLS, q, f);
+    say(kern->name);
+    say(": max rel err ");
+    say_double(worst * 1e15, 4);
+    say("e-15");
+
+    double start = clock_seconds();
+    for (int r = 0; r < REPS; r++) {
+      nn_forward(&net, x);
+      nn_backward(&net, x, 1);
+    }
+    double elapsed = clock_seconds() - start;
+    say(", forward+backward ");
+    say_double(elapsed / REPS * 1e6, 2);
+    say(" us\n");
+  }
+  kern = best;
+
+  nn_destroy(&net);
+  munmap(x, mem_size);
+  munmap(f, f32_size);
+  munmap(q, i8_size);
+  if (failures) exit(1);
+}
@@ -0,0 +1,62 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 3: Forward pass throughput for each sigmoid accuracy tier, against the
+ * exact (libm) tier. Runs nn_predict_matrix over a block of random inputs on
+ * a few network shapes, from narrow (where exp dominates) to wide (where the
+ * w01 product does).
+ */
+
+static const int NUM_ROWS = 4096;
+static const int REPS = 20;
+
+// Predictions per second for one tier on one shape
+static double throughput(int input_size, int hidden_size, nn_sigmoid tier,
+  double *x, double *out) {
+  nn_options opts;
+  nn_default_options(&opts);
+  opts.sigmoid = tier;
+  nn net;
+  nn_init_opts(&net, input_size, hidden_size, 0.01, &opts);
+
+  double start = clock_seconds();
+  for (int r = 0; r < REPS; r++) {
+    nn_predict_matrix(&net, x, NUM_ROWS, out, NULL);
+  }
+  double elapsed = clock_seconds() - start;
+  nn_destroy(&net);
+  return NUM_ROWS * REPS / elapsed;
+}
+
+int main(void) {
+  srand(1);
+  int shapes[4][2] = { {4, 2}, {13, 18}, {16, 256}, {256, 256} };
+  char *names[3] = { "exact   ", "accurate", "fast    " };
+
+  size_t mem_size = sizeof(double) * NUM_ROWS * (256 + 1);
+  double *x = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  double *out = x + NUM_ROWS * 256;
+  for (int i = 0; i < NUM_ROWS * 256; i++) x[i] = 2.0 * rand() / RAND_MAX - 1;
+
+  for (int s = 0; s < 4; s++) {
+    say_int(shapes[s][0]);
+    say("x");
+    say_int(shapes[s][1]);
+    say(":\n");
+    double exact = 0;
+    for (int t = NN_SIGMOID_EXACT; t <= NN_SIGMOID_FAST; t++) {
+      double rate = throughput(shapes[s][0], shapes[s][1], t, x, out);
+      if (t == NN_SIGMOID_EXACT) exact = rate;
+      say("  ");
+      say(names[t]);
+      say(" ");
+      say_double(rate / 1e6, 3);
+      say(" M predictions/s (");
+      say_double(rate / exact, 2);
+      say("x)\n");
+    }
+  }
+  munmap(x, mem_size);
+}
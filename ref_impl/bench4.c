@@ -0,0 +1,63 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 4: Input-major against hidden-major w01 layout. For a grid of network
+ * shapes, times one nn_forward + nn_backward per example (batch size 1, the
+ * nn_train inner loop) in each layout, and prints the hidden-major speedup.
+ * Values above 1 mean hidden-major wins; the crossover is where they cross 1.
+ */
+
+static const int TOTAL_WEIGHTS = 1 << 23;
+
+// Microseconds per example for one layout and shape. The number of steps is
+// scaled so that every shape touches about the same number of weights.
+static double time_step(int input_size, int hidden_size, nn_layout layout,
+  double *x) {
+  nn_options opts;
+  nn_default_options(&opts);
+  opts.layout = layout;
+  nn net;
+  rng_seed(1);
+  nn_init_opts(&net, input_size, hidden_size, 0.0001, &opts);
+
+  int steps = TOTAL_WEIGHTS / (input_size * hidden_size) + 1;
+  double start = clock_seconds();
+  for (int s = 0; s < steps; s++) {
+    nn_forward(&net, x);
+    nn_backward(&net, x, s & 1);
+  }
+  double elapsed = clock_seconds() - start;
+  nn_destroy(&net);
+  return elapsed / steps * 1e6;
+}
+
+int main(void) {
+  int inputs[5] = { 4, 32, 256, 2048, 16384 };
+  int hiddens[4] = { 2, 16, 128, 1024 };
+
+  size_t mem_size = sizeof(double) * 16384;
+  double *x = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  for (int i = 0; i < 16384; i++) x[i] = 2.0 * rand() / RAND_MAX - 1;
+
+  say("hidden-major speedup (input-major us / hidden-major us)\n");
+  say("input\\hidden");
+  for (int h = 0; h < 4; h++) {
+    say("\t");
+    say_int(hiddens[h]);
+  }
+  say("\n");
+  for (int i = 0; i < 5; i++) {
+    say_int(inputs[i]);
+    say("\t");
+    for (int h = 0; h < 4; h++) {
+      double im = time_step(inputs[i], hiddens[h], NN_LAYOUT_INPUT_MAJOR, x);
+      double hm = time_step(inputs[i], hiddens[h], NN_LAYOUT_HIDDEN_MAJOR, x);
+      say("\t");
+      say_double(im / hm, 2);
+    }
+    say("\n");
+  }
+  munmap(x, mem_size);
+}
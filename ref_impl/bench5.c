@@ -0,0 +1,61 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 5: CSV parsing throughput. Builds a large CSV by repeating the rows of
+ * the breast cancer dataset, then reports how fast ds_load and
+ * ds_load_parallel (with 1, 2, 4 and 8 threads) get through it, in MB/s. For
+ * comparison, the same data is saved with ds_save_binary, and the last line is
+ * the time to ds_open_binary it and read every attribute once, in CSV MB/s.
+ *
+ * Usage: ./bench5 [megabytes]   (defaults to 64)
+ */
+
+static char *SCRATCH = "/tmp/bench5.csv";
+static char *BINARY = "/tmp/bench5.bin";
+
+static void report(char *label, double megabytes, double seconds) {
+  say(label);
+  say(": ");
+  say_double(megabytes / seconds, 1);
+  say(" MB/s\n");
+}
+
+int main(int argc, char **argv) {
+  int target_mb = 64;
+  if (argc > 1) target_mb = atoi(argv[1]);
+
+  long rows;
+  long total = bench_inflate_csv(SCRATCH, target_mb, &rows);
+  double megabytes = total / (double) (1 << 20);
+
+  dataset ds;
+  double start = clock_seconds();
+  ds_load(SCRATCH, rows + 1, 31, &ds);
+  report("ds_load", megabytes, clock_seconds() - start);
+  ds_save_binary(&ds, BINARY, 0);
+  ds_deep_destroy(&ds);
+
+  char label[] = "ds_load_parallel x0";
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    start = clock_seconds();
+    ds_load_parallel(SCRATCH, threads, &ds);
+    label[sizeof(label) - 2] = '0' + threads;
+    report(label, megabytes, clock_seconds() - start);
+    ds_deep_destroy(&ds);
+  }
+
+  // Opening is lazy, so read everything to make the comparison fair
+  start = clock_seconds();
+  ds_open_binary(BINARY, &ds);
+  double sum = 0;
+  for (size_t i = 0; i < (size_t) ds.num_examples * ds.num_attributes; i++) {
+    sum += ds.features[i];
+  }
+  report("ds_open_binary", megabytes, clock_seconds() - start);
+  ds_deep_destroy(&ds);
+
+  unlink(SCRATCH);
+  unlink(BINARY);
+  return sum == 0;
+}
@@ -0,0 +1,57 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 6: Out-of-core training. Builds a large CSV by repeating the rows of
+ * the breast cancer dataset, then trains one epoch on it with nn_train_stream,
+ * reporting throughput and the peak RSS of the process. Only then does it load
+ * the whole file with ds_load_parallel and train one epoch with nn_train, for
+ * comparison. Peak RSS never goes down, so the streaming figure has to be
+ * taken first.
+ *
+ * Usage: ./bench6 [megabytes]   (defaults to 64)
+ */
+
+static char *SCRATCH = "/tmp/bench6.csv";
+
+static void report(char *label, long rows, double seconds) {
+  say(label);
+  say(": ");
+  say_int(rows / seconds);
+  say(" rows/s, peak RSS ");
+  say_int(peak_rss_kb() >> 10);
+  say(" MB\n");
+}
+
+int main(int argc, char **argv) {
+  int target_mb = 64;
+  if (argc > 1) target_mb = atoi(argv[1]);
+
+  long rows;
+  bench_inflate_csv(SCRATCH, target_mb, &rows);
+
+  bench_quiet();
+
+  nn net;
+  rng_seed(1);
+  nn_init(&net, 30, 32, 0.005);
+  ds_stream s;
+  ds_stream_open(&s, SCRATCH, NULL);
+  double start = clock_seconds();
+  nn_train_stream(&net, &s, 1);
+  report("nn_train_stream", rows, clock_seconds() - start);
+  ds_stream_close(&s);
+  nn_destroy(&net);
+
+  rng_seed(1);
+  nn_init(&net, 30, 32, 0.005);
+  dataset ds;
+  start = clock_seconds();
+  ds_load_parallel(SCRATCH, 1, &ds);
+  nn_train(&net, &ds, 1);
+  report("ds_load_parallel + nn_train", rows, clock_seconds() - start);
+  ds_deep_destroy(&ds);
+  nn_destroy(&net);
+
+  unlink(SCRATCH);
+}
@@ -0,0 +1,79 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 7: Epochs and wall time for each optimizer to bring the training loss
+ * below a target, on the wine and breast cancer datasets. Every optimizer
+ * starts from the same initial weights and sees the same shuffles; the loss is
+ * measured exactly after every epoch.
+ */
+
+static const int MAX_EPOCHS = 1000;
+
+static void report(char *label, int epochs, double seconds) {
+  say("  ");
+  say(label);
+  say(": ");
+  if (epochs > MAX_EPOCHS) {
+    say("did not reach target\n");
+    return;
+  }
+  say_int(epochs);
+  say(" epochs, ");
+  say_double(seconds, 4);
+  say(" s\n");
+}
+
+static void race(dataset *ds, int hidden, double target, char *label,
+  nn_optimizer optimizer, nn_schedule schedule, double rate) {
+  nn_options opts;
+  nn_default_options(&opts);
+  opts.optim.optimizer = optimizer;
+  opts.optim.schedule = schedule;
+  opts.optim.cosine_epochs = 200;
+  opts.optim.min_rate = rate / 10;
+  nn_train_options train_opts;
+  nn_default_train_options(&train_opts);
+  train_opts.eval_interval = 1;
+
+  nn net;
+  rng_seed(1);
+  nn_init_opts(&net, ds->num_attributes, hidden, rate, &opts);
+  int epochs = 1;
+  double start = clock_seconds();
+  while (nn_train_ex(&net, ds, 1, &train_opts) > target
+    && epochs <= MAX_EPOCHS) epochs++;
+  report(label, epochs, clock_seconds() - start);
+  nn_destroy(&net);
+}
+
+static void race_all(dataset *ds, int hidden, double target) {
+  race(ds, hidden, target, "sgd", NN_OPTIMIZER_SGD,
+    NN_SCHEDULE_CONSTANT, 0.005);
+  race(ds, hidden, target, "momentum", NN_OPTIMIZER_MOMENTUM,
+    NN_SCHEDULE_CONSTANT, 0.001);
+  race(ds, hidden, target, "nesterov", NN_OPTIMIZER_NESTEROV,
+    NN_SCHEDULE_CONSTANT, 0.001);
+  race(ds, hidden, target, "adam", NN_OPTIMIZER_ADAM,
+    NN_SCHEDULE_CONSTANT, 0.001);
+  race(ds, hidden, target, "adam + cosine", NN_OPTIMIZER_ADAM,
+    NN_SCHEDULE_COSINE, 0.002);
+}
+
+int main(void) {
+  bench_quiet();
+
+  dataset ds;
+  ds_load("../test_sets/wine.csv", 179, 14, &ds);
+  ds_normalize(&ds);
+  say("wine, target loss 0.02\n");
+  race_all(&ds, 16, 0.02);
+  ds_deep_destroy(&ds);
+
+  ds_load("../test_sets/breast-cancer-wisconsin.csv", 570, 31, &ds);
+  ds_normalize(&ds);
+  say("breast cancer, target loss 0.03\n");
+  race_all(&ds, 32, 0.03);
+  ds_deep_destroy(&ds);
+
+}
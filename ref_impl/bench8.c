@@ -0,0 +1,67 @@
+#include "nn.h"
+#include "bench.h"
+
+/**
+ * Bench 8: Double, float and mixed precision networks. Builds a large CSV by
+ * repeating the rows of the breast cancer dataset, loads it, and makes a float
+ * copy of it with ds_make_f32. Then, for each precision, reports the rows per
+ * second of one nn_train epoch and of one nn_average_loss pass over the
+ * shuffled dataset, and the loss after training, all from the same initial
+ * weights.
+ *
+ * Usage: ./bench8 [megabytes] [hidden_size]   (defaults to 64 and 32)
+ */
+
+static char *SCRATCH = "/tmp/bench8.csv";
+
+static void report(char *label, double train_rows, double eval_rows,
+  double loss) {
+  say(label);
+  say(": train ");
+  say_int(train_rows);
+  say(" rows/s, evaluate ");
+  say_int(eval_rows);
+  say(" rows/s, loss ");
+  say_double(loss, 8);
+  say("\n");
+}
+
+int main(int argc, char **argv) {
+  int target_mb = 64;
+  int hidden = 32;
+  if (argc > 1) target_mb = atoi(argv[1]);
+  if (argc > 2) hidden = atoi(argv[2]);
+
+  bench_inflate_csv(SCRATCH, target_mb, NULL);
+
+  bench_quiet();
+
+  dataset ds;
+  ds_load_parallel(SCRATCH, 1, &ds);
+  unlink(SCRATCH);
+  ds_normalize(&ds);
+  ds_make_f32(&ds);
+  int rows = ds.num_examples;
+
+  char *labels[] = {"double", "float ", "mixed "};
+  for (int p = NN_PRECISION_DOUBLE; p <= NN_PRECISION_MIXED; p++) {
+    nn_options opts;
+    nn_default_options(&opts);
+    opts.precision = p;
+    nn net;
+    rng_seed(1);
+    nn_init_opts(&net, ds.num_attributes, hidden, 0.001, &opts);
+    ds_shuffle(&ds);
+
+    double start = clock_seconds();
+    nn_train(&net, &ds, 1);
+    double train_seconds = clock_seconds() - start;
+    start = clock_seconds();
+    double loss = nn_average_loss(&net, &ds);
+    double eval_seconds = clock_seconds() - start;
+    report(labels[p], rows / train_seconds, rows / eval_seconds, loss);
+    nn_destroy(&net);
+  }
+
+  ds_deep_destroy(&ds);
+}
@@ -0,0 +1,99 @@
+#include "quant.h"
+#include "bench.h"
+
+/**
+ * Bench 9: Single-core prediction throughput of a network in double and float
+ * precision, and quantized to int8 with either sigmoid. Writes a synthetic CSV
+ * of uniform random attributes in [-1, 1], labelled by whether the first two
+ * sum to more than 0, trains a network on it for a couple of epochs and
+ * quantizes it, calibrating on the same data. Then reports, for each model,
+ * predictions per second over repeated passes through the dataset, the
+ * average loss, and the largest difference from the double network's
+ * predictions.
+ *
+ * Usage: ./bench9 [input_size] [hidden_size] [rows]   (defaults to 64, 64 and
+ * 	20000)
+ */
+
+static char *SCRATCH = "/tmp/bench9.csv";
+static char *SAVED = "/tmp/bench9.nn";
+
+static void report(char *label, double rate, double loss, double diff) {
+  say(label);
+  say(": ");
+  say_int(rate);
+  say(" predictions/s, loss ");
+  say_double(loss, 8);
+  say(", max difference ");
+  say_double(diff, 8);
+  say("\n");
+}
+
+static double max_difference(int n, const double *a, const double *b) {
+  double max = 0;
+  for (int i = 0; i < n; i++) {
+    if (fabs(a[i] - b[i]) > max) max = fabs(a[i] - b[i]);
+  }
+  return max;
+}
+
+int main(int argc, char **argv) {
+  int input = 64;
+  int hidden = 64;
+  int rows = 20000;
+  if (argc > 1) input = atoi(argv[1]);
+  if (argc > 2) hidden = atoi(argv[2]);
+  if (argc > 3) rows = atoi(argv[3]);
+  // Enough passes for about a million predictions per model
+  int passes = 1000000 / rows + 1;
+
+  bench_write_csv(SCRATCH, rows, input, 0);
+
+  bench_quiet();
+
+  dataset ds;
+  ds_load_parallel(SCRATCH, 1, &ds);
+  unlink(SCRATCH);
+
+  // Wider inputs need a smaller rate to keep training from diverging
+  nn net;
+  nn_init(&net, input, hidden, 0.5 / input);
+  nn_train(&net, &ds, 2);
+  nn_save(&net, SAVED);
+  nn net_f32;
+  nn_load(&net_f32, SAVED);
+  unlink(SAVED);
+  nn_convert(&net_f32, NN_PRECISION_FLOAT);
+  qnn q;
+  qnn_quantize(&q, &net, &ds);
+
+  size_t size = 2 * (size_t) rows * sizeof(double);
+  double *reference = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  double *out = reference + rows;
+  nn_predict_dataset(&net, &ds, reference, NULL);
+
+  char *labels[] = {"double     ", "float      ", "int8 float ", "int8 table "};
+  for (int m = 0; m < 4; m++) {
+    q.sigmoid = m == 3 ? QNN_SIGMOID_TABLE : QNN_SIGMOID_FLOAT;
+    double start = clock_seconds();
+    for (int pass = 0; pass < passes; pass++) {
+      if (m == 0) nn_predict_dataset(&net, &ds, out, NULL);
+      else if (m == 1) nn_predict_dataset(&net_f32, &ds, out, NULL);
+      else qnn_predict_dataset(&q, &ds, out);
+    }
+    double seconds = clock_seconds() - start;
+    double loss = 0;
+    for (int i = 0; i < rows; i++) {
+      loss += (ds_label(&ds, i) - out[i]) * (ds_label(&ds, i) - out[i]);
+    }
+    report(labels[m], (double) passes * rows / seconds, loss / rows,
+      max_difference(rows, out, reference));
+  }
+
+  munmap(reference, size);
+  qnn_destroy(&q);
+  nn_destroy(&net_f32);
+  nn_destroy(&net);
+  ds_deep_destroy(&ds);
+}
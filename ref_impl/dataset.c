@@ -1,12 +1,18 @@
 #include "dataset.h"
 
 /*
- * Just need to munmap the `examples` part of the struct, since we don't want
- * to free the underlying data in this case.
+ * Just need to munmap the `index` part of the struct, since we don't want
+ * to free the underlying data in this case. A float copy is the exception:
+ * it belongs to the dataset that made it, view or not.
  */
 void ds_destroy(dataset *ds) {
-	// total size of arrray is number of examples * the size of a pointer
-	int err = munmap(ds->examples, ds->num_examples * sizeof(data*));
+	// total size of array is number of examples * the size of a row number
+	// Views carved from an arena leave their index to it
+	int err = 0;
+	if(ds->index && !ds->_arena) {
+		err = munmap(ds->index, ds->num_examples * sizeof(int));
+	}
+	if(!err && ds->_f32_size) err = munmap(ds->features_f32, ds->_f32_size);
 	if(err) {
 		perror("ds_destroy munmap");
 		exit(8);
@@ -18,19 +24,16 @@ void ds_destroy(dataset *ds) {
  * ds_destroy to handle the rest.
  */
 void ds_deep_destroy(dataset *ds) {
-	// Compute the size of the block. This is duplicate code from loading,
-	// TODO does it make sense to restructure this?
-	size_t data_size = sizeof(int) + ds->num_attributes * sizeof(double);
-	size_t block_size = ds->num_examples * data_size;
-
-	// Free the underlying data
-	int err = munmap(ds->_mmap_ptr, block_size);
+	// Free the underlying data. The size was saved at load time, since a shuffled
+	// or split view can't recover it from num_examples alone. An empty dataset
+	// has none.
+	int err = ds->_mmap_ptr ? munmap(ds->_mmap_ptr, ds->_mmap_size) : 0;
 	if(err) {
 		perror("ds_deep_destroy munmap");
 		exit(9);
 	}
 
-	// Free ds->examples
+	// Free ds->index
 	ds_destroy(ds);
 }
 
@@ -41,24 +44,44 @@ void ds_deep_destroy(dataset *ds) {
  * moves the pointer through the CSV string data until its past the char c we
  * specify.
  *
+ * On x86-64 we look at 16 bytes at a time: compare them all against c at once,
+ * and the lowest set bit of the resulting mask is the first match. Only the
+ * last few bytes before end are scanned one at a time, so we never read past
+ * end.
+ *
  * @param ptr the ptr to move
  * @param end the rightmost limit of ptr; this is a stop condition in case there
  * 	are no more of c to consume. Without this, we may sigfault
  * @param c the character to consume past.
  */
 void _consume_past_char(char **ptr, char *end, char c) {
-	while(**ptr != c) {
-		(*ptr)++;
-		if (*ptr == end) return;
+	char *p = *ptr;
+#if defined(__x86_64__)
+	__m128i needle = _mm_set1_epi8(c);
+	while(p + 16 <= end) {
+		__m128i chunk = _mm_loadu_si128((__m128i*) p);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		if(mask) {
+			*ptr = p + __builtin_ctz(mask) + 1;
+			return;
+		}
+		p += 16;
 	}
-	(*ptr)++;
+#endif
+	while(p < end && *p != c) p++;
+	*ptr = p < end ? p + 1 : end;
+}
+
+// A row that is nothing but a line ending (LF or CRLF) is blank, and skipped
+int _is_blank_line(char *ptr, char *end) {
+	return *ptr == '\n' || (*ptr == '\r' && ptr + 1 < end && ptr[1] == '\n');
 }
 
 /*
  * Helper function to parse an int. Also moves the ptr past the int so it is
  * pointing at the next character which is not part of the int.
  */
-int _parse_int(char **ptr) {
+int _parse_int(char **ptr, char *end) {
 	// the result
 	int r = 0;
 
@@ -67,14 +90,14 @@ int _parse_int(char **ptr) {
 
 	// we only check the sign on the first character; a sign anywhere else is
 	// considered invalid
-	if (**ptr == '-') {
+	if (*ptr < end && **ptr == '-') {
 		sgn = -1;
 		(*ptr)++;
 	}
 
 	// While we keep seeing digits, append them to our result, and keep
 	// updating ptr
-	while (**ptr >= '0' && **ptr <= '9') {
+	while (*ptr < end && **ptr >= '0' && **ptr <= '9') {
 		r = r * 10 + (**ptr - '0');
 		(*ptr)++;
 	}
@@ -85,104 +108,404 @@ int _parse_int(char **ptr) {
 }
 
 /*
- * Helper function to parse a float. Some similar ideas to int, except we also
- * keep track of the exponent. This doesn't support scientific notation, but
- * is otherwise somewhat durable; "-.3", "-00.0001", "091.100" all successfully
- * parse
+ * Everything below up to _parse_double is for turning a decimal number
+ * w * 10^q (w a 64-bit integer) into the correctly rounded double, quickly.
+ *
+ * When w fits in 53 bits and |q| <= 22, both w and 10^q are exact doubles and
+ * a single multiplication or division rounds correctly (Clinger's fast path).
+ * Otherwise we use the Eisel-Lemire algorithm: multiply w by a 128-bit
+ * approximation of 5^q, and read the mantissa straight off the top bits of
+ * the product. In the rare cases where those bits are too close to a rounding
+ * boundary to be sure, we give up and fall back to strtod.
  */
-double _parse_double(char **ptr) {
-	double r = 0.0;
-	int sgn = 1;
 
-	// A flag telling us whether or not we've seen a decimal point yet.
-	int is_exp = 0;
-	// In the end, we will divide r by 10^exp.
-	int exp = 0;
+// Every power of ten that is exactly representable as a double
+static const double _POW10[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+	1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-	if (**ptr == '-') {
-		sgn = -1;
-		(*ptr)++;
+// Eisel-Lemire needs the top 128 bits of 5^q for q in [-342, 308]: entry
+// 2 * (q + 342) holds the high 64 bits and the entry after it the low 64. The
+// table is computed once, on first use, with exact big integer arithmetic.
+static unsigned long _pow5_128[2 * (342 + 308 + 1)];
+static pthread_once_t _pow5_once = PTHREAD_ONCE_INIT;
+
+// Just enough of an unsigned big integer to build that table: little-endian
+// 32-bit limbs, 2048 bits in total, which covers the largest number we need
+// (about 2^1720).
+typedef struct _bignum {
+	unsigned int limb[64];
+	int n;
+} _bignum;
+
+void _big_set_pow2(_bignum *b, int e) {
+	b->n = e / 32 + 1;
+	for(int i = 0; i < b->n; i++) {
+		b->limb[i] = 0;
 	}
+	b->limb[e / 32] = 1u << (e % 32);
+}
 
-	// Loop until we encounter some invalid character. TODO I'm realizing this
-	// (and the parse_int function) could have issues if the CSV files don't end
-	// with a newline.
-	while(1) {
-		if (**ptr == '.') {
-			// We can only have one decimal point, second one is not part of the
-			// number, so break
-			if (is_exp) break;
-			else is_exp = 1;
-		} else if (**ptr >= '0' && **ptr <= '9') {
-			// similar logic to before but also keep track of the exponent
-			r = r * 10 + (**ptr - '0');
-			exp += is_exp;
-		} else {
-			// Unrecognized character
-			break;
-		}
-
-		// Move ptr along
-		(*ptr)++;
+void _big_mul_small(_bignum *b, unsigned int m) {
+	unsigned long carry = 0;
+	for(int i = 0; i < b->n; i++) {
+		unsigned long t = (unsigned long) b->limb[i] * m + carry;
+		b->limb[i] = (unsigned int) t;
+		carry = t >> 32;
 	}
-	// Scale r back down to the correct value. Using this while loop avoids any
-	// cmath shenanigans
-	while(exp--) r /= 10.0;
-	return sgn*r;
+	if(carry) b->limb[b->n++] = (unsigned int) carry;
+}
+
+// Floor division. Dividing by 5 k times in a row is the same as dividing by
+// 5^k once, since floor(floor(a / b) / c) = floor(a / (b * c)).
+void _big_div_small(_bignum *b, unsigned int d) {
+	unsigned long rem = 0;
+	for(int i = b->n - 1; i >= 0; i--) {
+		unsigned long t = (rem << 32) | b->limb[i];
+		b->limb[i] = (unsigned int) (t / d);
+		rem = t % d;
+	}
+	while(b->n > 1 && b->limb[b->n - 1] == 0) b->n--;
+}
+
+void _big_add_one(_bignum *b) {
+	for(int i = 0; i < b->n; i++) {
+		if(++b->limb[i] != 0) return;
+	}
+	b->limb[b->n++] = 1;
+}
+
+int _big_bit_length(_bignum *b) {
+	return (b->n - 1) * 32 + (32 - __builtin_clz(b->limb[b->n - 1]));
+}
+
+// Stores the 128 bits of b starting at its most significant bit, padding with
+// zeros on the right if b is shorter than that.
+void _big_top128(_bignum *b, unsigned long *hi, unsigned long *lo) {
+	unsigned __int128 r = 0;
+	int len = _big_bit_length(b);
+	for(int i = len - 1; i >= len - 128; i--) {
+		int bit = i >= 0 ? (b->limb[i / 32] >> (i % 32)) & 1 : 0;
+		r = (r << 1) | bit;
+	}
+	*hi = (unsigned long) (r >> 64);
+	*lo = (unsigned long) r;
+}
+
+/*
+ * For q >= 0 the entry is 5^q truncated to its top 128 bits. For q < 0 it is
+ * 2^b / 5^-q rounded up, then truncated to 128 bits, where b is chosen so the
+ * quotient has at least 128 bits. This is exactly the table the reference
+ * implementation of the algorithm (fast_float) ships with.
+ */
+void _init_pow5() {
+	_bignum p5, t;
+	p5.n = 1;
+	p5.limb[0] = 1;
+	for(int q = 0; q <= 308; q++) {
+		_big_top128(&p5, &_pow5_128[2 * (q + 342)], &_pow5_128[2 * (q + 342) + 1]);
+		_big_mul_small(&p5, 5);
+	}
+
+	p5.n = 1;
+	p5.limb[0] = 1;
+	for(int k = 1; k <= 342; k++) {
+		_big_mul_small(&p5, 5);
+		// z is the smallest power of 2 at or above 5^k
+		int z = _big_bit_length(&p5);
+		_big_set_pow2(&t, k <= 27 ? z + 127 : 2 * z + 128);
+		for(int i = 0; i < k; i++) {
+			_big_div_small(&t, 5);
+		}
+		_big_add_one(&t);
+		_big_top128(&t, &_pow5_128[2 * (342 - k)], &_pow5_128[2 * (342 - k) + 1]);
+	}
+}
+
+double _double_from_bits(unsigned long bits) {
+	union { double d; unsigned long u; } v;
+	v.u = bits;
+	return v.d;
+}
+
+/*
+ * Eisel-Lemire. Computes the double nearest to w * 10^q, for w > 0, into
+ * *out. Returns 1 on success, or 0 if the product is too close to call and the
+ * caller has to fall back to a slower exact method.
+ */
+int _eisel_lemire(unsigned long w, long q, double *out) {
+	if(q < -342) {
+		*out = 0.0;
+		return 1;
+	}
+	if(q > 308) {
+		*out = _double_from_bits(0x7FFUL << 52);
+		return 1;
+	}
+	pthread_once(&_pow5_once, _init_pow5);
+
+	// Normalize w so its top bit is set, and take the high 128 bits of w * 5^q.
+	// The low table word only matters if the bits we keep could still carry.
+	int lz = __builtin_clzl(w);
+	w <<= lz;
+	int index = 2 * (q + 342);
+	unsigned __int128 product = (unsigned __int128) w * _pow5_128[index];
+	unsigned long high = (unsigned long) (product >> 64);
+	unsigned long low = (unsigned long) product;
+	if((high & 0x1FF) == 0x1FF) {
+		unsigned long extra = (unsigned long)
+			(((unsigned __int128) w * _pow5_128[index + 1]) >> 64);
+		low += extra;
+		if(extra > low) high++;
+		if(low == 0xFFFFFFFFFFFFFFFFUL && (q < -27 || q > 55)) return 0;
+	}
+
+	// 54 bits of mantissa (one more than we keep, for rounding) off the top
+	int upperbit = (int) (high >> 63);
+	int shift = upperbit + 64 - 52 - 3;
+	unsigned long mantissa = high >> shift;
+	// floor(q * log2(10)) + 63, plus where the top bit landed, as a biased
+	// exponent
+	long power2 = ((((152170 + 65536) * q) >> 16) + 63) + upperbit - lz + 1023;
+
+	if(power2 <= 0) {
+		// Subnormal: shift the mantissa down to where the exponent saturates
+		if(-power2 + 1 >= 64) {
+			*out = 0.0;
+			return 1;
+		}
+		mantissa >>= -power2 + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		// Rounding up may have made it the smallest normal number after all
+		power2 = mantissa < (1UL << 52) ? 0 : 1;
+		*out = _double_from_bits(mantissa | (power2 << 52));
+		return 1;
+	}
+
+	// Exactly halfway between two doubles can only happen for small q, and
+	// then ties go to even rather than up
+	if(low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+		&& (mantissa << shift) == high) {
+		mantissa &= ~1UL;
+	}
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if(mantissa >= (2UL << 52)) {
+		mantissa = 1UL << 52;
+		power2++;
+	}
+	mantissa &= ~(1UL << 52);
+	if(power2 >= 0x7FF) {
+		*out = _double_from_bits(0x7FFUL << 52);
+		return 1;
+	}
+	*out = _double_from_bits(mantissa | ((unsigned long) power2 << 52));
+	return 1;
+}
+
+// The slow but always exact fallback: strtod, on a NUL-terminated copy of
+// the number since the CSV data isn't NUL-terminated. The copy is on the stack
+// unless the number is too long for it, and then in a mapping of its own, so
+// strtod always sees every digit and the exponent.
+double _parse_double_slow(char *start, char *stop) {
+	char stack_buf[512];
+	size_t n = stop - start;
+	size_t map_size = n < sizeof(stack_buf) ? 0 : n + 1;
+	char *buf = stack_buf;
+	if(map_size) {
+		buf = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(buf == MAP_FAILED) {
+			printf("_parse_double_slow map failed\n");
+			exit(65);
+		}
+	}
+	for(size_t i = 0; i < n; i++) {
+		buf[i] = start[i];
+	}
+	buf[n] = '\0';
+	double x = strtod(buf, NULL);
+	if(map_size) munmap(buf, map_size);
+	return x;
+}
+
+/*
+ * Helper function to parse a float, moving ptr past it. The digits go into an
+ * integer w, and q keeps track of the power of ten they are scaled by,
+ * including an optional exponent ("1.5e-3", "2E+10"); w and q then go to the
+ * fast paths above. "-.3", "-00.0001", "091.100" all successfully parse, and
+ * anything that isn't a number at all parses as 0.
+ */
+double _parse_double(char **ptr, char *end) {
+	char *start = *ptr;
+	char *p = *ptr;
+	int neg = 0;
+	if(p < end && (*p == '-' || *p == '+')) {
+		neg = *p == '-';
+		p++;
+	}
+
+	// Accumulate every digit, and only afterwards check whether there were
+	// too many for w to hold. This keeps the loops as tight as possible for
+	// the usual short numbers.
+	unsigned long w = 0;
+	char *digits_start = p;
+	while(p < end && (unsigned) (*p - '0') < 10) {
+		w = w * 10 + (*p - '0');
+		p++;
+	}
+	long digits = p - digits_start;
+	long q = 0;
+	if(p < end && *p == '.') {
+		p++;
+		char *frac_start = p;
+		while(p < end && (unsigned) (*p - '0') < 10) {
+			w = w * 10 + (*p - '0');
+			p++;
+		}
+		q = -(p - frac_start);
+		digits += p - frac_start;
+	}
+
+	// Exponent, only if there really is one; "1e" or "1e+" stop before the e
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		char *e = p + 1;
+		int exp_neg = 0;
+		if(e < end && (*e == '-' || *e == '+')) {
+			exp_neg = *e == '-';
+			e++;
+		}
+		if(e < end && (unsigned) (*e - '0') < 10) {
+			long exp = 0;
+			for(; e < end && (unsigned) (*e - '0') < 10; e++) {
+				// Way past the range of doubles either way; just don't overflow
+				if(exp < 100000) exp = exp * 10 + (*e - '0');
+			}
+			q += exp_neg ? -exp : exp;
+			p = e;
+		}
+	}
+	*ptr = p;
+
+	// More than 19 digits may have overflowed w. Leading zeros don't count,
+	// but if there are still too many, let strtod deal with it.
+	if(digits > 19) {
+		for(char *z = digits_start; z < p && (*z == '0' || *z == '.'); z++) {
+			if(*z == '0') digits--;
+		}
+		if(digits > 19) return _parse_double_slow(start, p);
+	}
+
+	double r;
+	if(w == 0) {
+		r = 0.0;
+	} else if(q >= -22 && q <= 22 && w <= (1UL << 53)) {
+		r = (double) w;
+		r = q < 0 ? r / _POW10[-q] : r * _POW10[q];
+	} else if(!_eisel_lemire(w, q, &r)) {
+		return _parse_double_slow(start, p);
+	}
+	return neg ? -r : r;
 }
 
 /*
- * Parse a row of the CSV file into the given `data` struct, moving ptr to the
- * beginning of the next row.
+ * Parse a row of the CSV file into the given label and attribute row, moving
+ * ptr to the beginning of the next row.
  */
-void _parse_data(char **ptr, data *d, int num_attributes, char *end) {
+void _parse_data(char **ptr, int *label, double *row, int num_attributes,
+	char *end) {
 	// Consume the label first
-	d->label = _parse_int(ptr);
-	d->example = (double*) ((long) d + sizeof(data));
+	*label = _parse_int(ptr, end);
 
 	// Parse all of the attributes in this row
 	for(int i = 0; i < num_attributes; i++) {
 		_consume_past_char(ptr, end, ',');
-		d->example[i] = _parse_double(ptr);
+		row[i] = _parse_double(ptr, end);
 	}
 
-	// Move ptr to next row
+	// Move ptr to next row. This also skips the \r of a CRLF line ending.
 	_consume_past_char(ptr, end, '\n');
 }
 
 /*
- * Loads a CSV file. The file MUST have a header row, the first column
- * MUST be labels (integers only).
+ * The underlying data is one mapping holding the label array followed by the
+ * attribute matrix. The matrix starts on a cache line boundary so that rows
+ * line up with what the hardware prefetcher fetches.
  */
-void ds_load(char *filepath, int numrows, int numcols, dataset *ds) {
-	// e.g. load_csv("iris.csv", 151, 5, &ds);
-	// need to mmap() 3 things:
-	// - underlying data[]
-	// - the data[] for this particular dataset
-	// - the file we read from (munmapped before the return of this function)
+size_t _labels_size(int num_rows) {
+	size_t sz = num_rows * sizeof(int);
+	return (sz + 63) & ~((size_t) 63);
+}
 
-	ds->num_examples = numrows - 1;
-	ds->num_attributes = numcols - 1;
+/*
+ * Maps an identity index over n rows. The index starts out as the identity,
+ * so an unshuffled dataset walks the matrix front to back. An empty dataset
+ * gets a NULL index, since there is nothing to map.
+ */
+int *_identity_index(int n) {
+	if(n == 0) return NULL;
+	int *index = mmap(NULL, sizeof(int) * n, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(index == MAP_FAILED) {
+		printf("ds->index map failed\n");
+		exit(14);
+	}
+	for(int i = 0; i < n; i++) {
+		index[i] = i;
+	}
+	return index;
+}
 
-	// Allocate space for the underlying data. This is a pretty big allocation,
-	// but we only have to do it once; train-test-split reuses underlying data
-	// without moving anything.
+/*
+ * Allocates the underlying data for a dataset of the given shape, plus an
+ * identity index over it, and fills in every field of ds. This is a pretty big
+ * allocation, but we only have to do it once; train-test-split reuses
+ * underlying data without moving anything.
+ */
+void _alloc_dataset(dataset *ds, int num_examples, int num_attributes) {
+	ds->num_examples = num_examples;
+	ds->num_attributes = num_attributes;
 
 	// We first compute the total size we need to allocate
-	size_t data_size = sizeof(data) + ds->num_attributes * sizeof(double);
-	size_t block_size = ds->num_examples * data_size;
+	size_t labels_size = _labels_size(num_examples);
+	size_t block_size = labels_size
+		+ (size_t) num_examples * num_attributes * sizeof(double);
 
-	// key flag is MAP_ANONYMOUS, and we need RW access
-	data *data_ptr = mmap(NULL, block_size, PROT_READ | PROT_WRITE,
-		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	if(data_ptr == MAP_FAILED) {
-		printf("data_ptr map failed\n");
-		exit(10);
+	// key flag is MAP_ANONYMOUS, and we need RW access. The rows are read over
+	// and over in the training loop, so they get huge pages if they're big
+	// enough. An empty dataset has no block at all.
+	void *data_ptr = NULL;
+	if(block_size) {
+		data_ptr = mmap(NULL, block_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(data_ptr == MAP_FAILED) {
+			printf("data_ptr map failed\n");
+			exit(10);
+		}
+		advise_huge_pages(data_ptr, block_size);
 	}
 	// Save this ptr returned from mmap for freeing later
 	ds->_mmap_ptr = data_ptr;
+	ds->_mmap_size = block_size;
+	ds->labels = (int*) data_ptr;
+	ds->features = (double*) ((char*) data_ptr + labels_size);
+	ds->features_f32 = NULL;
+	ds->_f32_size = 0;
+	ds->_arena = NULL;
+
+	// mmap one more time for ds->index
+	ds->index = _identity_index(num_examples);
+}
 
-	// We now open the CSV file for reading. just need read access for this
+/*
+ * Maps a whole file for reading, storing its size in *size. CSV files may be
+ * quite large, so instead of `read` onto the stack into a huge buffer or
+ * something, much simpler to mmap into it.
+ */
+char *_map_file(char *filepath, size_t *size) {
+	// just need read access for this
 	int fd = open(filepath, O_RDONLY);
 	if(fd < 0){
 		perror("open");
@@ -195,67 +518,727 @@ void ds_load(char *filepath, int numrows, int numcols, dataset *ds) {
 		perror("fstat");
 		exit(12);
 	}
-	// CSV files may be quite large, so instead of `read` onto the stack into
-	// a huge buffer or something, much simpler to mmap into it
-	char *file_ptr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// An empty file can't be mapped, and doesn't need to be
+	char *file_ptr = NULL;
+	if(statbuf.st_size > 0) {
+		file_ptr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
 	if(file_ptr == MAP_FAILED) {
 		printf("file_ptr map failed\n");
 		exit(13);
 	}
 	close(fd);
+	*size = statbuf.st_size;
+	return file_ptr;
+}
 
-	// mmap one more time for ds->examples.
-	ds->examples = mmap(NULL, sizeof(data*) * ds->num_examples,
-		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	if(ds->examples == MAP_FAILED) {
-		printf("ds->examples map failed\n");
-		exit(14);
+void _unmap_file(char *file_ptr, size_t size) {
+	int err = size ? munmap(file_ptr, size) : 0;
+	if(err) {
+		perror("munmap");
+		exit(15);
 	}
+}
+
+/*
+ * Loads a CSV file. The file MUST have a header row, the first column
+ * MUST be labels (integers only).
+ */
+void ds_load(char *filepath, int numrows, int numcols, dataset *ds) {
+	// e.g. load_csv("iris.csv", 151, 5, &ds);
+	// need to mmap() 3 things:
+	// - underlying labels + attributes
+	// - the index for this particular dataset
+	// - the file we read from (munmapped before the return of this function)
+	_alloc_dataset(ds, numrows - 1, numcols - 1);
 
-	// file_ptr was returned by mmap and points to the first char in the file.
-	// end is the end of the file, computed by start + size
+	// file_ptr points to the first char in the file. end is the end of the file,
+	// computed by start + size
+	size_t file_size;
+	char *file_ptr = _map_file(filepath, &file_size);
 	char *parse_ptr = file_ptr;
-	char *end = file_ptr + statbuf.st_size;
+	char *end = file_ptr + file_size;
 
 	// skip first line
 	_consume_past_char(&parse_ptr, end, '\n');
-	// Parse row-by-row into underlying memory, and also save each index into
-	// ds->examples
+	// Parse row-by-row into underlying memory.
 	for (int i = 0; i < ds->num_examples; i++) {
-		data *d = (data*) ((long) data_ptr + i * data_size);
-		ds->examples[i] = d;
-		_parse_data(&parse_ptr, d, ds->num_attributes, end);
+		_parse_data(&parse_ptr, ds->labels + i,
+			ds->features + (size_t) i * ds->num_attributes, ds->num_attributes, end);
 	}
 
 	// We are done using the file, so we can unmap it
-	err = munmap(file_ptr, statbuf.st_size);
+	_unmap_file(file_ptr, file_size);
+}
+
+// Shared state for the two parallel passes of ds_load_parallel. Chunk c of the
+// file is [bounds[c], bounds[c + 1]), and its first row lands at row first[c]
+// of the underlying data.
+typedef struct _csv_chunks {
+	char **bounds;
+	int *first;
+	int num_attributes;
+	dataset *ds;
+} _csv_chunks;
+
+// Pass one: count the rows in this worker's chunk. Every non-empty line is a
+// row; blank lines (e.g. a trailing one) are skipped by both passes alike.
+void _count_rows(void *arg, int worker, int num_workers) {
+	_csv_chunks *cc = (_csv_chunks*) arg;
+	char *ptr = cc->bounds[worker];
+	char *end = cc->bounds[worker + 1];
+	int rows = 0;
+	while(ptr < end) {
+		if(!_is_blank_line(ptr, end)) rows++;
+		_consume_past_char(&ptr, end, '\n');
+	}
+	cc->first[worker + 1] = rows;
+}
+
+// Pass two: parse this worker's chunk straight into its final rows.
+void _parse_rows(void *arg, int worker, int num_workers) {
+	_csv_chunks *cc = (_csv_chunks*) arg;
+	char *ptr = cc->bounds[worker];
+	char *end = cc->bounds[worker + 1];
+	int row = cc->first[worker];
+	int n = cc->num_attributes;
+	while(ptr < end) {
+		if(_is_blank_line(ptr, end)) {
+			_consume_past_char(&ptr, end, '\n');
+			continue;
+		}
+		_parse_data(&ptr, cc->ds->labels + row,
+			cc->ds->features + (size_t) row * n, n, end);
+		row++;
+	}
+}
+
+/*
+ * The file is cut into one chunk per worker, with every cut moved forward to
+ * just past a newline so no row straddles two chunks. Workers count their
+ * chunk's rows, a prefix sum over the counts tells each chunk where its first
+ * row goes, and then workers parse their chunks in place. The number of
+ * attributes is the number of commas on the first data row.
+ */
+void ds_load_parallel(char *filepath, int num_threads, dataset *ds) {
+	if(num_threads < 1) num_threads = 1;
+	size_t file_size;
+	char *file_ptr = _map_file(filepath, &file_size);
+	char *end = file_ptr + file_size;
+
+	// skip the header, then count the columns of the first row
+	char *body = file_ptr;
+	_consume_past_char(&body, end, '\n');
+	int num_attributes = 0;
+	for(char *p = body; p < end && *p != '\n'; p++) {
+		if(*p == ',') num_attributes++;
+	}
+
+	// Chunk boundaries and per-chunk row offsets share one small mapping
+	size_t bookkeeping_size = (num_threads + 1) * (sizeof(char*) + sizeof(int));
+	char **bounds = mmap(NULL, bookkeeping_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(bounds == MAP_FAILED) {
+		printf("ds_load_parallel map failed\n");
+		exit(26);
+	}
+	_csv_chunks cc;
+	cc.bounds = bounds;
+	cc.first = (int*) (bounds + num_threads + 1);
+	cc.num_attributes = num_attributes;
+	cc.ds = ds;
+
+	size_t body_size = end - body;
+	bounds[0] = body;
+	for(int c = 1; c < num_threads; c++) {
+		char *cut = body + body_size / num_threads * c;
+		if(cut < bounds[c - 1]) cut = bounds[c - 1];
+		if(cut > body && cut < end && cut[-1] != '\n') {
+			_consume_past_char(&cut, end, '\n');
+		}
+		bounds[c] = cut;
+	}
+	bounds[num_threads] = end;
+
+	pool workers;
+	pool_init(&workers, num_threads);
+	cc.first[0] = 0;
+	pool_run(&workers, _count_rows, &cc);
+	for(int c = 1; c <= num_threads; c++) {
+		cc.first[c] += cc.first[c - 1];
+	}
+
+	_alloc_dataset(ds, cc.first[num_threads], num_attributes);
+	pool_run(&workers, _parse_rows, &cc);
+	pool_destroy(&workers);
+
+	int err = munmap(bounds, bookkeeping_size);
 	if(err) {
-		perror("munmap");
-		exit(15);
+		perror("ds_load_parallel munmap");
+		exit(27);
+	}
+	_unmap_file(file_ptr, file_size);
+}
+
+/*
+ * The binary format is a 64 byte header followed by the underlying data laid
+ * out exactly as _alloc_dataset lays it out in memory: the label array, padded
+ * to a cache line, then the row-major attribute matrix. mmap hands back page
+ * aligned memory, so once the file is mapped the labels and matrix are already
+ * where a dataset expects them, and nothing needs to be parsed or copied.
+ * Numbers are stored in the native byte order.
+ */
+static const char _DS_BINARY_MAGIC[8] = "NNDSBIN";
+static const int _DS_BINARY_VERSION = 1;
+
+typedef struct _ds_binary_header {
+	char magic[8];
+	int version;
+	int flags;
+	int num_examples;
+	int num_attributes;
+	// Pads the header out to one cache line
+	char _reserved[40];
+} _ds_binary_header;
+
+void ds_save_binary(dataset *ds, char *filepath, int normalize) {
+	// Gather the view's rows, in order, into a fresh block with the in-memory
+	// layout. That block is then the file's body as-is.
+	dataset out;
+	_alloc_dataset(&out, ds->num_examples, ds->num_attributes);
+	for(int i = 0; i < ds->num_examples; i++) {
+		out.labels[i] = ds_label(ds, i);
+		double *src = ds_example(ds, i);
+		double *dst = ds_example(&out, i);
+		for(int j = 0; j < ds->num_attributes; j++) {
+			dst[j] = src[j];
+		}
+	}
+	if(normalize) ds_normalize(&out);
+
+	_ds_binary_header header = {0};
+	for(int i = 0; i < 8; i++) {
+		header.magic[i] = _DS_BINARY_MAGIC[i];
+	}
+	header.version = _DS_BINARY_VERSION;
+	header.flags = normalize ? DS_BINARY_NORMALIZED : 0;
+	header.num_examples = out.num_examples;
+	header.num_attributes = out.num_attributes;
+
+	int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		perror("ds_save_binary open");
+		exit(28);
+	}
+	write_all(fd, &header, sizeof(header));
+	write_all(fd, out._mmap_ptr, out._mmap_size);
+	close(fd);
+	ds_deep_destroy(&out);
+}
+
+int ds_open_binary(char *filepath, dataset *ds) {
+	size_t file_size;
+	char *file_ptr = _map_file(filepath, &file_size);
+
+	// Check this really is a dataset file we know how to read, and that it
+	// holds as much data as its header claims
+	_ds_binary_header *header = (_ds_binary_header*) file_ptr;
+	int valid = file_size >= sizeof(_ds_binary_header)
+		&& header->version == _DS_BINARY_VERSION
+		&& header->num_examples >= 0 && header->num_attributes >= 0;
+	for(int i = 0; valid && i < 8; i++) {
+		valid = header->magic[i] == _DS_BINARY_MAGIC[i];
+	}
+	size_t labels_size = valid ? _labels_size(header->num_examples) : 0;
+	if(!valid || file_size != sizeof(_ds_binary_header) + labels_size
+		+ (size_t) header->num_examples * header->num_attributes * sizeof(double)) {
+		printf("ds_open_binary: %s is not a dataset file\n", filepath);
+		exit(30);
+	}
+
+	// The file mapping itself is the underlying data; ds_deep_destroy unmaps it
+	ds->num_examples = header->num_examples;
+	ds->num_attributes = header->num_attributes;
+	ds->_mmap_ptr = file_ptr;
+	ds->_mmap_size = file_size;
+	ds->labels = (int*) (file_ptr + sizeof(_ds_binary_header));
+	ds->features = (double*) (file_ptr + sizeof(_ds_binary_header) + labels_size);
+	ds->features_f32 = NULL;
+	ds->_f32_size = 0;
+	ds->_arena = NULL;
+	ds->index = _identity_index(ds->num_examples);
+	return header->flags;
+}
+
+void ds_stream_default_options(ds_stream_options *opts) {
+	opts->chunk_rows = 4096;
+	opts->shuffle_rows = 8192;
+	opts->max_rss_kb = 0;
+}
+
+// How much CSV text a stream reads at once. No line may be longer than this.
+static const size_t _STREAM_TEXT_SIZE = 1 << 20;
+
+// pread, but keeps going until it has read size bytes or hit the end of the
+// file. Returns how many bytes it read.
+size_t _pread_fully(int fd, void *buf, size_t size, off_t offset) {
+	size_t done = 0;
+	while(done < size) {
+		ssize_t n = pread(fd, (char*) buf + done, size - done, offset + done);
+		if(n < 0) {
+			perror("ds_stream read");
+			exit(32);
+		}
+		if(n == 0) break;
+		done += n;
+	}
+	return done;
+}
+
+// Reads the next chunk of rows of a binary file. Rows are read straight from
+// the label array and matrix into the chunk, no parsing needed.
+int _stream_fill_binary(ds_stream *s, _ds_chunk *chunk) {
+	int rows = s->_num_rows - s->_next_row;
+	if(rows > s->_opts.chunk_rows) rows = s->_opts.chunk_rows;
+	size_t row_size = s->num_attributes * sizeof(double);
+	size_t got = _pread_fully(s->_fd, chunk->labels, rows * sizeof(int),
+		s->_labels_offset + (off_t) s->_next_row * sizeof(int));
+	got += _pread_fully(s->_fd, chunk->features, rows * row_size,
+		s->_features_offset + (off_t) s->_next_row * row_size);
+	if(got != rows * (sizeof(int) + row_size)) {
+		printf("ds_stream: file is shorter than its header says\n");
+		exit(34);
+	}
+	chunk->count = rows;
+	s->_next_row += rows;
+	return s->_next_row == s->_num_rows;
+}
+
+// Parses the next chunk of rows of a CSV file, reading more text whenever the
+// text buffer runs out of complete lines. Whatever is left of a partial line
+// is moved to the front of the buffer first, so rows never straddle a read.
+int _stream_fill_csv(ds_stream *s, _ds_chunk *chunk) {
+	chunk->count = 0;
+	while(chunk->count < s->_opts.chunk_rows) {
+		char *ptr = s->_text + s->_text_start;
+		char *end = s->_text + s->_text_end;
+		char *line_end = ptr;
+		_consume_past_char(&line_end, end, '\n');
+
+		// Need more text, unless the file's last line just has no newline
+		if(ptr == end || (line_end == end && end[-1] != '\n' && !s->_file_eof)) {
+			if(s->_file_eof) return 1;
+			size_t rest = s->_text_end - s->_text_start;
+			if(rest == _STREAM_TEXT_SIZE) {
+				printf("ds_stream: line too long\n");
+				exit(34);
+			}
+			for(size_t i = 0; i < rest; i++) {
+				s->_text[i] = ptr[i];
+			}
+			size_t got = _pread_fully(s->_fd, s->_text + rest,
+				_STREAM_TEXT_SIZE - rest, s->_file_offset);
+			s->_file_offset += got;
+			s->_file_eof = got < _STREAM_TEXT_SIZE - rest;
+			s->_text_start = 0;
+			s->_text_end = rest + got;
+			continue;
+		}
+
+		if(!_is_blank_line(ptr, line_end)) {
+			_parse_data(&ptr, &chunk->labels[chunk->count],
+				&chunk->features[(size_t) chunk->count * s->num_attributes],
+				s->num_attributes, line_end);
+			chunk->count++;
+		}
+		s->_text_start = line_end - s->_text;
+	}
+	// A full chunk may happen to end exactly at the end of the file
+	return s->_file_eof && s->_text_start == s->_text_end;
+}
+
+// Starts the next pass through the file from its first row
+void _stream_rewind(ds_stream *s) {
+	s->_next_row = 0;
+	s->_text_start = 0;
+	s->_text_end = 0;
+	s->_file_offset = s->_body_offset;
+	s->_file_eof = 0;
+}
+
+// The background thread. It fills the two chunks in turn, waiting whenever the
+// one it wants to fill next hasn't been handed out yet, and loops over the file
+// until the stream is closed.
+void *_stream_reader(void *arg) {
+	ds_stream *s = (ds_stream*) arg;
+	int k = 0;
+	while(1) {
+		_ds_chunk *chunk = &s->_chunks[k];
+		pthread_mutex_lock(&s->_lock);
+		while(chunk->full && !s->_stop) {
+			pthread_cond_wait(&s->_cond, &s->_lock);
+		}
+		int stop = s->_stop;
+		pthread_mutex_unlock(&s->_lock);
+		if(stop) break;
+
+		int end_of_pass = s->_binary
+			? _stream_fill_binary(s, chunk) : _stream_fill_csv(s, chunk);
+		if(end_of_pass) _stream_rewind(s);
+
+		pthread_mutex_lock(&s->_lock);
+		chunk->end_of_pass = end_of_pass;
+		chunk->full = 1;
+		pthread_cond_broadcast(&s->_cond);
+		pthread_mutex_unlock(&s->_lock);
+		k ^= 1;
+	}
+	return NULL;
+}
+
+// Bytes in the mapping that holds a stream's two chunks, its shuffle buffer
+// and the row handed out last
+size_t _stream_block_size(int num_attributes, int chunk_rows, int shuffle_rows) {
+	size_t row_size = num_attributes * sizeof(double);
+	return 2 * (_labels_size(chunk_rows) + chunk_rows * row_size)
+		+ _labels_size(shuffle_rows) + shuffle_rows * row_size + row_size;
+}
+
+/*
+ * Shrinks the chunk and shuffle buffer until the stream's buffers fit in
+ * rss_left kilobytes, halving whichever is bigger each time. Exits if they
+ * don't fit even at one row each.
+ */
+void _stream_fit(ds_stream *s, size_t text_size, long rss_left) {
+	ds_stream_options *o = &s->_opts;
+	for(;;) {
+		size_t size = _stream_block_size(s->num_attributes, o->chunk_rows,
+			o->shuffle_rows) + text_size;
+		if((long) ((size + 1023) >> 10) <= rss_left) return;
+		if(o->chunk_rows == 1 && o->shuffle_rows == 1) {
+			printf("ds_stream: buffers don't fit under max_rss_kb\n");
+			exit(64);
+		}
+		if(o->chunk_rows >= o->shuffle_rows) o->chunk_rows = (o->chunk_rows + 1) / 2;
+		else o->shuffle_rows = (o->shuffle_rows + 1) / 2;
+	}
+}
+
+void ds_stream_open(ds_stream *s, char *filepath, const ds_stream_options *opts) {
+	if(opts) {
+		s->_opts = *opts;
+	} else {
+		ds_stream_default_options(&s->_opts);
+	}
+	if(s->_opts.chunk_rows < 1) s->_opts.chunk_rows = 1;
+	if(s->_opts.shuffle_rows < 1) s->_opts.shuffle_rows = 1;
+	// What the process already holds counts against the cap, so measure it
+	// before mapping anything
+	long rss_left = s->_opts.max_rss_kb - peak_rss_kb();
+
+	s->_fd = open(filepath, O_RDONLY);
+	if(s->_fd < 0) {
+		perror("ds_stream open");
+		exit(31);
+	}
+	// We read front to back, so ask for aggressive readahead
+	posix_fadvise(s->_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	// The text buffer comes first, since for a CSV we need it just to find out
+	// how many attributes there are. A binary file gets by on its header.
+	_ds_binary_header header;
+	size_t got = _pread_fully(s->_fd, &header, sizeof(header), 0);
+	s->_binary = got == sizeof(header);
+	for(int i = 0; s->_binary && i < 8; i++) {
+		s->_binary = header.magic[i] == _DS_BINARY_MAGIC[i];
+	}
+	size_t text_size = s->_binary ? 0 : _STREAM_TEXT_SIZE;
+
+	if(s->_binary) {
+		if(header.version != _DS_BINARY_VERSION) {
+			printf("ds_stream: %s has an unknown version\n", filepath);
+			exit(34);
+		}
+		s->num_attributes = header.num_attributes;
+		s->_num_rows = header.num_examples;
+		s->_labels_offset = sizeof(_ds_binary_header);
+		s->_features_offset = sizeof(_ds_binary_header)
+			+ _labels_size(header.num_examples);
+		s->_body_offset = 0;
+	} else {
+		s->_text = mmap(NULL, text_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(s->_text == MAP_FAILED) {
+			printf("ds_stream map failed\n");
+			exit(33);
+		}
+		// Skip the header and count the columns of the first row, which has
+		// to fit in the first read along with the header
+		got = _pread_fully(s->_fd, s->_text, text_size, 0);
+		char *ptr = s->_text;
+		char *end = s->_text + got;
+		_consume_past_char(&ptr, end, '\n');
+		s->_body_offset = ptr - s->_text;
+		s->num_attributes = 0;
+		for(; ptr < end && *ptr != '\n'; ptr++) {
+			if(*ptr == ',') s->num_attributes++;
+		}
+		if(ptr == end && got == text_size) {
+			printf("ds_stream: line too long\n");
+			exit(34);
+		}
+	}
+	_stream_rewind(s);
+	if(s->_opts.max_rss_kb) _stream_fit(s, text_size, rss_left);
+
+	// Everything else lives in one mapping: the two chunks, the shuffle buffer,
+	// and the row handed out last. The text buffer goes at its end.
+	int chunk_rows = s->_opts.chunk_rows;
+	int shuffle_rows = s->_opts.shuffle_rows;
+	size_t row_size = s->num_attributes * sizeof(double);
+	size_t chunk_labels = _labels_size(chunk_rows);
+	size_t shuffle_labels = _labels_size(shuffle_rows);
+	size_t block_size = _stream_block_size(s->num_attributes, chunk_rows,
+		shuffle_rows);
+	char *block = mmap(NULL, block_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(block == MAP_FAILED) {
+		printf("ds_stream map failed\n");
+		exit(33);
+	}
+	s->_mmap_ptr = block;
+	s->_mmap_size = block_size;
+	s->memory_size = block_size + text_size;
+	for(int k = 0; k < 2; k++) {
+		s->_chunks[k].labels = (int*) block;
+		block += chunk_labels;
+		s->_chunks[k].features = (double*) block;
+		block += chunk_rows * row_size;
+		s->_chunks[k].count = 0;
+		s->_chunks[k].end_of_pass = 0;
+		s->_chunks[k].full = 0;
+	}
+	s->_shuffle_labels = (int*) block;
+	block += shuffle_labels;
+	s->_shuffle_features = (double*) block;
+	block += shuffle_rows * row_size;
+	s->_row = (double*) block;
+	s->_shuffle_fill = 0;
+	s->_cur = 0;
+	s->_pos = 0;
+	s->_holding = 0;
+	s->_pass_ended = 0;
+
+	s->_stop = 0;
+	pthread_mutex_init(&s->_lock, NULL);
+	pthread_cond_init(&s->_cond, NULL);
+	if(pthread_create(&s->_thread, NULL, _stream_reader, s)) {
+		printf("ds_stream thread creation failed\n");
+		exit(31);
+	}
+}
+
+/*
+ * Makes sure there is an incoming row at s->_pos of the current chunk, waiting
+ * for the background thread if needed, and handing chunks back to it as they
+ * are used up. Returns 0 once the current pass has no more rows.
+ */
+int _stream_incoming(ds_stream *s) {
+	while(!s->_pass_ended) {
+		_ds_chunk *chunk = &s->_chunks[s->_cur];
+		if(!s->_holding) {
+			pthread_mutex_lock(&s->_lock);
+			while(!chunk->full) {
+				pthread_cond_wait(&s->_cond, &s->_lock);
+			}
+			pthread_mutex_unlock(&s->_lock);
+			s->_holding = 1;
+			s->_pos = 0;
+		}
+		if(s->_pos < chunk->count) return 1;
+
+		// Used up; let the background thread refill it with what comes after the
+		// other chunk
+		s->_pass_ended = chunk->end_of_pass;
+		pthread_mutex_lock(&s->_lock);
+		chunk->full = 0;
+		pthread_cond_broadcast(&s->_cond);
+		pthread_mutex_unlock(&s->_lock);
+		s->_holding = 0;
+		s->_cur ^= 1;
+
+		// ds_stream_open sized the buffers to fit under the cap, so this only
+		// catches memory the rest of the process took since. Peak RSS is only
+		// looked at here, between chunks.
+		if(s->_opts.max_rss_kb && peak_rss_kb() > s->_opts.max_rss_kb) {
+			printf("ds_stream: peak RSS went over the cap\n");
+			exit(35);
+		}
+	}
+	return 0;
+}
+
+// Copies the incoming row into slot i of the shuffle buffer
+void _stream_take(ds_stream *s, int i) {
+	_ds_chunk *chunk = &s->_chunks[s->_cur];
+	int n = s->num_attributes;
+	double *src = chunk->features + (size_t) s->_pos * n;
+	double *dst = s->_shuffle_features + (size_t) i * n;
+	for(int j = 0; j < n; j++) {
+		dst[j] = src[j];
+	}
+	s->_shuffle_labels[i] = chunk->labels[s->_pos];
+	s->_pos++;
+}
+
+/*
+ * The shuffle buffer is filled up first. After that, every call hands out a
+ * random row of the buffer and puts the next incoming row in its place. At the
+ * end of a pass the buffer just drains, still in random order.
+ */
+int ds_stream_next(ds_stream *s, double **x, int *label) {
+	while(s->_shuffle_fill < s->_opts.shuffle_rows && _stream_incoming(s)) {
+		_stream_take(s, s->_shuffle_fill++);
+	}
+	if(s->_shuffle_fill == 0) {
+		s->_pass_ended = 0;
+		return 0;
+	}
+
+	int n = s->num_attributes;
+	int i = rng_below(&rng_global, s->_shuffle_fill);
+	double *src = s->_shuffle_features + (size_t) i * n;
+	for(int j = 0; j < n; j++) {
+		s->_row[j] = src[j];
+	}
+	*x = s->_row;
+	*label = s->_shuffle_labels[i];
+
+	if(_stream_incoming(s)) {
+		_stream_take(s, i);
+	} else {
+		// Fill the hole with the last row instead
+		int last = --s->_shuffle_fill;
+		double *last_row = s->_shuffle_features + (size_t) last * n;
+		for(int j = 0; j < n; j++) {
+			src[j] = last_row[j];
+		}
+		s->_shuffle_labels[i] = s->_shuffle_labels[last];
+	}
+	return 1;
+}
+
+void ds_stream_close(ds_stream *s) {
+	pthread_mutex_lock(&s->_lock);
+	s->_stop = 1;
+	pthread_cond_broadcast(&s->_cond);
+	pthread_mutex_unlock(&s->_lock);
+	pthread_join(s->_thread, NULL);
+	pthread_mutex_destroy(&s->_lock);
+	pthread_cond_destroy(&s->_cond);
+
+	int err = munmap(s->_mmap_ptr, s->_mmap_size);
+	if(!err && !s->_binary) err = munmap(s->_text, _STREAM_TEXT_SIZE);
+	if(err) {
+		perror("ds_stream_close munmap");
+		exit(36);
+	}
+	close(s->_fd);
+}
+
+/*
+ * The copy is indexed exactly like features, so it has to reach the highest row
+ * the view uses; for a view over part of the data, the rows it doesn't use are
+ * left at zero rather than converted.
+ */
+void ds_make_f32(dataset *ds) {
+	int n = ds->num_attributes;
+	int rows = 0;
+	for(int i = 0; i < ds->num_examples; i++) {
+		if(ds->index[i] >= rows) rows = ds->index[i] + 1;
+	}
+	if(ds->_f32_size && munmap(ds->features_f32, ds->_f32_size)) {
+		perror("ds_make_f32 munmap");
+		exit(44);
+	}
+	ds->features_f32 = NULL;
+	ds->_f32_size = (size_t) rows * n * sizeof(float);
+	if(ds->_f32_size == 0) return;
+
+	ds->features_f32 = mmap(NULL, ds->_f32_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ds->features_f32 == MAP_FAILED) {
+		printf("ds_make_f32 map failed\n");
+		exit(44);
+	}
+	advise_huge_pages(ds->features_f32, ds->_f32_size);
+	for(int i = 0; i < ds->num_examples; i++) {
+		double *src = ds_example(ds, i);
+		float *dst = ds_example_f32(ds, i);
+		for(int j = 0; j < n; j++) {
+			dst[j] = src[j];
+		}
 	}
 }
 
 // This is a very trivial and direct usage of Fisher-Yates, since all we are
-// doing is moving pointers around, and not touching the underlying data at all
-void ds_shuffle(dataset *ds) {
-	int i, j;
-	data *tmp;
+// doing is moving row numbers around, and not touching the underlying data at
+// all. rng_below keeps every permutation equally likely, which rand() % (i + 1)
+// didn't quite.
+void ds_shuffle_rng(dataset *ds, rng *r) {
+	int i, j, tmp;
 	for (i = ds->num_examples - 1; i > 0; i--) {
-		j = rand() % (i + 1);
-		tmp = ds->examples[j];
-		ds->examples[j] = ds->examples[i];
-		ds->examples[i] = tmp;
+		j = rng_below(r, i + 1);
+		tmp = ds->index[j];
+		ds->index[j] = ds->index[i];
+		ds->index[i] = tmp;
 	}
 }
 
-// This function uses two mmaps, one for each of train_set and test_set.
-// Most of the other work is just initializing the various fields of train_set
-// and test_set
-void ds_train_test_split(
+void ds_shuffle(dataset *ds) {
+	ds_shuffle_rng(ds, &rng_global);
+}
+
+// Sets up view as an empty view of num_examples rows of original's data, with
+// an index of its own, carved from a if there is one
+void _init_view(const dataset *original, dataset *view, int num_examples,
+	arena *a) {
+	view->num_examples = num_examples;
+	view->num_attributes = original->num_attributes;
+	// The view reads the same underlying rows as the original.
+	view->features = original->features;
+	view->labels = original->labels;
+	view->features_f32 = original->features_f32;
+	view->_f32_size = 0;
+	// It doesn't really make sense to set it to original's _mmap_ptr, because
+	// it doesn't make sense to deep delete a view. We can't recover the total
+	// number of pages to unmap from the data in these structs.
+	view->_mmap_ptr = NULL;
+	view->_mmap_size = 0;
+	view->_arena = a;
+	size_t size = sizeof(int) * num_examples;
+	if(num_examples == 0) {
+		view->index = NULL;
+	} else if(a) {
+		view->index = arena_alloc(a, size);
+	} else {
+		view->index = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(view->index == MAP_FAILED) {
+			printf("dataset view map failed\n");
+			exit(54);
+		}
+	}
+}
+
+// Each view needs its own index, which is either one mmap each, or carved from
+// the arena. Everything else just points at the original's data.
+void ds_train_test_split_arena(
 	dataset *original,
 	dataset *train_set,
 	dataset *test_set,
-	double test_ratio) {
+	double test_ratio,
+	arena *a) {
 
 	// Clamp test_ratio to [0, 1].
 	if (test_ratio < 0) test_ratio = 0;
@@ -264,79 +1247,349 @@ void ds_train_test_split(
 	// Compute number of examples in each set
 	int test_size = (int) (test_ratio * original->num_examples);
 	int train_size = original->num_examples - test_size;
+	_init_view(original, test_set, test_size, a);
+	_init_view(original, train_set, train_size, a);
 
-	// Initialize all of the fields of both structs to something reasonable
-	test_set->num_examples = test_size;
-	train_set->num_examples = train_size;
-	test_set->num_attributes = original->num_attributes;
-	train_set->num_attributes = original->num_attributes;
-	// It doesn't really make sense to set it to original's _mmap_ptr, because
-	// it doesn't make sense to deep delete these sets. We can't recover the
-	// total number of pages to unmap from the data in these structs.
-	// TODO not really sure what to do here.
-	test_set->_mmap_ptr = NULL;
-	train_set->_mmap_ptr = NULL;
-
-	test_set->examples = mmap(NULL, sizeof(data*) * test_size,
-		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	train_set->examples = mmap(NULL, sizeof(data*) * train_size,
-		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	
-	// Just copy the first n examples into the test set, and the remaining
-	// examples into the train set.
+	// Just copy the first n row numbers into the test set, and the remaining
+	// row numbers into the train set.
 	for(int i = 0; i < test_size; i++) {
-		test_set->examples[i] = original->examples[i];
+		test_set->index[i] = original->index[i];
 	}
 	for(int i = test_size; i < original->num_examples; i++) {
-		train_set->examples[i - test_size] = original->examples[i];
+		train_set->index[i - test_size] = original->index[i];
+	}
+}
+
+void ds_train_test_split(
+	dataset *original,
+	dataset *train_set,
+	dataset *test_set,
+	double test_ratio) {
+	ds_train_test_split_arena(original, train_set, test_set, test_ratio, NULL);
+}
+
+// Every example of original is assigned a fold first, and then each fold's two
+// views are filled in one pass, keeping original's order within each view.
+// Without stratification, the folds are just consecutive runs of examples.
+// With it, the examples are dealt out to the folds like cards, label by label,
+// by counting how many of each label came before them (a counting sort that
+// never actually moves anything).
+void ds_kfold(dataset *original, int k, int stratify, dataset *train_sets,
+	dataset *valid_sets, arena *a) {
+	if(k < 2) {
+		printf("ds_kfold: k must be at least 2\n");
+		exit(66);
+	}
+	int n = original->num_examples;
+	int lo = 0, hi = 0;
+	for(int i = 0; stratify && i < n; i++) {
+		int y = ds_label(original, i);
+		if(i == 0 || y < lo) lo = y;
+		if(i == 0 || y > hi) hi = y;
+	}
+	int labels = stratify ? hi - lo + 1 : 0;
+
+	// The fold of every example, and then a counter per label
+	size_t scratch_size = sizeof(int) * ((size_t) n + labels);
+	int *fold = a ? arena_alloc(a, scratch_size) : mmap(NULL, scratch_size,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(fold == MAP_FAILED) {
+		printf("ds_kfold map failed\n");
+		exit(54);
+	}
+	int *seen = fold + n;
+	if(stratify) {
+		// Where each label's examples start in label order
+		for(int i = 0; i < n; i++) {
+			seen[ds_label(original, i) - lo]++;
+		}
+		int start = 0;
+		for(int y = 0; y < labels; y++) {
+			int count = seen[y];
+			seen[y] = start;
+			start += count;
+		}
+		for(int i = 0; i < n; i++) {
+			fold[i] = seen[ds_label(original, i) - lo]++ % k;
+		}
+	} else {
+		for(int i = 0; i < n; i++) {
+			fold[i] = (int) ((long) i * k / n);
+		}
+	}
+
+	for(int f = 0; f < k; f++) {
+		int size = 0;
+		for(int i = 0; i < n; i++) {
+			size += fold[i] == f;
+		}
+		_init_view(original, &valid_sets[f], size, a);
+		_init_view(original, &train_sets[f], n - size, a);
+		int v = 0, t = 0;
+		for(int i = 0; i < n; i++) {
+			if(fold[i] == f) valid_sets[f].index[v++] = original->index[i];
+			else train_sets[f].index[t++] = original->index[i];
+		}
+	}
+
+	int err = a ? 0 : munmap(fold, scratch_size);
+	if(err) {
+		perror("ds_kfold munmap");
+		exit(55);
 	}
 }
 
 void ds_show(dataset *ds) {
-	char buf[32];
-	int sz;
+	writer w;
+	writer_init(&w, STDOUT_FILENO, NULL, 0);
 
 	// Also print out row numbers, helpful for making sure we are getting the
 	// number of examples in the set that we expect
 	for(int i = 0; i < ds->num_examples; i++) {
+		double *x = ds_example(ds, i);
 		// Print the row number and label
-		sz = itoa(buf, i);
-		write(STDOUT_FILENO, buf, sz);
-		write(STDOUT_FILENO, " | ", 3);
-		sz = itoa(buf, ds->examples[i]->label);
-		write(STDOUT_FILENO, buf, sz);
+		writer_int(&w, i);
+		writer_str(&w, " | ", 3);
+		writer_int(&w, ds_label(ds, i));
 		// print all the attrs for the example
 		for(int j = 0; j < ds->num_attributes; j++) {
-			write(STDOUT_FILENO, ",", 1);
-			sz = dtoa(buf,  ds->examples[i]->example[j], 1);
-			write(STDOUT_FILENO, buf, sz);
+			writer_str(&w, ",", 1);
+			writer_double(&w, x[j], 1);
 		}
-		write(STDOUT_FILENO, "\n", 1);
+		writer_str(&w, "\n", 1);
 	}
+	writer_destroy(&w);
 }
 
-void ds_normalize(dataset *ds) {
-	// We iterate over attributes, finding mean and std. Have to go in three passes.
-	for(int i = 0; i < ds->num_attributes; i++) {
-		// First pass: compute the mean. mean = total / num_examples
-		double mean = 0;
-		for(int j = 0; j < ds->num_examples; j++) {
-			mean += ds->examples[j]->example[i];
+// The header row names the columns label, x0, x1 and so on; ds_load ignores
+// it anyway
+void ds_save_csv(dataset *ds, char *filepath, int precision) {
+	int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		perror("ds_save_csv open");
+		exit(61);
+	}
+	writer w;
+	writer_init(&w, fd, NULL, 0);
+	writer_str(&w, "label", 5);
+	for(int j = 0; j < ds->num_attributes; j++) {
+		writer_str(&w, ",x", 2);
+		writer_int(&w, j);
+	}
+	writer_str(&w, "\n", 1);
+
+	for(int i = 0; i < ds->num_examples; i++) {
+		double *x = ds_example(ds, i);
+		writer_int(&w, ds_label(ds, i));
+		for(int j = 0; j < ds->num_attributes; j++) {
+			writer_str(&w, ",", 1);
+			writer_double(&w, x[j], precision);
 		}
-		mean /= ds->num_examples;
+		writer_str(&w, "\n", 1);
+	}
+	writer_destroy(&w);
+	close(fd);
+}
 
-		// Second pass: compute std. Std = sqrt(sum of squared differences / num_examples)
-		double std = 0;
-		for(int j = 0; j < ds->num_examples; j++) {
-			double diff = ds->examples[j]->example[i] - mean;
-			std += diff * diff;
+/*
+ * Per-thread Welford state. Each worker runs Welford's update over its own
+ * contiguous range of rows, keeping the count, the running mean and the
+ * running sum of squared differences from the mean (m2) for every attribute.
+ */
+typedef struct _welford {
+	const dataset *ds;
+	// num_workers blocks of 2 * num_attributes doubles: mean, then m2
+	double *partials;
+	long *counts;
+} _welford;
+
+void _welford_rows(void *arg, int worker, int num_workers) {
+	_welford *wf = (_welford*) arg;
+	const dataset *ds = wf->ds;
+	int n = ds->num_attributes;
+	double *mean = wf->partials + (size_t) worker * 2 * n;
+	double *m2 = mean + n;
+	int start, end;
+	pool_range(ds->num_examples, worker, num_workers, &start, &end);
+
+	// One row at a time, so the data is read front to back exactly once. The
+	// inner loop runs along the row and vectorizes.
+	long count = 0;
+	for(int i = start; i < end; i++) {
+		const double *x = ds_example(ds, i);
+		count++;
+		double inv_count = 1.0 / count;
+		for(int j = 0; j < n; j++) {
+			double delta = x[j] - mean[j];
+			mean[j] += delta * inv_count;
+			m2[j] += delta * (x[j] - mean[j]);
 		}
-		std /= ds->num_examples;
-		std = sqrt(std);
+	}
+	wf->counts[worker] = count;
+}
 
-		// Third pass: rescale all attributes with mean and std
-		for(int j = 0; j < ds->num_examples; j++) {
-			ds->examples[j]->example[i] = (ds->examples[j]->example[i] - mean) / std;
+// mean, std and _scale share one mapping
+void _alloc_stats(ds_stats *stats, int num_attributes) {
+	stats->num_attributes = num_attributes;
+	stats->_mmap_size = 3 * num_attributes * sizeof(double);
+	stats->mean = mmap(NULL, stats->_mmap_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(stats->mean == MAP_FAILED) {
+		printf("ds_stats map failed\n");
+		exit(37);
+	}
+	stats->std = stats->mean + num_attributes;
+	stats->_scale = stats->std + num_attributes;
+}
+
+// Works out the reciprocal of every std once, so normalizing is a subtract and
+// a multiply. A constant attribute (std 0) carries no information, and becomes
+// all zeros rather than 0 / 0.
+void _stats_scales(ds_stats *stats) {
+	for(int j = 0; j < stats->num_attributes; j++) {
+		stats->_scale[j] = stats->std[j] > 0 ? 1.0 / stats->std[j] : 1.0;
+	}
+}
+
+void ds_stats_compute(const dataset *ds, int num_threads, ds_stats *stats) {
+	int n = ds->num_attributes;
+	_alloc_stats(stats, n);
+	if(num_threads < 1) num_threads = 1;
+
+	size_t scratch_size = (size_t) num_threads * (2 * n * sizeof(double)
+		+ sizeof(long));
+	double *partials = mmap(NULL, scratch_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(partials == MAP_FAILED) {
+		printf("ds_stats map failed\n");
+		exit(37);
+	}
+	_welford wf;
+	wf.ds = ds;
+	wf.partials = partials;
+	wf.counts = (long*) (partials + (size_t) num_threads * 2 * n);
+	if(num_threads == 1) {
+		_welford_rows(&wf, 0, 1);
+	} else {
+		pool workers;
+		pool_init(&workers, num_threads);
+		pool_run(&workers, _welford_rows, &wf);
+		pool_destroy(&workers);
+	}
+
+	// Merge the workers' results in worker order (Chan et al.), so a given
+	// thread count always gives the same answer. Merging two partial results
+	// needs only their counts, means and m2s:
+	// mean = mean_a + delta * n_b / n, m2 = m2_a + m2_b + delta^2 * n_a * n_b / n
+	double *mean = partials;
+	double *m2 = partials + n;
+	long count = wf.counts[0];
+	for(int w = 1; w < num_threads; w++) {
+		double *mean_b = partials + (size_t) w * 2 * n;
+		double *m2_b = mean_b + n;
+		long count_b = wf.counts[w];
+		if(count_b == 0) continue;
+		long total = count + count_b;
+		for(int j = 0; j < n; j++) {
+			double delta = mean_b[j] - mean[j];
+			mean[j] += delta * count_b / total;
+			m2[j] += m2_b[j] + delta * delta * ((double) count * count_b / total);
 		}
+		count = total;
+	}
+	for(int j = 0; j < n; j++) {
+		stats->mean[j] = mean[j];
+		stats->std[j] = count ? sqrt(m2[j] / count) : 0;
+	}
+	_stats_scales(stats);
+
+	int err = munmap(partials, scratch_size);
+	if(err) {
+		perror("ds_stats_compute munmap");
+		exit(40);
+	}
+}
+
+void ds_stats_apply_vector(const ds_stats *stats, double *x) {
+	for(int j = 0; j < stats->num_attributes; j++) {
+		x[j] = (x[j] - stats->mean[j]) * stats->_scale[j];
 	}
 }
+
+void ds_stats_apply(const ds_stats *stats, dataset *ds) {
+	for(int i = 0; i < ds->num_examples; i++) {
+		ds_stats_apply_vector(stats, ds_example(ds, i));
+	}
+}
+
+void ds_stats_destroy(ds_stats *stats) {
+	int err = munmap(stats->mean, stats->_mmap_size);
+	if(err) {
+		perror("ds_stats_destroy munmap");
+		exit(40);
+	}
+}
+
+/*
+ * A stats file is a small header (magic, version, number of attributes),
+ * followed by the means and then the stds, in the native byte order.
+ */
+static const char _DS_STATS_MAGIC[8] = "NNSTATS";
+static const int _DS_STATS_VERSION = 1;
+
+typedef struct _ds_stats_header {
+	char magic[8];
+	int version;
+	int num_attributes;
+} _ds_stats_header;
+
+void ds_stats_save(const ds_stats *stats, char *filepath) {
+	_ds_stats_header header = {0};
+	for(int i = 0; i < 8; i++) {
+		header.magic[i] = _DS_STATS_MAGIC[i];
+	}
+	header.version = _DS_STATS_VERSION;
+	header.num_attributes = stats->num_attributes;
+
+	int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		perror("ds_stats_save open");
+		exit(38);
+	}
+	write_all(fd, &header, sizeof(header));
+	write_all(fd, stats->mean, 2 * stats->num_attributes * sizeof(double));
+	close(fd);
+}
+
+void ds_stats_load(ds_stats *stats, char *filepath) {
+	size_t file_size;
+	char *file_ptr = _map_file(filepath, &file_size);
+	_ds_stats_header *header = (_ds_stats_header*) file_ptr;
+	int valid = file_size >= sizeof(_ds_stats_header)
+		&& header->version == _DS_STATS_VERSION && header->num_attributes >= 0
+		&& file_size == sizeof(_ds_stats_header)
+			+ 2 * header->num_attributes * sizeof(double);
+	for(int i = 0; valid && i < 8; i++) {
+		valid = header->magic[i] == _DS_STATS_MAGIC[i];
+	}
+	if(!valid) {
+		printf("ds_stats_load: %s is not a stats file\n", filepath);
+		exit(39);
+	}
+
+	_alloc_stats(stats, header->num_attributes);
+	double *saved = (double*) (file_ptr + sizeof(_ds_stats_header));
+	for(int j = 0; j < 2 * stats->num_attributes; j++) {
+		stats->mean[j] = saved[j];
+	}
+	_stats_scales(stats);
+	_unmap_file(file_ptr, file_size);
+}
+
+// One pass to get the statistics, and one to apply them
+void ds_normalize(dataset *ds) {
+	ds_stats stats;
+	ds_stats_compute(ds, 1, &stats);
+	ds_stats_apply(&stats, ds);
+	ds_stats_destroy(&stats);
+}
@@ -6,50 +6,95 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "util.h"
+#include "pool.h"
+#include "rng.h"
+#include "arena.h"
 
 /**
- * Defines a single labeled example that can be used in training or testing.
- * The label must be a single integer value (multiple labels not supported),
- * and the example attributes are expected to be doubles.
- */
-typedef struct data {
-
-	// The label corresponding to this particular example. Critically, GCC
-  // pads the 4 byte int to 8 bytes, and we will need to be careful to either
-  // replicate this in asm or adjust our loading code to not do the alignment
-	int label;
-
-	// The array of attributes corresponding to this particular example.
-	double* example;
-
-} data;
-
-/**
- * A `dataset` is an array of examples. We store an array of pointers to
- * examples instead to greatly facilitate shuffling and splitting datasets;
- * we can keep the underlying data in memory the same, and the `dataset` is
- * simply a view of a subset of the underlying data.
- * 
+ * A `dataset` is a view over a block of underlying data. The underlying data is
+ * stored densely: every label lives in one `int` array, and every example's
+ * attributes live in one row-major matrix of doubles, so consecutive rows sit
+ * next to each other in memory.
+ *
+ * Rather than storing the examples themselves, a dataset stores a permutation
+ * index into the underlying rows. This greatly facilitates shuffling and
+ * splitting datasets; we can keep the underlying data in memory the same, and
+ * only ever rearrange the (small) index. Finding example i is a single
+ * sequential load of index[i] followed by address arithmetic, instead of
+ * chasing a pointer per row.
+ *
  * We also store how many examples there are in this particular dataset, and
  * how many attributes there are per example.
- * 
- * The _mmap_ptr field is used to keep track of the beginning of the underlying
- * data in memory, so it can be freed later.
+ *
+ * The _mmap_ptr and _mmap_size fields are used to keep track of the underlying
+ * data in memory, so it can be freed later. Views that do not own the
+ * underlying data (e.g. those made by ds_train_test_split) set _mmap_ptr to
+ * NULL.
  */
 typedef struct dataset {
-	// Array of examples in this dataset.
-	data **examples;
+	// Row-major attribute matrix of the underlying data. Row r's attributes are
+	// features[r * num_attributes] up to features[(r + 1) * num_attributes - 1].
+	double *features;
+	// A float copy of features, made by ds_make_f32 for float networks to read,
+	// or NULL if there isn't one. Indexed like features.
+	float *features_f32;
+	// Labels of the underlying data, one per row, indexed like features.
+	int *labels;
+	// Example i of this dataset is row index[i] of the underlying data.
+	int *index;
 	// Total number of examples in this dataset.
 	int num_examples;
 	// Number of attributes per example in this dataset.
 	int num_attributes;
 	// The pointer returned by mmap, for management purposes
-	data *_mmap_ptr;
+	void *_mmap_ptr;
+	// The size of the mapping at _mmap_ptr, in bytes
+	size_t _mmap_size;
+	// The size of the mapping at features_f32 if this dataset made it, in bytes,
+	// or 0 if it didn't (views share their original's copy)
+	size_t _f32_size;
+	// The arena index was carved from, or NULL if it is a mapping of its own
+	arena *_arena;
 } dataset;
 
 /**
- * Destroy a `dataset` (freeing its `examples` list back to the OS), but
+ * Returns the attributes of the ith example in a dataset.
+ *
+ * @param ds the dataset to look in
+ * @param i the position of the example in this dataset (not in the underlying
+ * 	data)
+ */
+static inline double *ds_example(const dataset *ds, int i) {
+	return ds->features + (size_t) ds->index[i] * ds->num_attributes;
+}
+
+/**
+ * Returns the attributes of the ith example in a dataset, as floats. Only for
+ * datasets that have been through ds_make_f32.
+ *
+ * @param ds the dataset to look in
+ * @param i the position of the example in this dataset
+ */
+static inline float *ds_example_f32(const dataset *ds, int i) {
+	return ds->features_f32 + (size_t) ds->index[i] * ds->num_attributes;
+}
+
+/**
+ * Returns the label of the ith example in a dataset.
+ *
+ * @param ds the dataset to look in
+ * @param i the position of the example in this dataset
+ */
+static inline int ds_label(const dataset *ds, int i) {
+	return ds->labels[ds->index[i]];
+}
+
+/**
+ * Destroy a `dataset` (freeing its `index` list back to the OS), but
  * preserves the underlying data. Use this when you have multiple datasets over
  * the same block of underlying data.
  * 
@@ -61,7 +106,7 @@ void ds_destroy(dataset *ds);
  * Destroy a `dataset`, freeing everything - including the underlying data -
  * back to the OS. If you have multiple datasets over the same block of data,
  * calling ds_deep_destroy will invalidate all of them. This function
- * automatically calls ds_destroy to cleanup the `examples` list as well.
+ * automatically calls ds_destroy to cleanup the `index` list as well.
  * 
  * @param ds a pointer to the dataset to deeply destroy.
  */
@@ -74,10 +119,11 @@ void ds_deep_destroy(dataset *ds);
  *   it is ignored)
  * - The label column MUST be first.
  * - Labels are expected to be integers, everything else is expected to be
- *   floating point numbers (no scientific notation).
+ *   floating point numbers. Scientific notation (e.g. 1.5e-3) is fine, and
+ *   numbers are rounded to the nearest double exactly.
  * - No spaces or quotes anywhere.
  * - Comma is the only accepted delimiter.
- * - File must be in LF format, CRLF will cause issues
+ * - Lines may end in LF or CRLF.
  * 
  * @param filepath the path to the CSV file to parse and load into a dataset.
  * @param numrows the number of rows in the dataset, counting the header row
@@ -87,14 +133,220 @@ void ds_deep_destroy(dataset *ds);
  */
 void ds_load(char *filepath, int numrows, int numcols, dataset *ds);
 
+/**
+ * Load a dataset from a CSV file using several threads, without having to
+ * know its size up front. The file is split into newline-aligned chunks, one
+ * per thread; the threads count the rows of their chunks in parallel, and then
+ * parse their chunks straight into the rows they end up in. The same format
+ * limitations as ds_load apply. The number of attributes is taken from the
+ * first data row, and blank lines are skipped.
+ *
+ * @param filepath the path to the CSV file to parse and load into a dataset.
+ * @param num_threads the number of threads to load with, counting the calling
+ * 	thread
+ * @param ds the uninitialized ds struct to initialize and load the data into.
+ */
+void ds_load_parallel(char *filepath, int num_threads, dataset *ds);
+
+/**
+ * Make a float copy of the attributes of every row this dataset uses, for
+ * float and mixed precision networks (see nn_precision) to train on. Those
+ * read ds_example_f32 instead of converting each example as they go, which
+ * halves the memory traffic of an epoch. The copy is not kept in sync with
+ * features, so make it after ds_normalize, and call this again after any
+ * other change. Views made from the dataset afterwards (e.g. by
+ * ds_train_test_split) share its copy; ds_destroy frees it.
+ *
+ * @param ds the dataset to copy the attributes of
+ */
+void ds_make_f32(dataset *ds);
+
+/**
+ * Flags recorded in a binary dataset file, returned by ds_open_binary.
+ */
+typedef enum ds_binary_flags {
+	// The attributes were normalized (as by ds_normalize) before saving
+	DS_BINARY_NORMALIZED = 1
+} ds_binary_flags;
+
+/**
+ * Save a dataset to a binary file that ds_open_binary can map straight back
+ * in. The examples are written in this dataset's order, so a shuffled or split
+ * view saves just its own examples. The file is a small versioned header
+ * followed by the labels and the attribute matrix, aligned exactly as they are
+ * in memory. It is meant as a cache next to the CSV it was loaded from, on the
+ * same machine; it is not portable across byte orders.
+ *
+ * @param ds the dataset to save
+ * @param filepath where to write the file. An existing file is overwritten.
+ * @param normalize if nonzero, the saved attributes are normalized (ds itself
+ * 	is left untouched), and the file is flagged DS_BINARY_NORMALIZED
+ */
+void ds_save_binary(dataset *ds, char *filepath, int normalize);
+
+/**
+ * Open a dataset saved by ds_save_binary. There is no parsing and no copying:
+ * the file is mapped read-only and its mapping is used directly as the
+ * underlying data, so opening takes about as long as the mmap itself, and
+ * several processes opening the same file share one copy in the page cache.
+ *
+ * Since the underlying data is read-only, the dataset can be shuffled and
+ * split as usual, but not modified; in particular, don't ds_normalize it. Save
+ * it with normalize set instead. ds_deep_destroy unmaps the file as usual.
+ *
+ * @param filepath the path of the binary file
+ * @param ds the uninitialized ds struct to open the file into
+ * @return the ds_binary_flags the file was saved with
+ */
+int ds_open_binary(char *filepath, dataset *ds);
+
+/**
+ * Options for ds_stream_open. Fill in the defaults with
+ * ds_stream_default_options, then change whatever you need.
+ */
+typedef struct ds_stream_options {
+	// Rows per chunk. The stream holds two chunks at a time: the one being
+	// handed out, and the one being read in the background.
+	int chunk_rows;
+	// Rows in the shuffle buffer. Examples come out in random order within a
+	// sliding window of this many rows; 1 keeps the order of the file.
+	int shuffle_rows;
+	// If nonzero, a cap in kilobytes on the peak resident set size of the whole
+	// process. ds_stream_open halves chunk_rows and shuffle_rows (the bigger
+	// first) until the stream's buffers fit under it along with what the
+	// process already holds, and exits if they don't fit at one row each. As a
+	// backstop, the stream also checks the process's peak RSS each time it
+	// moves to the next chunk, and ends the process if it is over the cap,
+	// whatever took the memory. It can't catch going over within a chunk.
+	long max_rss_kb;
+} ds_stream_options;
+
+/**
+ * Fills opts with the defaults: 4096 row chunks, an 8192 row shuffle buffer
+ * and no RSS cap.
+ */
+void ds_stream_default_options(ds_stream_options *opts);
+
+// Half of a stream's double buffer. Only the stream itself looks inside.
+typedef struct _ds_chunk {
+	int *labels;
+	double *features;
+	int count;
+	// Set on the last chunk of a pass through the file
+	int end_of_pass;
+	// Set while the chunk holds rows not yet handed out
+	int full;
+} _ds_chunk;
+
+/**
+ * A `ds_stream` hands out the examples of a CSV or binary dataset file one at
+ * a time, without ever holding the whole file in memory. A background thread
+ * reads the file in chunks of rows, always one chunk ahead of the chunk being
+ * handed out, and the examples pass through a fixed-size shuffle buffer on
+ * the way out. The stream's memory use is fixed when it is opened, no matter
+ * how big the file is.
+ *
+ * Every field but num_attributes and memory_size is private.
+ */
+typedef struct ds_stream {
+	// Number of attributes per example
+	int num_attributes;
+	// Bytes held by the stream's buffers
+	size_t memory_size;
+
+	ds_stream_options _opts;
+	int _fd;
+	int _binary;
+	// Binary files: total rows, the offsets of the label array and matrix, and
+	// the next row to read
+	int _num_rows;
+	off_t _labels_offset;
+	off_t _features_offset;
+	int _next_row;
+	// CSV files: the text read so far but not parsed is _text[_text_start,
+	// _text_end). Reading resumes at _file_offset, and rows start at
+	// _body_offset.
+	char *_text;
+	size_t _text_start;
+	size_t _text_end;
+	off_t _file_offset;
+	off_t _body_offset;
+	int _file_eof;
+
+	_ds_chunk _chunks[2];
+	// The chunk being handed out, the next row in it, and whether it has been
+	// received from the background thread yet
+	int _cur;
+	int _pos;
+	int _holding;
+	int _pass_ended;
+	int *_shuffle_labels;
+	double *_shuffle_features;
+	int _shuffle_fill;
+	// The example most recently handed out
+	double *_row;
+
+	pthread_t _thread;
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	int _stop;
+	void *_mmap_ptr;
+	size_t _mmap_size;
+} ds_stream;
+
+/**
+ * Open a dataset file for streaming, and start reading it in the background.
+ * The file may be a CSV in the format ds_load accepts, or a binary file written
+ * by ds_save_binary; which one is detected from its contents. With max_rss_kb
+ * set, the chunks and shuffle buffer may come out smaller than opts asks for;
+ * memory_size says what the stream ended up holding.
+ *
+ * @param s the uninitialized stream to open
+ * @param filepath the path to the file to stream
+ * @param opts the stream options, or NULL for the defaults
+ */
+void ds_stream_open(ds_stream *s, char *filepath, const ds_stream_options *opts);
+
+/**
+ * Get the next example from a stream. Each call to ds_stream_next returns one
+ * example of the current pass through the file, and returns 0 once every row
+ * of the pass has been handed out; the call after that starts the next pass,
+ * which the background thread has already begun reading. Passes don't mix:
+ * the shuffle buffer is emptied before a pass ends.
+ *
+ * @param s the stream to read from
+ * @param x set to the attributes of the example, valid until the next call
+ * @param label set to the label of the example
+ * @return 1 if an example was returned, 0 at the end of a pass
+ */
+int ds_stream_next(ds_stream *s, double **x, int *label);
+
+/**
+ * Stop a stream's background thread, and free everything it holds.
+ *
+ * @param s the stream to close
+ */
+void ds_stream_close(ds_stream *s);
+
 /**
  * Shuffle a dataset in place, changing the order of its examples, using
- * Fisher-Yates.
+ * Fisher-Yates with rng_global. Only the index is permuted; the underlying
+ * data never moves.
  * 
  * @param ds the dataset to shuffle.
  */
 void ds_shuffle(dataset *ds);
 
+/**
+ * Same as ds_shuffle, but draws from the given stream instead of rng_global,
+ * so that several threads can each shuffle their own dataset, and get the
+ * same orders every run.
+ *
+ * @param ds the dataset to shuffle.
+ * @param r the stream to draw from
+ */
+void ds_shuffle_rng(dataset *ds, rng *r);
+
 /**
  * Split a dataset into training and testing sets. This does not shuffle the
  * dataset beforehand, please do it manually first with ds_shuffle if desired.
@@ -111,16 +363,143 @@ void ds_train_test_split(dataset *original, dataset *train_set,
 	dataset *test_set, double test_ratio);
 
 /**
- * Prints a dataset to the terminal, for debugging purposes.
+ * Same as ds_train_test_split, but carves the two views' indexes from an
+ * arena instead of mapping one each. ds_destroy then leaves them to the arena.
+ *
+ * @param a the arena to carve from, or NULL to behave like ds_train_test_split
+ */
+void ds_train_test_split_arena(dataset *original, dataset *train_set,
+	dataset *test_set, double test_ratio, arena *a);
+
+/**
+ * Split a dataset into k folds for cross-validation. Fold f's examples make up
+ * valid_sets[f], and all the other examples train_sets[f], so every example is
+ * validated on exactly once. Like ds_train_test_split, these are all views of
+ * original's underlying data, each with an index of its own (destroy them with
+ * ds_destroy), and the dataset isn't shuffled beforehand. With an arena, the
+ * 2k indexes are carved from it rather than mapped one by one.
+ *
+ * Without stratification, the folds are consecutive runs of examples. With it,
+ * each label's examples are spread as evenly as possible over the folds, so
+ * every fold has about the same proportion of each label as the whole dataset;
+ * labels should then be class numbers, as the work done grows with the range
+ * between the smallest and largest label. Either way, fold sizes differ by at
+ * most one, and with stratification, so do the counts of each label.
+ *
+ * @param original the dataset to split, with at least k examples
+ * @param k the number of folds, at least 2 (anything less exits)
+ * @param stratify nonzero to keep the proportion of each label in every fold
+ * @param train_sets space for k uninitialized datasets, to be filled with
+ * 	each fold's training examples
+ * @param valid_sets space for k uninitialized datasets, to be filled with
+ * 	each fold's validation examples
+ * @param a the arena to carve the views from, or NULL to map them
+ */
+void ds_kfold(dataset *original, int k, int stratify, dataset *train_sets,
+	dataset *valid_sets, arena *a);
+
+/**
+ * Prints a dataset to the terminal, for debugging purposes. The output is
+ * buffered, and goes out in large writes.
  * @param ds the dataset to print.
  */
 void ds_show(dataset *ds);
 
+/**
+ * Saves a dataset as a CSV file that ds_load and ds_load_parallel can read
+ * back: a header row, and then a row per example of the view, in order, with
+ * the label first. Attributes are written the way dtoa writes them: rounded
+ * to the given number of digits after the point, or, with a precision of -1,
+ * in full, so that loading the file gives back exactly the same doubles.
+ *
+ * @param ds the dataset to save
+ * @param filepath the path of the CSV file to write
+ * @param precision the number of digits after the decimal point, at most 18,
+ * 	or -1 to write every attribute in full
+ */
+void ds_save_csv(dataset *ds, char *filepath, int precision);
+
 /**
  * Normalizes all attributes in the dataset to have mean of 0 and standard
  * deviation of 1. This generally boosts accuracy as no particular attribute
- * gets weighted unfairly.
+ * gets weighted unfairly. Attributes that are the same in every example become
+ * 0. This is ds_stats_compute followed by ds_stats_apply; use those directly to
+ * normalize other data the same way.
  */ 
 void ds_normalize(dataset *ds);
 
+/**
+ * The mean and standard deviation of every attribute of a dataset. Keeping
+ * them around means test data, or inputs at prediction time, can be normalized
+ * exactly the way the training data was.
+ */
+typedef struct ds_stats {
+	// Number of attributes
+	int num_attributes;
+	// Mean of each attribute
+	double *mean;
+	// Standard deviation of each attribute (over the whole dataset, not a
+	// sample), which is 0 for an attribute that never changes
+	double *std;
+	// What each attribute is multiplied by after subtracting the mean
+	double *_scale;
+	// The size of the mapping at mean, in bytes
+	size_t _mmap_size;
+} ds_stats;
+
+/**
+ * Computes the statistics of a dataset in a single pass over its rows, using
+ * Welford's algorithm, which stays accurate even when an attribute's spread is
+ * tiny next to its mean. With more than one thread, each thread works on its
+ * own slice of rows and the partial results are merged at the end.
+ *
+ * @param ds the dataset to compute the statistics of
+ * @param num_threads the number of threads to use, counting the calling thread
+ * @param stats the uninitialized stats struct to fill in
+ */
+void ds_stats_compute(const dataset *ds, int num_threads, ds_stats *stats);
+
+/**
+ * Normalizes every example of a dataset in place with the given statistics:
+ * subtract the mean, then divide by the standard deviation. Attributes with a
+ * standard deviation of 0 are only centered.
+ *
+ * @param stats the statistics to normalize with, e.g. from the training set
+ * @param ds the dataset to normalize
+ */
+void ds_stats_apply(const ds_stats *stats, dataset *ds);
+
+/**
+ * Normalizes a single example in place, the same way ds_stats_apply does. Use
+ * this on inputs before passing them to nn_predict.
+ *
+ * @param stats the statistics to normalize with
+ * @param x the attributes of the example
+ */
+void ds_stats_apply_vector(const ds_stats *stats, double *x);
+
+/**
+ * Save statistics to a file, e.g. next to the model saved by nn_save, so the
+ * model can be used later on inputs normalized the same way.
+ *
+ * @param stats the statistics to save
+ * @param filepath where to write the file
+ */
+void ds_stats_save(const ds_stats *stats, char *filepath);
+
+/**
+ * Load statistics saved by ds_stats_save.
+ *
+ * @param stats the uninitialized stats struct to load into
+ * @param filepath the file to load
+ */
+void ds_stats_load(ds_stats *stats, char *filepath);
+
+/**
+ * Free the memory held by a stats struct.
+ *
+ * @param stats the stats to destroy
+ */
+void ds_stats_destroy(ds_stats *stats);
+
 #endif
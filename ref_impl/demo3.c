@@ -28,7 +28,7 @@ int main(void) {
   char buf[32];
   int sz;
   for(int i = 0; i < 3; i++) {
-    sz = dtoa(buf, nn_forward(&net, examples_to_predict[i]), 10);
+    sz = dtoa(buf, nn_predict(&net, examples_to_predict[i], NULL), 10);
     write(STDOUT_FILENO, buf, sz);
     write(STDOUT_FILENO, "\n", 1);
   }
@@ -0,0 +1,1661 @@
+#include <math.h>
+#include "kernels.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Scalar kernels. These are exactly the loops nn.c used to run inline, so the
+ * scalar table reproduces the original results bit for bit.
+ */
+
+void _matvec_scalar(int rows, int cols, const double *x, const double *w,
+	double *out) {
+	for(int j = 0; j < cols; j++) {
+		out[j] = 0.0;
+	}
+	for(int i = 0; i < rows; i++) {
+		for(int j = 0; j < cols; j++) {
+			out[j] += x[i] * w[i * cols + j];
+		}
+	}
+}
+
+void _sigmoid_scalar(int n, double *a, const double *b) {
+	for(int i = 0; i < n; i++) {
+		a[i] = 1.0 / (1.0 + exp(-(a[i] + b[i])));
+	}
+}
+
+/*
+ * The fast sigmoid evaluates exp the same way as the vectorized Cephes exp
+ * further down (range reduction to |r| <= ln(2) / 2, then scaling by 2^n),
+ * but approximates e^r with a plain degree 6 Taylor polynomial: no division,
+ * and short enough to keep in registers. The relative error of e^r is at most
+ * r^7 / 7! * e^r, about 1.7e-7, which puts the sigmoid within about 5e-8 of
+ * the exact value.
+ */
+static const double _FAST_LIMIT = 708.0;
+static const double _FAST_LOG2E = 1.4426950408889634073599;
+static const double _FAST_C1 = 6.93145751953125e-1;
+static const double _FAST_C2 = 1.42860682030941723212e-6;
+static const double _FAST_T6 = 1.0 / 720;
+static const double _FAST_T5 = 1.0 / 120;
+static const double _FAST_T4 = 1.0 / 24;
+static const double _FAST_T3 = 1.0 / 6;
+static const double _FAST_T2 = 1.0 / 2;
+
+double _exp_fast_scalar(double x) {
+	if(x > _FAST_LIMIT) x = _FAST_LIMIT;
+	if(x < -_FAST_LIMIT) x = -_FAST_LIMIT;
+	double t = x * _FAST_LOG2E;
+	long n = (long) (t < 0 ? t - 0.5 : t + 0.5);
+	double r = x - n * _FAST_C1 - n * _FAST_C2;
+	double p = _FAST_T6;
+	p = p * r + _FAST_T5;
+	p = p * r + _FAST_T4;
+	p = p * r + _FAST_T3;
+	p = p * r + _FAST_T2;
+	p = p * r + 1.0;
+	p = p * r + 1.0;
+
+	// Build 2^n straight from its exponent bits
+	union { double d; unsigned long u; } scale;
+	scale.u = (unsigned long) (n + 1023) << 52;
+	return p * scale.d;
+}
+
+void _sigmoid_fast_scalar(int n, double *a, const double *b) {
+	for(int i = 0; i < n; i++) {
+		a[i] = 1.0 / (1.0 + _exp_fast_scalar(-(a[i] + b[i])));
+	}
+}
+
+double _dot_scalar(int n, const double *a, const double *b) {
+	double sum = 0.0;
+	for(int i = 0; i < n; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+void _rank1_scalar(int rows, int cols, const double *x, const double *g,
+	double *w, double scale) {
+	for(int i = 0; i < rows; i++) {
+		for(int j = 0; j < cols; j++) {
+			w[i * cols + j] -= scale * (x[i] * g[j]);
+		}
+	}
+}
+
+void _matvec_f32_scalar(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	for(int j = 0; j < cols; j++) {
+		out[j] = 0.0f;
+	}
+	for(int i = 0; i < rows; i++) {
+		for(int j = 0; j < cols; j++) {
+			out[j] += x[i] * w[i * cols + j];
+		}
+	}
+}
+
+// A column at a time, so each column's sum can stay in a double
+void _matvec_mixed_scalar(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	for(int j = 0; j < cols; j++) {
+		double acc = 0.0;
+		for(int i = 0; i < rows; i++) {
+			acc += (double) x[i] * w[(size_t) i * cols + j];
+		}
+		out[j] = acc;
+	}
+}
+
+void _sigmoid_f32_scalar(int n, float *a, const float *b) {
+	for(int i = 0; i < n; i++) {
+		a[i] = 1.0 / (1.0 + exp(-((double) a[i] + b[i])));
+	}
+}
+
+void _sigmoid_fast_f32_scalar(int n, float *a, const float *b) {
+	for(int i = 0; i < n; i++) {
+		a[i] = 1.0 / (1.0 + _exp_fast_scalar(-((double) a[i] + b[i])));
+	}
+}
+
+double _dot_f32_scalar(int n, const float *a, const float *b) {
+	float sum = 0.0f;
+	for(int i = 0; i < n; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+double _dot_mixed_scalar(int n, const float *a, const float *b) {
+	double sum = 0.0;
+	for(int i = 0; i < n; i++) {
+		sum += (double) a[i] * b[i];
+	}
+	return sum;
+}
+
+void _rank1_f32_scalar(int rows, int cols, const float *x, const float *g,
+	float *w, float scale) {
+	for(int i = 0; i < rows; i++) {
+		for(int j = 0; j < cols; j++) {
+			w[i * cols + j] -= scale * (x[i] * g[j]);
+		}
+	}
+}
+
+// The pair of inputs i and i + 1 packed into one 32 bit lane as two 16 bit
+// halves, low half first: what the SSE2 matvec_i8 multiplies each pair of
+// weights by
+static inline int32_t _pair_i8(const int8_t *x, int i) {
+	return (uint16_t) x[i] | (uint32_t) (uint16_t) x[i + 1] << 16;
+}
+
+void _matvec_i8_scalar(int rows, int cols, const int8_t *x, const int8_t *w,
+	const float *scale, float *out) {
+	for(int j = 0; j < cols; j++) {
+		int32_t sum = 0;
+		for(int i = 0; i < rows; i += 2) {
+			const int8_t *wij = w + (size_t) i * cols + 2 * j;
+			sum += wij[0] * x[i] + wij[1] * x[i + 1];
+		}
+		out[j] = sum * scale[j];
+	}
+}
+
+// Columns from and up of matvec_i8, one at a time, for the leftovers of the
+// SIMD versions. Inlined into each of them, since a call from AVX code to
+// SSE code without a vzeroupper in between is slow, and GCC leaves the
+// vzeroupper out of tail calls.
+static inline void _matvec_i8_tail(int rows, int cols, int from,
+	const int8_t *x, const int8_t *w, const float *scale, float *out) {
+	for(int j = from; j < cols; j++) {
+		int32_t sum = 0;
+		for(int i = 0; i < rows; i += 2) {
+			const int8_t *wij = w + (size_t) i * cols + 2 * j;
+			sum += wij[0] * x[i] + wij[1] * x[i + 1];
+		}
+		out[j] = sum * scale[j];
+	}
+}
+
+// Rounding to the nearest integer, ties to even like the SIMD conversions, by
+// adding and subtracting 1.5 * 2^52: the sum has no bits left below the units
+// place, so the addition does the rounding. Inlined into the SIMD versions for
+// their leftovers, like _matvec_i8_tail.
+static inline void _quantize_i8_tail(int n, const double *x,
+	const float *scale, int8_t *out) {
+	for(int i = 0; i < n; i++) {
+		double v = x[i] * scale[i];
+		v = v > 127.0 ? 127.0 : v;
+		v = v < -127.0 ? -127.0 : v;
+		out[i] = (int8_t) ((v + 0x1.8p52) - 0x1.8p52);
+	}
+}
+
+void _quantize_i8_scalar(int n, const double *x, const float *scale,
+	int8_t *out) {
+	_quantize_i8_tail(n, x, scale, out);
+}
+
+/*
+ * Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3").
+ * Each of the ten rounds multiplies two of the four counter words by a
+ * constant, and mixes the high and low halves of the products with the other
+ * two words and the key, which is bumped by a Weyl sequence between rounds.
+ */
+static const uint32_t _PHILOX_M0 = 0xD2511F53;
+static const uint32_t _PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t _PHILOX_W0 = 0x9E3779B9;
+static const uint32_t _PHILOX_W1 = 0xBB67AE85;
+static const int _PHILOX_ROUNDS = 10;
+
+void _philox_scalar(int blocks, const uint32_t *key, uint64_t stream,
+	uint64_t block, uint32_t *out) {
+	for(int b = 0; b < blocks; b++) {
+		uint32_t c0 = (uint32_t) (block + b), c1 = (block + b) >> 32;
+		uint32_t c2 = (uint32_t) stream, c3 = stream >> 32;
+		uint32_t k0 = key[0], k1 = key[1];
+		for(int r = 0; r < _PHILOX_ROUNDS; r++) {
+			if(r) {
+				k0 += _PHILOX_W0;
+				k1 += _PHILOX_W1;
+			}
+			uint64_t p0 = (uint64_t) _PHILOX_M0 * c0;
+			uint64_t p1 = (uint64_t) _PHILOX_M1 * c2;
+			c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+			c1 = (uint32_t) p1;
+			c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+			c3 = (uint32_t) p0;
+		}
+		out[4 * b] = c0;
+		out[4 * b + 1] = c1;
+		out[4 * b + 2] = c2;
+		out[4 * b + 3] = c3;
+	}
+}
+
+// The SIMD versions run one block per 32-bit lane. These set up the lanes'
+// block numbers, and interleave the lanes' words back into blocks at the end.
+static inline void _philox_lanes(int lanes, uint64_t block, uint32_t *lo,
+	uint32_t *hi) {
+	for(int l = 0; l < lanes; l++) {
+		lo[l] = (uint32_t) (block + l);
+		hi[l] = (block + l) >> 32;
+	}
+}
+
+static inline void _philox_interleave(int lanes, const uint32_t *words,
+	uint32_t *out) {
+	for(int l = 0; l < lanes; l++) {
+		for(int i = 0; i < 4; i++) {
+			out[4 * l + i] = words[i * lanes + l];
+		}
+	}
+}
+
+const kernels kernels_scalar = {
+	"scalar", _matvec_scalar, _sigmoid_scalar, _sigmoid_fast_scalar, _dot_scalar,
+	_rank1_scalar, _matvec_f32_scalar, _matvec_mixed_scalar, _sigmoid_f32_scalar,
+	_sigmoid_fast_f32_scalar, _dot_f32_scalar, _dot_mixed_scalar,
+	_rank1_f32_scalar, _matvec_i8_scalar, _quantize_i8_scalar, _philox_scalar
+};
+
+#if defined(__x86_64__)
+
+/*
+ * Vectorized exp, shared by all of the SIMD sigmoids. This is the Cephes
+ * algorithm: write x = n * ln(2) + r with |r| <= ln(2) / 2, approximate e^r
+ * with a rational function, and scale by 2^n by building the exponent bits
+ * directly. ln(2) is split into a high part with few enough mantissa bits that
+ * n * _EXP_C1 is exact, and a low correction. Inputs are clamped to +-708 so
+ * 2^n stays a normal double; sigmoid is flat long before that.
+ */
+static const double _EXP_LIMIT = 708.0;
+static const double _EXP_LOG2E = 1.4426950408889634073599;
+static const double _EXP_C1 = 6.93145751953125e-1;
+static const double _EXP_C2 = 1.42860682030941723212e-6;
+static const double _EXP_P0 = 1.26177193074810590878e-4;
+static const double _EXP_P1 = 3.02994407707441961300e-2;
+static const double _EXP_P2 = 9.99999999999999999910e-1;
+static const double _EXP_Q0 = 3.00198505138664455042e-6;
+static const double _EXP_Q1 = 2.52448340349684104192e-3;
+static const double _EXP_Q2 = 2.27265548208155028766e-1;
+static const double _EXP_Q3 = 2.00000000000000000009e0;
+
+/*
+ * SSE2: two doubles per register. SSE2 is part of the x86-64 baseline, so
+ * these need no target attribute and the table is always supported there.
+ */
+
+void _matvec_sse2(int rows, int cols, const double *x, const double *w,
+	double *out) {
+	int j = 0;
+	// Four registers of accumulators at a time, so each x[i] broadcast is used
+	// eight times and out is only written once per column block
+	for(; j + 8 <= cols; j += 8) {
+		__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+		__m128d acc2 = _mm_setzero_pd(), acc3 = _mm_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			__m128d xi = _mm_set1_pd(x[i]);
+			const double *wi = w + (size_t) i * cols + j;
+			acc0 = _mm_add_pd(acc0, _mm_mul_pd(xi, _mm_loadu_pd(wi)));
+			acc1 = _mm_add_pd(acc1, _mm_mul_pd(xi, _mm_loadu_pd(wi + 2)));
+			acc2 = _mm_add_pd(acc2, _mm_mul_pd(xi, _mm_loadu_pd(wi + 4)));
+			acc3 = _mm_add_pd(acc3, _mm_mul_pd(xi, _mm_loadu_pd(wi + 6)));
+		}
+		_mm_storeu_pd(out + j, acc0);
+		_mm_storeu_pd(out + j + 2, acc1);
+		_mm_storeu_pd(out + j + 4, acc2);
+		_mm_storeu_pd(out + j + 6, acc3);
+	}
+	for(; j + 2 <= cols; j += 2) {
+		__m128d acc = _mm_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			acc = _mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(x[i]),
+				_mm_loadu_pd(w + (size_t) i * cols + j)));
+		}
+		_mm_storeu_pd(out + j, acc);
+	}
+	for(; j < cols; j++) {
+		double acc = 0.0;
+		for(int i = 0; i < rows; i++) {
+			acc += x[i] * w[(size_t) i * cols + j];
+		}
+		out[j] = acc;
+	}
+}
+
+__m128d _exp_sse2(__m128d x) {
+	x = _mm_min_pd(x, _mm_set1_pd(_EXP_LIMIT));
+	x = _mm_max_pd(x, _mm_set1_pd(-_EXP_LIMIT));
+
+	// SSE2 has no rounding instruction, but converting to int rounds to nearest
+	__m128i ni = _mm_cvtpd_epi32(_mm_mul_pd(x, _mm_set1_pd(_EXP_LOG2E)));
+	__m128d n = _mm_cvtepi32_pd(ni);
+	__m128d r = _mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(_EXP_C1)));
+	r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(_EXP_C2)));
+
+	__m128d rr = _mm_mul_pd(r, r);
+	__m128d p = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(_EXP_P0), rr),
+		_mm_set1_pd(_EXP_P1));
+	p = _mm_add_pd(_mm_mul_pd(p, rr), _mm_set1_pd(_EXP_P2));
+	p = _mm_mul_pd(p, r);
+	__m128d q = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(_EXP_Q0), rr),
+		_mm_set1_pd(_EXP_Q1));
+	q = _mm_add_pd(_mm_mul_pd(q, rr), _mm_set1_pd(_EXP_Q2));
+	q = _mm_add_pd(_mm_mul_pd(q, rr), _mm_set1_pd(_EXP_Q3));
+	__m128d e = _mm_div_pd(p, _mm_sub_pd(q, p));
+	e = _mm_add_pd(_mm_set1_pd(1.0), _mm_add_pd(e, e));
+
+	// 2^n: n + 1023 is positive here, so zero-extending to 64 bits is enough
+	ni = _mm_add_epi32(ni, _mm_set1_epi32(1023));
+	ni = _mm_unpacklo_epi32(ni, _mm_setzero_si128());
+	__m128d scale = _mm_castsi128_pd(_mm_slli_epi64(ni, 52));
+	return _mm_mul_pd(e, scale);
+}
+
+void _sigmoid_sse2(int n, double *a, const double *b) {
+	int i = 0;
+	__m128d one = _mm_set1_pd(1.0);
+	for(; i + 2 <= n; i += 2) {
+		__m128d v = _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+		__m128d e = _exp_sse2(_mm_sub_pd(_mm_setzero_pd(), v));
+		_mm_storeu_pd(a + i, _mm_div_pd(one, _mm_add_pd(one, e)));
+	}
+	_sigmoid_scalar(n - i, a + i, b + i);
+}
+
+__m128d _exp_fast_sse2(__m128d x) {
+	x = _mm_min_pd(x, _mm_set1_pd(_FAST_LIMIT));
+	x = _mm_max_pd(x, _mm_set1_pd(-_FAST_LIMIT));
+	__m128i ni = _mm_cvtpd_epi32(_mm_mul_pd(x, _mm_set1_pd(_FAST_LOG2E)));
+	__m128d n = _mm_cvtepi32_pd(ni);
+	__m128d r = _mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(_FAST_C1)));
+	r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(_FAST_C2)));
+
+	__m128d p = _mm_set1_pd(_FAST_T6);
+	p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(_FAST_T5));
+	p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(_FAST_T4));
+	p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(_FAST_T3));
+	p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(_FAST_T2));
+	p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0));
+	p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0));
+
+	ni = _mm_add_epi32(ni, _mm_set1_epi32(1023));
+	ni = _mm_unpacklo_epi32(ni, _mm_setzero_si128());
+	return _mm_mul_pd(p, _mm_castsi128_pd(_mm_slli_epi64(ni, 52)));
+}
+
+void _sigmoid_fast_sse2(int n, double *a, const double *b) {
+	int i = 0;
+	__m128d one = _mm_set1_pd(1.0);
+	for(; i + 2 <= n; i += 2) {
+		__m128d v = _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+		__m128d e = _exp_fast_sse2(_mm_sub_pd(_mm_setzero_pd(), v));
+		_mm_storeu_pd(a + i, _mm_div_pd(one, _mm_add_pd(one, e)));
+	}
+	_sigmoid_fast_scalar(n - i, a + i, b + i);
+}
+
+double _dot_sse2(int n, const double *a, const double *b) {
+	int i = 0;
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	for(; i + 4 <= n; i += 4) {
+		acc0 = _mm_add_pd(acc0,
+			_mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		acc1 = _mm_add_pd(acc1,
+			_mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + _dot_scalar(n - i, a + i, b + i);
+}
+
+void _rank1_sse2(int rows, int cols, const double *x, const double *g,
+	double *w, double scale) {
+	for(int i = 0; i < rows; i++) {
+		__m128d xi = _mm_set1_pd(x[i]);
+		__m128d s = _mm_set1_pd(scale);
+		double *wi = w + (size_t) i * cols;
+		int j = 0;
+		for(; j + 2 <= cols; j += 2) {
+			__m128d upd = _mm_mul_pd(s, _mm_mul_pd(xi, _mm_loadu_pd(g + j)));
+			_mm_storeu_pd(wi + j, _mm_sub_pd(_mm_loadu_pd(wi + j), upd));
+		}
+		for(; j < cols; j++) {
+			wi[j] -= scale * (x[i] * g[j]);
+		}
+	}
+}
+
+// The float kernels: four floats per register
+void _matvec_f32_sse2(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	int j = 0;
+	for(; j + 16 <= cols; j += 16) {
+		__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+		__m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+		for(int i = 0; i < rows; i++) {
+			__m128 xi = _mm_set1_ps(x[i]);
+			const float *wi = w + (size_t) i * cols + j;
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(xi, _mm_loadu_ps(wi)));
+			acc1 = _mm_add_ps(acc1, _mm_mul_ps(xi, _mm_loadu_ps(wi + 4)));
+			acc2 = _mm_add_ps(acc2, _mm_mul_ps(xi, _mm_loadu_ps(wi + 8)));
+			acc3 = _mm_add_ps(acc3, _mm_mul_ps(xi, _mm_loadu_ps(wi + 12)));
+		}
+		_mm_storeu_ps(out + j, acc0);
+		_mm_storeu_ps(out + j + 4, acc1);
+		_mm_storeu_ps(out + j + 8, acc2);
+		_mm_storeu_ps(out + j + 12, acc3);
+	}
+	for(; j + 4 <= cols; j += 4) {
+		__m128 acc = _mm_setzero_ps();
+		for(int i = 0; i < rows; i++) {
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(x[i]),
+				_mm_loadu_ps(w + (size_t) i * cols + j)));
+		}
+		_mm_storeu_ps(out + j, acc);
+	}
+	for(; j < cols; j++) {
+		float acc = 0.0f;
+		for(int i = 0; i < rows; i++) {
+			acc += x[i] * w[(size_t) i * cols + j];
+		}
+		out[j] = acc;
+	}
+}
+
+// Each register of four floats is widened into two registers of doubles
+void _matvec_mixed_sse2(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	int j = 0;
+	for(; j + 8 <= cols; j += 8) {
+		__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+		__m128d acc2 = _mm_setzero_pd(), acc3 = _mm_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			__m128d xi = _mm_set1_pd(x[i]);
+			const float *wi = w + (size_t) i * cols + j;
+			__m128 lo = _mm_loadu_ps(wi);
+			__m128 hi = _mm_loadu_ps(wi + 4);
+			__m128 lo_hi = _mm_movehl_ps(lo, lo);
+			__m128 hi_hi = _mm_movehl_ps(hi, hi);
+			acc0 = _mm_add_pd(acc0, _mm_mul_pd(xi, _mm_cvtps_pd(lo)));
+			acc1 = _mm_add_pd(acc1, _mm_mul_pd(xi, _mm_cvtps_pd(lo_hi)));
+			acc2 = _mm_add_pd(acc2, _mm_mul_pd(xi, _mm_cvtps_pd(hi)));
+			acc3 = _mm_add_pd(acc3, _mm_mul_pd(xi, _mm_cvtps_pd(hi_hi)));
+		}
+		_mm_storeu_ps(out + j,
+			_mm_movelh_ps(_mm_cvtpd_ps(acc0), _mm_cvtpd_ps(acc1)));
+		_mm_storeu_ps(out + j + 4,
+			_mm_movelh_ps(_mm_cvtpd_ps(acc2), _mm_cvtpd_ps(acc3)));
+	}
+	for(; j < cols; j++) {
+		double acc = 0.0;
+		for(int i = 0; i < rows; i++) {
+			acc += (double) x[i] * w[(size_t) i * cols + j];
+		}
+		out[j] = acc;
+	}
+}
+
+void _sigmoid_f32_sse2(int n, float *a, const float *b) {
+	int i = 0;
+	__m128d one = _mm_set1_pd(1.0);
+	for(; i + 2 <= n; i += 2) {
+		__m128 va = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) (a + i)));
+		__m128 vb = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) (b + i)));
+		__m128d v = _mm_add_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb));
+		__m128d e = _exp_sse2(_mm_sub_pd(_mm_setzero_pd(), v));
+		__m128 s = _mm_cvtpd_ps(_mm_div_pd(one, _mm_add_pd(one, e)));
+		_mm_storel_epi64((__m128i*) (a + i), _mm_castps_si128(s));
+	}
+	_sigmoid_f32_scalar(n - i, a + i, b + i);
+}
+
+void _sigmoid_fast_f32_sse2(int n, float *a, const float *b) {
+	int i = 0;
+	__m128d one = _mm_set1_pd(1.0);
+	for(; i + 2 <= n; i += 2) {
+		__m128 va = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) (a + i)));
+		__m128 vb = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) (b + i)));
+		__m128d v = _mm_add_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb));
+		__m128d e = _exp_fast_sse2(_mm_sub_pd(_mm_setzero_pd(), v));
+		__m128 s = _mm_cvtpd_ps(_mm_div_pd(one, _mm_add_pd(one, e)));
+		_mm_storel_epi64((__m128i*) (a + i), _mm_castps_si128(s));
+	}
+	_sigmoid_fast_f32_scalar(n - i, a + i, b + i);
+}
+
+double _dot_f32_sse2(int n, const float *a, const float *b) {
+	int i = 0;
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	for(; i + 8 <= n; i += 8) {
+		acc0 = _mm_add_ps(acc0,
+			_mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1,
+			_mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3])
+		+ _dot_f32_scalar(n - i, a + i, b + i);
+}
+
+double _dot_mixed_sse2(int n, const float *a, const float *b) {
+	int i = 0;
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	for(; i + 4 <= n; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 vb = _mm_loadu_ps(b + i);
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb)));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(va, va)),
+			_mm_cvtps_pd(_mm_movehl_ps(vb, vb))));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + _dot_mixed_scalar(n - i, a + i, b + i);
+}
+
+void _rank1_f32_sse2(int rows, int cols, const float *x, const float *g,
+	float *w, float scale) {
+	for(int i = 0; i < rows; i++) {
+		__m128 xi = _mm_set1_ps(x[i]);
+		__m128 s = _mm_set1_ps(scale);
+		float *wi = w + (size_t) i * cols;
+		int j = 0;
+		for(; j + 4 <= cols; j += 4) {
+			__m128 upd = _mm_mul_ps(s, _mm_mul_ps(xi, _mm_loadu_ps(g + j)));
+			_mm_storeu_ps(wi + j, _mm_sub_ps(_mm_loadu_ps(wi + j), upd));
+		}
+		for(; j < cols; j++) {
+			wi[j] -= scale * (x[i] * g[j]);
+		}
+	}
+}
+
+// Sign-extends the low 8 bytes of v to 16 bits each, by putting each byte in
+// the high half of a 16 bit lane and shifting it back down
+static inline __m128i _widen_i8_sse2(__m128i v) {
+	return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+
+// 4 columns per register: their 8 weights for a pair of inputs are widened to
+// 16 bits, and _mm_madd_epi16 multiplies them by the pair and adds each
+// column's two products into its 32 bit lane. Blocks of 16 columns keep 4
+// independent sums going.
+static inline __m128i _madd_i8_sse2(const int8_t *w, __m128i pair) {
+	__m128i v = _mm_loadl_epi64((const __m128i*) w);
+	return _mm_madd_epi16(_widen_i8_sse2(v), pair);
+}
+
+// Stores 4 sums, converted to floats and scaled
+static inline void _store_scaled_sse2(float *out, const float *scale,
+	__m128i acc) {
+	_mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(acc), _mm_loadu_ps(scale)));
+}
+
+void _matvec_i8_sse2(int rows, int cols, const int8_t *x, const int8_t *w,
+	const float *scale, float *out) {
+	int j = 0;
+	for(; j + 16 <= cols; j += 16) {
+		__m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+		__m128i acc2 = _mm_setzero_si128(), acc3 = _mm_setzero_si128();
+		for(int i = 0; i < rows; i += 2) {
+			__m128i pair = _mm_set1_epi32(_pair_i8(x, i));
+			const int8_t *wi = w + (size_t) i * cols + 2 * j;
+			acc0 = _mm_add_epi32(acc0, _madd_i8_sse2(wi, pair));
+			acc1 = _mm_add_epi32(acc1, _madd_i8_sse2(wi + 8, pair));
+			acc2 = _mm_add_epi32(acc2, _madd_i8_sse2(wi + 16, pair));
+			acc3 = _mm_add_epi32(acc3, _madd_i8_sse2(wi + 24, pair));
+		}
+		_store_scaled_sse2(out + j, scale + j, acc0);
+		_store_scaled_sse2(out + j + 4, scale + j + 4, acc1);
+		_store_scaled_sse2(out + j + 8, scale + j + 8, acc2);
+		_store_scaled_sse2(out + j + 12, scale + j + 12, acc3);
+	}
+	for(; j + 4 <= cols; j += 4) {
+		__m128i acc = _mm_setzero_si128();
+		for(int i = 0; i < rows; i += 2) {
+			__m128i pair = _mm_set1_epi32(_pair_i8(x, i));
+			acc = _mm_add_epi32(acc,
+				_madd_i8_sse2(w + (size_t) i * cols + 2 * j, pair));
+		}
+		_store_scaled_sse2(out + j, scale + j, acc);
+	}
+	_matvec_i8_tail(rows, cols, j, x, w, scale, out);
+}
+
+// Converts 8 doubles, already clamped to +-127, to int8s, rounding to even
+static inline void _store_i8_sse2(int8_t *out, __m128d a, __m128d b,
+	__m128d c, __m128d d) {
+	__m128i lo = _mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b));
+	__m128i hi = _mm_unpacklo_epi64(_mm_cvtpd_epi32(c), _mm_cvtpd_epi32(d));
+	__m128i packed = _mm_packs_epi32(lo, hi);
+	_mm_storel_epi64((__m128i*) out, _mm_packs_epi16(packed, packed));
+}
+
+// x * scale for 2 doubles, clamped to +-127
+static inline __m128d _scale_clamp_sse2(const double *x, const float *scale) {
+	__m128d s = _mm_cvtps_pd(_mm_castsi128_ps(
+		_mm_loadl_epi64((const __m128i*) scale)));
+	__m128d v = _mm_mul_pd(_mm_loadu_pd(x), s);
+	return _mm_max_pd(_mm_min_pd(v, _mm_set1_pd(127.0)), _mm_set1_pd(-127.0));
+}
+
+void _quantize_i8_sse2(int n, const double *x, const float *scale,
+	int8_t *out) {
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		_store_i8_sse2(out + i, _scale_clamp_sse2(x + i, scale + i),
+			_scale_clamp_sse2(x + i + 2, scale + i + 2),
+			_scale_clamp_sse2(x + i + 4, scale + i + 4),
+			_scale_clamp_sse2(x + i + 6, scale + i + 6));
+	}
+	_quantize_i8_tail(n - i, x + i, scale + i, out + i);
+}
+
+// _mm_mul_epu32 only multiplies the even lanes, so the odd lanes go through a
+// second multiply, shifted down into the even positions. Then the low and high
+// halves of the four 64-bit products get put back in lane order.
+static inline void _mulhilo_sse2(__m128i c, __m128i m, __m128i *hi,
+	__m128i *lo) {
+	__m128i low = _mm_set1_epi64x(0xFFFFFFFF);
+	__m128i even = _mm_mul_epu32(c, m);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(c, 32), m);
+	*lo = _mm_or_si128(_mm_and_si128(even, low), _mm_slli_epi64(odd, 32));
+	*hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low, odd));
+}
+
+// 4 blocks at a time
+void _philox_sse2(int blocks, const uint32_t *key, uint64_t stream,
+	uint64_t block, uint32_t *out) {
+	__m128i m0 = _mm_set1_epi32(_PHILOX_M0), m1 = _mm_set1_epi32(_PHILOX_M1);
+	uint32_t words[16];
+	int b = 0;
+	for(; b + 4 <= blocks; b += 4) {
+		_philox_lanes(4, block + b, words, words + 4);
+		__m128i c0 = _mm_loadu_si128((__m128i*) words);
+		__m128i c1 = _mm_loadu_si128((__m128i*) (words + 4));
+		__m128i c2 = _mm_set1_epi32((uint32_t) stream);
+		__m128i c3 = _mm_set1_epi32(stream >> 32);
+		__m128i k0 = _mm_set1_epi32(key[0]), k1 = _mm_set1_epi32(key[1]);
+		for(int r = 0; r < _PHILOX_ROUNDS; r++) {
+			if(r) {
+				k0 = _mm_add_epi32(k0, _mm_set1_epi32(_PHILOX_W0));
+				k1 = _mm_add_epi32(k1, _mm_set1_epi32(_PHILOX_W1));
+			}
+			__m128i hi0, lo0, hi1, lo1;
+			_mulhilo_sse2(c0, m0, &hi0, &lo0);
+			_mulhilo_sse2(c2, m1, &hi1, &lo1);
+			c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), k0);
+			c1 = lo1;
+			c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), k1);
+			c3 = lo0;
+		}
+		_mm_storeu_si128((__m128i*) words, c0);
+		_mm_storeu_si128((__m128i*) (words + 4), c1);
+		_mm_storeu_si128((__m128i*) (words + 8), c2);
+		_mm_storeu_si128((__m128i*) (words + 12), c3);
+		_philox_interleave(4, words, out + 4 * b);
+	}
+	_philox_scalar(blocks - b, key, stream, block + b, out + 4 * b);
+}
+
+const kernels kernels_sse2 = {
+	"sse2", _matvec_sse2, _sigmoid_sse2, _sigmoid_fast_sse2, _dot_sse2,
+	_rank1_sse2, _matvec_f32_sse2, _matvec_mixed_sse2, _sigmoid_f32_sse2,
+	_sigmoid_fast_f32_sse2, _dot_f32_sse2, _dot_mixed_sse2, _rank1_f32_sse2,
+	_matvec_i8_sse2, _quantize_i8_sse2, _philox_sse2
+};
+
+/*
+ * AVX2 + FMA: four doubles per register, with fused multiply-adds.
+ */
+
+__attribute__((target("avx2,fma")))
+void _matvec_avx2(int rows, int cols, const double *x, const double *w,
+	double *out) {
+	int j = 0;
+	for(; j + 16 <= cols; j += 16) {
+		__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+		__m256d acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			__m256d xi = _mm256_set1_pd(x[i]);
+			const double *wi = w + (size_t) i * cols + j;
+			acc0 = _mm256_fmadd_pd(xi, _mm256_loadu_pd(wi), acc0);
+			acc1 = _mm256_fmadd_pd(xi, _mm256_loadu_pd(wi + 4), acc1);
+			acc2 = _mm256_fmadd_pd(xi, _mm256_loadu_pd(wi + 8), acc2);
+			acc3 = _mm256_fmadd_pd(xi, _mm256_loadu_pd(wi + 12), acc3);
+		}
+		_mm256_storeu_pd(out + j, acc0);
+		_mm256_storeu_pd(out + j + 4, acc1);
+		_mm256_storeu_pd(out + j + 8, acc2);
+		_mm256_storeu_pd(out + j + 12, acc3);
+	}
+	for(; j + 4 <= cols; j += 4) {
+		__m256d acc = _mm256_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			acc = _mm256_fmadd_pd(_mm256_set1_pd(x[i]),
+				_mm256_loadu_pd(w + (size_t) i * cols + j), acc);
+		}
+		_mm256_storeu_pd(out + j, acc);
+	}
+	for(; j < cols; j++) {
+		double acc = 0.0;
+		for(int i = 0; i < rows; i++) {
+			acc += x[i] * w[(size_t) i * cols + j];
+		}
+		out[j] = acc;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+__m256d _exp_avx2(__m256d x) {
+	x = _mm256_min_pd(x, _mm256_set1_pd(_EXP_LIMIT));
+	x = _mm256_max_pd(x, _mm256_set1_pd(-_EXP_LIMIT));
+
+	__m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(_EXP_LOG2E)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(_EXP_C1), x);
+	r = _mm256_fnmadd_pd(n, _mm256_set1_pd(_EXP_C2), r);
+
+	__m256d rr = _mm256_mul_pd(r, r);
+	__m256d p = _mm256_fmadd_pd(_mm256_set1_pd(_EXP_P0), rr,
+		_mm256_set1_pd(_EXP_P1));
+	p = _mm256_fmadd_pd(p, rr, _mm256_set1_pd(_EXP_P2));
+	p = _mm256_mul_pd(p, r);
+	__m256d q = _mm256_fmadd_pd(_mm256_set1_pd(_EXP_Q0), rr,
+		_mm256_set1_pd(_EXP_Q1));
+	q = _mm256_fmadd_pd(q, rr, _mm256_set1_pd(_EXP_Q2));
+	q = _mm256_fmadd_pd(q, rr, _mm256_set1_pd(_EXP_Q3));
+	__m256d e = _mm256_div_pd(p, _mm256_sub_pd(q, p));
+	e = _mm256_fmadd_pd(e, _mm256_set1_pd(2.0), _mm256_set1_pd(1.0));
+
+	__m256i ni = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+	ni = _mm256_add_epi64(ni, _mm256_set1_epi64x(1023));
+	__m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(ni, 52));
+	return _mm256_mul_pd(e, scale);
+}
+
+__attribute__((target("avx2,fma")))
+void _sigmoid_avx2(int n, double *a, const double *b) {
+	int i = 0;
+	__m256d one = _mm256_set1_pd(1.0);
+	for(; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+		__m256d e = _exp_avx2(_mm256_sub_pd(_mm256_setzero_pd(), v));
+		_mm256_storeu_pd(a + i, _mm256_div_pd(one, _mm256_add_pd(one, e)));
+	}
+	_sigmoid_scalar(n - i, a + i, b + i);
+}
+
+__attribute__((target("avx2,fma")))
+__m256d _exp_fast_avx2(__m256d x) {
+	x = _mm256_min_pd(x, _mm256_set1_pd(_FAST_LIMIT));
+	x = _mm256_max_pd(x, _mm256_set1_pd(-_FAST_LIMIT));
+	__m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(_FAST_LOG2E)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(_FAST_C1), x);
+	r = _mm256_fnmadd_pd(n, _mm256_set1_pd(_FAST_C2), r);
+
+	__m256d p = _mm256_set1_pd(_FAST_T6);
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(_FAST_T5));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(_FAST_T4));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(_FAST_T3));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(_FAST_T2));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+
+	__m256i ni = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+	ni = _mm256_add_epi64(ni, _mm256_set1_epi64x(1023));
+	return _mm256_mul_pd(p, _mm256_castsi256_pd(_mm256_slli_epi64(ni, 52)));
+}
+
+__attribute__((target("avx2,fma")))
+void _sigmoid_fast_avx2(int n, double *a, const double *b) {
+	int i = 0;
+	__m256d one = _mm256_set1_pd(1.0);
+	for(; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+		__m256d e = _exp_fast_avx2(_mm256_sub_pd(_mm256_setzero_pd(), v));
+		_mm256_storeu_pd(a + i, _mm256_div_pd(one, _mm256_add_pd(one, e)));
+	}
+	_sigmoid_fast_scalar(n - i, a + i, b + i);
+}
+
+__attribute__((target("avx2,fma")))
+double _dot_avx2(int n, const double *a, const double *b) {
+	int i = 0;
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	for(; i + 8 <= n; i += 8) {
+		acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i),
+			acc0);
+		acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4),
+			_mm256_loadu_pd(b + i + 4), acc1);
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3])
+		+ _dot_scalar(n - i, a + i, b + i);
+}
+
+__attribute__((target("avx2,fma")))
+void _rank1_avx2(int rows, int cols, const double *x, const double *g,
+	double *w, double scale) {
+	for(int i = 0; i < rows; i++) {
+		// -scale * x[i] * g[j] + w[i][j] as a single fused operation
+		__m256d sxi = _mm256_set1_pd(-scale * x[i]);
+		double *wi = w + (size_t) i * cols;
+		int j = 0;
+		for(; j + 4 <= cols; j += 4) {
+			_mm256_storeu_pd(wi + j, _mm256_fmadd_pd(sxi, _mm256_loadu_pd(g + j),
+				_mm256_loadu_pd(wi + j)));
+		}
+		for(; j < cols; j++) {
+			wi[j] -= scale * (x[i] * g[j]);
+		}
+	}
+}
+
+// The float kernels: eight floats per register
+__attribute__((target("avx2,fma")))
+void _matvec_f32_avx2(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	int j = 0;
+	for(; j + 32 <= cols; j += 32) {
+		__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+		__m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+		for(int i = 0; i < rows; i++) {
+			__m256 xi = _mm256_set1_ps(x[i]);
+			const float *wi = w + (size_t) i * cols + j;
+			acc0 = _mm256_fmadd_ps(xi, _mm256_loadu_ps(wi), acc0);
+			acc1 = _mm256_fmadd_ps(xi, _mm256_loadu_ps(wi + 8), acc1);
+			acc2 = _mm256_fmadd_ps(xi, _mm256_loadu_ps(wi + 16), acc2);
+			acc3 = _mm256_fmadd_ps(xi, _mm256_loadu_ps(wi + 24), acc3);
+		}
+		_mm256_storeu_ps(out + j, acc0);
+		_mm256_storeu_ps(out + j + 8, acc1);
+		_mm256_storeu_ps(out + j + 16, acc2);
+		_mm256_storeu_ps(out + j + 24, acc3);
+	}
+	for(; j + 8 <= cols; j += 8) {
+		__m256 acc = _mm256_setzero_ps();
+		for(int i = 0; i < rows; i++) {
+			acc = _mm256_fmadd_ps(_mm256_set1_ps(x[i]),
+				_mm256_loadu_ps(w + (size_t) i * cols + j), acc);
+		}
+		_mm256_storeu_ps(out + j, acc);
+	}
+	for(; j < cols; j++) {
+		float acc = 0.0f;
+		for(int i = 0; i < rows; i++) {
+			acc += x[i] * w[(size_t) i * cols + j];
+		}
+		out[j] = acc;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void _matvec_mixed_avx2(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	int j = 0;
+	for(; j + 16 <= cols; j += 16) {
+		__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+		__m256d acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			__m256d xi = _mm256_set1_pd(x[i]);
+			const float *wi = w + (size_t) i * cols + j;
+			acc0 = _mm256_fmadd_pd(xi, _mm256_cvtps_pd(_mm_loadu_ps(wi)), acc0);
+			acc1 = _mm256_fmadd_pd(xi, _mm256_cvtps_pd(_mm_loadu_ps(wi + 4)), acc1);
+			acc2 = _mm256_fmadd_pd(xi, _mm256_cvtps_pd(_mm_loadu_ps(wi + 8)), acc2);
+			acc3 = _mm256_fmadd_pd(xi, _mm256_cvtps_pd(_mm_loadu_ps(wi + 12)), acc3);
+		}
+		_mm_storeu_ps(out + j, _mm256_cvtpd_ps(acc0));
+		_mm_storeu_ps(out + j + 4, _mm256_cvtpd_ps(acc1));
+		_mm_storeu_ps(out + j + 8, _mm256_cvtpd_ps(acc2));
+		_mm_storeu_ps(out + j + 12, _mm256_cvtpd_ps(acc3));
+	}
+	for(; j + 4 <= cols; j += 4) {
+		__m256d acc = _mm256_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			acc = _mm256_fmadd_pd(_mm256_set1_pd(x[i]),
+				_mm256_cvtps_pd(_mm_loadu_ps(w + (size_t) i * cols + j)), acc);
+		}
+		_mm_storeu_ps(out + j, _mm256_cvtpd_ps(acc));
+	}
+	for(; j < cols; j++) {
+		double acc = 0.0;
+		for(int i = 0; i < rows; i++) {
+			acc += (double) x[i] * w[(size_t) i * cols + j];
+		}
+		out[j] = acc;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void _sigmoid_f32_avx2(int n, float *a, const float *b) {
+	int i = 0;
+	__m256d one = _mm256_set1_pd(1.0);
+	for(; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_add_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + i)),
+			_mm256_cvtps_pd(_mm_loadu_ps(b + i)));
+		__m256d e = _exp_avx2(_mm256_sub_pd(_mm256_setzero_pd(), v));
+		_mm_storeu_ps(a + i, _mm256_cvtpd_ps(_mm256_div_pd(one,
+			_mm256_add_pd(one, e))));
+	}
+	_sigmoid_f32_scalar(n - i, a + i, b + i);
+}
+
+__attribute__((target("avx2,fma")))
+void _sigmoid_fast_f32_avx2(int n, float *a, const float *b) {
+	int i = 0;
+	__m256d one = _mm256_set1_pd(1.0);
+	for(; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_add_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + i)),
+			_mm256_cvtps_pd(_mm_loadu_ps(b + i)));
+		__m256d e = _exp_fast_avx2(_mm256_sub_pd(_mm256_setzero_pd(), v));
+		_mm_storeu_ps(a + i, _mm256_cvtpd_ps(_mm256_div_pd(one,
+			_mm256_add_pd(one, e))));
+	}
+	_sigmoid_fast_f32_scalar(n - i, a + i, b + i);
+}
+
+__attribute__((target("avx2,fma")))
+double _dot_f32_avx2(int n, const float *a, const float *b) {
+	int i = 0;
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	for(; i + 16 <= n; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),
+			acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),
+			_mm256_loadu_ps(b + i + 8), acc1);
+	}
+	__m256 acc = _mm256_add_ps(acc0, acc1);
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(acc),
+		_mm256_extractf128_ps(acc, 1));
+	float lanes[4];
+	_mm_storeu_ps(lanes, half);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3])
+		+ _dot_f32_scalar(n - i, a + i, b + i);
+}
+
+__attribute__((target("avx2,fma")))
+double _dot_mixed_avx2(int n, const float *a, const float *b) {
+	int i = 0;
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	for(; i + 8 <= n; i += 8) {
+		acc0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + i)),
+			_mm256_cvtps_pd(_mm_loadu_ps(b + i)), acc0);
+		acc1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + i + 4)),
+			_mm256_cvtps_pd(_mm_loadu_ps(b + i + 4)), acc1);
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3])
+		+ _dot_mixed_scalar(n - i, a + i, b + i);
+}
+
+__attribute__((target("avx2,fma")))
+void _rank1_f32_avx2(int rows, int cols, const float *x, const float *g,
+	float *w, float scale) {
+	for(int i = 0; i < rows; i++) {
+		__m256 sxi = _mm256_set1_ps(-scale * x[i]);
+		float *wi = w + (size_t) i * cols;
+		int j = 0;
+		for(; j + 8 <= cols; j += 8) {
+			_mm256_storeu_ps(wi + j, _mm256_fmadd_ps(sxi, _mm256_loadu_ps(g + j),
+				_mm256_loadu_ps(wi + j)));
+		}
+		for(; j < cols; j++) {
+			wi[j] -= scale * (x[i] * g[j]);
+		}
+	}
+}
+
+// matvec_i8_sse2 with 8 columns per register: their 16 weights for a pair of
+// inputs are sign-extended to 16 bits with vpmovsxbw
+__attribute__((target("avx2,fma")))
+static inline __m256i _madd_i8_avx2(const int8_t *w, __m256i pair) {
+	__m256i v = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) w));
+	return _mm256_madd_epi16(v, pair);
+}
+
+// The pair of inputs i and i + 1 in every 32 bit lane, sign-extended to 16
+// bits each: broadcast the two bytes, then widen them like the weights
+__attribute__((target("avx2,fma")))
+static inline __m256i _pair_i8_avx2(const int8_t *x, int i) {
+	return _mm256_cvtepi8_epi16(_mm_broadcastw_epi16(_mm_loadu_si16(x + i)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline void _store_scaled_avx2(float *out, const float *scale,
+	__m256i acc) {
+	_mm256_storeu_ps(out,
+		_mm256_mul_ps(_mm256_cvtepi32_ps(acc), _mm256_loadu_ps(scale)));
+}
+
+__attribute__((target("avx2,fma")))
+void _matvec_i8_avx2(int rows, int cols, const int8_t *x, const int8_t *w,
+	const float *scale, float *out) {
+	int j = 0;
+	for(; j + 32 <= cols; j += 32) {
+		__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+		__m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+		for(int i = 0; i < rows; i += 2) {
+			__m256i pair = _pair_i8_avx2(x, i);
+			const int8_t *wi = w + (size_t) i * cols + 2 * j;
+			acc0 = _mm256_add_epi32(acc0, _madd_i8_avx2(wi, pair));
+			acc1 = _mm256_add_epi32(acc1, _madd_i8_avx2(wi + 16, pair));
+			acc2 = _mm256_add_epi32(acc2, _madd_i8_avx2(wi + 32, pair));
+			acc3 = _mm256_add_epi32(acc3, _madd_i8_avx2(wi + 48, pair));
+		}
+		_store_scaled_avx2(out + j, scale + j, acc0);
+		_store_scaled_avx2(out + j + 8, scale + j + 8, acc1);
+		_store_scaled_avx2(out + j + 16, scale + j + 16, acc2);
+		_store_scaled_avx2(out + j + 24, scale + j + 24, acc3);
+	}
+	for(; j + 8 <= cols; j += 8) {
+		__m256i acc = _mm256_setzero_si256();
+		for(int i = 0; i < rows; i += 2) {
+			acc = _mm256_add_epi32(acc, _madd_i8_avx2(w + (size_t) i * cols + 2 * j,
+				_pair_i8_avx2(x, i)));
+		}
+		_store_scaled_avx2(out + j, scale + j, acc);
+	}
+	_matvec_i8_tail(rows, cols, j, x, w, scale, out);
+}
+
+// x * scale for 4 doubles, clamped to +-127
+__attribute__((target("avx2,fma")))
+static inline __m256d _scale_clamp_avx2(const double *x, const float *scale) {
+	__m256d v = _mm256_mul_pd(_mm256_loadu_pd(x),
+		_mm256_cvtps_pd(_mm_loadu_ps(scale)));
+	return _mm256_max_pd(_mm256_min_pd(v, _mm256_set1_pd(127.0)),
+		_mm256_set1_pd(-127.0));
+}
+
+__attribute__((target("avx2,fma")))
+void _quantize_i8_avx2(int n, const double *x, const float *scale,
+	int8_t *out) {
+	int i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i a = _mm_packs_epi32(
+			_mm256_cvtpd_epi32(_scale_clamp_avx2(x + i, scale + i)),
+			_mm256_cvtpd_epi32(_scale_clamp_avx2(x + i + 4, scale + i + 4)));
+		__m128i b = _mm_packs_epi32(
+			_mm256_cvtpd_epi32(_scale_clamp_avx2(x + i + 8, scale + i + 8)),
+			_mm256_cvtpd_epi32(_scale_clamp_avx2(x + i + 12, scale + i + 12)));
+		_mm_storeu_si128((__m128i*) (out + i), _mm_packs_epi16(a, b));
+	}
+	_quantize_i8_tail(n - i, x + i, scale + i, out + i);
+}
+
+__attribute__((target("avx2,fma")))
+static inline void _mulhilo_avx2(__m256i c, __m256i m, __m256i *hi,
+	__m256i *lo) {
+	__m256i low = _mm256_set1_epi64x(0xFFFFFFFF);
+	__m256i even = _mm256_mul_epu32(c, m);
+	__m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(c, 32), m);
+	*lo = _mm256_or_si256(_mm256_and_si256(even, low),
+		_mm256_slli_epi64(odd, 32));
+	*hi = _mm256_or_si256(_mm256_srli_epi64(even, 32),
+		_mm256_andnot_si256(low, odd));
+}
+
+// 8 blocks at a time, the same way as the SSE2 version
+__attribute__((target("avx2,fma")))
+void _philox_avx2(int blocks, const uint32_t *key, uint64_t stream,
+	uint64_t block, uint32_t *out) {
+	__m256i m0 = _mm256_set1_epi32(_PHILOX_M0);
+	__m256i m1 = _mm256_set1_epi32(_PHILOX_M1);
+	uint32_t words[32];
+	int b = 0;
+	for(; b + 8 <= blocks; b += 8) {
+		_philox_lanes(8, block + b, words, words + 8);
+		__m256i c0 = _mm256_loadu_si256((__m256i*) words);
+		__m256i c1 = _mm256_loadu_si256((__m256i*) (words + 8));
+		__m256i c2 = _mm256_set1_epi32((uint32_t) stream);
+		__m256i c3 = _mm256_set1_epi32(stream >> 32);
+		__m256i k0 = _mm256_set1_epi32(key[0]), k1 = _mm256_set1_epi32(key[1]);
+		for(int r = 0; r < _PHILOX_ROUNDS; r++) {
+			if(r) {
+				k0 = _mm256_add_epi32(k0, _mm256_set1_epi32(_PHILOX_W0));
+				k1 = _mm256_add_epi32(k1, _mm256_set1_epi32(_PHILOX_W1));
+			}
+			__m256i hi0, lo0, hi1, lo1;
+			_mulhilo_avx2(c0, m0, &hi0, &lo0);
+			_mulhilo_avx2(c2, m1, &hi1, &lo1);
+			c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), k0);
+			c1 = lo1;
+			c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), k1);
+			c3 = lo0;
+		}
+		_mm256_storeu_si256((__m256i*) words, c0);
+		_mm256_storeu_si256((__m256i*) (words + 8), c1);
+		_mm256_storeu_si256((__m256i*) (words + 16), c2);
+		_mm256_storeu_si256((__m256i*) (words + 24), c3);
+		_philox_interleave(8, words, out + 4 * b);
+	}
+	_philox_scalar(blocks - b, key, stream, block + b, out + 4 * b);
+}
+
+const kernels kernels_avx2 = {
+	"avx2", _matvec_avx2, _sigmoid_avx2, _sigmoid_fast_avx2, _dot_avx2,
+	_rank1_avx2, _matvec_f32_avx2, _matvec_mixed_avx2, _sigmoid_f32_avx2,
+	_sigmoid_fast_f32_avx2, _dot_f32_avx2, _dot_mixed_avx2, _rank1_f32_avx2,
+	_matvec_i8_avx2, _quantize_i8_avx2, _philox_avx2
+};
+
+/*
+ * AVX-512F: eight doubles per register, with masked loads and stores for the
+ * leftovers instead of scalar tails.
+ */
+
+__attribute__((target("avx512f")))
+void _matvec_avx512(int rows, int cols, const double *x, const double *w,
+	double *out) {
+	int j = 0;
+	for(; j + 32 <= cols; j += 32) {
+		__m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+		__m512d acc2 = _mm512_setzero_pd(), acc3 = _mm512_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			__m512d xi = _mm512_set1_pd(x[i]);
+			const double *wi = w + (size_t) i * cols + j;
+			acc0 = _mm512_fmadd_pd(xi, _mm512_loadu_pd(wi), acc0);
+			acc1 = _mm512_fmadd_pd(xi, _mm512_loadu_pd(wi + 8), acc1);
+			acc2 = _mm512_fmadd_pd(xi, _mm512_loadu_pd(wi + 16), acc2);
+			acc3 = _mm512_fmadd_pd(xi, _mm512_loadu_pd(wi + 24), acc3);
+		}
+		_mm512_storeu_pd(out + j, acc0);
+		_mm512_storeu_pd(out + j + 8, acc1);
+		_mm512_storeu_pd(out + j + 16, acc2);
+		_mm512_storeu_pd(out + j + 24, acc3);
+	}
+	for(; j < cols; j += 8) {
+		__mmask8 m = cols - j >= 8 ? 0xFF : (1 << (cols - j)) - 1;
+		__m512d acc = _mm512_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			acc = _mm512_fmadd_pd(_mm512_set1_pd(x[i]),
+				_mm512_maskz_loadu_pd(m, w + (size_t) i * cols + j), acc);
+		}
+		_mm512_mask_storeu_pd(out + j, m, acc);
+	}
+}
+
+__attribute__((target("avx512f")))
+__m512d _exp_avx512(__m512d x) {
+	x = _mm512_min_pd(x, _mm512_set1_pd(_EXP_LIMIT));
+	x = _mm512_max_pd(x, _mm512_set1_pd(-_EXP_LIMIT));
+
+	__m512d n = _mm512_roundscale_pd(
+		_mm512_mul_pd(x, _mm512_set1_pd(_EXP_LOG2E)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(_EXP_C1), x);
+	r = _mm512_fnmadd_pd(n, _mm512_set1_pd(_EXP_C2), r);
+
+	__m512d rr = _mm512_mul_pd(r, r);
+	__m512d p = _mm512_fmadd_pd(_mm512_set1_pd(_EXP_P0), rr,
+		_mm512_set1_pd(_EXP_P1));
+	p = _mm512_fmadd_pd(p, rr, _mm512_set1_pd(_EXP_P2));
+	p = _mm512_mul_pd(p, r);
+	__m512d q = _mm512_fmadd_pd(_mm512_set1_pd(_EXP_Q0), rr,
+		_mm512_set1_pd(_EXP_Q1));
+	q = _mm512_fmadd_pd(q, rr, _mm512_set1_pd(_EXP_Q2));
+	q = _mm512_fmadd_pd(q, rr, _mm512_set1_pd(_EXP_Q3));
+	__m512d e = _mm512_div_pd(p, _mm512_sub_pd(q, p));
+	e = _mm512_fmadd_pd(e, _mm512_set1_pd(2.0), _mm512_set1_pd(1.0));
+
+	// AVX-512 can scale by a power of two directly
+	return _mm512_scalef_pd(e, n);
+}
+
+__attribute__((target("avx512f")))
+void _sigmoid_avx512(int n, double *a, const double *b) {
+	__m512d one = _mm512_set1_pd(1.0);
+	for(int i = 0; i < n; i += 8) {
+		__mmask8 m = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+		__m512d v = _mm512_add_pd(_mm512_maskz_loadu_pd(m, a + i),
+			_mm512_maskz_loadu_pd(m, b + i));
+		__m512d e = _exp_avx512(_mm512_sub_pd(_mm512_setzero_pd(), v));
+		_mm512_mask_storeu_pd(a + i, m, _mm512_div_pd(one, _mm512_add_pd(one, e)));
+	}
+}
+
+__attribute__((target("avx512f")))
+__m512d _exp_fast_avx512(__m512d x) {
+	x = _mm512_min_pd(x, _mm512_set1_pd(_FAST_LIMIT));
+	x = _mm512_max_pd(x, _mm512_set1_pd(-_FAST_LIMIT));
+	__m512d n = _mm512_roundscale_pd(
+		_mm512_mul_pd(x, _mm512_set1_pd(_FAST_LOG2E)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(_FAST_C1), x);
+	r = _mm512_fnmadd_pd(n, _mm512_set1_pd(_FAST_C2), r);
+
+	__m512d p = _mm512_set1_pd(_FAST_T6);
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(_FAST_T5));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(_FAST_T4));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(_FAST_T3));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(_FAST_T2));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0));
+	return _mm512_scalef_pd(p, n);
+}
+
+__attribute__((target("avx512f")))
+void _sigmoid_fast_avx512(int n, double *a, const double *b) {
+	__m512d one = _mm512_set1_pd(1.0);
+	for(int i = 0; i < n; i += 8) {
+		__mmask8 m = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+		__m512d v = _mm512_add_pd(_mm512_maskz_loadu_pd(m, a + i),
+			_mm512_maskz_loadu_pd(m, b + i));
+		__m512d e = _exp_fast_avx512(_mm512_sub_pd(_mm512_setzero_pd(), v));
+		_mm512_mask_storeu_pd(a + i, m, _mm512_div_pd(one, _mm512_add_pd(one, e)));
+	}
+}
+
+__attribute__((target("avx512f")))
+double _dot_avx512(int n, const double *a, const double *b) {
+	__m512d acc = _mm512_setzero_pd();
+	for(int i = 0; i < n; i += 8) {
+		__mmask8 m = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+		acc = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a + i),
+			_mm512_maskz_loadu_pd(m, b + i), acc);
+	}
+	return _mm512_reduce_add_pd(acc);
+}
+
+__attribute__((target("avx512f")))
+void _rank1_avx512(int rows, int cols, const double *x, const double *g,
+	double *w, double scale) {
+	for(int i = 0; i < rows; i++) {
+		__m512d sxi = _mm512_set1_pd(-scale * x[i]);
+		double *wi = w + (size_t) i * cols;
+		for(int j = 0; j < cols; j += 8) {
+			__mmask8 m = cols - j >= 8 ? 0xFF : (1 << (cols - j)) - 1;
+			__m512d upd = _mm512_fmadd_pd(sxi, _mm512_maskz_loadu_pd(m, g + j),
+				_mm512_maskz_loadu_pd(m, wi + j));
+			_mm512_mask_storeu_pd(wi + j, m, upd);
+		}
+	}
+}
+
+// The float kernels: sixteen floats per register. Eight floats widen into a
+// full register of doubles, so the mixed kernels (and the sigmoids) work eight
+// at a time.
+__attribute__((target("avx512f")))
+void _matvec_f32_avx512(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	int j = 0;
+	for(; j + 64 <= cols; j += 64) {
+		__m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+		__m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+		for(int i = 0; i < rows; i++) {
+			__m512 xi = _mm512_set1_ps(x[i]);
+			const float *wi = w + (size_t) i * cols + j;
+			acc0 = _mm512_fmadd_ps(xi, _mm512_loadu_ps(wi), acc0);
+			acc1 = _mm512_fmadd_ps(xi, _mm512_loadu_ps(wi + 16), acc1);
+			acc2 = _mm512_fmadd_ps(xi, _mm512_loadu_ps(wi + 32), acc2);
+			acc3 = _mm512_fmadd_ps(xi, _mm512_loadu_ps(wi + 48), acc3);
+		}
+		_mm512_storeu_ps(out + j, acc0);
+		_mm512_storeu_ps(out + j + 16, acc1);
+		_mm512_storeu_ps(out + j + 32, acc2);
+		_mm512_storeu_ps(out + j + 48, acc3);
+	}
+	// Narrower blocks don't have enough accumulators to hide the latency of the
+	// fused multiply-adds, so give them two sets, for even and odd rows
+	for(; j + 32 <= cols; j += 32) {
+		__m512 even0 = _mm512_setzero_ps(), even1 = _mm512_setzero_ps();
+		__m512 odd0 = _mm512_setzero_ps(), odd1 = _mm512_setzero_ps();
+		int i = 0;
+		for(; i + 2 <= rows; i += 2) {
+			__m512 xe = _mm512_set1_ps(x[i]);
+			__m512 xo = _mm512_set1_ps(x[i + 1]);
+			const float *wi = w + (size_t) i * cols + j;
+			even0 = _mm512_fmadd_ps(xe, _mm512_loadu_ps(wi), even0);
+			even1 = _mm512_fmadd_ps(xe, _mm512_loadu_ps(wi + 16), even1);
+			odd0 = _mm512_fmadd_ps(xo, _mm512_loadu_ps(wi + cols), odd0);
+			odd1 = _mm512_fmadd_ps(xo, _mm512_loadu_ps(wi + cols + 16), odd1);
+		}
+		if(i < rows) {
+			__m512 xe = _mm512_set1_ps(x[i]);
+			const float *wi = w + (size_t) i * cols + j;
+			even0 = _mm512_fmadd_ps(xe, _mm512_loadu_ps(wi), even0);
+			even1 = _mm512_fmadd_ps(xe, _mm512_loadu_ps(wi + 16), even1);
+		}
+		_mm512_storeu_ps(out + j, _mm512_add_ps(even0, odd0));
+		_mm512_storeu_ps(out + j + 16, _mm512_add_ps(even1, odd1));
+	}
+	for(; j < cols; j += 16) {
+		__mmask16 m = cols - j >= 16 ? 0xFFFF : (1 << (cols - j)) - 1;
+		__m512 even = _mm512_setzero_ps(), odd = _mm512_setzero_ps();
+		int i = 0;
+		for(; i + 2 <= rows; i += 2) {
+			const float *wi = w + (size_t) i * cols + j;
+			even = _mm512_fmadd_ps(_mm512_set1_ps(x[i]),
+				_mm512_maskz_loadu_ps(m, wi), even);
+			odd = _mm512_fmadd_ps(_mm512_set1_ps(x[i + 1]),
+				_mm512_maskz_loadu_ps(m, wi + cols), odd);
+		}
+		if(i < rows) {
+			even = _mm512_fmadd_ps(_mm512_set1_ps(x[i]),
+				_mm512_maskz_loadu_ps(m, w + (size_t) i * cols + j), even);
+		}
+		_mm512_mask_storeu_ps(out + j, m, _mm512_add_ps(even, odd));
+	}
+}
+
+// Loads eight floats widened to doubles, or only as many as m says for the
+// last few. Whole groups of eight go through plain 256-bit loads and stores:
+// a masked store followed by a load of part of it can't be forwarded, and
+// costs a pipeline stall.
+__attribute__((target("avx512f")))
+static inline __m512d _load_widen_avx512(__mmask16 m, const float *p) {
+	if(m == 0xFF) return _mm512_cvtps_pd(_mm256_loadu_ps(p));
+	return _mm512_cvtps_pd(_mm512_castps512_ps256(_mm512_maskz_loadu_ps(m, p)));
+}
+
+// Stores eight doubles narrowed to floats, or only as many as m says
+__attribute__((target("avx512f")))
+static inline void _store_narrow_avx512(float *p, __mmask16 m, __m512d v) {
+	if(m == 0xFF) _mm256_storeu_ps(p, _mm512_cvtpd_ps(v));
+	else _mm512_mask_storeu_ps(p, m, _mm512_castps256_ps512(_mm512_cvtpd_ps(v)));
+}
+
+__attribute__((target("avx512f")))
+void _matvec_mixed_avx512(int rows, int cols, const float *x, const float *w,
+	float *out) {
+	int j = 0;
+	for(; j + 32 <= cols; j += 32) {
+		__m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+		__m512d acc2 = _mm512_setzero_pd(), acc3 = _mm512_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			__m512d xi = _mm512_set1_pd(x[i]);
+			const float *wi = w + (size_t) i * cols + j;
+			acc0 = _mm512_fmadd_pd(xi, _mm512_cvtps_pd(_mm256_loadu_ps(wi)), acc0);
+			acc1 = _mm512_fmadd_pd(xi, _mm512_cvtps_pd(_mm256_loadu_ps(wi + 8)),
+				acc1);
+			acc2 = _mm512_fmadd_pd(xi, _mm512_cvtps_pd(_mm256_loadu_ps(wi + 16)),
+				acc2);
+			acc3 = _mm512_fmadd_pd(xi, _mm512_cvtps_pd(_mm256_loadu_ps(wi + 24)),
+				acc3);
+		}
+		_mm256_storeu_ps(out + j, _mm512_cvtpd_ps(acc0));
+		_mm256_storeu_ps(out + j + 8, _mm512_cvtpd_ps(acc1));
+		_mm256_storeu_ps(out + j + 16, _mm512_cvtpd_ps(acc2));
+		_mm256_storeu_ps(out + j + 24, _mm512_cvtpd_ps(acc3));
+	}
+	for(; j < cols; j += 8) {
+		__mmask16 m = cols - j >= 8 ? 0xFF : (1 << (cols - j)) - 1;
+		__m512d acc = _mm512_setzero_pd();
+		for(int i = 0; i < rows; i++) {
+			acc = _mm512_fmadd_pd(_mm512_set1_pd(x[i]),
+				_load_widen_avx512(m, w + (size_t) i * cols + j), acc);
+		}
+		_store_narrow_avx512(out + j, m, acc);
+	}
+}
+
+__attribute__((target("avx512f")))
+void _sigmoid_f32_avx512(int n, float *a, const float *b) {
+	__m512d one = _mm512_set1_pd(1.0);
+	for(int i = 0; i < n; i += 8) {
+		__mmask16 m = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+		__m512d v = _mm512_add_pd(_load_widen_avx512(m, a + i),
+			_load_widen_avx512(m, b + i));
+		__m512d e = _exp_avx512(_mm512_sub_pd(_mm512_setzero_pd(), v));
+		_store_narrow_avx512(a + i, m, _mm512_div_pd(one, _mm512_add_pd(one, e)));
+	}
+}
+
+__attribute__((target("avx512f")))
+void _sigmoid_fast_f32_avx512(int n, float *a, const float *b) {
+	__m512d one = _mm512_set1_pd(1.0);
+	for(int i = 0; i < n; i += 8) {
+		__mmask16 m = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+		__m512d v = _mm512_add_pd(_load_widen_avx512(m, a + i),
+			_load_widen_avx512(m, b + i));
+		__m512d e = _exp_fast_avx512(_mm512_sub_pd(_mm512_setzero_pd(), v));
+		_store_narrow_avx512(a + i, m, _mm512_div_pd(one, _mm512_add_pd(one, e)));
+	}
+}
+
+__attribute__((target("avx512f")))
+double _dot_f32_avx512(int n, const float *a, const float *b) {
+	__m512 acc = _mm512_setzero_ps();
+	for(int i = 0; i < n; i += 16) {
+		__mmask16 m = n - i >= 16 ? 0xFFFF : (1 << (n - i)) - 1;
+		acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i),
+			_mm512_maskz_loadu_ps(m, b + i), acc);
+	}
+	return _mm512_reduce_add_ps(acc);
+}
+
+__attribute__((target("avx512f")))
+double _dot_mixed_avx512(int n, const float *a, const float *b) {
+	__m512d acc = _mm512_setzero_pd();
+	for(int i = 0; i < n; i += 8) {
+		__mmask16 m = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+		acc = _mm512_fmadd_pd(_load_widen_avx512(m, a + i),
+			_load_widen_avx512(m, b + i), acc);
+	}
+	return _mm512_reduce_add_pd(acc);
+}
+
+__attribute__((target("avx512f")))
+void _rank1_f32_avx512(int rows, int cols, const float *x, const float *g,
+	float *w, float scale) {
+	for(int i = 0; i < rows; i++) {
+		__m512 sxi = _mm512_set1_ps(-scale * x[i]);
+		float *wi = w + (size_t) i * cols;
+		for(int j = 0; j < cols; j += 16) {
+			__mmask16 m = cols - j >= 16 ? 0xFFFF : (1 << (cols - j)) - 1;
+			__m512 upd = _mm512_fmadd_ps(sxi, _mm512_maskz_loadu_ps(m, g + j),
+				_mm512_maskz_loadu_ps(m, wi + j));
+			_mm512_mask_storeu_ps(wi + j, m, upd);
+		}
+	}
+}
+
+// _madd_i8_avx2 twice as wide: 16 columns per register. The 16 bit arithmetic
+// takes AVX-512BW, and so do the masked byte loads for the leftovers: m has a
+// bit for each weight to load, two per column.
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i _madd_i8_avx512(__mmask64 m, const int8_t *w,
+	__m512i pair) {
+	__m256i v = m == ~0ULL ? _mm256_loadu_si256((const __m256i*) w)
+		: _mm512_castsi512_si256(_mm512_maskz_loadu_epi8(m, w));
+	return _mm512_madd_epi16(_mm512_cvtepi8_epi16(v), pair);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i _pair_i8_avx512(const int8_t *x, int i) {
+	return _mm512_cvtepi8_epi16(_mm256_broadcastw_epi16(_mm_loadu_si16(x + i)));
+}
+
+// Stores the first n of 16 sums, converted to floats and scaled
+__attribute__((target("avx512f,avx512bw")))
+static inline void _store_scaled_avx512(float *out, const float *scale,
+	__mmask16 m, __m512i acc) {
+	__m512 v = _mm512_mul_ps(_mm512_cvtepi32_ps(acc),
+		_mm512_maskz_loadu_ps(m, scale));
+	_mm512_mask_storeu_ps(out, m, v);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void _matvec_i8_avx512(int rows, int cols, const int8_t *x, const int8_t *w,
+	const float *scale, float *out) {
+	__mmask64 all = ~0ULL;
+	int j = 0;
+	for(; j + 64 <= cols; j += 64) {
+		__m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+		__m512i acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+		for(int i = 0; i < rows; i += 2) {
+			__m512i pair = _pair_i8_avx512(x, i);
+			const int8_t *wi = w + (size_t) i * cols + 2 * j;
+			acc0 = _mm512_add_epi32(acc0, _madd_i8_avx512(all, wi, pair));
+			acc1 = _mm512_add_epi32(acc1, _madd_i8_avx512(all, wi + 32, pair));
+			acc2 = _mm512_add_epi32(acc2, _madd_i8_avx512(all, wi + 64, pair));
+			acc3 = _mm512_add_epi32(acc3, _madd_i8_avx512(all, wi + 96, pair));
+		}
+		_store_scaled_avx512(out + j, scale + j, 0xFFFF, acc0);
+		_store_scaled_avx512(out + j + 16, scale + j + 16, 0xFFFF, acc1);
+		_store_scaled_avx512(out + j + 32, scale + j + 32, 0xFFFF, acc2);
+		_store_scaled_avx512(out + j + 48, scale + j + 48, 0xFFFF, acc3);
+	}
+	// 16 columns at a time, two blocks at once while there are two, so there
+	// are still two independent sums
+	for(; j < cols; j += 32) {
+		int left0 = cols - j >= 16 ? 16 : cols - j;
+		int left1 = cols - j - 16 >= 16 ? 16 : cols - j - 16;
+		__mmask64 m0 = left0 == 16 ? all : (1ULL << (2 * left0)) - 1;
+		__mmask64 m1 = left1 == 16 ? all
+			: left1 > 0 ? (1ULL << (2 * left1)) - 1 : 0;
+		__m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+		for(int i = 0; i < rows; i += 2) {
+			__m512i pair = _pair_i8_avx512(x, i);
+			const int8_t *wi = w + (size_t) i * cols + 2 * j;
+			acc0 = _mm512_add_epi32(acc0, _madd_i8_avx512(m0, wi, pair));
+			if(m1) {
+				acc1 = _mm512_add_epi32(acc1, _madd_i8_avx512(m1, wi + 32, pair));
+			}
+		}
+		_store_scaled_avx512(out + j, scale + j, (1 << left0) - 1, acc0);
+		if(m1) {
+			_store_scaled_avx512(out + j + 16, scale + j + 16, (1 << left1) - 1,
+				acc1);
+		}
+	}
+}
+
+// 8 at a time: rounded to int32, then narrowed to bytes with vpmovdb, with
+// masks for the leftovers
+__attribute__((target("avx512f,avx512bw")))
+void _quantize_i8_avx512(int n, const double *x, const float *scale,
+	int8_t *out) {
+	__m512d hi = _mm512_set1_pd(127.0), lo = _mm512_set1_pd(-127.0);
+	for(int i = 0; i < n; i += 8) {
+		__mmask8 m = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+		__m512d v = _mm512_mul_pd(_mm512_maskz_loadu_pd(m, x + i),
+			_load_widen_avx512(m, scale + i));
+		v = _mm512_max_pd(_mm512_min_pd(v, hi), lo);
+		__m512i q = _mm512_castsi256_si512(_mm512_cvtpd_epi32(v));
+		_mm512_mask_cvtepi32_storeu_epi8(out + i, m, q);
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline void _mulhilo_avx512(__m512i c, __m512i m, __m512i *hi,
+	__m512i *lo) {
+	__m512i low = _mm512_set1_epi64(0xFFFFFFFF);
+	__m512i even = _mm512_mul_epu32(c, m);
+	__m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(c, 32), m);
+	*lo = _mm512_or_si512(_mm512_and_si512(even, low),
+		_mm512_slli_epi64(odd, 32));
+	*hi = _mm512_or_si512(_mm512_srli_epi64(even, 32),
+		_mm512_andnot_si512(low, odd));
+}
+
+// 16 blocks at a time, the same way as the SSE2 version, with a three-way xor
+// in one vpternlogd
+__attribute__((target("avx512f")))
+void _philox_avx512(int blocks, const uint32_t *key, uint64_t stream,
+	uint64_t block, uint32_t *out) {
+	__m512i m0 = _mm512_set1_epi32(_PHILOX_M0);
+	__m512i m1 = _mm512_set1_epi32(_PHILOX_M1);
+	uint32_t words[64];
+	int b = 0;
+	for(; b + 16 <= blocks; b += 16) {
+		_philox_lanes(16, block + b, words, words + 16);
+		__m512i c0 = _mm512_loadu_si512(words);
+		__m512i c1 = _mm512_loadu_si512(words + 16);
+		__m512i c2 = _mm512_set1_epi32((uint32_t) stream);
+		__m512i c3 = _mm512_set1_epi32(stream >> 32);
+		__m512i k0 = _mm512_set1_epi32(key[0]), k1 = _mm512_set1_epi32(key[1]);
+		for(int r = 0; r < _PHILOX_ROUNDS; r++) {
+			if(r) {
+				k0 = _mm512_add_epi32(k0, _mm512_set1_epi32(_PHILOX_W0));
+				k1 = _mm512_add_epi32(k1, _mm512_set1_epi32(_PHILOX_W1));
+			}
+			__m512i hi0, lo0, hi1, lo1;
+			_mulhilo_avx512(c0, m0, &hi0, &lo0);
+			_mulhilo_avx512(c2, m1, &hi1, &lo1);
+			c0 = _mm512_ternarylogic_epi32(hi1, c1, k0, 0x96);
+			c1 = lo1;
+			c2 = _mm512_ternarylogic_epi32(hi0, c3, k1, 0x96);
+			c3 = lo0;
+		}
+		_mm512_storeu_si512(words, c0);
+		_mm512_storeu_si512(words + 16, c1);
+		_mm512_storeu_si512(words + 32, c2);
+		_mm512_storeu_si512(words + 48, c3);
+		_philox_interleave(16, words, out + 4 * b);
+	}
+	_philox_scalar(blocks - b, key, stream, block + b, out + 4 * b);
+}
+
+const kernels kernels_avx512 = {
+	"avx512", _matvec_avx512, _sigmoid_avx512, _sigmoid_fast_avx512, _dot_avx512,
+	_rank1_avx512, _matvec_f32_avx512, _matvec_mixed_avx512, _sigmoid_f32_avx512,
+	_sigmoid_fast_f32_avx512, _dot_f32_avx512, _dot_mixed_avx512,
+	_rank1_f32_avx512, _matvec_i8_avx512, _quantize_i8_avx512, _philox_avx512
+};
+
+int kernels_supported(const kernels *k) {
+	__builtin_cpu_init();
+	if(k == &kernels_avx512) {
+		return __builtin_cpu_supports("avx512f")
+			&& __builtin_cpu_supports("avx512bw");
+	}
+	if(k == &kernels_avx2) {
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	}
+	return 1;
+}
+
+#else
+
+// Nothing but the scalar kernels off x86-64
+const kernels kernels_sse2 = {
+	"sse2", _matvec_scalar, _sigmoid_scalar, _sigmoid_fast_scalar, _dot_scalar,
+	_rank1_scalar, _matvec_f32_scalar, _matvec_mixed_scalar, _sigmoid_f32_scalar,
+	_sigmoid_fast_f32_scalar, _dot_f32_scalar, _dot_mixed_scalar,
+	_rank1_f32_scalar, _matvec_i8_scalar, _quantize_i8_scalar, _philox_scalar
+};
+const kernels kernels_avx2 = {
+	"avx2", _matvec_scalar, _sigmoid_scalar, _sigmoid_fast_scalar, _dot_scalar,
+	_rank1_scalar, _matvec_f32_scalar, _matvec_mixed_scalar, _sigmoid_f32_scalar,
+	_sigmoid_fast_f32_scalar, _dot_f32_scalar, _dot_mixed_scalar,
+	_rank1_f32_scalar, _matvec_i8_scalar, _quantize_i8_scalar, _philox_scalar
+};
+const kernels kernels_avx512 = {
+	"avx512", _matvec_scalar, _sigmoid_scalar, _sigmoid_fast_scalar,
+	_dot_scalar, _rank1_scalar, _matvec_f32_scalar, _matvec_mixed_scalar,
+	_sigmoid_f32_scalar, _sigmoid_fast_f32_scalar, _dot_f32_scalar,
+	_dot_mixed_scalar, _rank1_f32_scalar, _matvec_i8_scalar,
+	_quantize_i8_scalar, _philox_scalar
+};
+
+int kernels_supported(const kernels *k) {
+	return k == &kernels_scalar;
+}
+
+#endif
+
+const kernels *kern = &kernels_scalar;
+
+// Pick the best supported table before main runs, so kern is ready by the time
+// anyone builds a network.
+__attribute__((constructor))
+void _select_kernels() {
+	if(kernels_supported(&kernels_avx512)) kern = &kernels_avx512;
+	else if(kernels_supported(&kernels_avx2)) kern = &kernels_avx2;
+	else if(kernels_supported(&kernels_sse2)) kern = &kernels_sse2;
+}
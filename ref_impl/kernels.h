@@ -0,0 +1,116 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include <stdint.h>
+#include "util.h"
+
+/**
+ * The inner loops of the network, pulled out so they can be implemented once
+ * per instruction set. A `kernels` struct is a table of implementations for
+ * one instruction set; `kern` points at the best one the CPU we are running
+ * on supports, chosen once at startup from CPUID. The scalar table is always
+ * available and is the reference the SIMD tables are checked against.
+ *
+ * All matrices are row-major, of doubles for the kernels networks use by
+ * default, and of floats for the _f32 and _mixed kernels that float networks
+ * use. The _mixed kernels take floats, but sum in doubles. The _i8 kernels are
+ * for the quantized models in quant.h.
+ */
+typedef struct kernels {
+	// Human readable name of the instruction set, for logging.
+	char *name;
+
+	// out[j] = sum over i of x[i] * w[i * cols + j], for j < cols. This is the
+	// input-to-hidden product of the forward pass.
+	void (*matvec)(int rows, int cols, const double *x, const double *w,
+		double *out);
+
+	// a[i] = sigmoid(a[i] + b[i]), for i < n. The SIMD versions evaluate exp
+	// with a vectorized Cephes-style approximation, accurate to a couple of ulp.
+	void (*sigmoid)(int n, double *a, const double *b);
+
+	// Same as sigmoid, but with a cheaper polynomial exp that is only accurate
+	// to about 5e-8. The scalar version uses the same polynomial.
+	void (*sigmoid_fast)(int n, double *a, const double *b);
+
+	// Returns the sum over i of a[i] * b[i], for i < n.
+	double (*dot)(int n, const double *a, const double *b);
+
+	// w[i * cols + j] -= scale * (x[i] * g[j]), for i < rows, j < cols. This is
+	// the input-to-hidden weight update of the backward pass.
+	void (*rank1)(int rows, int cols, const double *x, const double *g,
+		double *w, double scale);
+
+	// matvec on floats, summing in floats
+	void (*matvec_f32)(int rows, int cols, const float *x, const float *w,
+		float *out);
+
+	// matvec on floats, summing each column in a double and rounding it to a
+	// float at the end
+	void (*matvec_mixed)(int rows, int cols, const float *x, const float *w,
+		float *out);
+
+	// sigmoid and sigmoid_fast on floats. exp itself is still evaluated in
+	// doubles, with the same accuracy as the double versions, and the result
+	// rounded to a float.
+	void (*sigmoid_f32)(int n, float *a, const float *b);
+	void (*sigmoid_fast_f32)(int n, float *a, const float *b);
+
+	// dot on floats, summing in floats
+	double (*dot_f32)(int n, const float *a, const float *b);
+
+	// dot on floats, summing in doubles
+	double (*dot_mixed)(int n, const float *a, const float *b);
+
+	// rank1 on floats
+	void (*rank1_f32)(int rows, int cols, const float *x, const float *g,
+		float *w, float scale);
+
+	// out[j] = scale[j] * (sum over i of x[i] * w_ij), for j < cols, with the
+	// sum done exactly in int32 and then converted to a float, so every table
+	// gives the same result. This is the input-to-hidden product of the
+	// quantized models in quant.h. rows must be even (pad x and w with zeros),
+	// and w is row-major like matvec's, but with each pair of rows interleaved:
+	// w_ij and w_(i+1)j, for even i, are w[i * cols + 2 * j] and the byte after
+	// it. That is the order vpmaddwd wants, so the SIMD versions need no
+	// horizontal sums.
+	void (*matvec_i8)(int rows, int cols, const int8_t *x, const int8_t *w,
+		const float *scale, float *out);
+
+	// out[i] = x[i] * scale[i] rounded to the nearest integer (ties to even)
+	// and clamped to +-127, for i < n
+	void (*quantize_i8)(int n, const double *x, const float *scale,
+		int8_t *out);
+
+	// out[4 * b + i] = word i of the Philox4x32-10 block under the given
+	// two-word key whose four counter words are block + b and then stream, each
+	// low word first, for b < blocks. This is the generator behind rng.h; it is
+	// all integer arithmetic, so every table gives the same words.
+	void (*philox)(int blocks, const uint32_t *key, uint64_t stream,
+		uint64_t block, uint32_t *out);
+} kernels;
+
+/**
+ * The kernel tables we know about, from least to most capable. The AVX-512
+ * table needs AVX-512BW as well as AVX-512F. The SIMD tables are x86-64 only;
+ * elsewhere they are stand-ins for the scalar table that kernels_supported
+ * always turns down.
+ */
+extern const kernels kernels_scalar;
+extern const kernels kernels_sse2;
+extern const kernels kernels_avx2;
+extern const kernels kernels_avx512;
+
+/**
+ * The kernel table in use. Starts out as the best table this CPU supports;
+ * can be pointed at another supported table, e.g. for benchmarking.
+ */
+extern const kernels *kern;
+
+/**
+ * Returns 1 if the CPU we are running on can run the given kernel table, 0
+ * otherwise.
+ */
+int kernels_supported(const kernels *k);
+
+#endif
@@ -1,8 +1,19 @@
 #include "nn.h"
 
-// old friend sigmoid
-double _sigmoid(double x) {
-	return 1.0 / (1.0 + exp(-x));
+// old friend sigmoid, applied to a whole layer: a[i] = sigmoid(a[i] + b[i]).
+// Which kernel does the work depends on the accuracy tier the network was
+// set up with.
+void _activate(const nn *net, int n, double *a, const double *b) {
+	if(net->sigmoid == NN_SIGMOID_EXACT) kernels_scalar.sigmoid(n, a, b);
+	else if(net->sigmoid == NN_SIGMOID_FAST) kern->sigmoid_fast(n, a, b);
+	else kern->sigmoid(n, a, b);
+}
+
+// _activate for float and mixed networks
+void _activate_f32(const nn *net, int n, float *a, const float *b) {
+	if(net->sigmoid == NN_SIGMOID_EXACT) kernels_scalar.sigmoid_f32(n, a, b);
+	else if(net->sigmoid == NN_SIGMOID_FAST) kern->sigmoid_fast_f32(n, a, b);
+	else kern->sigmoid_f32(n, a, b);
 }
 
 // This formula is used fairly often throughout, so just decided to pull it into
@@ -17,32 +28,186 @@ size_t _compute_mem_reqs(int input_size, int hidden_size) {
 	return sizeof(double) * hidden_size * (input_size + 3);
 }
 
+// What we actually mmap: the block above, followed by room for the hidden
+// layer deltas (d1) that nn_backward works in. d1 is never saved.
+size_t _compute_alloc_reqs(int input_size, int hidden_size) {
+	return _compute_mem_reqs(input_size, hidden_size)
+		+ sizeof(double) * hidden_size;
+}
+
+// The number of trainable parameters: |w01| + |b1| + |w12| + |b2|
+size_t _param_count(const nn *net) {
+	return (size_t) net->hidden_size * (net->input_size + 2) + 1;
+}
+
+// How many arrays of per-parameter state an optimizer keeps
+int _state_slots(nn_optimizer optimizer) {
+	if(optimizer == NN_OPTIMIZER_ADAM) return 2;
+	if(optimizer == NN_OPTIMIZER_SGD) return 0;
+	return 1;
+}
+
+// The size of a network's whole mapping: the parameters and d1, then the
+// optimizer state and a gradient's worth of scratch if it has any. Float
+// networks keep the same arrays in floats, and never have optimizer state.
+size_t _block_size(const nn *net) {
+	size_t size = _compute_alloc_reqs(net->input_size, net->hidden_size);
+	if(net->precision != NN_PRECISION_DOUBLE) {
+		return size / sizeof(double) * sizeof(float);
+	}
+	int slots = _state_slots(net->optim.optimizer);
+	if(slots) size += (slots + 1) * _param_count(net) * sizeof(double);
+	return size;
+}
+
+// The size of one entry of the network's arrays
+size_t _elem_size(const nn *net) {
+	return net->precision == NN_PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
+}
+
+// The start of the network's block, whatever its precision
+void *_block(const nn *net) {
+	if(net->precision == NN_PRECISION_DOUBLE) return net->w01;
+	return net->w01_f32;
+}
+
+// Sets up the pointers into a block, starting with w01 or w01_f32 depending on
+// the precision. The pointers for the other precision are all NULL.
+void _set_pointers(nn *net, void *block) {
+	net->w01 = net->b1 = net->o1 = net->w12 = net->d1 = net->opt_state = NULL;
+	net->w01_f32 = net->b1_f32 = net->o1_f32 = net->w12_f32 = net->d1_f32 = NULL;
+	if(net->precision != NN_PRECISION_DOUBLE) {
+		net->w01_f32 = (float*) block;
+		net->b1_f32 = net->w01_f32 + net->input_size * net->hidden_size;
+		net->o1_f32 = net->b1_f32 + net->hidden_size;
+		net->w12_f32 = net->o1_f32 + net->hidden_size;
+		net->d1_f32 = net->w12_f32 + net->hidden_size;
+		return;
+	}
+	net->w01 = (double*) block;
+	net->b1 = net->w01 + net->input_size * net->hidden_size;
+	net->o1 = net->b1 + net->hidden_size;
+	net->w12 = net->o1 + net->hidden_size;
+	net->d1 = net->w12 + net->hidden_size;
+	net->opt_state = _state_slots(net->optim.optimizer)
+		? net->d1 + net->hidden_size : NULL;
+}
+
+// Maps a fresh block for the network, going by its shape, precision and
+// optimizer, and points everything into it, or carves it from the network's
+// arena if it has one. Either way, the block starts out zeroed.
+void _map_block(nn *net, char *failure, int code) {
+	void *block;
+	if(net->_arena) {
+		block = arena_alloc(net->_arena, _block_size(net));
+	} else {
+		block = mmap(NULL, _block_size(net), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(block == MAP_FAILED) {
+			printf("%s\n", failure);
+			exit(code);
+		}
+		advise_huge_pages(block, _block_size(net));
+	}
+	_set_pointers(net, block);
+	net->_file = NULL;
+	net->_file_size = 0;
+}
+
+// Entry k of the block, whatever the precision
+static inline double _param(const nn *net, size_t k) {
+	return net->w01 ? net->w01[k] : net->w01_f32[k];
+}
+
+static inline void _set_param(nn *net, size_t k, double v) {
+	if(net->w01) net->w01[k] = v;
+	else net->w01_f32[k] = v;
+}
+
 // Zero out all of the outputs in the network before each forward pass
 void _zero_outputs(nn *net) {
 	net->o2 = 0.0;
+	size_t o1 = (size_t) net->hidden_size * (net->input_size + 1);
 	for(int i = 0; i < net->hidden_size; i++) {
-		net->o1[i] = 0.0;
+		_set_param(net, o1 + i, 0.0);
 	}
 }
 
-// Helper fn to generate a random double between 0 and 1. I don't know if this
-// is uniformly distributed, but if it isn't, I'm not about to implement a
-// uniformly distributed RNG
-double _random_01() {
-	return ((double) rand() / RAND_MAX);
+// The weight between input j and hidden neuron i is w01[j * s_in + i * s_hid].
+// Code that has to work with either layout goes through these strides instead
+// of hard-coding the index.
+void _w01_strides(const nn *net, size_t *s_in, size_t *s_hid) {
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		*s_in = 1;
+		*s_hid = net->input_size;
+	} else {
+		*s_in = net->hidden_size;
+		*s_hid = 1;
+	}
 }
 
 // Helper function called by nn_init to randomize all of the weights of a
-// network. Necessary to establish independence between all of the neurons
-void _random_weights(nn *net) {
+// network. Necessary to establish independence between all of the neurons.
+// Weights are drawn in the same order whatever the layout, so both layouts
+// start from the same network: for each hidden neuron, its input weights, its
+// bias and its output weight, which rng_fill draws a neuron at a time.
+void _random_weights(nn *net, rng *r) {
+	size_t s_in, s_hid;
+	_w01_strides(net, &s_in, &s_hid);
+	size_t b1 = (size_t) net->input_size * net->hidden_size;
+	size_t w12 = b1 + 2 * net->hidden_size;
+	double *row = _thread_scratch(net->input_size + 2);
 	for(int i = 0; i < net->hidden_size; i++) {
+		rng_fill(r, net->input_size + 2, row);
 		for(int j = 0; j < net->input_size; j++) {
-			net->w01[j * net->hidden_size + i] = _random_01();
+			_set_param(net, j * s_in + i * s_hid, row[j]);
 		}
-		net->b1[i] = _random_01();
-		net->w12[i] = _random_01();
+		_set_param(net, b1 + i, row[net->input_size]);
+		_set_param(net, w12 + i, row[net->input_size + 1]);
+	}
+	net->b2 = rng_double(r);
+}
+
+void nn_default_options(nn_options *opts) {
+	opts->sigmoid = NN_SIGMOID_ACCURATE;
+	opts->layout = NN_LAYOUT_INPUT_MAJOR;
+	opts->optim.optimizer = NN_OPTIMIZER_SGD;
+	opts->optim.momentum = 0.9;
+	opts->optim.beta2 = 0.999;
+	opts->optim.epsilon = 1e-8;
+	opts->optim.schedule = NN_SCHEDULE_CONSTANT;
+	opts->optim.warmup_epochs = 0;
+	opts->optim.step_epochs = 10;
+	opts->optim.step_gamma = 0.5;
+	opts->optim.cosine_epochs = 100;
+	opts->optim.min_rate = 0;
+	opts->precision = NN_PRECISION_DOUBLE;
+	opts->load = NN_LOAD_COPY;
+	opts->rng = NULL;
+	opts->arena = NULL;
+}
+
+// Sets every field of the net struct but the pointers into its block, which
+// nn_init_opts and nn_load_opts get from different places
+void _init_fields(nn *net, int input_size, int hidden_size,
+	double learning_rate, const nn_options *opts) {
+	net->input_size = input_size;
+	net->hidden_size = hidden_size;
+	net->learning_rate = learning_rate;
+	net->sigmoid = opts->sigmoid;
+	net->layout = opts->layout;
+	net->optim = opts->optim;
+	net->rate = learning_rate;
+	net->epoch = 0;
+	net->step = 0;
+	net->precision = opts->precision;
+	net->shape = nn_find_shape(input_size, hidden_size, net->layout);
+	net->_arena = opts->arena;
+	if(net->precision != NN_PRECISION_DOUBLE
+		&& net->optim.optimizer != NN_OPTIMIZER_SGD) {
+		printf("nn_init: float networks only train with SGD\n");
+		exit(45);
 	}
-	net->b2 = _random_01();
 }
 
 /*
@@ -51,55 +216,362 @@ void _random_weights(nn *net) {
  * weights and biases, and initializing everything to expected values
  * (randomizing the weights and biases, zeroing out activations)
  */
-void nn_init(nn *net, int input_size, int hidden_size, double learning_rate) {
-	net->input_size = input_size;
-	net->hidden_size = hidden_size;
-	net->learning_rate = learning_rate;
-	int mem_size = _compute_mem_reqs(input_size, hidden_size);
-	// mmap the required space. w01 will point to the beginning of the block,
-	// but keep in mind that its not the whole block, just the first input*hidden
-	// slots
-	net->w01 = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
-		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	if(net->w01 == MAP_FAILED) {
-		printf("nn_init map failed\n");
-		exit(1);
-	}
-	// set up the other pointers into the block
-	net->b1 = net->w01 + input_size * hidden_size;
-	net->o1 = net->b1 + hidden_size;
-	net->w12 = net->o1 + hidden_size;
+void nn_init_opts(nn *net, int input_size, int hidden_size,
+	double learning_rate, const nn_options *opts) {
+	nn_options defaults;
+	if(opts == NULL) {
+		nn_default_options(&defaults);
+		opts = &defaults;
+	}
+	_init_fields(net, input_size, hidden_size, learning_rate, opts);
+	// mmap the required space, and set up the pointers into it. w01 will point
+	// to the beginning of the block, but keep in mind that its not the whole
+	// block, just the first input*hidden slots. The optimizer state starts out
+	// at zero.
+	_map_block(net, "nn_init map failed", 1);
 	// initialize everything
 	_zero_outputs(net);
-	_random_weights(net);
+	_random_weights(net, opts->rng ? opts->rng : &rng_global);
+}
+
+void nn_init(nn *net, int input_size, int hidden_size, double learning_rate) {
+	nn_init_opts(net, input_size, hidden_size, learning_rate, NULL);
+}
+
+// A new block in the new precision, filled from the old one. Float and mixed
+// networks store the same floats, so going between those is just a relabel.
+void nn_convert(nn *net, nn_precision precision) {
+	int was_double = net->precision == NN_PRECISION_DOUBLE;
+	if(was_double == (precision == NN_PRECISION_DOUBLE)) {
+		net->precision = precision;
+		return;
+	}
+	nn old = *net;
+	net->precision = precision;
+	if(precision != NN_PRECISION_DOUBLE) net->optim.optimizer = NN_OPTIMIZER_SGD;
+	_map_block(net, "nn_convert map failed", 46);
+	size_t n = _compute_mem_reqs(net->input_size, net->hidden_size)
+		/ sizeof(double);
+	for(size_t k = 0; k < n; k++) {
+		_set_param(net, k, _param(&old, k));
+	}
+	nn_destroy(&old);
+}
+
+// The size of the block o1 and d1 live in when the parameters are mapped from
+// a file, followed by the gradient scratch if the optimizer needs it
+size_t _mapped_scratch_size(const nn *net) {
+	size_t size = 2 * (size_t) net->hidden_size * _elem_size(net);
+	if(_state_slots(net->optim.optimizer)) {
+		size += _param_count(net) * sizeof(double);
+	}
+	return size;
 }
 
-// Very simple, just deallocate the pages starting at w01
+// Very simple, just deallocate the pages starting at w01 (or w01_f32), or the
+// file mapping and the scratch beside it
 void nn_destroy(nn *net) {
-	int mem_size = _compute_mem_reqs(net->input_size, net->hidden_size);
-	int err = munmap(net->w01, mem_size);
+	int err = 0;
+	if(net->_file) {
+		void *scratch = net->precision == NN_PRECISION_DOUBLE
+			? (void*) net->o1 : (void*) net->o1_f32;
+		err = munmap(net->_file, net->_file_size)
+			|| munmap(scratch, _mapped_scratch_size(net));
+	} else if(!net->_arena) {
+		err = munmap(_block(net), _block_size(net));
+	}
 	if(err) {
 		perror("nn_destroy munmap");
 		exit(2);
 	}
 }
 
+// Destructor for the per-thread prediction scratch below. The first double of
+// the mapping records its size in bytes.
+void _free_thread_scratch(void *block) {
+	double *base = (double*) block - 1;
+	munmap(base, (size_t) base[0]);
+}
+
+// Key for the per-thread prediction scratch, created once on first use.
+static pthread_key_t _scratch_key;
+static pthread_once_t _scratch_once = PTHREAD_ONCE_INIT;
+
+void _make_scratch_key() {
+	pthread_key_create(&_scratch_key, _free_thread_scratch);
+}
+
+// Returns a buffer of at least n doubles that belongs to the calling thread,
+// growing it when a larger network comes along. Each thread's buffer is its
+// own mapping, so they never share cache lines. The buffer is unmapped when
+// the thread exits.
+double *_thread_scratch(int n) {
+	pthread_once(&_scratch_once, _make_scratch_key);
+	double *block = pthread_getspecific(_scratch_key);
+	if(block != NULL && block[-1] >= (n + 1) * sizeof(double)) return block;
+	if(block != NULL) _free_thread_scratch(block);
+
+	size_t size = (n + 1) * sizeof(double);
+	double *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED) {
+		printf("_thread_scratch map failed\n");
+		exit(25);
+	}
+	base[0] = size;
+	pthread_setspecific(_scratch_key, base + 1);
+	return base + 1;
+}
+
+// _thread_scratch, in floats
+float *_thread_scratch_f32(int n) {
+	return (float*) _thread_scratch((n + 1) / 2);
+}
+
+// Float and mixed networks work on examples in floats, so examples in doubles
+// are converted on the way in, into buf
+const float *_input_f32(const nn *net, const double *x, float *buf) {
+	for(int j = 0; j < net->input_size; j++) {
+		buf[j] = x[j];
+	}
+	return buf;
+}
+
+// Example i of ds in floats: from the dataset's float copy if it has one, or
+// else converted into buf
+const float *_example_f32(const nn *net, const dataset *ds, int i, float *buf) {
+	if(ds->features_f32) return ds_example_f32(ds, i);
+	return _input_f32(net, ds_example(ds, i), buf);
+}
+
+// nn_predict for float and mixed networks, on an example in floats, with the
+// hidden layer going into scratch. The two only differ in which kernels they
+// use: mixed networks sum every dot product in doubles.
+double _predict_f32(const nn *net, const float *x, float *scratch) {
+	int mixed = net->precision == NN_PRECISION_MIXED;
+	int in = net->input_size;
+	int hid = net->hidden_size;
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		for(int i = 0; i < hid; i++) {
+			const float *w = net->w01_f32 + (size_t) i * in;
+			scratch[i] = mixed ? kern->dot_mixed(in, w, x) : kern->dot_f32(in, w, x);
+		}
+	} else if(mixed) {
+		kern->matvec_mixed(in, hid, x, net->w01_f32, scratch);
+	} else {
+		kern->matvec_f32(in, hid, x, net->w01_f32, scratch);
+	}
+	_activate_f32(net, hid, scratch, net->b1_f32);
+	if(mixed) return kern->dot_mixed(hid, scratch, net->w12_f32) + net->b2;
+	return kern->dot_f32(hid, scratch, net->w12_f32) + net->b2;
+}
+
 // Compute a forward pass through the network, pretty much how you would expect.
+// The hidden layer goes into scratch, so the network is only ever read. Each
+// step is one of the kernels, so it runs on the widest SIMD the CPU has. With
+// the hidden-major layout, each hidden neuron's weights are a contiguous row,
+// so its activation is a single dot product with x.
+double nn_predict(const nn *net, const double *x, double *scratch) {
+	if(net->precision != NN_PRECISION_DOUBLE) {
+		// The float example and activations go in scratch of our own, and the
+		// activations are copied out afterwards
+		float *buf = _thread_scratch_f32(net->input_size + net->hidden_size);
+		float *h = buf + net->input_size;
+		double out = _predict_f32(net, _input_f32(net, x, buf), h);
+		for(int i = 0; scratch && i < net->hidden_size; i++) {
+			scratch[i] = h[i];
+		}
+		return out;
+	}
+	if(scratch == NULL) scratch = _thread_scratch(net->hidden_size);
+	if(net->shape) return net->shape->predict(net, x, scratch);
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		for(int i = 0; i < net->hidden_size; i++) {
+			scratch[i] = kern->dot(net->input_size,
+				net->w01 + (size_t) i * net->input_size, x);
+		}
+	} else {
+		kern->matvec(net->input_size, net->hidden_size, x, net->w01, scratch);
+	}
+	_activate(net, net->hidden_size, scratch, net->b1);
+	return kern->dot(net->hidden_size, scratch, net->w12) + net->b2;
+}
+
+void nn_predict_dataset(const nn *net, const dataset *ds, double *out,
+	double *scratch) {
+	if(net->precision != NN_PRECISION_DOUBLE) {
+		float *buf = _thread_scratch_f32(net->input_size + net->hidden_size);
+		for(int i = 0; i < ds->num_examples; i++) {
+			out[i] = _predict_f32(net, _example_f32(net, ds, i, buf),
+				buf + net->input_size);
+		}
+		return;
+	}
+	if(scratch == NULL) scratch = _thread_scratch(net->hidden_size);
+	for(int i = 0; i < ds->num_examples; i++) {
+		out[i] = nn_predict(net, ds_example(ds, i), scratch);
+	}
+}
+
+void nn_predict_matrix(const nn *net, const double *x, int num_rows,
+	double *out, double *scratch) {
+	// Float networks convert each row in scratch of their own anyway
+	if(scratch == NULL && net->precision == NN_PRECISION_DOUBLE) {
+		scratch = _thread_scratch(net->hidden_size);
+	}
+	for(int i = 0; i < num_rows; i++) {
+		out[i] = nn_predict(net, x + (size_t) i * net->input_size, scratch);
+	}
+}
+
+// The training passes need the activations kept around for backprop, so they
+// go into the network's own o1 and o2.
 double nn_forward(nn *net, double *x) {
-	_zero_outputs(net);
-	for(int i = 0; i < net->input_size; i++) {
-		for(int j = 0; j < net->hidden_size; j++) {
-			net->o1[j] += x[i] * net->w01[i*net->hidden_size + j];
+	if(net->precision != NN_PRECISION_DOUBLE) {
+		float *buf = _thread_scratch_f32(net->input_size);
+		net->o2 = _predict_f32(net, _input_f32(net, x, buf), net->o1_f32);
+	} else {
+		net->o2 = nn_predict(net, x, net->o1);
+	}
+	return net->o2;
+}
+
+/*
+ * Applies one optimizer step to count consecutive parameters starting at w.
+ * Their gradients start at g, and are multiplied by scale first (e.g. to
+ * average over a batch); their state starts at entry k of each state array.
+ */
+void _optim_segment(nn *net, double *w, const double *g, double scale,
+	size_t k, size_t count) {
+	double rate = net->rate;
+	double mu = net->optim.momentum;
+	if(net->optim.optimizer == NN_OPTIMIZER_SGD) {
+		for(size_t i = 0; i < count; i++) {
+			w[i] -= rate * scale * g[i];
+		}
+	} else if(net->optim.optimizer == NN_OPTIMIZER_MOMENTUM) {
+		double *v = net->opt_state + k;
+		for(size_t i = 0; i < count; i++) {
+			v[i] = mu * v[i] + scale * g[i];
+			w[i] -= rate * v[i];
+		}
+	} else if(net->optim.optimizer == NN_OPTIMIZER_NESTEROV) {
+		double *v = net->opt_state + k;
+		for(size_t i = 0; i < count; i++) {
+			double gi = scale * g[i];
+			v[i] = mu * v[i] + gi;
+			w[i] -= rate * (gi + mu * v[i]);
+		}
+	} else {
+		double *m = net->opt_state + k;
+		double *v = m + _param_count(net);
+		double beta2 = net->optim.beta2;
+		double eps = net->optim.epsilon;
+		// Both averages start at 0, which biases them low for the first steps;
+		// dividing by 1 - beta^step undoes that
+		double c1 = 1 / (1 - pow(mu, net->step));
+		double c2 = 1 / (1 - pow(beta2, net->step));
+		for(size_t i = 0; i < count; i++) {
+			double gi = scale * g[i];
+			m[i] = mu * m[i] + (1 - mu) * gi;
+			v[i] = beta2 * v[i] + (1 - beta2) * gi * gi;
+			w[i] -= rate * m[i] * c1 / (sqrt(v[i] * c2) + eps);
 		}
 	}
-	for(int i = 0; i < net->hidden_size; i++) {
-		net->o1[i] = _sigmoid(net->o1[i] + net->b1[i]);
+}
+
+/*
+ * Applies the optimizer to gradient entries [start, end), with the gradient
+ * laid out w01, b1, w12, b2. The range is cut where it crosses from one of
+ * those to the next, since they don't sit next to each other in the block.
+ * Working on a range lets parallel trainers split the update between threads.
+ */
+void _apply_gradient_range(nn *net, double *grad, double scale, size_t start,
+	size_t end) {
+	size_t n_w01 = (size_t) net->input_size * net->hidden_size;
+	size_t hid = net->hidden_size;
+	size_t bounds[5] = {0, n_w01, n_w01 + hid, n_w01 + 2 * hid,
+		n_w01 + 2 * hid + 1};
+	double *params[4] = {net->w01, net->b1, net->w12, &net->b2};
+	for(int s = 0; s < 4; s++) {
+		size_t lo = start > bounds[s] ? start : bounds[s];
+		size_t hi = end < bounds[s + 1] ? end : bounds[s + 1];
+		if(lo < hi) {
+			_optim_segment(net, params[s] + (lo - bounds[s]), grad + lo, scale, lo,
+				hi - lo);
+		}
 	}
+}
+
+void _apply_gradient(nn *net, double *grad, double scale) {
+	_apply_gradient_range(net, grad, scale, 0, _param_count(net));
+}
+
+// Where _backward_optim works out the gradient: after the optimizer state, or
+// after d1 for a network mapped from a file, whose optimizer state ends with
+// the file
+double *_grad_scratch(const nn *net) {
+	if(net->_file) return net->d1 + net->hidden_size;
+	return net->opt_state
+		+ _state_slots(net->optim.optimizer) * _param_count(net);
+}
+
+// nn_backward for every optimizer but SGD: work out the whole gradient into its
+// scratch, then hand it to the optimizer. The gradient is the same one plain
+// SGD applies on the fly.
+void _backward_optim(nn *net, double *x, int y) {
+	int in = net->input_size;
+	int hid = net->hidden_size;
+	size_t n = _param_count(net);
+	double *grad = _grad_scratch(net);
+	double *grad_b1 = grad + (size_t) in * hid;
+	double *grad_w12 = grad_b1 + hid;
+
+	double grad_b2 = 2 * (net->o2 - y);
+	for(int i = 0; i < hid; i++) {
+		grad_w12[i] = grad_b2 * net->o1[i];
+		grad_b1[i] = grad_b2 * net->w12[i] * net->o1[i] * (1 - net->o1[i]);
+	}
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		for(int i = 0; i < hid; i++) {
+			for(int j = 0; j < in; j++) {
+				grad[(size_t) i * in + j] = grad_b1[i] * x[j];
+			}
+		}
+	} else {
+		for(int j = 0; j < in; j++) {
+			for(int i = 0; i < hid; i++) {
+				grad[(size_t) j * hid + i] = x[j] * grad_b1[i];
+			}
+		}
+	}
+	grad[n - 1] = grad_b2;
+
+	net->step++;
+	_apply_gradient(net, grad, 1);
+}
+
+// nn_backward for float and mixed networks, with the example in floats. The
+// per-neuron arithmetic is only hidden_size long, so it is done in doubles,
+// and rounded as it is stored; the w01 update is all floats.
+void _backward_f32(nn *net, const float *x, int y) {
+	double grad_b2 = 2 * (net->o2 - y);
+	net->b2 -= net->rate * grad_b2;
 	for(int i = 0; i < net->hidden_size; i++) {
-		net->o2 += net->o1[i] * net->w12[i];
+		double o = net->o1_f32[i];
+		double grad_w12_i = grad_b2 * o;
+		double grad_b1_i = grad_b2 * net->w12_f32[i] * o * (1 - o);
+		net->w12_f32[i] -= net->rate * grad_w12_i;
+		net->b1_f32[i] -= net->rate * grad_b1_i;
+		net->d1_f32[i] = grad_b1_i;
+	}
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		kern->rank1_f32(net->hidden_size, net->input_size, net->d1_f32, x,
+			net->w01_f32, net->rate);
+	} else {
+		kern->rank1_f32(net->input_size, net->hidden_size, x, net->d1_f32,
+			net->w01_f32, net->rate);
 	}
-	net->o2 += net->b2;
-	return net->o2;
 }
 
 /*
@@ -112,102 +584,730 @@ double nn_forward(nn *net, double *x) {
  *
  * grad_b2 = 2 * (o2 - y)
  * grad_w12_i = 2 * (o2 - y) * o1_i
- * grad_b1_i = 2 * (o2 - y) * w12_i * o1_i * (1 - o1_i) (sigmoid derivative here)
+ * grad_b1_i = 2 * (o2 - y) * w12_i * o1_i * (1 - o1_i)
  * grad_w01_ji = 2 * (o2 - y) * w12_i * o1_i * (1 - o1_i) * x_i
+ *
+ * where o1_i * (1 - o1_i) is the sigmoid derivative.
+ *
+ * grad_w01 is the outer product of x and the grad_b1 vector, so we first
+ * collect grad_b1 in d1 and then apply the whole w01 update as one rank-1
+ * kernel, which walks w01 row by row in memory order whatever its layout.
  */
 void nn_backward(nn *net, double *x, int y) {
+	if(net->precision != NN_PRECISION_DOUBLE) {
+		float *buf = _thread_scratch_f32(net->input_size);
+		_backward_f32(net, _input_f32(net, x, buf), y);
+		return;
+	}
+	if(net->optim.optimizer != NN_OPTIMIZER_SGD) {
+		_backward_optim(net, x, y);
+		return;
+	}
+	if(net->shape) {
+		net->shape->backward(net, x, y);
+		return;
+	}
+
 	// update b2
 	double grad_b2 = 2 * (net->o2 - y);
-	net->b2 -= net->learning_rate * grad_b2;
+	net->b2 -= net->rate * grad_b2;
 
-	// update everything else
+	// update w12 and b1, saving each grad_b1_i for the w01 update
 	for(int i = 0; i < net->hidden_size; i++) {
 		double grad_w12_i = grad_b2 * net->o1[i];
 		double grad_b1_i = grad_b2 * net->w12[i] * net->o1[i] * (1 - net->o1[i]);
-		net->w12[i] -= net->learning_rate * grad_w12_i;
-		net->b1[i] -= net->learning_rate * grad_b1_i;
-		for(int j = 0; j < net->input_size; j++) {
-			double grad_w01_ji = x[j] * grad_b1_i;
-			net->w01[j*net->hidden_size + i] -= net->learning_rate * grad_w01_ji;
-		}
+		net->w12[i] -= net->rate * grad_w12_i;
+		net->b1[i] -= net->rate * grad_b1_i;
+		net->d1[i] = grad_b1_i;
+	}
+
+	// update w01, a row at a time in whichever order it is stored
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		kern->rank1(net->hidden_size, net->input_size, net->d1, x, net->w01,
+			net->rate);
+	} else {
+		kern->rank1(net->input_size, net->hidden_size, x, net->d1, net->w01,
+			net->rate);
 	}
 }
 
+// The average loss over just the first count examples of ds
+double _average_loss_prefix(const nn *net, const dataset *ds, int count) {
+	double total_loss = 0;
+	double *scratch = NULL;
+	float *buf = NULL;
+	if(net->precision == NN_PRECISION_DOUBLE) {
+		scratch = _thread_scratch(net->hidden_size);
+	} else {
+		buf = _thread_scratch_f32(net->input_size + net->hidden_size);
+	}
+	for(int i = 0; i < count; i++) {
+		double pred = scratch ? nn_predict(net, ds_example(ds, i), scratch)
+			: _predict_f32(net, _example_f32(net, ds, i, buf), buf + net->input_size);
+		double err = ds_label(ds, i) - pred;
+		total_loss += err*err;
+	}
+	return count ? total_loss / count : 0;
+}
+
 // Pretty much straight up the formula. Accumulate the squared error in
 // total_loss and divide by num_examples at the end to get avg loss
-double nn_average_loss(nn *net, dataset *ds) {
+double nn_average_loss(const nn *net, const dataset *ds) {
+	return _average_loss_prefix(net, ds, ds->num_examples);
+}
+
+// Writes the per-epoch log line. We have to do this convoluted stuff with a
+// writer because we don't have printf in the asm world. The line goes out in
+// one write, and right away, so progress shows as it happens.
+void _log_epoch(int epoch, double loss) {
+	char line[64];
+	writer w;
+	writer_init(&w, STDOUT_FILENO, line, sizeof(line));
+	writer_str(&w, "Epoch ", 6);
+	writer_int(&w, epoch);
+	writer_str(&w, " | Loss: ", 9);
+	writer_double(&w, loss, 10);
+	writer_str(&w, "\n", 1);
+	writer_destroy(&w);
+}
+
+// The learning rate for the network's next epoch, going by its schedule
+double _scheduled_rate(const nn *net) {
+	const nn_optim *o = &net->optim;
+	double base = net->learning_rate;
+	int epoch = net->epoch;
+	if(epoch < o->warmup_epochs) return base * (epoch + 1) / o->warmup_epochs;
+	epoch -= o->warmup_epochs;
+
+	if(o->schedule == NN_SCHEDULE_STEP && o->step_epochs > 0) {
+		return base * pow(o->step_gamma, epoch / o->step_epochs);
+	}
+	if(o->schedule == NN_SCHEDULE_COSINE && o->cosine_epochs > 0) {
+		if(epoch >= o->cosine_epochs) return o->min_rate;
+		return o->min_rate + (base - o->min_rate)
+			* 0.5 * (1 + cos(M_PI * epoch / o->cosine_epochs));
+	}
+	return base;
+}
+
+// Every trainer brackets each epoch with these two, which is what keeps the
+// schedule going, including across nn_save and nn_load
+void _begin_epoch(nn *net) {
+	net->rate = _scheduled_rate(net);
+}
+
+void _end_epoch(nn *net) {
+	net->epoch++;
+}
+
+void nn_default_train_options(nn_train_options *opts) {
+	opts->eval_interval = 0;
+	opts->eval_set = NULL;
+	opts->eval_sample = 0;
+	opts->patience = 0;
+	opts->min_delta = 0;
+	opts->best = NULL;
+	opts->parallel_eval = 0;
+}
+
+// Gives dst a parameter block of its own with the same shape and settings as
+// src, without touching its contents (or the random number generator)
+void _alloc_like(nn *dst, const nn *src) {
+	*dst = *src;
+	_map_block(dst, "nn_train_ex map failed", 41);
+}
+
+// Copies every parameter of src into dst. Both have to be the same shape,
+// layout and precision, since the block is copied as is.
+void _copy_params(nn *dst, const nn *src) {
+	if(dst->input_size != src->input_size || dst->hidden_size != src->hidden_size
+		|| dst->layout != src->layout
+		|| (dst->precision == NN_PRECISION_DOUBLE)
+			!= (src->precision == NN_PRECISION_DOUBLE)) {
+		printf("nn_train_ex: best has a different shape, layout or precision "
+			"than net\n");
+		exit(42);
+	}
+	size_t n = _compute_mem_reqs(src->input_size, src->hidden_size)
+		/ sizeof(double);
+	if(src->precision != NN_PRECISION_DOUBLE) {
+		for(size_t i = 0; i < n; i++) {
+			dst->w01_f32[i] = src->w01_f32[i];
+		}
+	} else {
+		for(size_t i = 0; i < n; i++) {
+			dst->w01[i] = src->w01[i];
+		}
+	}
+	dst->b2 = src->b2;
+}
+
+// _train_epoch for float and mixed networks, which read each example as floats
+// straight from the dataset when it has a float copy
+double _train_epoch_f32(nn *net, dataset *ds) {
 	double total_loss = 0;
-	for(int i = 0; i < ds->num_examples; i++) {
-		double pred = nn_forward(net, ds->examples[i]->example);
-		double err = ds->examples[i]->label - pred;
+	float *buf = _thread_scratch_f32(net->input_size);
+	for(int j = 0; j < ds->num_examples; j++) {
+		const float *x = _example_f32(net, ds, j, buf);
+		int y = ds_label(ds, j);
+		net->o2 = _predict_f32(net, x, net->o1_f32);
+		double err = y - net->o2;
 		total_loss += err*err;
+		_backward_f32(net, x, y);
 	}
-	return total_loss / ds->num_examples;
+	return ds->num_examples ? total_loss / ds->num_examples : 0;
+}
+
+// One epoch of SGD over ds, returning the running loss of the epoch
+double _train_epoch(nn *net, dataset *ds) {
+	if(net->precision != NN_PRECISION_DOUBLE) return _train_epoch_f32(net, ds);
+	double total_loss = 0;
+	for(int j = 0; j < ds->num_examples; j++) {
+		double *x = ds_example(ds, j);
+		int y = ds_label(ds, j);
+		double err = y - nn_forward(net, x);
+		total_loss += err*err;
+		nn_backward(net, x, y);
+	}
+	return ds->num_examples ? total_loss / ds->num_examples : 0;
+}
+
+// Early stopping bookkeeping, shared by both ways of evaluating
+typedef struct _early_stop {
+	const nn_train_options *opts;
+	double best_loss;
+	// Evaluations in a row that didn't beat best_loss by min_delta
+	int stale;
+} _early_stop;
+
+// Records the evaluated loss of the parameters in weights, copying them into
+// opts->best if they are the best so far. Returns 1 if it is time to stop.
+int _track_best(_early_stop *es, const nn *weights, double loss) {
+	if(loss < es->best_loss - es->opts->min_delta) {
+		es->best_loss = loss;
+		es->stale = 0;
+		if(es->opts->best) _copy_params(es->opts->best, weights);
+	} else {
+		es->stale++;
+	}
+	return es->opts->patience > 0 && es->stale >= es->opts->patience;
+}
+
+/*
+ * With parallel_eval, evaluating runs alongside the next epoch on a pool of
+ * two: worker 0 trains while worker 1 evaluates a snapshot of the parameters
+ * as they were at the end of the previous epoch.
+ */
+typedef struct _async_epoch {
+	nn *net;
+	dataset *ds;
+	const nn *snapshot;
+	const dataset *eval_set;
+	int eval_count;
+	// Whether worker 1 has a snapshot to evaluate this time
+	int pending;
+	double train_loss;
+	double eval_loss;
+} _async_epoch;
+
+void _async_epoch_job(void *arg, int worker, int num_workers) {
+	_async_epoch *ae = (_async_epoch*) arg;
+	if(worker == 0) {
+		ae->train_loss = _train_epoch(ae->net, ae->ds);
+	} else if(ae->pending) {
+		ae->eval_loss = _average_loss_prefix(ae->snapshot, ae->eval_set,
+			ae->eval_count);
+	}
+}
+
+// nn_train_ex with parallel_eval. Each evaluation finishes one epoch later
+// than it would otherwise, so its epoch is logged, and stopping decided, then.
+double _train_async(nn *net, dataset *ds, int num_epochs, int interval,
+	const dataset *eval_set, int eval_count, _early_stop *es) {
+	nn snapshot;
+	_alloc_like(&snapshot, net);
+	pool workers;
+	pool_init(&workers, 2);
+	_async_epoch ae;
+	ae.net = net;
+	ae.ds = ds;
+	ae.snapshot = &snapshot;
+	ae.eval_set = eval_set;
+	ae.eval_count = eval_count;
+
+	double loss = 0;
+	int pending_epoch = -1;
+	int stop = 0;
+	for(int i = 0; i < num_epochs && !stop; i++) {
+		ae.pending = pending_epoch >= 0;
+		_begin_epoch(net);
+		pool_run(&workers, _async_epoch_job, &ae);
+		_end_epoch(net);
+		if(ae.pending) {
+			loss = ae.eval_loss;
+			_log_epoch(pending_epoch, loss);
+			stop = _track_best(es, &snapshot, loss);
+			pending_epoch = -1;
+		}
+		if(!stop && ((i + 1) % interval == 0 || i == num_epochs - 1)) {
+			_copy_params(&snapshot, net);
+			pending_epoch = i;
+		} else {
+			loss = ae.train_loss;
+			_log_epoch(i, loss);
+		}
+		ds_shuffle(ds);
+	}
+	// Nothing left to overlap the last evaluation with
+	if(pending_epoch >= 0) {
+		loss = _average_loss_prefix(&snapshot, eval_set, eval_count);
+		_log_epoch(pending_epoch, loss);
+		_track_best(es, &snapshot, loss);
+	}
+
+	pool_destroy(&workers);
+	nn_destroy(&snapshot);
+	return loss;
 }
 
 // For each epoch, do forward and backward pass with all the examples in the
 // training set, and then log useful data to the terminal. Then shuffle the
-// data and go to the next epoch.
-void nn_train(nn *net, dataset *ds, int num_epochs) {
-	// These two variables are just for logging (see next few lines)
-	char buf[32];
-	int sz;
+// data and go to the next epoch. The loss of each example falls out of its
+// forward pass for free, so the logged loss is usually just their average; a
+// separate evaluation pass only runs when the options ask for one.
+double nn_train_ex(nn *net, dataset *ds, int num_epochs,
+	const nn_train_options *opts) {
+	nn_train_options defaults;
+	if(!opts) {
+		nn_default_train_options(&defaults);
+		opts = &defaults;
+	}
+	const dataset *eval_set = opts->eval_set ? opts->eval_set : ds;
+	int eval_count = eval_set->num_examples;
+	if(opts->eval_sample > 0 && opts->eval_sample < eval_count) {
+		eval_count = opts->eval_sample;
+	}
+	// Early stopping needs something to go on
+	int interval = opts->eval_interval;
+	if(interval <= 0 && (opts->patience > 0 || opts->best)) interval = 1;
+
+	_early_stop es;
+	es.opts = opts;
+	es.best_loss = INFINITY;
+	es.stale = 0;
+
+	double loss = 0;
+	if(interval > 0 && opts->parallel_eval) {
+		loss = _train_async(net, ds, num_epochs, interval, eval_set, eval_count,
+			&es);
+	} else {
+		int stop = 0;
+		for(int i = 0; i < num_epochs && !stop; i++) {
+			_begin_epoch(net);
+			loss = _train_epoch(net, ds);
+			_end_epoch(net);
+			if(interval > 0 && ((i + 1) % interval == 0 || i == num_epochs - 1)) {
+				loss = _average_loss_prefix(net, eval_set, eval_count);
+				stop = _track_best(&es, net, loss);
+			}
+			_log_epoch(i, loss);
+			ds_shuffle(ds);
+		}
+	}
+	return opts->patience > 0 || opts->best ? es.best_loss : loss;
+}
+
+double nn_train(nn *net, dataset *ds, int num_epochs) {
+	return nn_train_ex(net, ds, num_epochs, NULL);
+}
+
+// Like nn_train, with one pass through the stream per epoch
+double nn_train_stream(nn *net, ds_stream *s, int num_epochs) {
+	double loss = 0;
+	double *x;
+	int y;
+	for(int i = 0; i < num_epochs; i++) {
+		// Each example's loss is taken just before training on it, since we
+		// can't go back over the file to measure the loss at the end
+		double total_loss = 0;
+		long count = 0;
+		_begin_epoch(net);
+		while(ds_stream_next(s, &x, &y)) {
+			double err = y - nn_forward(net, x);
+			total_loss += err*err;
+			count++;
+			nn_backward(net, x, y);
+		}
+		_end_epoch(net);
+
+		loss = count ? total_loss / count : 0;
+		_log_epoch(i, loss);
+	}
+	return loss;
+}
+
+// The batched, parallel and Hogwild trainers work on the double arrays
+// directly, so they need a double network
+void _require_double(const nn *net, char *trainer) {
+	if(net->precision != NN_PRECISION_DOUBLE) {
+		printf("%s needs a double precision network\n", trainer);
+		exit(45);
+	}
+}
+
+// Tile sizes for the blocked matrix products below. A K-by-N tile of the right
+// hand matrix is 128 * 256 * 8 bytes = 256KB, which sits comfortably in L2
+// while every row of the left hand matrix streams past it.
+static const int _GEMM_BLOCK_K = 128;
+static const int _GEMM_BLOCK_N = 256;
+
+// C (m x n) += A (m x k) * B (k x n), everything row-major with the given
+// leading dimensions. The innermost loop is a contiguous axpy over a row of B
+// and a row of C, which the compiler vectorizes.
+void _gemm(int m, int n, int k, const double *a, int lda, const double *b,
+	int ldb, double *c, int ldc) {
+	for(int k0 = 0; k0 < k; k0 += _GEMM_BLOCK_K) {
+		int k1 = k0 + _GEMM_BLOCK_K < k ? k0 + _GEMM_BLOCK_K : k;
+		for(int n0 = 0; n0 < n; n0 += _GEMM_BLOCK_N) {
+			int n1 = n0 + _GEMM_BLOCK_N < n ? n0 + _GEMM_BLOCK_N : n;
+			for(int i = 0; i < m; i++) {
+				double *ci = c + (size_t) i * ldc;
+				for(int p = k0; p < k1; p++) {
+					double aip = a[(size_t) i * lda + p];
+					const double *bp = b + (size_t) p * ldb;
+					for(int j = n0; j < n1; j++) {
+						ci[j] += aip * bp[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+// C (k x n) += A^T * B, where A is (m x k) and B is (m x n). This is how the
+// w01 gradient falls out of a batch: X^T times the hidden deltas. We block over
+// the rows of C so the tile being accumulated into stays in cache across the
+// whole batch.
+void _gemm_tn(int m, int n, int k, const double *a, int lda, const double *b,
+	int ldb, double *c, int ldc) {
+	for(int k0 = 0; k0 < k; k0 += _GEMM_BLOCK_K) {
+		int k1 = k0 + _GEMM_BLOCK_K < k ? k0 + _GEMM_BLOCK_K : k;
+		for(int n0 = 0; n0 < n; n0 += _GEMM_BLOCK_N) {
+			int n1 = n0 + _GEMM_BLOCK_N < n ? n0 + _GEMM_BLOCK_N : n;
+			for(int i = 0; i < m; i++) {
+				const double *bi = b + (size_t) i * ldb;
+				for(int p = k0; p < k1; p++) {
+					double aip = a[(size_t) i * lda + p];
+					double *cp = c + (size_t) p * ldc;
+					for(int j = n0; j < n1; j++) {
+						cp[j] += aip * bi[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+// C (m x n) += A * B^T, where A is (m x k) and B is (n x k). This is the
+// forward product for the hidden-major layout, where every entry of C is a dot
+// product of two contiguous rows. We block over the rows of B so they stay in
+// cache while every row of A streams past.
+void _gemm_nt(int m, int n, int k, const double *a, int lda, const double *b,
+	int ldb, double *c, int ldc) {
+	for(int n0 = 0; n0 < n; n0 += _GEMM_BLOCK_K) {
+		int n1 = n0 + _GEMM_BLOCK_K < n ? n0 + _GEMM_BLOCK_K : n;
+		for(int i = 0; i < m; i++) {
+			const double *ai = a + (size_t) i * lda;
+			for(int j = n0; j < n1; j++) {
+				c[(size_t) i * ldc + j] += kern->dot(k, ai, b + (size_t) j * ldb);
+			}
+		}
+	}
+}
+
+// The gradient block mirrors the parameters it belongs to: w01, then b1, then
+// w12, then b2, so hidden_size * (input_size + 2) + 1 doubles in total.
+size_t _compute_grad_reqs(int input_size, int hidden_size) {
+	return sizeof(double) * ((size_t) hidden_size * (input_size + 2) + 1);
+}
+
+// Copy examples [start, start + count) of ds into one contiguous row-major
+// block, so the batched products below read dense rows no matter how the
+// dataset has been shuffled.
+void _gather_batch(dataset *ds, int start, int count, double *x, double *y) {
+	int n = ds->num_attributes;
+	for(int b = 0; b < count; b++) {
+		double *src = ds_example(ds, start + b);
+		double *dst = x + (size_t) b * n;
+		for(int i = 0; i < n; i++) {
+			dst[i] = src[i];
+		}
+		y[b] = ds_label(ds, start + b);
+	}
+}
+
+/*
+ * Computes the summed gradient of the squared error over a batch of `count`
+ * examples, using the same formulas as nn_backward but with each row replaced
+ * by a matrix:
+ *
+ * H = sigmoid(X * w01 + b1)                        (count x hidden)
+ * d2 = 2 * (H * w12 + b2 - y)                      (count)
+ * D1 = (d2 * w12^T) .* H .* (1 - H)                (count x hidden)
+ * grad_w01 = X^T * D1, grad_b1 = colsum(D1), grad_w12 = H^T * d2,
+ * grad_b2 = sum(d2)
+ *
+ * h is caller-provided scratch of count * hidden_size doubles, and grad is
+ * overwritten with the result. grad_w01 comes out in the same layout as w01.
+ * Returns the summed squared error of the batch, from the same forward pass.
+ */
+double _batch_gradient(nn *net, double *x, double *y, int count, double *h,
+	double *grad) {
+	int in = net->input_size;
+	int hid = net->hidden_size;
+	double *g_w01 = grad;
+	double *g_b1 = g_w01 + (size_t) in * hid;
+	double *g_w12 = g_b1 + hid;
+	double *g_b2 = g_w12 + hid;
+
+	for(size_t i = 0; i < _compute_grad_reqs(in, hid) / sizeof(double); i++) {
+		grad[i] = 0.0;
+	}
+	for(size_t i = 0; i < (size_t) count * hid; i++) {
+		h[i] = 0.0;
+	}
+	double total_loss = 0;
+
+	// Forward: hidden pre-activations for the whole batch in one product
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		_gemm_nt(count, hid, in, x, in, net->w01, in, h, hid);
+	} else {
+		_gemm(count, hid, in, x, in, net->w01, hid, h, hid);
+	}
+	for(int b = 0; b < count; b++) {
+		double *hb = h + (size_t) b * hid;
+		_activate(net, hid, hb, net->b1);
+		double out = kern->dot(hid, hb, net->w12) + net->b2;
+
+		// Backward through the output neuron, then turn this row of H into the
+		// hidden deltas in place once its activations have been consumed
+		double d2 = 2 * (out - y[b]);
+		total_loss += (out - y[b]) * (out - y[b]);
+		*g_b2 += d2;
+		for(int i = 0; i < hid; i++) {
+			g_w12[i] += d2 * hb[i];
+			hb[i] = d2 * net->w12[i] * hb[i] * (1 - hb[i]);
+			g_b1[i] += hb[i];
+		}
+	}
+
+	// And the big one: the w01 gradient for the whole batch in one product,
+	// X^T * D1 for input-major and its transpose D1^T * X for hidden-major
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		_gemm_tn(count, in, hid, h, hid, x, in, g_w01, in);
+	} else {
+		_gemm_tn(count, hid, in, x, in, h, hid, g_w01, hid);
+	}
+	return total_loss;
+}
+
+
+/*
+ * Same epoch structure as nn_train, but the inner loop walks the dataset one
+ * batch at a time. All of the scratch space we need (the gathered batch, its
+ * labels, the hidden activations and the gradient) is mmapped once up front as
+ * a single block and reused for every batch.
+ */
+double nn_train_batched(nn *net, dataset *ds, int num_epochs,
+	int batch_size) {
+	_require_double(net, "nn_train_batched");
+	double loss = 0;
+	int in = net->input_size;
+	int hid = net->hidden_size;
+	if(batch_size < 1) batch_size = 1;
+
+	size_t x_size = (size_t) batch_size * in * sizeof(double);
+	size_t y_size = (size_t) batch_size * sizeof(double);
+	size_t h_size = (size_t) batch_size * hid * sizeof(double);
+	size_t grad_size = _compute_grad_reqs(in, hid);
+	size_t mem_size = x_size + y_size + h_size + grad_size;
+	double *x = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(x == MAP_FAILED) {
+		printf("nn_train_batched map failed\n");
+		exit(16);
+	}
+	double *y = x + (size_t) batch_size * in;
+	double *h = y + batch_size;
+	double *grad = h + (size_t) batch_size * hid;
 
 	for(int i = 0; i < num_epochs; i++) {
-		for(int j = 0; j < ds->num_examples; j++) {
-			nn_forward(net, ds->examples[j]->example);
-			nn_backward(net, ds->examples[j]->example, ds->examples[j]->label);
-		}
-
-		// We have to do this convoluted stuff with write because we don't have
-		// printf in the asm world
-		double loss = nn_average_loss(net, ds);
-		write(STDOUT_FILENO, "Epoch ", 6);
-		sz = itoa(buf, i);
-		write(STDOUT_FILENO, buf, sz);
-		write(STDOUT_FILENO, " | Loss: ", 9);
-		sz = dtoa(buf, loss, 10);
-		write(STDOUT_FILENO, buf, sz);
-		write(STDOUT_FILENO, "\n", 1);
+		_begin_epoch(net);
+		double total_loss = 0;
+		for(int j = 0; j < ds->num_examples; j += batch_size) {
+			// The last batch of an epoch may come up short
+			int count = ds->num_examples - j;
+			if(count > batch_size) count = batch_size;
+			_gather_batch(ds, j, count, x, y);
+			total_loss += _batch_gradient(net, x, y, count, h, grad);
+			net->step++;
+			_apply_gradient(net, grad, 1.0 / count);
+		}
+		_end_epoch(net);
 
+		loss = ds->num_examples ? total_loss / ds->num_examples : 0;
+		_log_epoch(i, loss);
 		ds_shuffle(ds);
 	}
+
+	int err = munmap(x, mem_size);
+	if(err) {
+		perror("nn_train_batched munmap");
+		exit(17);
+	}
+	return loss;
 }
 
 /**
  * Save the network into a file at the given filepath. The serialization format
- * we use here is stupid simple, yet remarkably dense. We simply store the
- * struct how you would expect; first 4 bytes stores the input size, next
- * 4 bytes stores the hidden size, next 8 bytes stores the learning rate,
- * next 8 bytes stores the layer 2 bias, and then we just copy in our big
- * block from memory that has the rest of our weights and biases in it.
+ * we use here is stupid simple, yet remarkably dense. A header (see
+ * _nn_header) comes first, then we just copy in our big block from memory
+ * that has the rest of our weights and biases in it, and then each of the
+ * optimizer's state arrays, if it has any.
+ *
+ * w01 is always saved input-major, so files don't depend on the layout the
+ * network was trained with. A hidden-major w01 is transposed on the way out,
+ * one input row at a time. The w01 part of each state array goes the same way.
+ *
+ * The block and w01 are stored in the network's precision, so float and mixed
+ * networks make files half the size. The optimizer state is always doubles,
+ * but only double networks have any.
+ *
+ * The original format had no header: 4 bytes of input size, 4 bytes of hidden
+ * size, 8 bytes of learning rate, 8 bytes of layer 2 bias, then the block.
+ * Those files start with a small input size rather than the magic number, so
+ * nn_load tells them apart and still reads them.
+ *
+ * The header is padded with zeros to a 64 byte boundary, so that in a mapping
+ * of the whole file the block is as aligned as one of our own, and
+ * nn_load_opts can use it in place. Past the block, the file is laid out just
+ * like the optimizer state in memory too.
  */
+static const char _NN_MAGIC[8] = "NNMODEL";
+// Version 1 is the original, headerless format. Version 2 is the header up to
+// (not including) the precision, with everything in doubles. Version 3 is the
+// whole header, without the padding.
+static const int _NN_VERSION = 4;
+
+typedef struct _nn_header {
+	char magic[8];
+	int version;
+	int input_size;
+	int hidden_size;
+	int epoch;
+	long step;
+	double learning_rate;
+	double b2;
+	nn_optim optim;
+	nn_precision precision;
+} _nn_header;
+
+// Where the block starts in a file with a header of the given version
+size_t _block_offset(int version) {
+	if(version == 2) return offsetof(_nn_header, precision);
+	if(version == 3) return sizeof(_nn_header);
+	return (sizeof(_nn_header) + 63) / 64 * 64;
+}
+
+// Writes an array shaped like w01, input-major whatever the layout. Its
+// entries are elem bytes long: floats or doubles.
+void _write_w01(int fd, const nn *net, const void *w01, size_t elem) {
+	if(net->layout == NN_LAYOUT_HIDDEN_MAJOR) {
+		double *row = _thread_scratch(net->hidden_size);
+		for(int j = 0; j < net->input_size; j++) {
+			for(int i = 0; i < net->hidden_size; i++) {
+				size_t k = (size_t) i * net->input_size + j;
+				if(elem == sizeof(float)) ((float*) row)[i] = ((const float*) w01)[k];
+				else row[i] = ((const double*) w01)[k];
+			}
+			write_all(fd, row, net->hidden_size * elem);
+		}
+	} else {
+		write_all(fd, w01, (size_t) net->input_size * net->hidden_size * elem);
+	}
+}
+
+// Reads an input-major array shaped like w01 into the network's layout, with
+// entries elem bytes long as for _write_w01
+void _read_w01(const nn *net, void *w01, const void *saved, size_t elem) {
+	size_t s_in, s_hid;
+	_w01_strides(net, &s_in, &s_hid);
+	for(int j = 0; j < net->input_size; j++) {
+		for(int i = 0; i < net->hidden_size; i++) {
+			size_t to = j * s_in + i * s_hid;
+			size_t from = (size_t) j * net->hidden_size + i;
+			if(elem == sizeof(float)) ((float*) w01)[to] = ((const float*) saved)[from];
+			else ((double*) w01)[to] = ((const double*) saved)[from];
+		}
+	}
+}
+
 void nn_save(nn *net, char *filepath) {
 	int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
 	if (fd < 0) {
 		perror("nn_save");
 		exit(3);            
 	}
-	write(fd, &net->input_size, sizeof(int));
-	write(fd, &net->hidden_size, sizeof(int));
-	write(fd, &net->learning_rate, sizeof(double));
-	write(fd, &net->b2, sizeof(double));
-	int mem_size = _compute_mem_reqs(net->input_size, net->hidden_size);
-	write(fd, net->w01, mem_size);
+	// Zero every byte, padding included, so none of it is left over from the
+	// stack and ends up in the file
+	_nn_header header;
+	char *bytes = (char*) &header;
+	for(size_t i = 0; i < sizeof(header); i++) {
+		bytes[i] = 0;
+	}
+	for(int i = 0; i < 8; i++) {
+		header.magic[i] = _NN_MAGIC[i];
+	}
+	header.version = _NN_VERSION;
+	header.input_size = net->input_size;
+	header.hidden_size = net->hidden_size;
+	header.epoch = net->epoch;
+	header.step = net->step;
+	header.learning_rate = net->learning_rate;
+	header.b2 = net->b2;
+	header.optim = net->optim;
+	header.precision = net->precision;
+	write_all(fd, &header, sizeof(header));
+	char padding[64] = {0};
+	write_all(fd, padding, _block_offset(_NN_VERSION) - sizeof(header));
+
+	size_t elem = _elem_size(net);
+	size_t n_w01 = (size_t) net->input_size * net->hidden_size;
+	_write_w01(fd, net, _block(net), elem);
+	write_all(fd, (char*) _block(net) + n_w01 * elem, 3 * net->hidden_size * elem);
+
+	// Each state array is laid out like a gradient: w01, then b1, w12 and b2
+	size_t n = _param_count(net);
+	for(int s = 0; s < _state_slots(net->optim.optimizer); s++) {
+		double *state = net->opt_state + s * n;
+		_write_w01(fd, net, state, sizeof(double));
+		write_all(fd, state + n_w01, (n - n_w01) * sizeof(double));
+	}
 	close(fd);
 }
 
 /**
  * The corresponding operation to save. The simplicity of the serialization
- * format also makes this incredibly easy. We call nn_init on the net struct
- * just so it sets up the w01, w12, b1, etc pointers for us and zeros out the
- * activations, and then we copy in all of the data from our file.
- * 
- * nn_init mmaps a new space for the data, so we have to copy it over. That
- * renders this file mapping useless, so we munmap it and close it after we
- * are done.
+ * format also makes this incredibly easy. We map the file, set up the net
+ * struct from its header, and then either copy in all of the data from the
+ * file, or, with a mapped load mode, point w01, b1, w12 and the optimizer
+ * state straight into the mapping and keep it.
+ *
+ * Copying, the network gets a block of its own (there is no point filling it
+ * with random weights first, as nn_init would), and the file mapping is
+ * useless afterwards, so we munmap it and close it once we are done.
  */
-void nn_load(nn *net, char *filepath) {
+void nn_load_opts(nn *net, char *filepath, const nn_options *opts) {
 	int fd = open(filepath, O_RDONLY);
 	if(fd < 0){
 		perror("open");
@@ -220,25 +1320,113 @@ void nn_load(nn *net, char *filepath) {
 		perror("fstat");
 		exit(5);
 	}
+	nn_options o;
+	if(opts) {
+		o = *opts;
+	} else {
+		nn_default_options(&o);
+	}
 
 	// Very much the reverse operation from save, we just read the file at certain
-	// places and those are the exact values we need to populate the struct
-	void *file_ptr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// places and those are the exact values we need to populate the struct. A
+	// private mapping can be written to if we are going to fine-tune in it; the
+	// writes never reach the file.
+	int prot = o.load == NN_LOAD_PRIVATE ? PROT_READ | PROT_WRITE : PROT_READ;
+	void *file_ptr = mmap(NULL, statbuf.st_size, prot, MAP_PRIVATE, fd, 0);
 	if(file_ptr == MAP_FAILED) {
 		printf("file_ptr map failed\n");
 		exit(6);
 	}
-	int input_size = *((int*) file_ptr);
-	int hidden_size = *((int*) (file_ptr + sizeof(int)));
-	double learning_rate = *((double*) (file_ptr + 2 * sizeof(int)));
-	double b2 = *((double*) (file_ptr + 2 * sizeof(int) + sizeof(double)));
-	double* w01 = (double*) (file_ptr + 2 * sizeof(int) + 2 * sizeof(double));
-	nn_init(net, input_size, hidden_size, learning_rate);
-	net->b2 = b2;
-	int mem_size = hidden_size * (input_size + 3);
-	// copy over weights and biases from file
-	for(int i = 0; i < mem_size; i++) {
-		net->w01[i] = w01[i];
+
+	_nn_header *header = (_nn_header*) file_ptr;
+	int has_header = statbuf.st_size >= (off_t) sizeof(_nn_header);
+	for(int i = 0; has_header && i < 8; i++) {
+		has_header = header->magic[i] == _NN_MAGIC[i];
+	}
+	// Files without a precision are all doubles
+	o.precision = NN_PRECISION_DOUBLE;
+	char *block;
+	int version = 1;
+	if(has_header) {
+		version = header->version;
+		if(version < 2 || version > _NN_VERSION) {
+			printf("nn_load: %s has an unknown version\n", filepath);
+			exit(43);
+		}
+		o.optim = header->optim;
+		block = (char*) file_ptr + _block_offset(version);
+		if(version > 2) o.precision = header->precision;
+		_init_fields(net, header->input_size, header->hidden_size,
+			header->learning_rate, &o);
+		net->b2 = header->b2;
+		net->epoch = header->epoch;
+		net->step = header->step;
+	} else {
+		int input_size = *((int*) file_ptr);
+		int hidden_size = *((int*) (file_ptr + sizeof(int)));
+		double learning_rate = *((double*) (file_ptr + 2 * sizeof(int)));
+		_init_fields(net, input_size, hidden_size, learning_rate, &o);
+		net->b2 = *((double*) (file_ptr + 2 * sizeof(int) + sizeof(double)));
+		block = (char*) file_ptr + 2 * sizeof(int) + 2 * sizeof(double);
+	}
+	net->o2 = 0.0;
+	size_t elem = _elem_size(net);
+	size_t n = _param_count(net);
+	size_t n_w01 = (size_t) net->input_size * net->hidden_size;
+	int slots = _state_slots(net->optim.optimizer);
+	size_t expected = block - (char*) file_ptr
+		+ (n_w01 + 3 * net->hidden_size) * elem
+		+ (has_header ? slots * n : 0) * sizeof(double);
+	if((size_t) statbuf.st_size != expected) {
+		printf("nn_load: %s is the wrong size for its network\n", filepath);
+		exit(43);
+	}
+	close(fd);
+
+	if(o.load != NN_LOAD_COPY && version == _NN_VERSION
+		&& net->layout == NN_LAYOUT_INPUT_MAJOR) {
+		// The file's block is laid out just like ours up to the end of w12, and
+		// the optimizer state follows it directly, where ours would have d1 in
+		// between. o1 and d1 (and the gradient scratch) go in a block of their
+		// own, since even predicting writes to o1.
+		_set_pointers(net, block);
+		void *scratch = mmap(NULL, _mapped_scratch_size(net),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(scratch == MAP_FAILED) {
+			printf("nn_load scratch map failed\n");
+			exit(6);
+		}
+		if(net->precision == NN_PRECISION_DOUBLE) {
+			net->o1 = (double*) scratch;
+			net->d1 = net->o1 + net->hidden_size;
+			if(slots) net->opt_state = net->w12 + net->hidden_size;
+		} else {
+			net->o1_f32 = (float*) scratch;
+			net->d1_f32 = net->o1_f32 + net->hidden_size;
+		}
+		net->_file = file_ptr;
+		net->_file_size = statbuf.st_size;
+		return;
+	}
+
+	// copy over weights from file, which are input-major, into whatever layout
+	// we were asked for, and then the biases, which are laid out the same
+	// either way
+	_map_block(net, "nn_init map failed", 1);
+	_read_w01(net, _block(net), block, elem);
+	for(size_t i = n_w01; i < n_w01 + 3 * net->hidden_size; i++) {
+		if(elem == sizeof(float)) _set_param(net, i, ((float*) block)[i]);
+		else _set_param(net, i, ((double*) block)[i]);
+	}
+	// and the optimizer state, if the file has any
+	double *saved = (double*) (block + (n_w01 + 3 * net->hidden_size) * elem);
+	for(int s = 0; has_header && s < slots; s++) {
+		double *state = net->opt_state + s * n;
+		_read_w01(net, state, saved, sizeof(double));
+		for(size_t k = n_w01; k < n; k++) {
+			state[k] = saved[k];
+		}
+		saved += n;
 	}
 	// free resources
 	err = munmap(file_ptr, statbuf.st_size);
@@ -246,5 +1434,530 @@ void nn_load(nn *net, char *filepath) {
 		perror("nn_load munmap");
 		exit(7);
 	}
-	close(fd);
+}
+
+void nn_load(nn *net, char *filepath) {
+	nn_load_opts(net, filepath, NULL);
+}
+
+// Everything a worker of nn_train_parallel needs to know about the batch that
+// is currently being processed.
+typedef struct _parallel_batch {
+	nn *net;
+	dataset *ds;
+	// First example of the batch, and how many examples it has
+	int start;
+	int count;
+	// Per-worker scratch: worker w's block starts at scratch + w * stride and
+	// holds its gathered rows, their labels, hidden activations and gradient.
+	double *scratch;
+	size_t stride;
+	int max_rows;
+	// Each worker's summed squared error over its share of the batch
+	double *losses;
+} _parallel_batch;
+
+// Carve worker w's pieces out of its scratch block. The gradient goes first so
+// the reduction can find every worker's gradient without knowing max_rows.
+void _worker_scratch(_parallel_batch *pb, int w, double **grad, double **x,
+	double **y, double **h) {
+	int in = pb->net->input_size;
+	*grad = pb->scratch + w * pb->stride;
+	*x = *grad + _compute_grad_reqs(in, pb->net->hidden_size) / sizeof(double);
+	*y = *x + (size_t) pb->max_rows * in;
+	*h = *y + pb->max_rows;
+}
+
+// Phase one: each worker computes the summed gradient over its share of the
+// batch into its own buffer. Nothing shared is written.
+void _parallel_gradient(void *arg, int worker, int num_workers) {
+	_parallel_batch *pb = (_parallel_batch*) arg;
+	double *grad, *x, *y, *h;
+	int start, end;
+	_worker_scratch(pb, worker, &grad, &x, &y, &h);
+	pool_range(pb->count, worker, num_workers, &start, &end);
+	_gather_batch(pb->ds, pb->start + start, end - start, x, y);
+	pb->losses[worker] = _batch_gradient(pb->net, x, y, end - start, h, grad);
+}
+
+/*
+ * Phase two: sum the workers' gradients and apply the update. Rather than
+ * reducing whole buffers, each worker takes a slice of the gradient entries
+ * and reduces that slice across all buffers, pairwise in a fixed tree order
+ * (0+1, 2+3, ... then 0+2, ...). Every entry is therefore always summed in the
+ * same order for a given number of workers, whichever thread ends up doing it,
+ * which is what makes the results bit-for-bit reproducible.
+ */
+void _parallel_reduce(void *arg, int worker, int num_workers) {
+	_parallel_batch *pb = (_parallel_batch*) arg;
+	int n = _compute_grad_reqs(pb->net->input_size, pb->net->hidden_size)
+		/ sizeof(double);
+	int start, end;
+	pool_range(n, worker, num_workers, &start, &end);
+
+	for(int step = 1; step < num_workers; step *= 2) {
+		for(int w = 0; w + step < num_workers; w += 2 * step) {
+			double *dst = pb->scratch + w * pb->stride;
+			double *src = pb->scratch + (w + step) * pb->stride;
+			for(int k = start; k < end; k++) {
+				dst[k] += src[k];
+			}
+		}
+	}
+	_apply_gradient_range(pb->net, pb->scratch, 1.0 / pb->count, start, end);
+}
+
+/*
+ * Data-parallel version of nn_train_batched. Every batch is split evenly over
+ * a pool of workers, each with its own activation scratch and gradient buffer,
+ * and the buffers are then reduced in a fixed order before a single update.
+ * Worker blocks are rounded up to whole pages so no two workers ever write to
+ * the same cache line.
+ */
+double nn_train_parallel(nn *net, dataset *ds, int num_epochs, int batch_size,
+	int num_threads) {
+	_require_double(net, "nn_train_parallel");
+	double loss = 0;
+	if(batch_size < 1) batch_size = 1;
+	if(num_threads < 1) num_threads = 1;
+	// No point having more workers than there are examples in a batch
+	if(num_threads > batch_size) num_threads = batch_size;
+
+	_parallel_batch pb;
+	pb.net = net;
+	pb.ds = ds;
+	pb.max_rows = (batch_size + num_threads - 1) / num_threads;
+	size_t worker_size = _compute_grad_reqs(net->input_size, net->hidden_size)
+		+ sizeof(double) * pb.max_rows
+			* (net->input_size + 1 + net->hidden_size);
+	long page = sysconf(_SC_PAGESIZE);
+	worker_size = (worker_size + page - 1) / page * page;
+	pb.stride = worker_size / sizeof(double);
+
+	// The workers' losses go after their blocks
+	size_t mem_size = worker_size * num_threads + sizeof(double) * num_threads;
+	pb.scratch = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(pb.scratch == MAP_FAILED) {
+		printf("nn_train_parallel map failed\n");
+		exit(21);
+	}
+	pb.losses = pb.scratch + pb.stride * num_threads;
+
+	pool workers;
+	pool_init(&workers, num_threads);
+	for(int i = 0; i < num_epochs; i++) {
+		_begin_epoch(net);
+		double total_loss = 0;
+		for(int j = 0; j < ds->num_examples; j += batch_size) {
+			pb.start = j;
+			pb.count = ds->num_examples - j;
+			if(pb.count > batch_size) pb.count = batch_size;
+			pool_run(&workers, _parallel_gradient, &pb);
+			// In worker order, so the loss is reproducible too
+			for(int w = 0; w < num_threads; w++) {
+				total_loss += pb.losses[w];
+			}
+			net->step++;
+			pool_run(&workers, _parallel_reduce, &pb);
+		}
+		_end_epoch(net);
+
+		loss = ds->num_examples ? total_loss / ds->num_examples : 0;
+		_log_epoch(i, loss);
+		ds_shuffle(ds);
+	}
+	pool_destroy(&workers);
+
+	int err = munmap(pb.scratch, mem_size);
+	if(err) {
+		perror("nn_train_parallel munmap");
+		exit(22);
+	}
+	return loss;
+}
+
+// Hogwild workers read and write the shared parameters without any locking.
+// Going through relaxed atomics keeps every individual load and store whole
+// (and keeps the compiler from caching parameters in registers across other
+// threads' updates) while compiling down to plain moves. Concurrent updates to
+// the same weight can still overwrite each other; Hogwild accepts that.
+static inline double _relaxed_load(double *p) {
+	double v;
+	__atomic_load(p, &v, __ATOMIC_RELAXED);
+	return v;
+}
+
+static inline void _relaxed_store(double *p, double v) {
+	__atomic_store(p, &v, __ATOMIC_RELAXED);
+}
+
+// What a Hogwild worker needs: the shared network, the view to train on, and
+// per-worker scratch (worker w's starts at o1 + w * stride) holding its hidden
+// activations, its snapshot of b1, and then the summed squared error of its
+// slice of the epoch.
+typedef struct _hogwild_epoch {
+	nn *net;
+	dataset *ds;
+	double *o1;
+	size_t stride;
+	// Each worker's running loss for the epoch, by worker
+	double *losses;
+} _hogwild_epoch;
+
+/*
+ * One worker's share of an epoch: the same forward and backward passes as
+ * nn_forward and nn_backward, except activations live in the worker's own
+ * scratch and every parameter access is a relaxed load or store straight into
+ * the shared block.
+ */
+void _hogwild_worker(void *arg, int worker, int num_workers) {
+	_hogwild_epoch *he = (_hogwild_epoch*) arg;
+	nn *net = he->net;
+	int in = net->input_size;
+	int hid = net->hidden_size;
+	double *o1 = he->o1 + worker * he->stride;
+	double *b1 = o1 + hid;
+	double total_loss = 0;
+	double lr = net->rate;
+	size_t s_in, s_hid;
+	_w01_strides(net, &s_in, &s_hid);
+	int start, end;
+	pool_range(he->ds->num_examples, worker, num_workers, &start, &end);
+
+	for(int e = start; e < end; e++) {
+		double *x = ds_example(he->ds, e);
+
+		// forward
+		for(int j = 0; j < hid; j++) {
+			o1[j] = 0.0;
+		}
+		for(int i = 0; i < in; i++) {
+			for(int j = 0; j < hid; j++) {
+				o1[j] += x[i] * _relaxed_load(&net->w01[i * s_in + j * s_hid]);
+			}
+		}
+		for(int i = 0; i < hid; i++) {
+			b1[i] = _relaxed_load(&net->b1[i]);
+		}
+		_activate(net, hid, o1, b1);
+		double o2 = _relaxed_load(&net->b2);
+		for(int i = 0; i < hid; i++) {
+			o2 += o1[i] * _relaxed_load(&net->w12[i]);
+		}
+
+		// backward
+		double err = o2 - ds_label(he->ds, e);
+		total_loss += err * err;
+		double grad_b2 = 2 * err;
+		_relaxed_store(&net->b2, _relaxed_load(&net->b2) - lr * grad_b2);
+		for(int i = 0; i < hid; i++) {
+			double w12_i = _relaxed_load(&net->w12[i]);
+			double grad_b1_i = grad_b2 * w12_i * o1[i] * (1 - o1[i]);
+			_relaxed_store(&net->w12[i], w12_i - lr * grad_b2 * o1[i]);
+			_relaxed_store(&net->b1[i], _relaxed_load(&net->b1[i]) - lr * grad_b1_i);
+			for(int j = 0; j < in; j++) {
+				double *w = &net->w01[j * s_in + i * s_hid];
+				_relaxed_store(w, _relaxed_load(w) - lr * x[j] * grad_b1_i);
+			}
+		}
+	}
+	he->losses[worker] = total_loss;
+}
+
+/*
+ * Asynchronous SGD. Each epoch, the (shuffled) dataset is cut into one slice
+ * per worker and every worker runs batch-size-1 SGD over its slice directly
+ * against the shared network, with no locks and no barrier until the end of
+ * the epoch, where we log each worker's running loss summed, and reshuffle,
+ * just like nn_train.
+ */
+double nn_train_hogwild(nn *net, dataset *ds, int num_epochs,
+	int num_threads) {
+	_require_double(net, "nn_train_hogwild");
+	double loss = 0;
+	if(num_threads < 1) num_threads = 1;
+
+	// Page-sized scratch per worker, so activations never share a cache line,
+	// then the workers' losses, which are only written once an epoch
+	_hogwild_epoch he;
+	he.net = net;
+	he.ds = ds;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t worker_size = 2 * net->hidden_size * sizeof(double);
+	worker_size = (worker_size + page - 1) / page * page;
+	he.stride = worker_size / sizeof(double);
+	size_t mem_size = worker_size * num_threads + num_threads * sizeof(double);
+	he.o1 = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(he.o1 == MAP_FAILED) {
+		printf("nn_train_hogwild map failed\n");
+		exit(23);
+	}
+	he.losses = he.o1 + he.stride * num_threads;
+
+	pool workers;
+	pool_init(&workers, num_threads);
+	for(int i = 0; i < num_epochs; i++) {
+		_begin_epoch(net);
+		pool_run(&workers, _hogwild_worker, &he);
+		_end_epoch(net);
+
+		double total_loss = 0;
+		for(int w = 0; w < num_threads; w++) {
+			total_loss += he.losses[w];
+		}
+		loss = ds->num_examples ? total_loss / ds->num_examples : 0;
+		_log_epoch(i, loss);
+		ds_shuffle(ds);
+	}
+	pool_destroy(&workers);
+
+	int err = munmap(he.o1, mem_size);
+	if(err) {
+		perror("nn_train_hogwild munmap");
+		exit(24);
+	}
+	return loss;
+}
+
+// Moves the parameters of every network in an ensemble into the side by side
+// arrays of nn_train_ensemble, or back out of them
+void _ensemble_move(nn *nets, int count, double *w01, double *b1, double *w12,
+	int total, int gather) {
+	int in = nets[0].input_size;
+	int off = 0;
+	for(int k = 0; k < count; k++) {
+		nn *net = &nets[k];
+		size_t s_in, s_hid;
+		_w01_strides(net, &s_in, &s_hid);
+		for(int j = 0; j < in; j++) {
+			for(int i = 0; i < net->hidden_size; i++) {
+				double *mine = &net->w01[j * s_in + i * s_hid];
+				double *shared = &w01[(size_t) j * total + off + i];
+				if(gather) *shared = *mine;
+				else *mine = *shared;
+			}
+		}
+		for(int i = 0; i < net->hidden_size; i++) {
+			if(gather) {
+				b1[off + i] = net->b1[i];
+				w12[off + i] = net->w12[i];
+			} else {
+				net->b1[i] = b1[off + i];
+				net->w12[i] = w12[off + i];
+			}
+		}
+		off += net->hidden_size;
+	}
+}
+
+/*
+ * Fused SGD for several networks at once. Every network's w01 goes side by
+ * side in one input-major matrix, network k's hidden neurons taking the next
+ * hidden_size columns after network k - 1's, and b1 and w12 are laid out the
+ * same way. Then the hidden layers of all the networks are a single matvec
+ * over the example, read once while it is in cache, and all of their w01
+ * updates a single rank1, with each network's learning rate folded into its
+ * deltas. Only the output neurons are done one network at a time, and those
+ * are a single dot product each.
+ */
+int nn_train_ensemble(nn *nets, int count, dataset *ds, int num_epochs,
+	double *losses) {
+	int in = nets[0].input_size;
+	int total = 0;
+	for(int k = 0; k < count; k++) {
+		_require_double(&nets[k], "nn_train_ensemble");
+		if(nets[k].input_size != in) {
+			printf("nn_train_ensemble: networks have different input sizes\n");
+			exit(51);
+		}
+		total += nets[k].hidden_size;
+	}
+
+	// w01, b1, w12, the activations and the deltas, then each network's
+	// running loss
+	size_t mem_size = sizeof(double) * ((size_t) total * (in + 4) + count);
+	double *w01 = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(w01 == MAP_FAILED) {
+		printf("nn_train_ensemble map failed\n");
+		exit(52);
+	}
+	double *b1 = w01 + (size_t) in * total;
+	double *w12 = b1 + total;
+	double *h = w12 + total;
+	double *d = h + total;
+	double *loss = d + total;
+	_ensemble_move(nets, count, w01, b1, w12, total, 1);
+
+	int best = 0;
+	for(int e = 0; e < num_epochs; e++) {
+		for(int k = 0; k < count; k++) {
+			_begin_epoch(&nets[k]);
+			loss[k] = 0;
+		}
+		for(int r = 0; r < ds->num_examples; r++) {
+			double *x = ds_example(ds, r);
+			int y = ds_label(ds, r);
+			kern->matvec(in, total, x, w01, h);
+			// Neighbouring networks with the same sigmoid share one call
+			for(int k = 0, off = 0; k < count; ) {
+				int end = k;
+				int width = 0;
+				while(end < count && nets[end].sigmoid == nets[k].sigmoid) {
+					width += nets[end].hidden_size;
+					end++;
+				}
+				_activate(&nets[k], width, h + off, b1 + off);
+				off += width;
+				k = end;
+			}
+			// The same updates as nn_backward, but with the deltas scaled by the
+			// rate for the rank1 below
+			for(int k = 0, off = 0; k < count; off += nets[k].hidden_size, k++) {
+				nn *net = &nets[k];
+				double *o1 = h + off;
+				net->o2 = kern->dot(net->hidden_size, o1, w12 + off) + net->b2;
+				double err = y - net->o2;
+				loss[k] += err*err;
+				double grad_b2 = 2 * (net->o2 - y);
+				net->b2 -= net->rate * grad_b2;
+				for(int i = 0; i < net->hidden_size; i++) {
+					double grad_w12_i = grad_b2 * o1[i];
+					double grad_b1_i = grad_b2 * w12[off + i] * o1[i] * (1 - o1[i]);
+					w12[off + i] -= net->rate * grad_w12_i;
+					b1[off + i] -= net->rate * grad_b1_i;
+					d[off + i] = net->rate * grad_b1_i;
+				}
+			}
+			kern->rank1(in, total, x, d, w01, 1.0);
+		}
+
+		// Every loss is averaged before any are compared, since best may come
+		// after k and still hold a sum
+		for(int k = 0; k < count; k++) {
+			_end_epoch(&nets[k]);
+			if(ds->num_examples) loss[k] /= ds->num_examples;
+		}
+		best = 0;
+		for(int k = 1; k < count; k++) {
+			if(loss[k] < loss[best]) best = k;
+		}
+		_log_epoch(e, loss[best]);
+		ds_shuffle(ds);
+	}
+
+	_ensemble_move(nets, count, w01, b1, w12, total, 0);
+	for(int k = 0; losses && k < count; k++) {
+		losses[k] = loss[k];
+	}
+	int err = munmap(w01, mem_size);
+	if(err) {
+		perror("nn_train_ensemble munmap");
+		exit(53);
+	}
+	return best;
+}
+
+// One fold of nn_cross_validate, with everything its worker touches
+typedef struct _cv_fold {
+	nn net;
+	dataset *train;
+	dataset *valid;
+	// The fold's own stream, for its initial weights and its shuffles
+	rng rng;
+	double loss;
+} _cv_fold;
+
+typedef struct _cv_job {
+	_cv_fold **folds;
+	int k;
+	int num_epochs;
+} _cv_job;
+
+// Worker w takes folds w, w + num_workers, and so on, and trains and evaluates
+// each from start to finish. Nothing is logged, since the folds interleave.
+void _cv_worker(void *arg, int worker, int num_workers) {
+	_cv_job *job = (_cv_job*) arg;
+	for(int f = worker; f < job->k; f += num_workers) {
+		_cv_fold *fold = job->folds[f];
+		for(int e = 0; e < job->num_epochs; e++) {
+			_begin_epoch(&fold->net);
+			_train_epoch(&fold->net, fold->train);
+			_end_epoch(&fold->net);
+			ds_shuffle_rng(fold->train, &fold->rng);
+		}
+		fold->loss = nn_average_loss(&fold->net, fold->valid);
+	}
+}
+
+/*
+ * The folds only share the underlying data, which nobody writes, so they can
+ * run side by side with no synchronization at all. Fold f draws everything
+ * random from stream f of one seed, taken from rng_global up front, so the
+ * losses don't depend on which thread runs which fold, or when.
+ *
+ * Everything a fold needs (its struct, views and network) is carved from one
+ * arena, on this thread, and released with it at the end. Each fold's struct
+ * is a piece of its own, so folds don't share cache lines either.
+ */
+double nn_cross_validate(dataset *ds, int k, int stratify, int hidden_size,
+	double learning_rate, const nn_options *opts, int num_epochs,
+	int num_threads, double *losses, double *variance) {
+	// One fold would leave nothing to train on, and the variance would divide
+	// by k - 1 = 0
+	if(k < 2) {
+		printf("nn_cross_validate: k must be at least 2\n");
+		exit(67);
+	}
+	nn_options fold_opts;
+	if(opts == NULL) nn_default_options(&fold_opts);
+	else fold_opts = *opts;
+	if(num_threads < 1) num_threads = 1;
+	if(num_threads > k) num_threads = k;
+
+	arena mem;
+	arena_init(&mem, 0);
+	_cv_fold **folds = arena_alloc(&mem, sizeof(_cv_fold*) * k);
+	dataset *train = arena_alloc(&mem, sizeof(dataset) * k);
+	dataset *valid = arena_alloc(&mem, sizeof(dataset) * k);
+	ds_kfold(ds, k, stratify, train, valid, &mem);
+	uint64_t seed = rng_next64(&rng_global);
+	fold_opts.arena = &mem;
+	for(int f = 0; f < k; f++) {
+		_cv_fold *fold = arena_alloc(&mem, sizeof(_cv_fold));
+		fold->train = &train[f];
+		fold->valid = &valid[f];
+		rng_init(&fold->rng, seed, f);
+		fold_opts.rng = &fold->rng;
+		nn_init_opts(&fold->net, ds->num_attributes, hidden_size, learning_rate,
+			&fold_opts);
+		folds[f] = fold;
+	}
+
+	_cv_job job;
+	job.folds = folds;
+	job.k = k;
+	job.num_epochs = num_epochs;
+	pool workers;
+	pool_init(&workers, num_threads);
+	pool_run(&workers, _cv_worker, &job);
+	pool_destroy(&workers);
+
+	double mean = 0;
+	for(int f = 0; f < k; f++) {
+		mean += folds[f]->loss;
+	}
+	mean /= k;
+	double sum_sq = 0;
+	for(int f = 0; f < k; f++) {
+		double d = folds[f]->loss - mean;
+		sum_sq += d * d;
+		if(losses) losses[f] = folds[f]->loss;
+	}
+	if(variance) *variance = sum_sq / (k - 1);
+
+	arena_destroy(&mem);
+	return mean;
 }
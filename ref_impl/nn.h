@@ -1,7 +1,11 @@
 #ifndef _NN_H_
 #define _NN_H_
 
+#include <stddef.h>
 #include "dataset.h"
+#include "pool.h"
+#include "kernels.h"
+#include "shapes.h"
 
 /**
  * This is the actual neural network implementation. We obviously can't implement
@@ -12,6 +16,157 @@
  * networks, running predictions, initializing/destroying, and saving/loading.
  */
 
+/**
+ * How the hidden layer's sigmoid is computed. The exp inside it is the single
+ * most expensive part of a forward pass, so networks can trade accuracy for
+ * speed. The error bounds are the largest absolute differences from the true
+ * sigmoid, measured over a dense sweep of [-50, 50].
+ */
+typedef enum nn_sigmoid {
+	// libm exp, one neuron at a time. Exactly what the original code did.
+	NN_SIGMOID_EXACT,
+	// Vectorized Cephes-style rational exp. Within 2e-16 of the true sigmoid, so
+	// indistinguishable from exact in practice. The default.
+	NN_SIGMOID_ACCURATE,
+	// Vectorized degree 6 polynomial exp, within 1.7e-7 relative. That keeps
+	// the sigmoid within 5e-8 of the true one, which is plenty for training.
+	NN_SIGMOID_FAST
+} nn_sigmoid;
+
+/**
+ * How w01 is laid out in memory. With input-major, the weights out of each
+ * input neuron are contiguous: the forward pass walks w01 in order, and the
+ * backward pass does too as long as the w01 update is applied a whole input
+ * row at a time. With hidden-major, the weights into each hidden neuron are
+ * contiguous, so the forward pass becomes one dot product per hidden neuron.
+ * Which is faster depends on the shape of the network (see bench4). Files
+ * written by nn_save look the same either way.
+ */
+typedef enum nn_layout {
+	// w01[j * hidden_size + i] connects input j to hidden neuron i. The default.
+	NN_LAYOUT_INPUT_MAJOR,
+	// w01[i * input_size + j] connects input j to hidden neuron i.
+	NN_LAYOUT_HIDDEN_MAJOR
+} nn_layout;
+
+/**
+ * What a network stores its parameters and activations in, and computes with.
+ * Floats halve the memory every pass has to move, and fit twice as many lanes
+ * in a SIMD register, at the cost of about 7 significant digits instead of 16.
+ * Float networks only train with plain SGD, and only with nn_train,
+ * nn_train_ex and nn_train_stream; the other trainers need doubles.
+ */
+typedef enum nn_precision {
+	// Everything in doubles. The default, and what the original code did.
+	NN_PRECISION_DOUBLE,
+	// Parameters, activations and arithmetic all in floats
+	NN_PRECISION_FLOAT,
+	// Parameters and activations in floats, but every dot product summed in a
+	// double, so long sums don't pile up rounding error
+	NN_PRECISION_MIXED
+} nn_precision;
+
+/**
+ * How a gradient turns into a weight update. Every optimizer but plain SGD
+ * keeps some state for each parameter. That state lives in a buffer allocated
+ * right after the network's parameters, and nn_save saves it along with them,
+ * so training can pick up where it left off after nn_load.
+ */
+typedef enum nn_optimizer {
+	// w -= rate * g. The default, and what the original code did.
+	NN_OPTIMIZER_SGD,
+	// Classical momentum: v = momentum * v + g, then w -= rate * v
+	NN_OPTIMIZER_MOMENTUM,
+	// Nesterov momentum: v = momentum * v + g, then w -= rate * (g + momentum * v)
+	NN_OPTIMIZER_NESTEROV,
+	// Adam: running averages of g (decaying by momentum) and g^2 (by beta2),
+	// bias-corrected, give each parameter a step size of its own
+	NN_OPTIMIZER_ADAM
+} nn_optimizer;
+
+/**
+ * How the learning rate changes from epoch to epoch. Whatever the schedule,
+ * the rate first ramps up linearly over warmup_epochs epochs, and the schedule
+ * proper starts counting epochs after that.
+ */
+typedef enum nn_schedule {
+	// Always learning_rate. The default.
+	NN_SCHEDULE_CONSTANT,
+	// learning_rate, multiplied by step_gamma every step_epochs epochs
+	NN_SCHEDULE_STEP,
+	// From learning_rate down to min_rate along half a cosine wave over
+	// cosine_epochs epochs, then min_rate from there on
+	NN_SCHEDULE_COSINE
+} nn_schedule;
+
+/**
+ * Optimizer and learning rate schedule settings. Unlike the rest of
+ * nn_options, these are saved with the network.
+ */
+typedef struct nn_optim {
+	nn_optimizer optimizer;
+	// The momentum coefficient for MOMENTUM and NESTEROV, and beta1 for ADAM
+	double momentum;
+	// Adam's decay for the average of g^2, and the epsilon added to its square
+	// root before dividing by it
+	double beta2;
+	double epsilon;
+	nn_schedule schedule;
+	int warmup_epochs;
+	int step_epochs;
+	double step_gamma;
+	int cosine_epochs;
+	double min_rate;
+} nn_optim;
+
+/**
+ * How nn_load_opts gets a saved network's parameters into memory. The mapped
+ * modes read the parameters straight from the page cache instead of copying
+ * them, so loading costs next to nothing whatever the size of the network, and
+ * any number of processes serving the same file share one copy of it. Only
+ * files saved in the current format by nn_save can be mapped, and only into an
+ * input-major network, since that is the order the file is in; anything else
+ * is copied whatever the mode. A mapped network must be destroyed before its
+ * file is overwritten or truncated, e.g. by nn_save to the same path.
+ */
+typedef enum nn_load_mode {
+	// Copy the parameters into a block of the network's own. The default.
+	NN_LOAD_COPY,
+	// Map the file copy-on-write, for fine-tuning: each page of parameters is
+	// copied the first time training writes to it, and the file never changes
+	NN_LOAD_PRIVATE,
+	// Map the file read-only, for serving. The network can predict, and run
+	// nn_forward, but anything that writes a parameter crashes.
+	NN_LOAD_READONLY
+} nn_load_mode;
+
+/**
+ * Optional settings for nn_init_opts and nn_load_opts. Start from
+ * nn_default_options and change what you need; that way new settings can be
+ * added without breaking existing callers.
+ */
+typedef struct nn_options {
+	// Accuracy tier of the hidden layer sigmoid
+	nn_sigmoid sigmoid;
+	// Memory layout of w01
+	nn_layout layout;
+	// Optimizer and learning rate schedule. nn_load_opts only uses these for
+	// files saved without them; otherwise the saved ones are restored.
+	nn_optim optim;
+	// Storage and arithmetic precision. nn_load_opts ignores this, and keeps
+	// the precision the file was saved in; see nn_convert.
+	nn_precision precision;
+	// How nn_load_opts loads the parameters. nn_init_opts ignores this.
+	nn_load_mode load;
+	// The stream nn_init_opts draws the initial weights from, or NULL for
+	// rng_global. nn_load_opts ignores this.
+	rng *rng;
+	// The arena to carve the network's block from, or NULL to map one of its
+	// own. nn_destroy then leaves the block to the arena. The mapped load
+	// modes map the file whatever this is.
+	arena *arena;
+} nn_options;
+
 typedef struct nn {
 	// The size of the input layer.
 	int input_size;
@@ -27,7 +182,8 @@ typedef struct nn {
 	// contiguous memory array.
 
 	// The weights of the connections between the input and the hidden layer.
-	// There are input_size * hidden_size such connections
+	// There are input_size * hidden_size such connections, laid out as given by
+	// the layout field.
 	double* w01;
 	// Hidden layer biases
 	double* b1;
@@ -40,8 +196,57 @@ typedef struct nn {
 	double b2;
 	// output neuron output, stored for backprop
 	double o2;
+	// Hidden layer deltas, scratch space for nn_backward. Allocated right after
+	// w12 but not part of the saved block.
+	double* d1;
+	// Accuracy tier of the hidden layer sigmoid. Not saved with the network;
+	// pick it again when loading.
+	nn_sigmoid sigmoid;
+	// Memory layout of w01. Also not saved, since files are always input-major.
+	nn_layout layout;
+	// Optimizer and learning rate schedule settings
+	nn_optim optim;
+	// The learning rate in effect, which the trainers set from learning_rate
+	// and the schedule at the start of every epoch
+	double rate;
+	// Epochs trained so far, which is what the schedule goes by
+	int epoch;
+	// Updates made so far, for Adam's bias correction
+	long step;
+	// Optimizer state, allocated after d1: one array (MOMENTUM, NESTEROV) or two
+	// (ADAM, g's average then g^2's) with an entry per parameter, in the order
+	// w01, b1, w12, b2, and then one more such array of scratch for the
+	// gradient. NULL for SGD.
+	double* opt_state;
+	// Storage and arithmetic precision. With FLOAT or MIXED, w01, b1, o1, w12
+	// and d1 are NULL, and the parameters live in the float arrays below
+	// instead, laid out the same way in a block of their own. b2 and o2 stay
+	// doubles either way.
+	nn_precision precision;
+	float* w01_f32;
+	float* b1_f32;
+	float* o1_f32;
+	float* w12_f32;
+	float* d1_f32;
+	// Forward and backward passes generated for exactly this shape and layout
+	// (see shapes.h), or NULL if there aren't any. nn_init_opts and nn_load
+	// look them up; set it to NULL to always use the generic passes.
+	const nn_shape* shape;
+	// For networks loaded with a mapped nn_load_mode: the mapping of the file
+	// the parameters (and optimizer state) live in, and its size. o1 and d1,
+	// which even predicting writes to, are then in a small block of their own.
+	// NULL for networks with a block of their own.
+	void* _file;
+	size_t _file_size;
+	// The arena the block was carved from, or NULL
+	arena* _arena;
 } nn;
 
+/**
+ * Fills in the default options: what nn_init and nn_load use.
+ */
+void nn_default_options(nn_options *opts);
+
 /**
  * Initializes a neural network from the given input layer size, hidden layer
  * size, and learning rate. This function zeros out all outputs and randomizes
@@ -57,6 +262,24 @@ typedef struct nn {
  */
 void nn_init(nn *net, int input_size, int hidden_size, double learning_rate);
 
+/**
+ * nn_init with options. nn_init(...) is nn_init_opts(..., NULL).
+ *
+ * @param opts the options to initialize with, or NULL for the defaults
+ */
+void nn_init_opts(nn *net, int input_size, int hidden_size,
+	double learning_rate, const nn_options *opts);
+
+/**
+ * Changes the precision of a network in place, rounding or widening every
+ * parameter. Going to FLOAT or MIXED drops any optimizer state, since float
+ * networks always train with plain SGD.
+ *
+ * @param net the network to convert
+ * @param precision the precision to convert it to
+ */
+void nn_convert(nn *net, nn_precision precision);
+
 /**
  * Frees resources associated with this nn (just the big w01+b1+o1+w12 array)
  */
@@ -73,6 +296,49 @@ void nn_destroy(nn *net);
  */
 double nn_forward(nn *net, double *x);
 
+/**
+ * Generate a prediction for an example without touching the network at all.
+ * The hidden layer activations are written to scratch instead of net->o1, so
+ * any number of threads can predict with the same network at once, and a
+ * model that is only used for predictions never has its memory written to.
+ *
+ * @param net the network to run the example through
+ * @param x the example
+ * @param scratch space for at least net->hidden_size doubles, which will hold
+ * 	the hidden layer activations afterwards. Pass NULL to use a buffer private
+ * 	to the calling thread instead. Float and mixed networks always work in a
+ * 	buffer private to the calling thread, and only copy the activations into
+ * 	scratch if it isn't NULL.
+ * @return the network's prediction
+ */
+double nn_predict(const nn *net, const double *x, double *scratch);
+
+/**
+ * nn_predict for every example of a dataset, in dataset order. Float and mixed
+ * networks read the examples from the dataset's float copy, if ds_make_f32 has
+ * made one.
+ *
+ * @param net the network to run the examples through
+ * @param ds the examples to predict
+ * @param out space for ds->num_examples predictions
+ * @param scratch as for nn_predict; may be NULL
+ */
+void nn_predict_dataset(const nn *net, const dataset *ds, double *out,
+	double *scratch);
+
+/**
+ * nn_predict for every row of a row-major matrix of examples, each
+ * net->input_size doubles long.
+ *
+ * @param net the network to run the examples through
+ * @param x the first example; example i starts at x + i * net->input_size
+ * @param num_rows the number of examples
+ * @param out space for num_rows predictions
+ * @param scratch as for nn_predict; may be NULL
+ */
+void nn_predict_matrix(const nn *net, const double *x, int num_rows,
+	double *out, double *scratch);
+
 /**
  * Given an example and its true label, update the network weights via 
  * backpropagation. You must run nn_forward on this same example before calling
@@ -85,17 +351,215 @@ double nn_forward(nn *net, double *x);
  */
 void nn_backward(nn *net, double *x, int y);
 
+/**
+ * Optional settings for nn_train_ex. Start from nn_default_train_options and
+ * change what you need.
+ */
+typedef struct nn_train_options {
+	// Every this many epochs, and after the last one, the logged loss is the
+	// exact average loss of the network after the epoch (as nn_average_loss)
+	// instead of the running loss. 0 means never.
+	int eval_interval;
+	// The dataset those evaluations use, e.g. a held-out test set. NULL means
+	// the training set.
+	const dataset *eval_set;
+	// If nonzero, evaluations only use the first eval_sample examples of the
+	// evaluation set. The training set is reshuffled every epoch, so on it this
+	// is a new random sample each time.
+	int eval_sample;
+	// Early stopping: stop once this many evaluations in a row have failed to
+	// beat the best loss so far by more than min_delta. 0 means never stop
+	// early. Evaluates every epoch if eval_interval isn't set.
+	int patience;
+	double min_delta;
+	// If not NULL, whenever an evaluation beats the best loss so far, the
+	// network's parameters are copied into best, so at the end it holds the
+	// best network seen, ready for nn_save. It has to have the same shape and
+	// layout as the network being trained (e.g. from the same nn_init_opts).
+	nn *best;
+	// If nonzero, each evaluation runs on a second thread, at the same time as
+	// the next epoch trains, on a copy of the parameters. Evaluations (and so
+	// early stopping) then lag one epoch behind training.
+	int parallel_eval;
+} nn_train_options;
+
+/**
+ * Fills in the default training options: running loss only, no evaluations,
+ * no early stopping.
+ */
+void nn_default_train_options(nn_train_options *opts);
+
 /**
  * Trains a neural network on the given dataset for the specified number of
  * epochs. Training is done via stochastic gradient descent with a batch size
  * of 1. After each epoch, useful stats such as epoch number and average loss
- * are logged.
+ * are logged. The loss is the running loss of the epoch: the average over all
+ * examples of the loss of each one, measured by the forward pass that trained
+ * on it. That comes for free, where measuring the loss on the whole dataset
+ * after the epoch would take another forward pass over all of it; use
+ * nn_train_ex for that.
  * 
  * @param net the network to train
  * @param ds the dataset to train on
  * @param num_epochs the number of epochs to train for
+ * @return the running loss of the last epoch
+ */
+double nn_train(nn *net, dataset *ds, int num_epochs);
+
+/**
+ * Same as nn_train, with options for measuring the loss exactly every so often,
+ * for instance on a validation set, and for stopping early once that loss
+ * stops improving (see nn_train_options). With early stopping, num_epochs is
+ * the most epochs it will train for. Note that net itself always ends up with
+ * the weights of the last epoch trained; the best ones are in opts->best.
+ *
+ * @param net the network to train
+ * @param ds the dataset to train on
+ * @param num_epochs the number of epochs to train for
+ * @param opts the training options, or NULL for the defaults
+ * @return with patience or best set, the best evaluated loss; otherwise the
+ * 	loss logged for the last epoch, which with eval_interval set is an exact
+ * 	evaluation
+ */
+double nn_train_ex(nn *net, dataset *ds, int num_epochs,
+	const nn_train_options *opts);
+
+/**
+ * Trains a neural network on the given dataset with mini-batch gradient
+ * descent. Each batch of examples is gathered into one contiguous block, and
+ * the forward and backward passes for the whole batch are computed as blocked
+ * matrix-matrix products, so every tile of w01 is reused across the batch
+ * instead of being streamed from memory once per example. The gradients of a
+ * batch are averaged and applied in a single update. Logging and shuffling
+ * behave like nn_train.
+ *
+ * @param net the network to train
+ * @param ds the dataset to train on
+ * @param num_epochs the number of epochs to train for
+ * @param batch_size the number of examples per update. Must be at least 1; a
+ * 	batch size of 1 is the same as nn_train.
+ * @return the running loss of the last epoch, as nn_train returns, each
+ * 	example's loss measured by the forward pass of its batch
+ */
+double nn_train_batched(nn *net, dataset *ds, int num_epochs, int batch_size);
+
+/**
+ * Data-parallel mini-batch training. Each batch is split evenly across a pool
+ * of worker threads; every worker keeps its own activation scratch and
+ * gradient buffer, so the network itself is only read during the passes. The
+ * per-worker gradients are then summed in a fixed tree order and applied as one
+ * update, so for a given random seed and thread count the result is
+ * bit-for-bit identical from run to run. Logging and shuffling behave like
+ * nn_train.
+ *
+ * @param net the network to train
+ * @param ds the dataset to train on
+ * @param num_epochs the number of epochs to train for
+ * @param batch_size the number of examples per update
+ * @param num_threads the number of worker threads to use, counting the
+ * 	calling thread. Capped at batch_size.
+ * @return the running loss of the last epoch, as nn_train_batched returns
+ */
+double nn_train_parallel(nn *net, dataset *ds, int num_epochs, int batch_size,
+	int num_threads);
+
+/**
+ * Train a neural network on a stream, for datasets too big to load into
+ * memory. This is SGD exactly like nn_train, except the examples come from
+ * ds_stream_next, one pass through the file per epoch, in the order the
+ * stream's shuffle buffer hands them out. Memory use stays at whatever the
+ * stream was opened with.
+ *
+ * Since the file can't be revisited cheaply, the loss logged each epoch is the
+ * average loss of every example of the epoch, measured just before training
+ * on it, rather than the loss over the whole dataset after the epoch.
+ *
+ * @param net the network to train
+ * @param s an open stream to train on
+ * @param num_epochs the number of epochs (passes through the file) to train for
+ * @return the running average loss of the last epoch
+ */
+double nn_train_stream(nn *net, ds_stream *s, int num_epochs);
+
+/**
+ * Asynchronous ("Hogwild") SGD with a batch size of 1. Each epoch, the
+ * dataset is split into one contiguous slice per thread, and every thread runs
+ * forward and backward passes over its slice, writing its updates straight
+ * into the shared weights without any locking. Updates from different threads
+ * may occasionally overwrite each other, and results are not reproducible from
+ * run to run, but there is no synchronization at all until the end of the
+ * epoch. Since each example only makes a small update, this converges about as
+ * well as nn_train in practice. Logging and shuffling behave like nn_train.
+ * The learning rate schedule applies, but the updates are always plain SGD,
+ * whatever optimizer the network was set up with.
+ *
+ * @param net the network to train
+ * @param ds the dataset to train on
+ * @param num_epochs the number of epochs to train for
+ * @param num_threads the number of worker threads to use, counting the
+ * 	calling thread
+ * @return the running loss of the last epoch, as nn_train returns
  */
-void nn_train(nn *net, dataset *ds, int num_epochs);
+double nn_train_hogwild(nn *net, dataset *ds, int num_epochs, int num_threads);
+
+/**
+ * Trains several networks on the same dataset in one pass over it per epoch,
+ * e.g. for a hyperparameter sweep over hidden sizes, learning rates and
+ * initial weights. For every example, all of the networks run their forward
+ * and backward passes while the example is still in cache, and their hidden
+ * layers, laid side by side in one matrix for the duration, are computed and
+ * updated together as if they were a single wide network. Each network gets
+ * the same updates, in the same order, as it would from nn_train with the same
+ * shuffles, up to rounding.
+ *
+ * The networks can have any hidden size, layout and sigmoid, but have to have
+ * the same input size and double precision. Like nn_train_hogwild, this is
+ * always plain SGD, following each network's own learning rate schedule. Each
+ * epoch logs the lowest running loss of any network, and then shuffles ds.
+ *
+ * @param nets the networks to train
+ * @param count the number of networks
+ * @param ds the dataset to train on
+ * @param num_epochs the number of epochs to train for
+ * @param losses space for count losses, which will hold each network's running
+ * 	loss of the last epoch (as nn_train returns); may be NULL
+ * @return the index of the network with the lowest of those losses, e.g. to
+ * 	nn_save it
+ */
+int nn_train_ensemble(nn *nets, int count, dataset *ds, int num_epochs,
+	double *losses);
+
+/**
+ * k-fold cross-validation of one network configuration. Splits ds with
+ * ds_kfold, and for every fold, trains a freshly initialized network on the
+ * other folds with nn_train's SGD (following the options' optimizer and
+ * schedule) and then measures its average loss on the fold itself. The folds
+ * train concurrently, each on its own network and views, with its initial
+ * weights and the shuffles between epochs drawn from a stream of its own;
+ * nothing is logged. The views and networks are all carved from one arena.
+ * The streams are all split from one seed drawn from rng_global, so seeding
+ * with rng_seed first makes the results the same for any number of threads.
+ *
+ * @param ds the dataset to cross-validate on, shuffled beforehand if desired
+ * 	(the folds are made the way ds_kfold makes them)
+ * @param k the number of folds, at least 2 (anything less exits)
+ * @param stratify nonzero to keep the proportion of each label in every fold
+ * @param hidden_size the number of hidden neurons of every network
+ * @param learning_rate the learning rate of every network
+ * @param opts the options to make every network with, or NULL for defaults
+ * 	(their rng and arena are ignored)
+ * @param num_epochs the number of epochs to train each network for
+ * @param num_threads the number of folds to run at once, counting the calling
+ * 	thread
+ * @param losses space for k losses, which will hold each fold's validation
+ * 	loss; may be NULL
+ * @param variance set to the sample variance of the k validation losses; may
+ * 	be NULL
+ * @return the mean of the k validation losses
+ */
+double nn_cross_validate(dataset *ds, int k, int stratify, int hidden_size,
+	double learning_rate, const nn_options *opts, int num_epochs,
+	int num_threads, double *losses, double *variance);
 
 /**
  * Computes the average L2 loss of the network. If n is the number of examples,
@@ -105,13 +569,20 @@ void nn_train(nn *net, dataset *ds, int num_epochs);
  * hyperparameters and minimize this value on the held-out test set.
  * 
  * @param net the network to compute average loss on
- * @param ds the dataset to compute average loss for. This will call nn_forward
- * 	on each example in ds.
+ * @param ds the dataset to compute average loss for. This will call nn_predict
+ * 	on each example in ds, so the network is left untouched.
  */
-double nn_average_loss(nn *net, dataset *ds);
+double nn_average_loss(const nn *net, const dataset *ds);
 
 /**
- * Saves the network to a file at the given filepath.
+ * Saves the network to a file at the given filepath. The file starts with a
+ * header (a magic number, the format version, the shape, learning rate,
+ * optimizer settings and precision, and how far training has got), followed
+ * by the parameters in the network's precision, with w01 always input-major,
+ * and then the optimizer state. The header is padded to 64 bytes, and the rest
+ * is laid out so that nn_load_opts can use it in place (see nn_load_mode).
+ * Files from before the header existed, which start straight with the shape,
+ * can still be loaded, as can files from before the padding.
  */
 void nn_save(nn *net, char *filepath);
 
@@ -123,4 +594,28 @@ void nn_save(nn *net, char *filepath);
  */
 void nn_load(nn *net, char *filepath);
 
+/**
+ * nn_load with options, e.g. to serve a saved network with a faster sigmoid
+ * than it was trained with. nn_load(...) is nn_load_opts(..., NULL). The
+ * optimizer, its state and the epoch count come from the file if it has them,
+ * so training the loaded network carries on where it stopped; opts->optim only
+ * applies to files from before they were saved. The precision always comes
+ * from the file (files from before it was saved are doubles); use nn_convert
+ * to change it. opts->load chooses between copying the parameters and mapping
+ * the file.
+ *
+ * @param opts the options to load with, or NULL for the defaults
+ */
+void nn_load_opts(nn *net, char *filepath, const nn_options *opts);
+
+// Internals of nn.c that the rest of the library uses too. Not for callers.
+
+// A buffer of at least n doubles that belongs to the calling thread, and is
+// reused by its next call; what nn_predict works in. quant.c shares it.
+double *_thread_scratch(int n);
+
+// The hidden layer's sigmoid, for the accuracy tier net was set up with:
+// a[i] = sigmoid(a[i] + b[i]). The passes shapegen writes call it too.
+void _activate(const nn *net, int n, double *a, const double *b);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#include "nn.h"
+
+/**
+ * nnconvert: Converts a network saved by nn_save to another precision, e.g. to
+ * serve a network trained in doubles as floats, from a file half the size.
+ * Converting to the precision a network already has just rewrites it in the
+ * current file format. Going to float or mixed drops any optimizer state.
+ *
+ * Usage: ./nnconvert <in.nn> <out.nn> <double|float|mixed>
+ */
+
+static char *NAMES[] = {"double", "float", "mixed"};
+
+static int same(char *a, char *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+static void say(int fd, char *s) {
+  int len = 0;
+  while (s[len]) len++;
+  write(fd, s, len);
+}
+
+int main(int argc, char **argv) {
+  int precision = -1;
+  for (int i = 0; argc == 4 && i < 3; i++) {
+    if (same(argv[3], NAMES[i])) precision = i;
+  }
+  if (precision < 0) {
+    say(STDERR_FILENO, "Usage: ./nnconvert <in.nn> <out.nn> <double|float|mixed>\n");
+    return 1;
+  }
+
+  nn net;
+  nn_load(&net, argv[1]);
+  say(STDOUT_FILENO, NAMES[net.precision]);
+  say(STDOUT_FILENO, " -> ");
+  say(STDOUT_FILENO, NAMES[precision]);
+  say(STDOUT_FILENO, "\n");
+  nn_convert(&net, precision);
+  nn_save(&net, argv[2]);
+  nn_destroy(&net);
+  return 0;
+}
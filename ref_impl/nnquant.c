@@ -0,0 +1,125 @@
+#include "quant.h"
+
+/**
+ * nnquant: Quantizes a network saved by nn_save to int8 (see quant.h) and
+ * saves it with qnn_save, calibrating the input ranges on a CSV dataset. Then
+ * loads the quantized file back and reports how it does on that dataset
+ * against the original network, with either sigmoid: the average loss, the
+ * accuracy (how many predictions round to the true label), and the
+ * largest difference between the two networks' predictions.
+ *
+ * If the network was trained on normalized data, pass the ds_stats file it was
+ * normalized with, and the dataset is normalized with it first.
+ *
+ * Usage: ./nnquant <in.nn> <data.csv> <out.qnn> [stats]
+ */
+
+static void say_to(int fd, char *s) {
+  int len = 0;
+  while (s[len]) len++;
+  write(fd, s, len);
+}
+
+static void say(char *s) {
+  say_to(STDOUT_FILENO, s);
+}
+
+static void say_double(double x, int precision) {
+  char buf[32];
+  int sz = dtoa(buf, x, precision);
+  write(STDOUT_FILENO, buf, sz);
+}
+
+// How many predictions round to the true label
+static int correct(const dataset *ds, const double *pred) {
+  int right = 0;
+  for (int i = 0; i < ds->num_examples; i++) {
+    double rounded = pred[i] < 0 ? pred[i] - 0.5 : pred[i] + 0.5;
+    if ((int) rounded == ds_label(ds, i)) right++;
+  }
+  return right;
+}
+
+static double max_difference(int n, const double *a, const double *b) {
+  double max = 0;
+  for (int i = 0; i < n; i++) {
+    if (fabs(a[i] - b[i]) > max) max = fabs(a[i] - b[i]);
+  }
+  return max;
+}
+
+static void report(char *label, const dataset *ds, const double *pred,
+  const double *reference) {
+  double loss = 0;
+  for (int i = 0; i < ds->num_examples; i++) {
+    double err = ds_label(ds, i) - pred[i];
+    loss += err * err;
+  }
+  say(label);
+  say(" loss ");
+  say_double(ds->num_examples ? loss / ds->num_examples : 0, 8);
+  char buf[32];
+  say(", correct ");
+  write(STDOUT_FILENO, buf, itoa(buf, correct(ds, pred)));
+  say("/");
+  write(STDOUT_FILENO, buf, itoa(buf, ds->num_examples));
+  if (reference) {
+    say(", max difference ");
+    say_double(max_difference(ds->num_examples, pred, reference), 8);
+  }
+  say("\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4 && argc != 5) {
+    say_to(STDERR_FILENO,
+      "Usage: ./nnquant <in.nn> <data.csv> <out.qnn> [stats]\n");
+    return 1;
+  }
+
+  nn net;
+  nn_load(&net, argv[1]);
+  dataset ds;
+  ds_load_parallel(argv[2], 1, &ds);
+  if (argc == 5) {
+    ds_stats stats;
+    ds_stats_load(&stats, argv[4]);
+    ds_stats_apply(&stats, &ds);
+    ds_stats_destroy(&stats);
+  }
+
+  qnn q;
+  qnn_quantize(&q, &net, &ds);
+  qnn_save(&q, argv[3]);
+  qnn_destroy(&q);
+  qnn_load(&q, argv[3]);
+
+  int n = ds.num_examples;
+  size_t size = 3 * n * sizeof(double);
+  double *pred = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  nn_predict_dataset(&net, &ds, pred, NULL);
+  qnn_predict_dataset(&q, &ds, pred + n);
+  q.sigmoid = QNN_SIGMOID_TABLE;
+  qnn_predict_dataset(&q, &ds, pred + 2 * n);
+
+  char buf[32];
+  say("Quantized ");
+  write(STDOUT_FILENO, buf, itoa(buf, net.input_size));
+  say("x");
+  write(STDOUT_FILENO, buf, itoa(buf, net.hidden_size));
+  say(" network into ");
+  write(STDOUT_FILENO, buf, itoa(buf, (int) q._image_size));
+  say(" bytes, checked on ");
+  write(STDOUT_FILENO, buf, itoa(buf, n));
+  say(" examples\n");
+  report("original       ", &ds, pred, NULL);
+  report("int8, float    ", &ds, pred + n, pred);
+  report("int8, table    ", &ds, pred + 2 * n, pred);
+
+  munmap(pred, size);
+  qnn_destroy(&q);
+  nn_destroy(&net);
+  ds_deep_destroy(&ds);
+  return 0;
+}
@@ -0,0 +1,113 @@
+#include "pool.h"
+
+// The loop every spawned thread runs: wait for a job with a new generation
+// number, run it, report back, and go back to sleep.
+void *_pool_worker(void *data) {
+	pool *p = (pool*) data;
+	unsigned long seen = 0;
+
+	// Our worker number is our position in the threads array, plus one since
+	// the caller of pool_run is worker 0.
+	int worker = 0;
+	pthread_t self = pthread_self();
+	pthread_mutex_lock(&p->lock);
+	for(int i = 0; i < p->num_workers - 1; i++) {
+		if(pthread_equal(p->threads[i], self)) worker = i + 1;
+	}
+
+	while(1) {
+		while(p->generation == seen && !p->shutdown) {
+			pthread_cond_wait(&p->job_posted, &p->lock);
+		}
+		if(p->shutdown) break;
+		seen = p->generation;
+		pthread_mutex_unlock(&p->lock);
+
+		p->fn(p->arg, worker, p->num_workers);
+
+		pthread_mutex_lock(&p->lock);
+		if(--p->pending == 0) pthread_cond_signal(&p->job_done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/*
+ * The thread handles are the only thing we need to allocate. Workers look up
+ * their own number in that array, so we hold the lock while spawning to make
+ * sure the array is complete before any of them go looking.
+ */
+void pool_init(pool *p, int num_workers) {
+	if(num_workers < 1) num_workers = 1;
+	p->num_workers = num_workers;
+	p->fn = NULL;
+	p->arg = NULL;
+	p->generation = 0;
+	p->pending = 0;
+	p->shutdown = 0;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->job_posted, NULL);
+	pthread_cond_init(&p->job_done, NULL);
+
+	p->threads = mmap(NULL, sizeof(pthread_t) * num_workers,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p->threads == MAP_FAILED) {
+		printf("pool_init map failed\n");
+		exit(18);
+	}
+
+	pthread_mutex_lock(&p->lock);
+	for(int i = 0; i < num_workers - 1; i++) {
+		if(pthread_create(&p->threads[i], NULL, _pool_worker, p)) {
+			perror("pthread_create");
+			exit(19);
+		}
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+// Post the job, do our own share as worker 0, then wait for the stragglers.
+void pool_run(pool *p, pool_fn fn, void *arg) {
+	pthread_mutex_lock(&p->lock);
+	p->fn = fn;
+	p->arg = arg;
+	p->pending = p->num_workers - 1;
+	p->generation++;
+	pthread_cond_broadcast(&p->job_posted);
+	pthread_mutex_unlock(&p->lock);
+
+	fn(arg, 0, p->num_workers);
+
+	pthread_mutex_lock(&p->lock);
+	while(p->pending > 0) {
+		pthread_cond_wait(&p->job_done, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pool_destroy(pool *p) {
+	pthread_mutex_lock(&p->lock);
+	p->shutdown = 1;
+	pthread_cond_broadcast(&p->job_posted);
+	pthread_mutex_unlock(&p->lock);
+	for(int i = 0; i < p->num_workers - 1; i++) {
+		pthread_join(p->threads[i], NULL);
+	}
+
+	int err = munmap(p->threads, sizeof(pthread_t) * p->num_workers);
+	if(err) {
+		perror("pool_destroy munmap");
+		exit(20);
+	}
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->job_posted);
+	pthread_cond_destroy(&p->job_done);
+}
+
+// The first n % num_workers workers get one extra item each.
+void pool_range(int n, int worker, int num_workers, int *start, int *end) {
+	int base = n / num_workers;
+	int extra = n % num_workers;
+	*start = worker * base + (worker < extra ? worker : extra);
+	*end = *start + base + (worker < extra ? 1 : 0);
+}
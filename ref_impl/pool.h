@@ -0,0 +1,76 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include "util.h"
+
+/**
+ * A small fork-join worker pool. A pool owns a fixed set of threads that sleep
+ * until pool_run hands them a job, at which point every worker runs the same
+ * function with its own worker number, and pool_run returns once all of them
+ * are done. The thread calling pool_run takes part as worker 0, so a pool of
+ * n workers only ever spawns n - 1 threads.
+ *
+ * Jobs decide how to split their work from the worker number alone, which is
+ * what keeps parallel results reproducible: the same job on the same number of
+ * workers always divides the same way, no matter how the OS schedules them.
+ */
+
+/**
+ * The signature of a job. arg is passed through from pool_run unchanged.
+ */
+typedef void (*pool_fn)(void *arg, int worker, int num_workers);
+
+typedef struct pool {
+	// Number of workers, counting the thread that calls pool_run.
+	int num_workers;
+	// The spawned threads (num_workers - 1 of them), mmapped.
+	pthread_t *threads;
+
+	// The current job and its argument.
+	pool_fn fn;
+	void *arg;
+	// Bumped every time a new job is posted, so sleeping workers can tell a new
+	// job from a spurious wakeup.
+	unsigned long generation;
+	// Workers still running the current job.
+	int pending;
+	// Set by pool_destroy to send the workers home.
+	int shutdown;
+
+	pthread_mutex_t lock;
+	pthread_cond_t job_posted;
+	pthread_cond_t job_done;
+} pool;
+
+/**
+ * Starts a pool of the given number of workers.
+ *
+ * @param p the uninitialized pool to start
+ * @param num_workers the number of workers, including the calling thread.
+ * 	Values below 1 are treated as 1.
+ */
+void pool_init(pool *p, int num_workers);
+
+/**
+ * Runs fn on every worker of the pool and waits for all of them to finish.
+ *
+ * @param p the pool to run on
+ * @param fn the job
+ * @param arg passed to every invocation of fn
+ */
+void pool_run(pool *p, pool_fn fn, void *arg);
+
+/**
+ * Stops and joins all of the pool's threads and frees its resources.
+ */
+void pool_destroy(pool *p);
+
+/**
+ * Helper for splitting n items evenly over a pool's workers: worker w of
+ * num_workers gets items [*start, *end).
+ */
+void pool_range(int n, int worker, int num_workers, int *start, int *end);
+
+#endif
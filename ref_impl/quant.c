@@ -0,0 +1,269 @@
+#include "quant.h"
+
+/**
+ * The file format is the image itself. The header is padded to 64 bytes so the
+ * float arrays after it stay aligned, and w01 starts on the next 64 byte
+ * boundary after them.
+ */
+static const char _QNN_MAGIC[8] = "NNQUANT";
+static const int _QNN_VERSION = 1;
+
+typedef struct _qnn_header {
+	char magic[8];
+	int version;
+	int input_size;
+	int hidden_size;
+	int input_padded;
+	double b2;
+	char _pad[32];
+} _qnn_header;
+
+// The offset of w01 in the image of a network of the given shape
+size_t _qnn_w01_offset(int input_size, int hidden_size) {
+	size_t floats = (size_t) input_size + 3 * (size_t) hidden_size;
+	return (sizeof(_qnn_header) + floats * sizeof(float) + 63) / 64 * 64;
+}
+
+size_t _qnn_image_size(int input_size, int hidden_size) {
+	return _qnn_w01_offset(input_size, hidden_size)
+		+ (size_t) hidden_size * ((input_size + 1) / 2 * 2);
+}
+
+// Points q into an image whose header is already filled in
+void _qnn_bind(qnn *q, void *image, size_t size) {
+	_qnn_header *header = image;
+	q->input_size = header->input_size;
+	q->hidden_size = header->hidden_size;
+	q->input_padded = header->input_padded;
+	q->b2 = header->b2;
+	q->in_scale = (const float*) ((char*) image + sizeof(_qnn_header));
+	q->w_scale = q->in_scale + q->input_size;
+	q->b1 = q->w_scale + q->hidden_size;
+	q->w12 = q->b1 + q->hidden_size;
+	q->w01 = (const int8_t*) image
+		+ _qnn_w01_offset(q->input_size, q->hidden_size);
+	q->sigmoid = QNN_SIGMOID_FLOAT;
+	q->_image = image;
+	q->_image_size = size;
+}
+
+// The sigmoid table: 2048 steps of 1/64 over [-16, 16], and the end point
+static float _sigmoid_table[2049];
+static pthread_once_t _sigmoid_table_once = PTHREAD_ONCE_INIT;
+
+void _fill_sigmoid_table() {
+	for(int k = 0; k <= 2048; k++) {
+		_sigmoid_table[k] = 1.0 / (1.0 + exp(-(k / 64.0 - 16.0)));
+	}
+}
+
+// a[i] = sigmoid(a[i] + b[i]) by the table, interpolating linearly between
+// its entries
+void _sigmoid_table_f32(int n, float *a, const float *b) {
+	for(int i = 0; i < n; i++) {
+		float t = (a[i] + b[i] + 16.0f) * 64.0f;
+		if(t < 0.0f) t = 0.0f;
+		if(t > 2048.0f) t = 2048.0f;
+		int k = (int) t;
+		if(k == 2048) k = 2047;
+		float lo = _sigmoid_table[k];
+		a[i] = lo + (t - k) * (_sigmoid_table[k + 1] - lo);
+	}
+}
+
+// Rounds to the nearest int8, clamping to +-127 so the range is symmetric
+static inline int8_t _round_i8(double v) {
+	if(v > 127.0) return 127;
+	if(v < -127.0) return -127;
+	return (int8_t) (v < 0 ? v - 0.5 : v + 0.5);
+}
+
+// The weight between input j and hidden neuron i in the network, whatever its
+// layout and precision
+double _w01_at(const nn *net, int j, int i) {
+	size_t k = net->layout == NN_LAYOUT_HIDDEN_MAJOR
+		? (size_t) i * net->input_size + j
+		: (size_t) j * net->hidden_size + i;
+	if(net->precision == NN_PRECISION_DOUBLE) return net->w01[k];
+	return net->w01_f32[k];
+}
+
+void qnn_quantize(qnn *q, const nn *net, const dataset *calib) {
+	int in = net->input_size;
+	int hid = net->hidden_size;
+	if(calib->num_attributes != in) {
+		printf("qnn_quantize: calibration set has %d attributes, network has %d\n",
+			calib->num_attributes, in);
+		exit(47);
+	}
+	// Every int32 sum has to stay below 2^31 even if all of its products are
+	// 127 * 127
+	int padded = (in + 1) / 2 * 2;
+	if(padded > 133000) {
+		printf("qnn_quantize: input layer too wide to accumulate in int32\n");
+		exit(47);
+	}
+
+	size_t size = _qnn_image_size(in, hid);
+	void *image = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(image == MAP_FAILED) {
+		printf("qnn_quantize map failed\n");
+		exit(47);
+	}
+	_qnn_header *header = image;
+	for(int k = 0; k < 8; k++) {
+		header->magic[k] = _QNN_MAGIC[k];
+	}
+	header->version = _QNN_VERSION;
+	header->input_size = in;
+	header->hidden_size = hid;
+	header->input_padded = padded;
+	header->b2 = net->b2;
+	_qnn_bind(q, image, size);
+
+	// The image is still writable while we fill it in. It is zeroed, which
+	// takes care of the padding row of w01, if there is one.
+	float *in_scale = (float*) q->in_scale;
+	float *w_scale = (float*) q->w_scale;
+	float *b1 = (float*) q->b1;
+	float *w12 = (float*) q->w12;
+	int8_t *w01 = (int8_t*) q->w01;
+
+	// Input ranges, one pass over the calibration set. Inputs that never
+	// leave 0 get a range of 1, which is as good as any.
+	for(int j = 0; j < in; j++) {
+		in_scale[j] = 0.0f;
+	}
+	for(int r = 0; r < calib->num_examples; r++) {
+		double *x = ds_example(calib, r);
+		for(int j = 0; j < in; j++) {
+			if(fabs(x[j]) > in_scale[j]) in_scale[j] = fabs(x[j]);
+		}
+	}
+	for(int j = 0; j < in; j++) {
+		in_scale[j] = in_scale[j] > 0.0f ? 127.0 / in_scale[j] : 127.0f;
+	}
+
+	for(int i = 0; i < hid; i++) {
+		double max = 0.0;
+		for(int j = 0; j < in; j++) {
+			double w = fabs(_w01_at(net, j, i) / in_scale[j]);
+			if(w > max) max = w;
+		}
+		w_scale[i] = max > 0.0 ? max / 127.0 : 1.0f;
+		for(int j = 0; j < in; j++) {
+			double w = _w01_at(net, j, i) / in_scale[j];
+			// Rows j and j + 1 (for even j) are interleaved, as matvec_i8 wants
+			size_t k = (size_t) (j & ~1) * hid + 2 * i + (j & 1);
+			w01[k] = _round_i8(w / w_scale[i]);
+		}
+		if(net->precision == NN_PRECISION_DOUBLE) {
+			b1[i] = net->b1[i];
+			w12[i] = net->w12[i];
+		} else {
+			b1[i] = net->b1_f32[i];
+			w12[i] = net->w12_f32[i];
+		}
+	}
+	pthread_once(&_sigmoid_table_once, _fill_sigmoid_table);
+}
+
+void qnn_save(const qnn *q, char *filepath) {
+	int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if(fd < 0) {
+		perror("qnn_save");
+		exit(48);
+	}
+	write_all(fd, q->_image, q->_image_size);
+	close(fd);
+}
+
+void qnn_load(qnn *q, char *filepath) {
+	int fd = open(filepath, O_RDONLY);
+	if(fd < 0) {
+		perror("qnn_load");
+		exit(49);
+	}
+	struct stat statbuf;
+	if(fstat(fd, &statbuf) < 0) {
+		perror("qnn_load fstat");
+		exit(49);
+	}
+	size_t size = statbuf.st_size;
+	void *image = NULL;
+	if(size >= sizeof(_qnn_header)) {
+		image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(image == MAP_FAILED) {
+			printf("qnn_load map failed\n");
+			exit(49);
+		}
+	}
+	close(fd);
+
+	_qnn_header *header = image;
+	int ok = image != NULL && header->version == _QNN_VERSION;
+	for(int k = 0; ok && k < 8; k++) {
+		ok = header->magic[k] == _QNN_MAGIC[k];
+	}
+	ok = ok && header->input_size > 0 && header->hidden_size > 0
+		&& header->input_padded == (header->input_size + 1) / 2 * 2
+		&& size == _qnn_image_size(header->input_size, header->hidden_size);
+	if(!ok) {
+		printf("qnn_load: %s is not a quantized network\n", filepath);
+		exit(49);
+	}
+	_qnn_bind(q, image, size);
+	pthread_once(&_sigmoid_table_once, _fill_sigmoid_table);
+}
+
+void qnn_destroy(qnn *q) {
+	int err = munmap(q->_image, q->_image_size);
+	if(err) {
+		perror("qnn_destroy munmap");
+		exit(50);
+	}
+}
+
+// The forward pass, in a scratch buffer of input_padded bytes for the
+// quantized input, rounded up to a multiple of 8, followed by hidden_size
+// floats for the activations
+double _qnn_predict(const qnn *q, const double *x, void *scratch) {
+	int8_t *xq = scratch;
+	float *h = (float*) (xq + (q->input_padded + 7) / 8 * 8);
+	kern->quantize_i8(q->input_size, x, q->in_scale, xq);
+	if(q->input_padded > q->input_size) xq[q->input_size] = 0;
+	kern->matvec_i8(q->input_padded, q->hidden_size, xq, q->w01, q->w_scale, h);
+	if(q->sigmoid == QNN_SIGMOID_TABLE) {
+		_sigmoid_table_f32(q->hidden_size, h, q->b1);
+	} else {
+		kern->sigmoid_f32(q->hidden_size, h, q->b1);
+	}
+	return kern->dot_f32(q->hidden_size, h, q->w12) + q->b2;
+}
+
+// Scratch for _qnn_predict, private to the calling thread
+void *_qnn_scratch(const qnn *q) {
+	return _thread_scratch((q->input_padded + 7) / 8 + (q->hidden_size + 1) / 2);
+}
+
+double qnn_predict(const qnn *q, const double *x) {
+	return _qnn_predict(q, x, _qnn_scratch(q));
+}
+
+void qnn_predict_dataset(const qnn *q, const dataset *ds, double *out) {
+	void *scratch = _qnn_scratch(q);
+	for(int i = 0; i < ds->num_examples; i++) {
+		out[i] = _qnn_predict(q, ds_example(ds, i), scratch);
+	}
+}
+
+double qnn_average_loss(const qnn *q, const dataset *ds) {
+	void *scratch = _qnn_scratch(q);
+	double total_loss = 0;
+	for(int i = 0; i < ds->num_examples; i++) {
+		double err = ds_label(ds, i) - _qnn_predict(q, ds_example(ds, i), scratch);
+		total_loss += err*err;
+	}
+	return ds->num_examples ? total_loss / ds->num_examples : 0;
+}
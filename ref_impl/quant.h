@@ -0,0 +1,132 @@
+#ifndef _QUANT_H_
+#define _QUANT_H_
+
+#include "nn.h"
+
+/**
+ * Quantized networks, for serving. A `qnn` is an inference-only copy of a
+ * trained `nn` whose input-to-hidden weights (by far the biggest part of it)
+ * are 8 bit integers. That makes w01 an eighth of the size of a double
+ * network's, and the products accumulate exactly in int32 with the
+ * matvec_i8 kernel, 32 at a time with AVX-512.
+ *
+ * The quantization is symmetric and done once, after training:
+ *
+ * - each input j is scaled by in_scale[j] and rounded to an int8 (by the
+ *   quantize_i8 kernel), where in_scale[j] is 127 over the largest |x_j| seen
+ *   in a calibration dataset. Bigger inputs are clamped to +-127.
+ * - w01 is divided by the same factors, so the product stays the same, and
+ *   then every hidden neuron's weights are scaled by a factor of their own
+ *   (w_scale) to use the whole int8 range and rounded.
+ *
+ * So the pre-activation of hidden neuron i is w_scale[i] times the int32 dot
+ * product of its weights and the quantized input, plus b1[i]. Everything from
+ * there on (the biases, the sigmoid and the output layer) is in floats.
+ *
+ * A qnn lives in a single read-only image that is laid out exactly like the
+ * file qnn_save writes: a header, then in_scale, w_scale, b1 and w12, then,
+ * from the next 64 byte boundary, w01 in the order matvec_i8 takes it:
+ * input-major, with the rows of each pair of inputs interleaved, and a row of
+ * zeros at the end if input_size is odd. qnn_load maps the file and uses it
+ * as is, without copying or converting anything, so several processes serving
+ * the same model share one copy in the page cache.
+ */
+
+/**
+ * How a quantized network computes its hidden layer's sigmoid.
+ */
+typedef enum qnn_sigmoid {
+	// The sigmoid_f32 kernel. The default.
+	QNN_SIGMOID_FLOAT,
+	// Linear interpolation in a table of 2048 steps over [-16, 16], clamped
+	// outside it. Within 3e-6 of the true sigmoid.
+	QNN_SIGMOID_TABLE
+} qnn_sigmoid;
+
+typedef struct qnn {
+	// The size of the input layer.
+	int input_size;
+	// The size of the hidden layer.
+	int hidden_size;
+	// The number of rows of w01: input_size rounded up to an even number
+	int input_padded;
+	// What input j is multiplied by before being rounded to an int8
+	const float *in_scale;
+	// What hidden neuron i's int32 dot product is multiplied by
+	const float *w_scale;
+	// Hidden layer biases
+	const float *b1;
+	// Weights between hidden layer and output neuron
+	const float *w12;
+	// Quantized weights, input_padded rows of hidden_size, laid out for
+	// matvec_i8
+	const int8_t *w01;
+	// Output neuron bias
+	double b2;
+	// How the sigmoid is computed. Not saved; qnn_quantize and qnn_load set it
+	// to QNN_SIGMOID_FLOAT, and it can be changed at any time.
+	qnn_sigmoid sigmoid;
+	// The image everything above points into, and its size in bytes
+	void *_image;
+	size_t _image_size;
+} qnn;
+
+/**
+ * Quantizes a trained network. The network can have any precision and layout,
+ * and is left untouched.
+ *
+ * @param q the uninitialized qnn to quantize into
+ * @param net the network to quantize
+ * @param calib the examples to take the input ranges from; ideally the
+ * 	training set, normalized the same way inputs will be at prediction time.
+ * 	Must have net->input_size attributes.
+ */
+void qnn_quantize(qnn *q, const nn *net, const dataset *calib);
+
+/**
+ * Saves a quantized network to a file, which is just its image.
+ */
+void qnn_save(const qnn *q, char *filepath);
+
+/**
+ * Maps a file saved by qnn_save read-only and uses it directly as the
+ * quantized network. Like the binary dataset format, this is meant for the
+ * machine (or at least the byte order) it was saved on.
+ *
+ * @param q the uninitialized qnn to load into
+ * @param filepath the file to load
+ */
+void qnn_load(qnn *q, char *filepath);
+
+/**
+ * Unmaps a quantized network's image.
+ */
+void qnn_destroy(qnn *q);
+
+/**
+ * Generate a prediction for an example. Like nn_predict, this never writes to
+ * the network, so any number of threads can predict with the same one at
+ * once; each works in a buffer private to the calling thread.
+ *
+ * @param q the quantized network to run the example through
+ * @param x the example, with q->input_size attributes
+ * @return the network's prediction
+ */
+double qnn_predict(const qnn *q, const double *x);
+
+/**
+ * qnn_predict for every example of a dataset, in dataset order.
+ *
+ * @param q the quantized network to run the examples through
+ * @param ds the examples to predict
+ * @param out space for ds->num_examples predictions
+ */
+void qnn_predict_dataset(const qnn *q, const dataset *ds, double *out);
+
+/**
+ * Computes the average L2 loss of a quantized network on a dataset, the same
+ * way nn_average_loss does.
+ */
+double qnn_average_loss(const qnn *q, const dataset *ds);
+
+#endif
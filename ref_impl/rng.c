@@ -0,0 +1,108 @@
+#include "rng.h"
+
+rng rng_global;
+
+void rng_init(rng *r, uint64_t seed, uint64_t stream) {
+	r->key[0] = (uint32_t) seed;
+	r->key[1] = seed >> 32;
+	r->stream = stream;
+	r->block = 0;
+	r->left = 0;
+}
+
+void rng_seed(uint64_t seed) {
+	rng_init(&rng_global, seed, 0);
+}
+
+void seed() {
+	struct timespec t;
+	// we have to do this instead of just time(NULL)
+	// because clock_gettime is a syscall and time is stdlib
+	if(clock_gettime(CLOCK_REALTIME, &t) == -1) {
+		perror("clock_gettime");
+		exit(1);
+	}
+	// Seed the randomizer with system time
+	rng_seed(t.tv_sec);
+}
+
+// One block at a time goes through the scalar kernel; the SIMD ones would
+// mostly be computing lanes we'd throw away.
+uint32_t rng_next(rng *r) {
+	if(r->left == 0) {
+		kernels_scalar.philox(1, r->key, r->stream, r->block++, r->buf);
+		r->left = 4;
+	}
+	return r->buf[4 - r->left--];
+}
+
+uint64_t rng_next64(rng *r) {
+	uint64_t lo = rng_next(r);
+	return lo | (uint64_t) rng_next(r) << 32;
+}
+
+uint32_t rng_below(rng *r, uint32_t n) {
+	uint64_t m = (uint64_t) rng_next(r) * n;
+	uint32_t low = (uint32_t) m;
+	if(low < n) {
+		// 2^32 mod n: the low halves below this are the excess that would
+		// favor some results over others
+		uint32_t threshold = -n % n;
+		while(low < threshold) {
+			m = (uint64_t) rng_next(r) * n;
+			low = (uint32_t) m;
+		}
+	}
+	return m >> 32;
+}
+
+// The top 52 bits of a 64-bit word, as the mantissa of a double in [1, 2),
+// minus 1
+static inline double _to_double(uint32_t lo, uint32_t hi) {
+	union {
+		uint64_t bits;
+		double d;
+	} u;
+	u.bits = 0x3FF0000000000000ULL | (((uint64_t) hi << 32 | lo) >> 12);
+	return u.d - 1.0;
+}
+
+double rng_double(rng *r) {
+	uint32_t lo = rng_next(r);
+	return _to_double(lo, rng_next(r));
+}
+
+// Blocks per round of rng_fill, sized for the buffer on the stack
+static const int _FILL_BLOCKS = 256;
+
+/*
+ * Each round takes the words left over from the last block first, then as many
+ * new blocks as it takes to make up the round's doubles, and puts back the few
+ * words that weren't needed, so the stream ends up exactly where rng_double
+ * would have left it.
+ */
+void rng_fill(rng *r, int n, double *out) {
+	uint32_t words[4 * _FILL_BLOCKS + 4];
+	while(n > 0) {
+		int count = n < 2 * _FILL_BLOCKS ? n : 2 * _FILL_BLOCKS;
+		int have = 0;
+		while(r->left) {
+			words[have++] = r->buf[4 - r->left--];
+		}
+		int blocks = (2 * count - have + 3) / 4;
+		kern->philox(blocks, r->key, r->stream, r->block, words + have);
+		r->block += blocks;
+		have += 4 * blocks;
+
+		for(int i = 0; i < count; i++) {
+			out[i] = _to_double(words[2 * i], words[2 * i + 1]);
+		}
+		int spare = have - 2 * count;
+		for(int i = 0; i < spare; i++) {
+			r->buf[4 - spare + i] = words[2 * count + i];
+		}
+		r->left = spare;
+		out += count;
+		n -= count;
+	}
+}
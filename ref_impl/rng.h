@@ -0,0 +1,98 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include <stdint.h>
+#include "util.h"
+#include "kernels.h"
+
+/**
+ * Random numbers, from explicit generator objects instead of the one hidden
+ * state behind rand(). The generator is Philox4x32-10, a counter-based one:
+ * every 128-bit block of output is a keyed hash of its own position, so an
+ * rng is just a key (the seed), a stream number and a position. That makes
+ * streams free to split: every stream of a seed is a different part of the
+ * same counter space, so they never overlap, and threads, folds or ensemble
+ * members can each take one by number and get the same numbers every run, no
+ * matter what the others do. It also makes bulk generation vectorize, with the
+ * philox kernel computing many blocks side by side.
+ *
+ * rng_global is the stream that seed and rng_seed set up, and that everything
+ * which doesn't take an rng of its own (ds_shuffle, nn_init) draws from. Like
+ * rand(), it is not for sharing between threads.
+ */
+typedef struct rng {
+	// The seed, as Philox's key
+	uint32_t key[2];
+	// The stream number, and the next block of it to generate
+	uint64_t stream;
+	uint64_t block;
+	// The words of the last block that haven't been handed out yet:
+	// buf[4 - left] is the next one
+	uint32_t buf[4];
+	int left;
+} rng;
+
+/**
+ * The default stream: stream 0 of the seed given to seed or rng_seed (0 until
+ * then).
+ */
+extern rng rng_global;
+
+/**
+ * Starts a generator at the beginning of one stream of a seed. Different
+ * streams of the same seed never produce overlapping output.
+ *
+ * @param r the generator to start
+ * @param seed the seed
+ * @param stream which stream of the seed to take, e.g. a thread or fold number
+ */
+void rng_init(rng *r, uint64_t seed, uint64_t stream);
+
+/**
+ * Restarts rng_global at stream 0 of the given seed.
+ */
+void rng_seed(uint64_t seed);
+
+/**
+ * Seeds rng_global from the system time. Only in the C implementation; the
+ * asm seeds its XorShift64* the same way.
+ */
+void seed();
+
+/**
+ * Returns the next 32 random bits of a stream.
+ */
+uint32_t rng_next(rng *r);
+
+/**
+ * Returns the next 64 random bits of a stream: two rng_next words, the first
+ * one low.
+ */
+uint64_t rng_next64(rng *r);
+
+/**
+ * Returns a uniformly distributed integer in [0, n), for n >= 1. Unlike
+ * rand() % n, this has no bias towards small values: it takes the high half
+ * of a 32 x 32-bit product, and draws again in the rare case the low half
+ * shows the result would have been biased (Lemire's method).
+ */
+uint32_t rng_below(rng *r, uint32_t n);
+
+/**
+ * Returns a uniformly distributed double in [0, 1), with 52 random bits, made
+ * from the next 64 bits of the stream.
+ */
+double rng_double(rng *r);
+
+/**
+ * Fills out with n uniformly distributed doubles in [0, 1). Gives exactly what
+ * n calls to rng_double would, and leaves the stream in the same place, but
+ * generates whole runs of blocks at a time with the philox kernel.
+ *
+ * @param r the stream to draw from
+ * @param n the number of doubles
+ * @param out space for n doubles
+ */
+void rng_fill(rng *r, int n, double *out);
+
+#endif
@@ -0,0 +1,277 @@
+#include <unistd.h>
+#include "util.h"
+
+/**
+ * shapegen: Writes shapes.c (see shapes.h) to stdout: nn_predict and
+ * nn_backward for each of the given network shapes, in both layouts, with
+ * every loop unrolled, and the table nn_find_shape looks them up in. The
+ * Makefile runs it with the shapes listed in SHAPES.
+ *
+ * The unrolled code grows with input_size * hidden_size, so shapes with more
+ * than 4096 weights are refused; the generic passes are as good as anything
+ * at that size anyway.
+ *
+ * Usage: ./shapegen [<input_size>x<hidden_size> ...]
+ */
+
+#define MAX_WEIGHTS 4096
+
+static char out[1 << 16];
+static int used = 0;
+
+static void flush() {
+  write(STDOUT_FILENO, out, used);
+  used = 0;
+}
+
+static void put(char *s) {
+  while (*s) {
+    if (used == sizeof(out)) flush();
+    out[used++] = *s++;
+  }
+}
+
+static void put_int(int x) {
+  char buf[16];
+  int sz = x == 0 ? 1 : itoa(buf, x);
+  if (x == 0) buf[0] = '0';
+  buf[sz] = '\0';
+  put(buf);
+}
+
+static void say_error(char *s) {
+  int len = 0;
+  while (s[len]) len++;
+  write(STDERR_FILENO, s, len);
+}
+
+static void fail(char *shape, char *why) {
+  say_error("shapegen: ");
+  say_error(shape);
+  say_error(why);
+  say_error("\n");
+  exit(1);
+}
+
+// Parses a positive decimal number at *s, leaving *s after it, or returns 0
+static int parse_int(char **s) {
+  int x = 0;
+  while (**s >= '0' && **s <= '9' && x < 100000) {
+    x = 10 * x + (**s - '0');
+    (*s)++;
+  }
+  return x;
+}
+
+// The index in w01 of the weight between input j and hidden neuron i
+static int w01_index(int in, int hid, int layout, int j, int i) {
+  return layout == 0 ? j * hid + i : i * in + j;
+}
+
+// Writes the name of a generated function: _<kind>_<in>x<hid>_<layout>
+static void put_name(char *kind, int in, int hid, int layout) {
+  put("_");
+  put(kind);
+  put("_");
+  put_int(in);
+  put("x");
+  put_int(hid);
+  put("_");
+  put_int(layout);
+}
+
+// The generic passes run on whichever kernels table suits the CPU. The
+// generated ones get the same treatment from GCC: target_clones compiles a
+// function once per instruction set and picks one when the program is loaded.
+static void put_clones() {
+#if defined(__x86_64__)
+  put("__attribute__((target_clones(");
+  put("\"avx512f\", \"avx2,fma\", \"default\")))\n");
+#endif
+}
+
+static void put_weight(char *array, int k) {
+  put(array);
+  put("[");
+  put_int(k);
+  put("]");
+}
+
+// The forward pass. Every hidden neuron's sum gets a local of its own, s<i>,
+// and the inputs are taken in the order the weights are laid out in. The
+// output layer's dot product is split over four sums, so the adds don't all
+// wait on each other.
+static void put_predict(int in, int hid, int layout) {
+  put_clones();
+  put("static double ");
+  put_name("predict", in, hid, layout);
+  put("(const nn *net, const double *x,\n\tdouble *h) {\n");
+  put("\tconst double *w = net->w01;\n");
+  int outer = layout == 0 ? in : hid;
+  int inner = layout == 0 ? hid : in;
+  for (int a = 0; a < outer; a++) {
+    for (int b = 0; b < inner; b++) {
+      int j = layout == 0 ? a : b;
+      int i = layout == 0 ? b : a;
+      put(j == 0 ? "\tdouble s" : "\ts");
+      put_int(i);
+      put(j == 0 ? " = x[" : " += x[");
+      put_int(j);
+      put("] * ");
+      put_weight("w", w01_index(in, hid, layout, j, i));
+      put(";\n");
+    }
+  }
+  for (int i = 0; i < hid; i++) {
+    put("\th[");
+    put_int(i);
+    put("] = s");
+    put_int(i);
+    put(";\n");
+  }
+  put("\t_activate(net, ");
+  put_int(hid);
+  put(", h, net->b1);\n");
+  put("\tconst double *w12 = net->w12;\n");
+  for (int i = 0; i < hid; i++) {
+    put(i < 4 ? "\tdouble o" : "\to");
+    put_int(i % 4);
+    put(i < 4 ? " = h[" : " += h[");
+    put_int(i);
+    put("] * ");
+    put_weight("w12", i);
+    put(";\n");
+  }
+  put("\treturn ");
+  for (int k = 0; k < 4 && k < hid; k++) {
+    put(k ? " + o" : "o");
+    put_int(k);
+  }
+  put(" + net->b2;\n}\n\n");
+}
+
+// The backward pass for plain SGD. w01, b1, o1 and w12 all live in the same
+// block, so the compiler has to assume any store could change any of them;
+// the hidden activations and the inputs are read into locals first so they
+// aren't loaded again after every store. Each hidden neuron's delta goes in a
+// local too, d<i>, and the w01 update then walks w01 in memory order.
+static void put_backward(int in, int hid, int layout) {
+  put_clones();
+  put("static void ");
+  put_name("backward", in, hid, layout);
+  put("(nn *net, const double *x, int y) {\n");
+  put("\tdouble *w = net->w01;\n");
+  put("\tdouble *b1 = net->b1;\n");
+  put("\tdouble *w12 = net->w12;\n");
+  put("\tdouble rate = net->rate;\n");
+  put("\tdouble g = 2 * (net->o2 - y);\n");
+  for (int j = 0; j < in; j++) {
+    put("\tdouble x");
+    put_int(j);
+    put(" = x[");
+    put_int(j);
+    put("];\n");
+  }
+  for (int i = 0; i < hid; i++) {
+    put("\tdouble h");
+    put_int(i);
+    put(" = net->o1[");
+    put_int(i);
+    put("];\n");
+  }
+  put("\tnet->b2 -= rate * g;\n");
+  for (int i = 0; i < hid; i++) {
+    put("\tdouble d");
+    put_int(i);
+    put(" = g * ");
+    put_weight("w12", i);
+    put(" * h");
+    put_int(i);
+    put(" * (1 - h");
+    put_int(i);
+    put(");\n\t");
+    put_weight("w12", i);
+    put(" -= rate * (g * h");
+    put_int(i);
+    put(");\n\t");
+    put_weight("b1", i);
+    put(" -= rate * d");
+    put_int(i);
+    put(";\n");
+  }
+  int outer = layout == 0 ? in : hid;
+  int inner = layout == 0 ? hid : in;
+  for (int a = 0; a < outer; a++) {
+    for (int b = 0; b < inner; b++) {
+      int j = layout == 0 ? a : b;
+      int i = layout == 0 ? b : a;
+      put("\t");
+      put_weight("w", w01_index(in, hid, layout, j, i));
+      put(" -= rate * (x");
+      put_int(j);
+      put(" * d");
+      put_int(i);
+      put(");\n");
+    }
+  }
+  put("}\n\n");
+}
+
+int main(int argc, char **argv) {
+  int in[argc];
+  int hid[argc];
+  for (int k = 1; k < argc; k++) {
+    char *s = argv[k];
+    in[k] = parse_int(&s);
+    if (*s++ != 'x') fail(argv[k], " is not <input_size>x<hidden_size>");
+    hid[k] = parse_int(&s);
+    if (*s || in[k] == 0 || hid[k] == 0) {
+      fail(argv[k], " is not <input_size>x<hidden_size>");
+    }
+    if (in[k] * hid[k] > MAX_WEIGHTS) {
+      fail(argv[k], " has too many weights to unroll");
+    }
+  }
+
+  put("// Generated by shapegen; see shapes.h. Do not edit.\n\n");
+  put("#include \"nn.h\"\n\n");
+  for (int k = 1; k < argc; k++) {
+    for (int layout = 0; layout < 2; layout++) {
+      put("// ");
+      put_int(in[k]);
+      put("x");
+      put_int(hid[k]);
+      put(layout == 0 ? ", input-major\n" : ", hidden-major\n");
+      put_predict(in[k], hid[k], layout);
+      put_backward(in[k], hid[k], layout);
+    }
+  }
+
+  put("// Ends with an entry of all zeros\n");
+  put("static const nn_shape _shapes[] = {\n");
+  for (int k = 1; k < argc; k++) {
+    for (int layout = 0; layout < 2; layout++) {
+      put("\t{");
+      put_int(in[k]);
+      put(", ");
+      put_int(hid[k]);
+      put(", ");
+      put_int(layout);
+      put(", ");
+      put_name("predict", in[k], hid[k], layout);
+      put(", ");
+      put_name("backward", in[k], hid[k], layout);
+      put("},\n");
+    }
+  }
+  put("\t{0, 0, 0, NULL, NULL}\n};\n\n");
+
+  put("const nn_shape *nn_find_shape(int input_size, int hidden_size, "
+    "int layout) {\n");
+  put("\tfor(const nn_shape *s = _shapes; s->input_size; s++) {\n");
+  put("\t\tif(s->input_size == input_size && s->hidden_size == hidden_size\n");
+  put("\t\t\t&& s->layout == layout) {\n");
+  put("\t\t\treturn s;\n\t\t}\n\t}\n\treturn NULL;\n}\n");
+  flush();
+  return 0;
+}
@@ -0,0 +1,1344 @@
+// Generated by shapegen; see shapes.h. Do not edit.
+
+#include "nn.h"
+
+// 13x18, input-major
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static double _predict_13x18_0(const nn *net, const double *x,
+	double *h) {
+	const double *w = net->w01;
+	double s0 = x[0] * w[0];
+	double s1 = x[0] * w[1];
+	double s2 = x[0] * w[2];
+	double s3 = x[0] * w[3];
+	double s4 = x[0] * w[4];
+	double s5 = x[0] * w[5];
+	double s6 = x[0] * w[6];
+	double s7 = x[0] * w[7];
+	double s8 = x[0] * w[8];
+	double s9 = x[0] * w[9];
+	double s10 = x[0] * w[10];
+	double s11 = x[0] * w[11];
+	double s12 = x[0] * w[12];
+	double s13 = x[0] * w[13];
+	double s14 = x[0] * w[14];
+	double s15 = x[0] * w[15];
+	double s16 = x[0] * w[16];
+	double s17 = x[0] * w[17];
+	s0 += x[1] * w[18];
+	s1 += x[1] * w[19];
+	s2 += x[1] * w[20];
+	s3 += x[1] * w[21];
+	s4 += x[1] * w[22];
+	s5 += x[1] * w[23];
+	s6 += x[1] * w[24];
+	s7 += x[1] * w[25];
+	s8 += x[1] * w[26];
+	s9 += x[1] * w[27];
+	s10 += x[1] * w[28];
+	s11 += x[1] * w[29];
+	s12 += x[1] * w[30];
+	s13 += x[1] * w[31];
+	s14 += x[1] * w[32];
+	s15 += x[1] * w[33];
+	s16 += x[1] * w[34];
+	s17 += x[1] * w[35];
+	s0 += x[2] * w[36];
+	s1 += x[2] * w[37];
+	s2 += x[2] * w[38];
+	s3 += x[2] * w[39];
+	s4 += x[2] * w[40];
+	s5 += x[2] * w[41];
+	s6 += x[2] * w[42];
+	s7 += x[2] * w[43];
+	s8 += x[2] * w[44];
+	s9 += x[2] * w[45];
+	s10 += x[2] * w[46];
+	s11 += x[2] * w[47];
+	s12 += x[2] * w[48];
+	s13 += x[2] * w[49];
+	s14 += x[2] * w[50];
+	s15 += x[2] * w[51];
+	s16 += x[2] * w[52];
+	s17 += x[2] * w[53];
+	s0 += x[3] * w[54];
+	s1 += x[3] * w[55];
+	s2 += x[3] * w[56];
+	s3 += x[3] * w[57];
+	s4 += x[3] * w[58];
+	s5 += x[3] * w[59];
+	s6 += x[3] * w[60];
+	s7 += x[3] * w[61];
+	s8 += x[3] * w[62];
+	s9 += x[3] * w[63];
+	s10 += x[3] * w[64];
+	s11 += x[3] * w[65];
+	s12 += x[3] * w[66];
+	s13 += x[3] * w[67];
+	s14 += x[3] * w[68];
+	s15 += x[3] * w[69];
+	s16 += x[3] * w[70];
+	s17 += x[3] * w[71];
+	s0 += x[4] * w[72];
+	s1 += x[4] * w[73];
+	s2 += x[4] * w[74];
+	s3 += x[4] * w[75];
+	s4 += x[4] * w[76];
+	s5 += x[4] * w[77];
+	s6 += x[4] * w[78];
+	s7 += x[4] * w[79];
+	s8 += x[4] * w[80];
+	s9 += x[4] * w[81];
+	s10 += x[4] * w[82];
+	s11 += x[4] * w[83];
+	s12 += x[4] * w[84];
+	s13 += x[4] * w[85];
+	s14 += x[4] * w[86];
+	s15 += x[4] * w[87];
+	s16 += x[4] * w[88];
+	s17 += x[4] * w[89];
+	s0 += x[5] * w[90];
+	s1 += x[5] * w[91];
+	s2 += x[5] * w[92];
+	s3 += x[5] * w[93];
+	s4 += x[5] * w[94];
+	s5 += x[5] * w[95];
+	s6 += x[5] * w[96];
+	s7 += x[5] * w[97];
+	s8 += x[5] * w[98];
+	s9 += x[5] * w[99];
+	s10 += x[5] * w[100];
+	s11 += x[5] * w[101];
+	s12 += x[5] * w[102];
+	s13 += x[5] * w[103];
+	s14 += x[5] * w[104];
+	s15 += x[5] * w[105];
+	s16 += x[5] * w[106];
+	s17 += x[5] * w[107];
+	s0 += x[6] * w[108];
+	s1 += x[6] * w[109];
+	s2 += x[6] * w[110];
+	s3 += x[6] * w[111];
+	s4 += x[6] * w[112];
+	s5 += x[6] * w[113];
+	s6 += x[6] * w[114];
+	s7 += x[6] * w[115];
+	s8 += x[6] * w[116];
+	s9 += x[6] * w[117];
+	s10 += x[6] * w[118];
+	s11 += x[6] * w[119];
+	s12 += x[6] * w[120];
+	s13 += x[6] * w[121];
+	s14 += x[6] * w[122];
+	s15 += x[6] * w[123];
+	s16 += x[6] * w[124];
+	s17 += x[6] * w[125];
+	s0 += x[7] * w[126];
+	s1 += x[7] * w[127];
+	s2 += x[7] * w[128];
+	s3 += x[7] * w[129];
+	s4 += x[7] * w[130];
+	s5 += x[7] * w[131];
+	s6 += x[7] * w[132];
+	s7 += x[7] * w[133];
+	s8 += x[7] * w[134];
+	s9 += x[7] * w[135];
+	s10 += x[7] * w[136];
+	s11 += x[7] * w[137];
+	s12 += x[7] * w[138];
+	s13 += x[7] * w[139];
+	s14 += x[7] * w[140];
+	s15 += x[7] * w[141];
+	s16 += x[7] * w[142];
+	s17 += x[7] * w[143];
+	s0 += x[8] * w[144];
+	s1 += x[8] * w[145];
+	s2 += x[8] * w[146];
+	s3 += x[8] * w[147];
+	s4 += x[8] * w[148];
+	s5 += x[8] * w[149];
+	s6 += x[8] * w[150];
+	s7 += x[8] * w[151];
+	s8 += x[8] * w[152];
+	s9 += x[8] * w[153];
+	s10 += x[8] * w[154];
+	s11 += x[8] * w[155];
+	s12 += x[8] * w[156];
+	s13 += x[8] * w[157];
+	s14 += x[8] * w[158];
+	s15 += x[8] * w[159];
+	s16 += x[8] * w[160];
+	s17 += x[8] * w[161];
+	s0 += x[9] * w[162];
+	s1 += x[9] * w[163];
+	s2 += x[9] * w[164];
+	s3 += x[9] * w[165];
+	s4 += x[9] * w[166];
+	s5 += x[9] * w[167];
+	s6 += x[9] * w[168];
+	s7 += x[9] * w[169];
+	s8 += x[9] * w[170];
+	s9 += x[9] * w[171];
+	s10 += x[9] * w[172];
+	s11 += x[9] * w[173];
+	s12 += x[9] * w[174];
+	s13 += x[9] * w[175];
+	s14 += x[9] * w[176];
+	s15 += x[9] * w[177];
+	s16 += x[9] * w[178];
+	s17 += x[9] * w[179];
+	s0 += x[10] * w[180];
+	s1 += x[10] * w[181];
+	s2 += x[10] * w[182];
+	s3 += x[10] * w[183];
+	s4 += x[10] * w[184];
+	s5 += x[10] * w[185];
+	s6 += x[10] * w[186];
+	s7 += x[10] * w[187];
+	s8 += x[10] * w[188];
+	s9 += x[10] * w[189];
+	s10 += x[10] * w[190];
+	s11 += x[10] * w[191];
+	s12 += x[10] * w[192];
+	s13 += x[10] * w[193];
+	s14 += x[10] * w[194];
+	s15 += x[10] * w[195];
+	s16 += x[10] * w[196];
+	s17 += x[10] * w[197];
+	s0 += x[11] * w[198];
+	s1 += x[11] * w[199];
+	s2 += x[11] * w[200];
+	s3 += x[11] * w[201];
+	s4 += x[11] * w[202];
+	s5 += x[11] * w[203];
+	s6 += x[11] * w[204];
+	s7 += x[11] * w[205];
+	s8 += x[11] * w[206];
+	s9 += x[11] * w[207];
+	s10 += x[11] * w[208];
+	s11 += x[11] * w[209];
+	s12 += x[11] * w[210];
+	s13 += x[11] * w[211];
+	s14 += x[11] * w[212];
+	s15 += x[11] * w[213];
+	s16 += x[11] * w[214];
+	s17 += x[11] * w[215];
+	s0 += x[12] * w[216];
+	s1 += x[12] * w[217];
+	s2 += x[12] * w[218];
+	s3 += x[12] * w[219];
+	s4 += x[12] * w[220];
+	s5 += x[12] * w[221];
+	s6 += x[12] * w[222];
+	s7 += x[12] * w[223];
+	s8 += x[12] * w[224];
+	s9 += x[12] * w[225];
+	s10 += x[12] * w[226];
+	s11 += x[12] * w[227];
+	s12 += x[12] * w[228];
+	s13 += x[12] * w[229];
+	s14 += x[12] * w[230];
+	s15 += x[12] * w[231];
+	s16 += x[12] * w[232];
+	s17 += x[12] * w[233];
+	h[0] = s0;
+	h[1] = s1;
+	h[2] = s2;
+	h[3] = s3;
+	h[4] = s4;
+	h[5] = s5;
+	h[6] = s6;
+	h[7] = s7;
+	h[8] = s8;
+	h[9] = s9;
+	h[10] = s10;
+	h[11] = s11;
+	h[12] = s12;
+	h[13] = s13;
+	h[14] = s14;
+	h[15] = s15;
+	h[16] = s16;
+	h[17] = s17;
+	_activate(net, 18, h, net->b1);
+	const double *w12 = net->w12;
+	double o0 = h[0] * w12[0];
+	double o1 = h[1] * w12[1];
+	double o2 = h[2] * w12[2];
+	double o3 = h[3] * w12[3];
+	o0 += h[4] * w12[4];
+	o1 += h[5] * w12[5];
+	o2 += h[6] * w12[6];
+	o3 += h[7] * w12[7];
+	o0 += h[8] * w12[8];
+	o1 += h[9] * w12[9];
+	o2 += h[10] * w12[10];
+	o3 += h[11] * w12[11];
+	o0 += h[12] * w12[12];
+	o1 += h[13] * w12[13];
+	o2 += h[14] * w12[14];
+	o3 += h[15] * w12[15];
+	o0 += h[16] * w12[16];
+	o1 += h[17] * w12[17];
+	return o0 + o1 + o2 + o3 + net->b2;
+}
+
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static void _backward_13x18_0(nn *net, const double *x, int y) {
+	double *w = net->w01;
+	double *b1 = net->b1;
+	double *w12 = net->w12;
+	double rate = net->rate;
+	double g = 2 * (net->o2 - y);
+	double x0 = x[0];
+	double x1 = x[1];
+	double x2 = x[2];
+	double x3 = x[3];
+	double x4 = x[4];
+	double x5 = x[5];
+	double x6 = x[6];
+	double x7 = x[7];
+	double x8 = x[8];
+	double x9 = x[9];
+	double x10 = x[10];
+	double x11 = x[11];
+	double x12 = x[12];
+	double h0 = net->o1[0];
+	double h1 = net->o1[1];
+	double h2 = net->o1[2];
+	double h3 = net->o1[3];
+	double h4 = net->o1[4];
+	double h5 = net->o1[5];
+	double h6 = net->o1[6];
+	double h7 = net->o1[7];
+	double h8 = net->o1[8];
+	double h9 = net->o1[9];
+	double h10 = net->o1[10];
+	double h11 = net->o1[11];
+	double h12 = net->o1[12];
+	double h13 = net->o1[13];
+	double h14 = net->o1[14];
+	double h15 = net->o1[15];
+	double h16 = net->o1[16];
+	double h17 = net->o1[17];
+	net->b2 -= rate * g;
+	double d0 = g * w12[0] * h0 * (1 - h0);
+	w12[0] -= rate * (g * h0);
+	b1[0] -= rate * d0;
+	double d1 = g * w12[1] * h1 * (1 - h1);
+	w12[1] -= rate * (g * h1);
+	b1[1] -= rate * d1;
+	double d2 = g * w12[2] * h2 * (1 - h2);
+	w12[2] -= rate * (g * h2);
+	b1[2] -= rate * d2;
+	double d3 = g * w12[3] * h3 * (1 - h3);
+	w12[3] -= rate * (g * h3);
+	b1[3] -= rate * d3;
+	double d4 = g * w12[4] * h4 * (1 - h4);
+	w12[4] -= rate * (g * h4);
+	b1[4] -= rate * d4;
+	double d5 = g * w12[5] * h5 * (1 - h5);
+	w12[5] -= rate * (g * h5);
+	b1[5] -= rate * d5;
+	double d6 = g * w12[6] * h6 * (1 - h6);
+	w12[6] -= rate * (g * h6);
+	b1[6] -= rate * d6;
+	double d7 = g * w12[7] * h7 * (1 - h7);
+	w12[7] -= rate * (g * h7);
+	b1[7] -= rate * d7;
+	double d8 = g * w12[8] * h8 * (1 - h8);
+	w12[8] -= rate * (g * h8);
+	b1[8] -= rate * d8;
+	double d9 = g * w12[9] * h9 * (1 - h9);
+	w12[9] -= rate * (g * h9);
+	b1[9] -= rate * d9;
+	double d10 = g * w12[10] * h10 * (1 - h10);
+	w12[10] -= rate * (g * h10);
+	b1[10] -= rate * d10;
+	double d11 = g * w12[11] * h11 * (1 - h11);
+	w12[11] -= rate * (g * h11);
+	b1[11] -= rate * d11;
+	double d12 = g * w12[12] * h12 * (1 - h12);
+	w12[12] -= rate * (g * h12);
+	b1[12] -= rate * d12;
+	double d13 = g * w12[13] * h13 * (1 - h13);
+	w12[13] -= rate * (g * h13);
+	b1[13] -= rate * d13;
+	double d14 = g * w12[14] * h14 * (1 - h14);
+	w12[14] -= rate * (g * h14);
+	b1[14] -= rate * d14;
+	double d15 = g * w12[15] * h15 * (1 - h15);
+	w12[15] -= rate * (g * h15);
+	b1[15] -= rate * d15;
+	double d16 = g * w12[16] * h16 * (1 - h16);
+	w12[16] -= rate * (g * h16);
+	b1[16] -= rate * d16;
+	double d17 = g * w12[17] * h17 * (1 - h17);
+	w12[17] -= rate * (g * h17);
+	b1[17] -= rate * d17;
+	w[0] -= rate * (x0 * d0);
+	w[1] -= rate * (x0 * d1);
+	w[2] -= rate * (x0 * d2);
+	w[3] -= rate * (x0 * d3);
+	w[4] -= rate * (x0 * d4);
+	w[5] -= rate * (x0 * d5);
+	w[6] -= rate * (x0 * d6);
+	w[7] -= rate * (x0 * d7);
+	w[8] -= rate * (x0 * d8);
+	w[9] -= rate * (x0 * d9);
+	w[10] -= rate * (x0 * d10);
+	w[11] -= rate * (x0 * d11);
+	w[12] -= rate * (x0 * d12);
+	w[13] -= rate * (x0 * d13);
+	w[14] -= rate * (x0 * d14);
+	w[15] -= rate * (x0 * d15);
+	w[16] -= rate * (x0 * d16);
+	w[17] -= rate * (x0 * d17);
+	w[18] -= rate * (x1 * d0);
+	w[19] -= rate * (x1 * d1);
+	w[20] -= rate * (x1 * d2);
+	w[21] -= rate * (x1 * d3);
+	w[22] -= rate * (x1 * d4);
+	w[23] -= rate * (x1 * d5);
+	w[24] -= rate * (x1 * d6);
+	w[25] -= rate * (x1 * d7);
+	w[26] -= rate * (x1 * d8);
+	w[27] -= rate * (x1 * d9);
+	w[28] -= rate * (x1 * d10);
+	w[29] -= rate * (x1 * d11);
+	w[30] -= rate * (x1 * d12);
+	w[31] -= rate * (x1 * d13);
+	w[32] -= rate * (x1 * d14);
+	w[33] -= rate * (x1 * d15);
+	w[34] -= rate * (x1 * d16);
+	w[35] -= rate * (x1 * d17);
+	w[36] -= rate * (x2 * d0);
+	w[37] -= rate * (x2 * d1);
+	w[38] -= rate * (x2 * d2);
+	w[39] -= rate * (x2 * d3);
+	w[40] -= rate * (x2 * d4);
+	w[41] -= rate * (x2 * d5);
+	w[42] -= rate * (x2 * d6);
+	w[43] -= rate * (x2 * d7);
+	w[44] -= rate * (x2 * d8);
+	w[45] -= rate * (x2 * d9);
+	w[46] -= rate * (x2 * d10);
+	w[47] -= rate * (x2 * d11);
+	w[48] -= rate * (x2 * d12);
+	w[49] -= rate * (x2 * d13);
+	w[50] -= rate * (x2 * d14);
+	w[51] -= rate * (x2 * d15);
+	w[52] -= rate * (x2 * d16);
+	w[53] -= rate * (x2 * d17);
+	w[54] -= rate * (x3 * d0);
+	w[55] -= rate * (x3 * d1);
+	w[56] -= rate * (x3 * d2);
+	w[57] -= rate * (x3 * d3);
+	w[58] -= rate * (x3 * d4);
+	w[59] -= rate * (x3 * d5);
+	w[60] -= rate * (x3 * d6);
+	w[61] -= rate * (x3 * d7);
+	w[62] -= rate * (x3 * d8);
+	w[63] -= rate * (x3 * d9);
+	w[64] -= rate * (x3 * d10);
+	w[65] -= rate * (x3 * d11);
+	w[66] -= rate * (x3 * d12);
+	w[67] -= rate * (x3 * d13);
+	w[68] -= rate * (x3 * d14);
+	w[69] -= rate * (x3 * d15);
+	w[70] -= rate * (x3 * d16);
+	w[71] -= rate * (x3 * d17);
+	w[72] -= rate * (x4 * d0);
+	w[73] -= rate * (x4 * d1);
+	w[74] -= rate * (x4 * d2);
+	w[75] -= rate * (x4 * d3);
+	w[76] -= rate * (x4 * d4);
+	w[77] -= rate * (x4 * d5);
+	w[78] -= rate * (x4 * d6);
+	w[79] -= rate * (x4 * d7);
+	w[80] -= rate * (x4 * d8);
+	w[81] -= rate * (x4 * d9);
+	w[82] -= rate * (x4 * d10);
+	w[83] -= rate * (x4 * d11);
+	w[84] -= rate * (x4 * d12);
+	w[85] -= rate * (x4 * d13);
+	w[86] -= rate * (x4 * d14);
+	w[87] -= rate * (x4 * d15);
+	w[88] -= rate * (x4 * d16);
+	w[89] -= rate * (x4 * d17);
+	w[90] -= rate * (x5 * d0);
+	w[91] -= rate * (x5 * d1);
+	w[92] -= rate * (x5 * d2);
+	w[93] -= rate * (x5 * d3);
+	w[94] -= rate * (x5 * d4);
+	w[95] -= rate * (x5 * d5);
+	w[96] -= rate * (x5 * d6);
+	w[97] -= rate * (x5 * d7);
+	w[98] -= rate * (x5 * d8);
+	w[99] -= rate * (x5 * d9);
+	w[100] -= rate * (x5 * d10);
+	w[101] -= rate * (x5 * d11);
+	w[102] -= rate * (x5 * d12);
+	w[103] -= rate * (x5 * d13);
+	w[104] -= rate * (x5 * d14);
+	w[105] -= rate * (x5 * d15);
+	w[106] -= rate * (x5 * d16);
+	w[107] -= rate * (x5 * d17);
+	w[108] -= rate * (x6 * d0);
+	w[109] -= rate * (x6 * d1);
+	w[110] -= rate * (x6 * d2);
+	w[111] -= rate * (x6 * d3);
+	w[112] -= rate * (x6 * d4);
+	w[113] -= rate * (x6 * d5);
+	w[114] -= rate * (x6 * d6);
+	w[115] -= rate * (x6 * d7);
+	w[116] -= rate * (x6 * d8);
+	w[117] -= rate * (x6 * d9);
+	w[118] -= rate * (x6 * d10);
+	w[119] -= rate * (x6 * d11);
+	w[120] -= rate * (x6 * d12);
+	w[121] -= rate * (x6 * d13);
+	w[122] -= rate * (x6 * d14);
+	w[123] -= rate * (x6 * d15);
+	w[124] -= rate * (x6 * d16);
+	w[125] -= rate * (x6 * d17);
+	w[126] -= rate * (x7 * d0);
+	w[127] -= rate * (x7 * d1);
+	w[128] -= rate * (x7 * d2);
+	w[129] -= rate * (x7 * d3);
+	w[130] -= rate * (x7 * d4);
+	w[131] -= rate * (x7 * d5);
+	w[132] -= rate * (x7 * d6);
+	w[133] -= rate * (x7 * d7);
+	w[134] -= rate * (x7 * d8);
+	w[135] -= rate * (x7 * d9);
+	w[136] -= rate * (x7 * d10);
+	w[137] -= rate * (x7 * d11);
+	w[138] -= rate * (x7 * d12);
+	w[139] -= rate * (x7 * d13);
+	w[140] -= rate * (x7 * d14);
+	w[141] -= rate * (x7 * d15);
+	w[142] -= rate * (x7 * d16);
+	w[143] -= rate * (x7 * d17);
+	w[144] -= rate * (x8 * d0);
+	w[145] -= rate * (x8 * d1);
+	w[146] -= rate * (x8 * d2);
+	w[147] -= rate * (x8 * d3);
+	w[148] -= rate * (x8 * d4);
+	w[149] -= rate * (x8 * d5);
+	w[150] -= rate * (x8 * d6);
+	w[151] -= rate * (x8 * d7);
+	w[152] -= rate * (x8 * d8);
+	w[153] -= rate * (x8 * d9);
+	w[154] -= rate * (x8 * d10);
+	w[155] -= rate * (x8 * d11);
+	w[156] -= rate * (x8 * d12);
+	w[157] -= rate * (x8 * d13);
+	w[158] -= rate * (x8 * d14);
+	w[159] -= rate * (x8 * d15);
+	w[160] -= rate * (x8 * d16);
+	w[161] -= rate * (x8 * d17);
+	w[162] -= rate * (x9 * d0);
+	w[163] -= rate * (x9 * d1);
+	w[164] -= rate * (x9 * d2);
+	w[165] -= rate * (x9 * d3);
+	w[166] -= rate * (x9 * d4);
+	w[167] -= rate * (x9 * d5);
+	w[168] -= rate * (x9 * d6);
+	w[169] -= rate * (x9 * d7);
+	w[170] -= rate * (x9 * d8);
+	w[171] -= rate * (x9 * d9);
+	w[172] -= rate * (x9 * d10);
+	w[173] -= rate * (x9 * d11);
+	w[174] -= rate * (x9 * d12);
+	w[175] -= rate * (x9 * d13);
+	w[176] -= rate * (x9 * d14);
+	w[177] -= rate * (x9 * d15);
+	w[178] -= rate * (x9 * d16);
+	w[179] -= rate * (x9 * d17);
+	w[180] -= rate * (x10 * d0);
+	w[181] -= rate * (x10 * d1);
+	w[182] -= rate * (x10 * d2);
+	w[183] -= rate * (x10 * d3);
+	w[184] -= rate * (x10 * d4);
+	w[185] -= rate * (x10 * d5);
+	w[186] -= rate * (x10 * d6);
+	w[187] -= rate * (x10 * d7);
+	w[188] -= rate * (x10 * d8);
+	w[189] -= rate * (x10 * d9);
+	w[190] -= rate * (x10 * d10);
+	w[191] -= rate * (x10 * d11);
+	w[192] -= rate * (x10 * d12);
+	w[193] -= rate * (x10 * d13);
+	w[194] -= rate * (x10 * d14);
+	w[195] -= rate * (x10 * d15);
+	w[196] -= rate * (x10 * d16);
+	w[197] -= rate * (x10 * d17);
+	w[198] -= rate * (x11 * d0);
+	w[199] -= rate * (x11 * d1);
+	w[200] -= rate * (x11 * d2);
+	w[201] -= rate * (x11 * d3);
+	w[202] -= rate * (x11 * d4);
+	w[203] -= rate * (x11 * d5);
+	w[204] -= rate * (x11 * d6);
+	w[205] -= rate * (x11 * d7);
+	w[206] -= rate * (x11 * d8);
+	w[207] -= rate * (x11 * d9);
+	w[208] -= rate * (x11 * d10);
+	w[209] -= rate * (x11 * d11);
+	w[210] -= rate * (x11 * d12);
+	w[211] -= rate * (x11 * d13);
+	w[212] -= rate * (x11 * d14);
+	w[213] -= rate * (x11 * d15);
+	w[214] -= rate * (x11 * d16);
+	w[215] -= rate * (x11 * d17);
+	w[216] -= rate * (x12 * d0);
+	w[217] -= rate * (x12 * d1);
+	w[218] -= rate * (x12 * d2);
+	w[219] -= rate * (x12 * d3);
+	w[220] -= rate * (x12 * d4);
+	w[221] -= rate * (x12 * d5);
+	w[222] -= rate * (x12 * d6);
+	w[223] -= rate * (x12 * d7);
+	w[224] -= rate * (x12 * d8);
+	w[225] -= rate * (x12 * d9);
+	w[226] -= rate * (x12 * d10);
+	w[227] -= rate * (x12 * d11);
+	w[228] -= rate * (x12 * d12);
+	w[229] -= rate * (x12 * d13);
+	w[230] -= rate * (x12 * d14);
+	w[231] -= rate * (x12 * d15);
+	w[232] -= rate * (x12 * d16);
+	w[233] -= rate * (x12 * d17);
+}
+
+// 13x18, hidden-major
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static double _predict_13x18_1(const nn *net, const double *x,
+	double *h) {
+	const double *w = net->w01;
+	double s0 = x[0] * w[0];
+	s0 += x[1] * w[1];
+	s0 += x[2] * w[2];
+	s0 += x[3] * w[3];
+	s0 += x[4] * w[4];
+	s0 += x[5] * w[5];
+	s0 += x[6] * w[6];
+	s0 += x[7] * w[7];
+	s0 += x[8] * w[8];
+	s0 += x[9] * w[9];
+	s0 += x[10] * w[10];
+	s0 += x[11] * w[11];
+	s0 += x[12] * w[12];
+	double s1 = x[0] * w[13];
+	s1 += x[1] * w[14];
+	s1 += x[2] * w[15];
+	s1 += x[3] * w[16];
+	s1 += x[4] * w[17];
+	s1 += x[5] * w[18];
+	s1 += x[6] * w[19];
+	s1 += x[7] * w[20];
+	s1 += x[8] * w[21];
+	s1 += x[9] * w[22];
+	s1 += x[10] * w[23];
+	s1 += x[11] * w[24];
+	s1 += x[12] * w[25];
+	double s2 = x[0] * w[26];
+	s2 += x[1] * w[27];
+	s2 += x[2] * w[28];
+	s2 += x[3] * w[29];
+	s2 += x[4] * w[30];
+	s2 += x[5] * w[31];
+	s2 += x[6] * w[32];
+	s2 += x[7] * w[33];
+	s2 += x[8] * w[34];
+	s2 += x[9] * w[35];
+	s2 += x[10] * w[36];
+	s2 += x[11] * w[37];
+	s2 += x[12] * w[38];
+	double s3 = x[0] * w[39];
+	s3 += x[1] * w[40];
+	s3 += x[2] * w[41];
+	s3 += x[3] * w[42];
+	s3 += x[4] * w[43];
+	s3 += x[5] * w[44];
+	s3 += x[6] * w[45];
+	s3 += x[7] * w[46];
+	s3 += x[8] * w[47];
+	s3 += x[9] * w[48];
+	s3 += x[10] * w[49];
+	s3 += x[11] * w[50];
+	s3 += x[12] * w[51];
+	double s4 = x[0] * w[52];
+	s4 += x[1] * w[53];
+	s4 += x[2] * w[54];
+	s4 += x[3] * w[55];
+	s4 += x[4] * w[56];
+	s4 += x[5] * w[57];
+	s4 += x[6] * w[58];
+	s4 += x[7] * w[59];
+	s4 += x[8] * w[60];
+	s4 += x[9] * w[61];
+	s4 += x[10] * w[62];
+	s4 += x[11] * w[63];
+	s4 += x[12] * w[64];
+	double s5 = x[0] * w[65];
+	s5 += x[1] * w[66];
+	s5 += x[2] * w[67];
+	s5 += x[3] * w[68];
+	s5 += x[4] * w[69];
+	s5 += x[5] * w[70];
+	s5 += x[6] * w[71];
+	s5 += x[7] * w[72];
+	s5 += x[8] * w[73];
+	s5 += x[9] * w[74];
+	s5 += x[10] * w[75];
+	s5 += x[11] * w[76];
+	s5 += x[12] * w[77];
+	double s6 = x[0] * w[78];
+	s6 += x[1] * w[79];
+	s6 += x[2] * w[80];
+	s6 += x[3] * w[81];
+	s6 += x[4] * w[82];
+	s6 += x[5] * w[83];
+	s6 += x[6] * w[84];
+	s6 += x[7] * w[85];
+	s6 += x[8] * w[86];
+	s6 += x[9] * w[87];
+	s6 += x[10] * w[88];
+	s6 += x[11] * w[89];
+	s6 += x[12] * w[90];
+	double s7 = x[0] * w[91];
+	s7 += x[1] * w[92];
+	s7 += x[2] * w[93];
+	s7 += x[3] * w[94];
+	s7 += x[4] * w[95];
+	s7 += x[5] * w[96];
+	s7 += x[6] * w[97];
+	s7 += x[7] * w[98];
+	s7 += x[8] * w[99];
+	s7 += x[9] * w[100];
+	s7 += x[10] * w[101];
+	s7 += x[11] * w[102];
+	s7 += x[12] * w[103];
+	double s8 = x[0] * w[104];
+	s8 += x[1] * w[105];
+	s8 += x[2] * w[106];
+	s8 += x[3] * w[107];
+	s8 += x[4] * w[108];
+	s8 += x[5] * w[109];
+	s8 += x[6] * w[110];
+	s8 += x[7] * w[111];
+	s8 += x[8] * w[112];
+	s8 += x[9] * w[113];
+	s8 += x[10] * w[114];
+	s8 += x[11] * w[115];
+	s8 += x[12] * w[116];
+	double s9 = x[0] * w[117];
+	s9 += x[1] * w[118];
+	s9 += x[2] * w[119];
+	s9 += x[3] * w[120];
+	s9 += x[4] * w[121];
+	s9 += x[5] * w[122];
+	s9 += x[6] * w[123];
+	s9 += x[7] * w[124];
+	s9 += x[8] * w[125];
+	s9 += x[9] * w[126];
+	s9 += x[10] * w[127];
+	s9 += x[11] * w[128];
+	s9 += x[12] * w[129];
+	double s10 = x[0] * w[130];
+	s10 += x[1] * w[131];
+	s10 += x[2] * w[132];
+	s10 += x[3] * w[133];
+	s10 += x[4] * w[134];
+	s10 += x[5] * w[135];
+	s10 += x[6] * w[136];
+	s10 += x[7] * w[137];
+	s10 += x[8] * w[138];
+	s10 += x[9] * w[139];
+	s10 += x[10] * w[140];
+	s10 += x[11] * w[141];
+	s10 += x[12] * w[142];
+	double s11 = x[0] * w[143];
+	s11 += x[1] * w[144];
+	s11 += x[2] * w[145];
+	s11 += x[3] * w[146];
+	s11 += x[4] * w[147];
+	s11 += x[5] * w[148];
+	s11 += x[6] * w[149];
+	s11 += x[7] * w[150];
+	s11 += x[8] * w[151];
+	s11 += x[9] * w[152];
+	s11 += x[10] * w[153];
+	s11 += x[11] * w[154];
+	s11 += x[12] * w[155];
+	double s12 = x[0] * w[156];
+	s12 += x[1] * w[157];
+	s12 += x[2] * w[158];
+	s12 += x[3] * w[159];
+	s12 += x[4] * w[160];
+	s12 += x[5] * w[161];
+	s12 += x[6] * w[162];
+	s12 += x[7] * w[163];
+	s12 += x[8] * w[164];
+	s12 += x[9] * w[165];
+	s12 += x[10] * w[166];
+	s12 += x[11] * w[167];
+	s12 += x[12] * w[168];
+	double s13 = x[0] * w[169];
+	s13 += x[1] * w[170];
+	s13 += x[2] * w[171];
+	s13 += x[3] * w[172];
+	s13 += x[4] * w[173];
+	s13 += x[5] * w[174];
+	s13 += x[6] * w[175];
+	s13 += x[7] * w[176];
+	s13 += x[8] * w[177];
+	s13 += x[9] * w[178];
+	s13 += x[10] * w[179];
+	s13 += x[11] * w[180];
+	s13 += x[12] * w[181];
+	double s14 = x[0] * w[182];
+	s14 += x[1] * w[183];
+	s14 += x[2] * w[184];
+	s14 += x[3] * w[185];
+	s14 += x[4] * w[186];
+	s14 += x[5] * w[187];
+	s14 += x[6] * w[188];
+	s14 += x[7] * w[189];
+	s14 += x[8] * w[190];
+	s14 += x[9] * w[191];
+	s14 += x[10] * w[192];
+	s14 += x[11] * w[193];
+	s14 += x[12] * w[194];
+	double s15 = x[0] * w[195];
+	s15 += x[1] * w[196];
+	s15 += x[2] * w[197];
+	s15 += x[3] * w[198];
+	s15 += x[4] * w[199];
+	s15 += x[5] * w[200];
+	s15 += x[6] * w[201];
+	s15 += x[7] * w[202];
+	s15 += x[8] * w[203];
+	s15 += x[9] * w[204];
+	s15 += x[10] * w[205];
+	s15 += x[11] * w[206];
+	s15 += x[12] * w[207];
+	double s16 = x[0] * w[208];
+	s16 += x[1] * w[209];
+	s16 += x[2] * w[210];
+	s16 += x[3] * w[211];
+	s16 += x[4] * w[212];
+	s16 += x[5] * w[213];
+	s16 += x[6] * w[214];
+	s16 += x[7] * w[215];
+	s16 += x[8] * w[216];
+	s16 += x[9] * w[217];
+	s16 += x[10] * w[218];
+	s16 += x[11] * w[219];
+	s16 += x[12] * w[220];
+	double s17 = x[0] * w[221];
+	s17 += x[1] * w[222];
+	s17 += x[2] * w[223];
+	s17 += x[3] * w[224];
+	s17 += x[4] * w[225];
+	s17 += x[5] * w[226];
+	s17 += x[6] * w[227];
+	s17 += x[7] * w[228];
+	s17 += x[8] * w[229];
+	s17 += x[9] * w[230];
+	s17 += x[10] * w[231];
+	s17 += x[11] * w[232];
+	s17 += x[12] * w[233];
+	h[0] = s0;
+	h[1] = s1;
+	h[2] = s2;
+	h[3] = s3;
+	h[4] = s4;
+	h[5] = s5;
+	h[6] = s6;
+	h[7] = s7;
+	h[8] = s8;
+	h[9] = s9;
+	h[10] = s10;
+	h[11] = s11;
+	h[12] = s12;
+	h[13] = s13;
+	h[14] = s14;
+	h[15] = s15;
+	h[16] = s16;
+	h[17] = s17;
+	_activate(net, 18, h, net->b1);
+	const double *w12 = net->w12;
+	double o0 = h[0] * w12[0];
+	double o1 = h[1] * w12[1];
+	double o2 = h[2] * w12[2];
+	double o3 = h[3] * w12[3];
+	o0 += h[4] * w12[4];
+	o1 += h[5] * w12[5];
+	o2 += h[6] * w12[6];
+	o3 += h[7] * w12[7];
+	o0 += h[8] * w12[8];
+	o1 += h[9] * w12[9];
+	o2 += h[10] * w12[10];
+	o3 += h[11] * w12[11];
+	o0 += h[12] * w12[12];
+	o1 += h[13] * w12[13];
+	o2 += h[14] * w12[14];
+	o3 += h[15] * w12[15];
+	o0 += h[16] * w12[16];
+	o1 += h[17] * w12[17];
+	return o0 + o1 + o2 + o3 + net->b2;
+}
+
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static void _backward_13x18_1(nn *net, const double *x, int y) {
+	double *w = net->w01;
+	double *b1 = net->b1;
+	double *w12 = net->w12;
+	double rate = net->rate;
+	double g = 2 * (net->o2 - y);
+	double x0 = x[0];
+	double x1 = x[1];
+	double x2 = x[2];
+	double x3 = x[3];
+	double x4 = x[4];
+	double x5 = x[5];
+	double x6 = x[6];
+	double x7 = x[7];
+	double x8 = x[8];
+	double x9 = x[9];
+	double x10 = x[10];
+	double x11 = x[11];
+	double x12 = x[12];
+	double h0 = net->o1[0];
+	double h1 = net->o1[1];
+	double h2 = net->o1[2];
+	double h3 = net->o1[3];
+	double h4 = net->o1[4];
+	double h5 = net->o1[5];
+	double h6 = net->o1[6];
+	double h7 = net->o1[7];
+	double h8 = net->o1[8];
+	double h9 = net->o1[9];
+	double h10 = net->o1[10];
+	double h11 = net->o1[11];
+	double h12 = net->o1[12];
+	double h13 = net->o1[13];
+	double h14 = net->o1[14];
+	double h15 = net->o1[15];
+	double h16 = net->o1[16];
+	double h17 = net->o1[17];
+	net->b2 -= rate * g;
+	double d0 = g * w12[0] * h0 * (1 - h0);
+	w12[0] -= rate * (g * h0);
+	b1[0] -= rate * d0;
+	double d1 = g * w12[1] * h1 * (1 - h1);
+	w12[1] -= rate * (g * h1);
+	b1[1] -= rate * d1;
+	double d2 = g * w12[2] * h2 * (1 - h2);
+	w12[2] -= rate * (g * h2);
+	b1[2] -= rate * d2;
+	double d3 = g * w12[3] * h3 * (1 - h3);
+	w12[3] -= rate * (g * h3);
+	b1[3] -= rate * d3;
+	double d4 = g * w12[4] * h4 * (1 - h4);
+	w12[4] -= rate * (g * h4);
+	b1[4] -= rate * d4;
+	double d5 = g * w12[5] * h5 * (1 - h5);
+	w12[5] -= rate * (g * h5);
+	b1[5] -= rate * d5;
+	double d6 = g * w12[6] * h6 * (1 - h6);
+	w12[6] -= rate * (g * h6);
+	b1[6] -= rate * d6;
+	double d7 = g * w12[7] * h7 * (1 - h7);
+	w12[7] -= rate * (g * h7);
+	b1[7] -= rate * d7;
+	double d8 = g * w12[8] * h8 * (1 - h8);
+	w12[8] -= rate * (g * h8);
+	b1[8] -= rate * d8;
+	double d9 = g * w12[9] * h9 * (1 - h9);
+	w12[9] -= rate * (g * h9);
+	b1[9] -= rate * d9;
+	double d10 = g * w12[10] * h10 * (1 - h10);
+	w12[10] -= rate * (g * h10);
+	b1[10] -= rate * d10;
+	double d11 = g * w12[11] * h11 * (1 - h11);
+	w12[11] -= rate * (g * h11);
+	b1[11] -= rate * d11;
+	double d12 = g * w12[12] * h12 * (1 - h12);
+	w12[12] -= rate * (g * h12);
+	b1[12] -= rate * d12;
+	double d13 = g * w12[13] * h13 * (1 - h13);
+	w12[13] -= rate * (g * h13);
+	b1[13] -= rate * d13;
+	double d14 = g * w12[14] * h14 * (1 - h14);
+	w12[14] -= rate * (g * h14);
+	b1[14] -= rate * d14;
+	double d15 = g * w12[15] * h15 * (1 - h15);
+	w12[15] -= rate * (g * h15);
+	b1[15] -= rate * d15;
+	double d16 = g * w12[16] * h16 * (1 - h16);
+	w12[16] -= rate * (g * h16);
+	b1[16] -= rate * d16;
+	double d17 = g * w12[17] * h17 * (1 - h17);
+	w12[17] -= rate * (g * h17);
+	b1[17] -= rate * d17;
+	w[0] -= rate * (x0 * d0);
+	w[1] -= rate * (x1 * d0);
+	w[2] -= rate * (x2 * d0);
+	w[3] -= rate * (x3 * d0);
+	w[4] -= rate * (x4 * d0);
+	w[5] -= rate * (x5 * d0);
+	w[6] -= rate * (x6 * d0);
+	w[7] -= rate * (x7 * d0);
+	w[8] -= rate * (x8 * d0);
+	w[9] -= rate * (x9 * d0);
+	w[10] -= rate * (x10 * d0);
+	w[11] -= rate * (x11 * d0);
+	w[12] -= rate * (x12 * d0);
+	w[13] -= rate * (x0 * d1);
+	w[14] -= rate * (x1 * d1);
+	w[15] -= rate * (x2 * d1);
+	w[16] -= rate * (x3 * d1);
+	w[17] -= rate * (x4 * d1);
+	w[18] -= rate * (x5 * d1);
+	w[19] -= rate * (x6 * d1);
+	w[20] -= rate * (x7 * d1);
+	w[21] -= rate * (x8 * d1);
+	w[22] -= rate * (x9 * d1);
+	w[23] -= rate * (x10 * d1);
+	w[24] -= rate * (x11 * d1);
+	w[25] -= rate * (x12 * d1);
+	w[26] -= rate * (x0 * d2);
+	w[27] -= rate * (x1 * d2);
+	w[28] -= rate * (x2 * d2);
+	w[29] -= rate * (x3 * d2);
+	w[30] -= rate * (x4 * d2);
+	w[31] -= rate * (x5 * d2);
+	w[32] -= rate * (x6 * d2);
+	w[33] -= rate * (x7 * d2);
+	w[34] -= rate * (x8 * d2);
+	w[35] -= rate * (x9 * d2);
+	w[36] -= rate * (x10 * d2);
+	w[37] -= rate * (x11 * d2);
+	w[38] -= rate * (x12 * d2);
+	w[39] -= rate * (x0 * d3);
+	w[40] -= rate * (x1 * d3);
+	w[41] -= rate * (x2 * d3);
+	w[42] -= rate * (x3 * d3);
+	w[43] -= rate * (x4 * d3);
+	w[44] -= rate * (x5 * d3);
+	w[45] -= rate * (x6 * d3);
+	w[46] -= rate * (x7 * d3);
+	w[47] -= rate * (x8 * d3);
+	w[48] -= rate * (x9 * d3);
+	w[49] -= rate * (x10 * d3);
+	w[50] -= rate * (x11 * d3);
+	w[51] -= rate * (x12 * d3);
+	w[52] -= rate * (x0 * d4);
+	w[53] -= rate * (x1 * d4);
+	w[54] -= rate * (x2 * d4);
+	w[55] -= rate * (x3 * d4);
+	w[56] -= rate * (x4 * d4);
+	w[57] -= rate * (x5 * d4);
+	w[58] -= rate * (x6 * d4);
+	w[59] -= rate * (x7 * d4);
+	w[60] -= rate * (x8 * d4);
+	w[61] -= rate * (x9 * d4);
+	w[62] -= rate * (x10 * d4);
+	w[63] -= rate * (x11 * d4);
+	w[64] -= rate * (x12 * d4);
+	w[65] -= rate * (x0 * d5);
+	w[66] -= rate * (x1 * d5);
+	w[67] -= rate * (x2 * d5);
+	w[68] -= rate * (x3 * d5);
+	w[69] -= rate * (x4 * d5);
+	w[70] -= rate * (x5 * d5);
+	w[71] -= rate * (x6 * d5);
+	w[72] -= rate * (x7 * d5);
+	w[73] -= rate * (x8 * d5);
+	w[74] -= rate * (x9 * d5);
+	w[75] -= rate * (x10 * d5);
+	w[76] -= rate * (x11 * d5);
+	w[77] -= rate * (x12 * d5);
+	w[78] -= rate * (x0 * d6);
+	w[79] -= rate * (x1 * d6);
+	w[80] -= rate * (x2 * d6);
+	w[81] -= rate * (x3 * d6);
+	w[82] -= rate * (x4 * d6);
+	w[83] -= rate * (x5 * d6);
+	w[84] -= rate * (x6 * d6);
+	w[85] -= rate * (x7 * d6);
+	w[86] -= rate * (x8 * d6);
+	w[87] -= rate * (x9 * d6);
+	w[88] -= rate * (x10 * d6);
+	w[89] -= rate * (x11 * d6);
+	w[90] -= rate * (x12 * d6);
+	w[91] -= rate * (x0 * d7);
+	w[92] -= rate * (x1 * d7);
+	w[93] -= rate * (x2 * d7);
+	w[94] -= rate * (x3 * d7);
+	w[95] -= rate * (x4 * d7);
+	w[96] -= rate * (x5 * d7);
+	w[97] -= rate * (x6 * d7);
+	w[98] -= rate * (x7 * d7);
+	w[99] -= rate * (x8 * d7);
+	w[100] -= rate * (x9 * d7);
+	w[101] -= rate * (x10 * d7);
+	w[102] -= rate * (x11 * d7);
+	w[103] -= rate * (x12 * d7);
+	w[104] -= rate * (x0 * d8);
+	w[105] -= rate * (x1 * d8);
+	w[106] -= rate * (x2 * d8);
+	w[107] -= rate * (x3 * d8);
+	w[108] -= rate * (x4 * d8);
+	w[109] -= rate * (x5 * d8);
+	w[110] -= rate * (x6 * d8);
+	w[111] -= rate * (x7 * d8);
+	w[112] -= rate * (x8 * d8);
+	w[113] -= rate * (x9 * d8);
+	w[114] -= rate * (x10 * d8);
+	w[115] -= rate * (x11 * d8);
+	w[116] -= rate * (x12 * d8);
+	w[117] -= rate * (x0 * d9);
+	w[118] -= rate * (x1 * d9);
+	w[119] -= rate * (x2 * d9);
+	w[120] -= rate * (x3 * d9);
+	w[121] -= rate * (x4 * d9);
+	w[122] -= rate * (x5 * d9);
+	w[123] -= rate * (x6 * d9);
+	w[124] -= rate * (x7 * d9);
+	w[125] -= rate * (x8 * d9);
+	w[126] -= rate * (x9 * d9);
+	w[127] -= rate * (x10 * d9);
+	w[128] -= rate * (x11 * d9);
+	w[129] -= rate * (x12 * d9);
+	w[130] -= rate * (x0 * d10);
+	w[131] -= rate * (x1 * d10);
+	w[132] -= rate * (x2 * d10);
+	w[133] -= rate * (x3 * d10);
+	w[134] -= rate * (x4 * d10);
+	w[135] -= rate * (x5 * d10);
+	w[136] -= rate * (x6 * d10);
+	w[137] -= rate * (x7 * d10);
+	w[138] -= rate * (x8 * d10);
+	w[139] -= rate * (x9 * d10);
+	w[140] -= rate * (x10 * d10);
+	w[141] -= rate * (x11 * d10);
+	w[142] -= rate * (x12 * d10);
+	w[143] -= rate * (x0 * d11);
+	w[144] -= rate * (x1 * d11);
+	w[145] -= rate * (x2 * d11);
+	w[146] -= rate * (x3 * d11);
+	w[147] -= rate * (x4 * d11);
+	w[148] -= rate * (x5 * d11);
+	w[149] -= rate * (x6 * d11);
+	w[150] -= rate * (x7 * d11);
+	w[151] -= rate * (x8 * d11);
+	w[152] -= rate * (x9 * d11);
+	w[153] -= rate * (x10 * d11);
+	w[154] -= rate * (x11 * d11);
+	w[155] -= rate * (x12 * d11);
+	w[156] -= rate * (x0 * d12);
+	w[157] -= rate * (x1 * d12);
+	w[158] -= rate * (x2 * d12);
+	w[159] -= rate * (x3 * d12);
+	w[160] -= rate * (x4 * d12);
+	w[161] -= rate * (x5 * d12);
+	w[162] -= rate * (x6 * d12);
+	w[163] -= rate * (x7 * d12);
+	w[164] -= rate * (x8 * d12);
+	w[165] -= rate * (x9 * d12);
+	w[166] -= rate * (x10 * d12);
+	w[167] -= rate * (x11 * d12);
+	w[168] -= rate * (x12 * d12);
+	w[169] -= rate * (x0 * d13);
+	w[170] -= rate * (x1 * d13);
+	w[171] -= rate * (x2 * d13);
+	w[172] -= rate * (x3 * d13);
+	w[173] -= rate * (x4 * d13);
+	w[174] -= rate * (x5 * d13);
+	w[175] -= rate * (x6 * d13);
+	w[176] -= rate * (x7 * d13);
+	w[177] -= rate * (x8 * d13);
+	w[178] -= rate * (x9 * d13);
+	w[179] -= rate * (x10 * d13);
+	w[180] -= rate * (x11 * d13);
+	w[181] -= rate * (x12 * d13);
+	w[182] -= rate * (x0 * d14);
+	w[183] -= rate * (x1 * d14);
+	w[184] -= rate * (x2 * d14);
+	w[185] -= rate * (x3 * d14);
+	w[186] -= rate * (x4 * d14);
+	w[187] -= rate * (x5 * d14);
+	w[188] -= rate * (x6 * d14);
+	w[189] -= rate * (x7 * d14);
+	w[190] -= rate * (x8 * d14);
+	w[191] -= rate * (x9 * d14);
+	w[192] -= rate * (x10 * d14);
+	w[193] -= rate * (x11 * d14);
+	w[194] -= rate * (x12 * d14);
+	w[195] -= rate * (x0 * d15);
+	w[196] -= rate * (x1 * d15);
+	w[197] -= rate * (x2 * d15);
+	w[198] -= rate * (x3 * d15);
+	w[199] -= rate * (x4 * d15);
+	w[200] -= rate * (x5 * d15);
+	w[201] -= rate * (x6 * d15);
+	w[202] -= rate * (x7 * d15);
+	w[203] -= rate * (x8 * d15);
+	w[204] -= rate * (x9 * d15);
+	w[205] -= rate * (x10 * d15);
+	w[206] -= rate * (x11 * d15);
+	w[207] -= rate * (x12 * d15);
+	w[208] -= rate * (x0 * d16);
+	w[209] -= rate * (x1 * d16);
+	w[210] -= rate * (x2 * d16);
+	w[211] -= rate * (x3 * d16);
+	w[212] -= rate * (x4 * d16);
+	w[213] -= rate * (x5 * d16);
+	w[214] -= rate * (x6 * d16);
+	w[215] -= rate * (x7 * d16);
+	w[216] -= rate * (x8 * d16);
+	w[217] -= rate * (x9 * d16);
+	w[218] -= rate * (x10 * d16);
+	w[219] -= rate * (x11 * d16);
+	w[220] -= rate * (x12 * d16);
+	w[221] -= rate * (x0 * d17);
+	w[222] -= rate * (x1 * d17);
+	w[223] -= rate * (x2 * d17);
+	w[224] -= rate * (x3 * d17);
+	w[225] -= rate * (x4 * d17);
+	w[226] -= rate * (x5 * d17);
+	w[227] -= rate * (x6 * d17);
+	w[228] -= rate * (x7 * d17);
+	w[229] -= rate * (x8 * d17);
+	w[230] -= rate * (x9 * d17);
+	w[231] -= rate * (x10 * d17);
+	w[232] -= rate * (x11 * d17);
+	w[233] -= rate * (x12 * d17);
+}
+
+// 4x2, input-major
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static double _predict_4x2_0(const nn *net, const double *x,
+	double *h) {
+	const double *w = net->w01;
+	double s0 = x[0] * w[0];
+	double s1 = x[0] * w[1];
+	s0 += x[1] * w[2];
+	s1 += x[1] * w[3];
+	s0 += x[2] * w[4];
+	s1 += x[2] * w[5];
+	s0 += x[3] * w[6];
+	s1 += x[3] * w[7];
+	h[0] = s0;
+	h[1] = s1;
+	_activate(net, 2, h, net->b1);
+	const double *w12 = net->w12;
+	double o0 = h[0] * w12[0];
+	double o1 = h[1] * w12[1];
+	return o0 + o1 + net->b2;
+}
+
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static void _backward_4x2_0(nn *net, const double *x, int y) {
+	double *w = net->w01;
+	double *b1 = net->b1;
+	double *w12 = net->w12;
+	double rate = net->rate;
+	double g = 2 * (net->o2 - y);
+	double x0 = x[0];
+	double x1 = x[1];
+	double x2 = x[2];
+	double x3 = x[3];
+	double h0 = net->o1[0];
+	double h1 = net->o1[1];
+	net->b2 -= rate * g;
+	double d0 = g * w12[0] * h0 * (1 - h0);
+	w12[0] -= rate * (g * h0);
+	b1[0] -= rate * d0;
+	double d1 = g * w12[1] * h1 * (1 - h1);
+	w12[1] -= rate * (g * h1);
+	b1[1] -= rate * d1;
+	w[0] -= rate * (x0 * d0);
+	w[1] -= rate * (x0 * d1);
+	w[2] -= rate * (x1 * d0);
+	w[3] -= rate * (x1 * d1);
+	w[4] -= rate * (x2 * d0);
+	w[5] -= rate * (x2 * d1);
+	w[6] -= rate * (x3 * d0);
+	w[7] -= rate * (x3 * d1);
+}
+
+// 4x2, hidden-major
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static double _predict_4x2_1(const nn *net, const double *x,
+	double *h) {
+	const double *w = net->w01;
+	double s0 = x[0] * w[0];
+	s0 += x[1] * w[1];
+	s0 += x[2] * w[2];
+	s0 += x[3] * w[3];
+	double s1 = x[0] * w[4];
+	s1 += x[1] * w[5];
+	s1 += x[2] * w[6];
+	s1 += x[3] * w[7];
+	h[0] = s0;
+	h[1] = s1;
+	_activate(net, 2, h, net->b1);
+	const double *w12 = net->w12;
+	double o0 = h[0] * w12[0];
+	double o1 = h[1] * w12[1];
+	return o0 + o1 + net->b2;
+}
+
+__attribute__((target_clones("avx512f", "avx2,fma", "default")))
+static void _backward_4x2_1(nn *net, const double *x, int y) {
+	double *w = net->w01;
+	double *b1 = net->b1;
+	double *w12 = net->w12;
+	double rate = net->rate;
+	double g = 2 * (net->o2 - y);
+	double x0 = x[0];
+	double x1 = x[1];
+	double x2 = x[2];
+	double x3 = x[3];
+	double h0 = net->o1[0];
+	double h1 = net->o1[1];
+	net->b2 -= rate * g;
+	double d0 = g * w12[0] * h0 * (1 - h0);
+	w12[0] -= rate * (g * h0);
+	b1[0] -= rate * d0;
+	double d1 = g * w12[1] * h1 * (1 - h1);
+	w12[1] -= rate * (g * h1);
+	b1[1] -= rate * d1;
+	w[0] -= rate * (x0 * d0);
+	w[1] -= rate * (x1 * d0);
+	w[2] -= rate * (x2 * d0);
+	w[3] -= rate * (x3 * d0);
+	w[4] -= rate * (x0 * d1);
+	w[5] -= rate * (x1 * d1);
+	w[6] -= rate * (x2 * d1);
+	w[7] -= rate * (x3 * d1);
+}
+
+// Ends with an entry of all zeros
+static const nn_shape _shapes[] = {
+	{13, 18, 0, _predict_13x18_0, _backward_13x18_0},
+	{13, 18, 1, _predict_13x18_1, _backward_13x18_1},
+	{4, 2, 0, _predict_4x2_0, _backward_4x2_0},
+	{4, 2, 1, _predict_4x2_1, _backward_4x2_1},
+	{0, 0, 0, NULL, NULL}
+};
+
+const nn_shape *nn_find_shape(int input_size, int hidden_size, int layout) {
+	for(const nn_shape *s = _shapes; s->input_size; s++) {
+		if(s->input_size == input_size && s->hidden_size == hidden_size
+			&& s->layout == layout) {
+			return s;
+		}
+	}
+	return NULL;
+}
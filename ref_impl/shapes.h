@@ -0,0 +1,45 @@
+#ifndef _SHAPES_H_
+#define _SHAPES_H_
+
+/**
+ * Forward and backward passes specialized for particular network shapes. The
+ * generic passes take input_size and hidden_size at runtime, so every loop
+ * carries dynamic bounds and every weight is found with a multiply. For the
+ * shapes we actually deploy, shapegen writes out the whole pass instead: every
+ * loop fully unrolled, every index a constant, and the hidden layer's sums
+ * kept in registers until they are done. On x86-64 each generated function
+ * is compiled for AVX-512, AVX2 and the baseline with GCC's target_clones,
+ * which picks one at load time the way kernels.c picks a kernels table.
+ *
+ * The shapes to generate are listed in SHAPES in the Makefile, which runs
+ * shapegen to produce shapes.c before compiling it. nn_init_opts (and so
+ * nn_load) looks up the network's shape and layout, and if there are passes
+ * for it, double networks predict with them from then on, and also update
+ * with them if they train with plain SGD. They compute the same things as the
+ * generic ones, although not in exactly the same order, so results can differ
+ * in the last bits.
+ */
+
+struct nn;
+
+typedef struct nn_shape {
+	int input_size;
+	int hidden_size;
+	// An nn_layout
+	int layout;
+	// nn_predict, for a double network of this shape and layout. scratch is
+	// never NULL.
+	double (*predict)(const struct nn *net, const double *x, double *scratch);
+	// nn_backward, for a double network of this shape and layout trained with
+	// plain SGD
+	void (*backward)(struct nn *net, const double *x, int y);
+} nn_shape;
+
+/**
+ * Finds the generated passes for a shape and layout.
+ *
+ * @return the passes, or NULL if shapegen wasn't asked for that shape
+ */
+const nn_shape *nn_find_shape(int input_size, int hidden_size, int layout);
+
+#endif
@@ -1,80 +1,298 @@
 #include "util.h"
 
 /*
- * We don't support negative ints, simply because we don't need them!
- * This can very easily be expanded to support negatives at any point, I just
- * want to reduce the workload of rewriting this in asm later
+ * Digits come out of x least significant first, so they go into a scratch
+ * buffer from the end backwards, and are then copied out in order.
  */
+int _utoa(char *buf, unsigned long long x) {
+	char digits[20];
+	int d = 20;
+	do {
+		digits[--d] = (x % 10) + '0';
+		x /= 10;
+	} while (x > 0);
+	int n = 0;
+	while (d < 20) {
+		buf[n++] = digits[d++];
+	}
+	return n;
+}
+
+// Negatives are turned into positives as unsigned, so that INT_MIN works too
 int itoa(char *buf, int x) {
-	// n holds the index of the buffer into which we are writing
+	if (x < 0) {
+		buf[0] = '-';
+		return 1 + _utoa(buf + 1, -(unsigned int) x);
+	}
+	return _utoa(buf, x);
+}
+
+/*
+ * Multiplies a little-endian array of 32-bit limbs by a 32-bit factor in
+ * place, growing it by a limb if the product needs one.
+ */
+void _big_mul(unsigned int *limbs, int *len, unsigned int factor) {
+	unsigned long long carry = 0;
+	for (int i = 0; i < *len; i++) {
+		carry += (unsigned long long) limbs[i] * factor;
+		limbs[i] = (unsigned int) carry;
+		carry >>= 32;
+	}
+	if (carry) limbs[(*len)++] = (unsigned int) carry;
+}
+
+/*
+ * Writes the decimal digits of a limb array (destroying it) into digits,
+ * most significant first, without leading zeros, and returns how many.
+ * Dividing by 10^9 peels off nine digits at a time, least significant first,
+ * so they go in from the end of a scratch buffer, like in _utoa.
+ */
+int _big_digits(unsigned int *limbs, int len, char *digits) {
+	char scratch[800];
+	int d = 800;
+	while (len > 0) {
+		unsigned long long rem = 0;
+		for (int i = len - 1; i >= 0; i--) {
+			rem = (rem << 32) | limbs[i];
+			limbs[i] = (unsigned int) (rem / 1000000000);
+			rem %= 1000000000;
+		}
+		while (len > 0 && limbs[len - 1] == 0) len--;
+		for (int i = 0; i < 9; i++) {
+			scratch[--d] = (rem % 10) + '0';
+			rem /= 10;
+		}
+	}
+	while (d < 800 && scratch[d] == '0') d++;
 	int n = 0;
-	// Special case, x=0
-	if (x == 0) {
-		buf[0] = '0';
-		return 1;
+	while (d < 800) {
+		digits[n++] = scratch[d++];
 	}
+	return n;
+}
 
-	while (x > 0) {
-		buf[n] = (x % 10) + '0';
-		x /= 10;
-		n++;
+/*
+ * The full form of dtoa, for a nonzero finite x. A double is m * 2^e for
+ * integers m and e, which is exactly the integer m * 2^e when e >= 0, and
+ * exactly m * 5^-e / 10^-e when e < 0. Either way that integer has at most
+ * 767 digits, so we work all of them out with schoolbook arithmetic and round
+ * to 17 significant digits (half to even) knowing every digit after the cut.
+ * 17 correctly rounded digits are always enough to get the same double back.
+ */
+int _dtoa_full(char *buf, double x) {
+	union { double d; unsigned long long u; } bits;
+	bits.d = x;
+	int n = 0;
+	if (bits.u >> 63) buf[n++] = '-';
+	int biased = (bits.u >> 52) & 0x7ff;
+	unsigned long long m = bits.u & ((1ULL << 52) - 1);
+	int e = -1074;
+	if (biased > 0) {
+		m |= 1ULL << 52;
+		e = biased - 1075;
+	}
+	// Trailing zero bits of m only make the numbers longer
+	while ((m & 1) == 0) {
+		m >>= 1;
+		e++;
+	}
+
+	// 53 + 1074 * log2(5) bits, at most
+	unsigned int limbs[80];
+	limbs[0] = (unsigned int) m;
+	limbs[1] = (unsigned int) (m >> 32);
+	int len = limbs[1] ? 2 : 1;
+	int point = 0;
+	if (e >= 0) {
+		for (; e >= 31; e -= 31) _big_mul(limbs, &len, 1U << 31);
+		_big_mul(limbs, &len, 1U << e);
+	} else {
+		point = e;
+		// 5^13 is the biggest power of 5 that fits in 32 bits
+		for (; e <= -13; e += 13) _big_mul(limbs, &len, 1220703125);
+		for (; e < 0; e++) _big_mul(limbs, &len, 5);
+	}
+	char digits[800];
+	int count = _big_digits(limbs, len, digits);
+	int exponent = count - 1 + point;
+
+	if (count > 17) {
+		int sticky = 0;
+		for (int i = 18; i < count; i++) sticky |= digits[i] != '0';
+		int up = digits[17] > '5' || (digits[17] == '5'
+			&& (sticky || (digits[16] - '0') % 2 == 1));
+		count = 17;
+		for (int i = 16; up && i >= 0; i--) {
+			up = digits[i] == '9';
+			digits[i] = up ? '0' : digits[i] + 1;
+		}
+		// Rounded up from 99...9 to 100...0
+		if (up) {
+			digits[0] = '1';
+			exponent++;
+		}
 	}
+	while (count > 1 && digits[count - 1] == '0') count--;
 
-	// Reverse the digits of the buffer up to the nth character, since we put the
-	// ones digit in buf[0], tens digit in buf[1], etc.
-	for(int i = 0; i < n / 2; i++) {
-		char tmp = buf[i];
-		buf[i]  = buf[n - i - 1];
-		buf[n - i - 1] = tmp;
+	buf[n++] = digits[0];
+	if (count > 1) {
+		buf[n++] = '.';
+		for (int i = 1; i < count; i++) {
+			buf[n++] = digits[i];
+		}
+	}
+	if (exponent != 0) {
+		buf[n++] = 'e';
+		n += itoa(buf + n, exponent);
 	}
 	return n;
 }
 
 /*
- * Printing doubles is notoriously harder than it looks, but I am not too 
- * concerned about precision. We won't be dealing with scientific notation,
- * or infinities, or NaN in this implementation.
+ * Printing doubles is notoriously harder than it looks. With a precision, we
+ * are not too concerned about it, and don't deal with scientific notation,
+ * infinities or NaN. Without one, _dtoa_full does it properly.
+ *
+ * The fraction is scaled up to an integer of precision digits and rounded all
+ * at once, rather than peeled off a digit at a time, which is faster and
+ * rounds instead of truncating. Rounding up can carry into the integer part.
+ * The sign goes on last, so that tiny negatives don't come out as -0.000.
  */
 int dtoa(char *buf, double x, int precision) {
-	// Special cases: if zero, just return 0, and if negative, add a - to the
-	// buffer and make it positive
 	if (x == 0) {
 		buf[0] = '0';
 		return 1;
 	}
-	int isneg = 0;
-	if (x < 0) {
-		isneg = 1;
-		buf[0] = '-';
-		x *= -1;
+	if (precision < 0) return _dtoa_full(buf, x);
+	int negative = x < 0;
+	if (negative) x *= -1;
+	if (precision > 18) precision = 18;
+	unsigned long long scale = 1;
+	for (int i = 0; i < precision; i++) {
+		scale *= 10;
 	}
-	int n = itoa(buf + isneg, (int) x);
-	n += isneg;
-	// Add the decimal point and increment n
+	unsigned long long whole = (unsigned long long) x;
+	unsigned long long frac = (x - whole) * scale + 0.5;
+	if (frac >= scale) {
+		whole++;
+		frac -= scale;
+	}
+	int n = 0;
+	if (negative && (whole > 0 || frac > 0)) buf[n++] = '-';
+	n += _utoa(buf + n, whole);
+	// Add the decimal point, then the fraction, zero padded
 	buf[n++] = '.';
-
-	// This little maneuver is the best way I could figure out how to get the
-	// fraction part of a number, not sure if there's a better way
-	x = x - ((int) x);
-	// Similar process to itoa except happily we don't need to worry about
-	// reversing
-	for(int i = 0; i < precision; i++) {
-		x *= 10;
-		buf[n] = ((char) x) + '0';
-		n++;
-		x = x - ((int) x);
+	for (int i = precision - 1; i >= 0; i--) {
+		buf[n + i] = (frac % 10) + '0';
+		frac /= 10;
 	}
-	return n;
+	return n + precision;
 }
 
-void seed() {
+double clock_seconds() {
 	struct timespec t;
-	// we have to do this instead of just time(NULL)
-	// because clock_gettime is a syscall and time is stdlib
-	if(clock_gettime(CLOCK_REALTIME, &t) == -1) {
+	if(clock_gettime(CLOCK_MONOTONIC, &t) == -1) {
 		perror("clock_gettime");
 		exit(1);
 	}
-	// Seed the randomizer with system time
-	srand(t.tv_sec);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+long peak_rss_kb() {
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == -1) {
+		perror("getrusage");
+		exit(1);
+	}
+	// Linux reports ru_maxrss in kilobytes already
+	return usage.ru_maxrss;
+}
+
+// Failing is harmless (the mapping just keeps regular pages), so errors are
+// ignored
+void advise_huge_pages(void *ptr, size_t size) {
+	if(size >= (2 << 20)) madvise(ptr, size, MADV_HUGEPAGE);
+}
+
+void write_all(int fd, const void *buf, size_t size) {
+	const char *p = (const char*) buf;
+	while(size > 0) {
+		ssize_t n = write(fd, p, size);
+		if(n < 0) {
+			perror("write_all");
+			exit(29);
+		}
+		p += n;
+		size -= n;
+	}
+}
+
+// Default buffer size for writer_init
+static const size_t _WRITER_SIZE = 1 << 20;
+
+void writer_init(writer *w, int fd, char *buf, size_t size) {
+	w->fd = fd;
+	w->len = 0;
+	w->_owned = buf == NULL;
+	if(buf == NULL) {
+		if(size == 0) size = _WRITER_SIZE;
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(buf == MAP_FAILED) {
+			printf("writer_init map failed\n");
+			exit(58);
+		}
+	}
+	w->buf = buf;
+	w->size = size;
+}
+
+// write() may write less than asked for, so keep going until it's all out
+void writer_flush(writer *w) {
+	char *p = w->buf;
+	size_t left = w->len;
+	while(left > 0) {
+		ssize_t n = write(w->fd, p, left);
+		if(n < 0) {
+			perror("writer write");
+			exit(59);
+		}
+		p += n;
+		left -= n;
+	}
+	w->len = 0;
+}
+
+void writer_str(writer *w, const char *s, size_t len) {
+	while(len > 0) {
+		if(w->len == w->size) writer_flush(w);
+		size_t n = w->size - w->len;
+		if(n > len) n = len;
+		for(size_t i = 0; i < n; i++) {
+			w->buf[w->len + i] = s[i];
+		}
+		w->len += n;
+		s += n;
+		len -= n;
+	}
+}
+
+// Numbers are formatted in place, so there has to be room for the longest one
+// first: 11 characters for an int, and 40 for a double
+void writer_int(writer *w, int x) {
+	if(w->size - w->len < 11) writer_flush(w);
+	w->len += itoa(w->buf + w->len, x);
+}
+
+void writer_double(writer *w, double x, int precision) {
+	if(w->size - w->len < 40) writer_flush(w);
+	w->len += dtoa(w->buf + w->len, x, precision);
+}
+
+void writer_destroy(writer *w) {
+	writer_flush(w);
+	if(w->_owned && munmap(w->buf, w->size)) {
+		perror("writer_destroy munmap");
+		exit(60);
+	}
 }
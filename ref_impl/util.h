@@ -2,12 +2,16 @@
 #define _UTIL_H_
 
 #include <time.h>
+#include <sys/resource.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 /**
  * This header file defines useful functions used in both nn.c and dataset.c.
- * For now, it is just two functions, itoa and dtoa.
+ * Mostly number formatting (itoa and dtoa), and a buffered writer built on
+ * them, plus a few odds and ends.
  * 
  * Although these functions are implemented in the C standard library, we
  * will not have access to that in Assembly, so they have to be cooked up from
@@ -16,8 +20,8 @@
  */
 
 /**
- * Converts a POSITIVE integer to a string, putting it into the given buffer.
- * Does not zero-pad.
+ * Converts an integer, positive or negative, to a string, putting it into the
+ * given buffer. Does not zero-pad. At most 11 characters are written.
  * @param buf the buffer to store the stringified int in
  * @param x the int to stringify
  * @returns the length of the stringified int
@@ -27,17 +31,100 @@ int itoa(char *buf, int x);
 /**
  * Converts a double value, positive or negative, into a string, putting it in
  * the given buffer. The number of decimal places after the decimal point
- * can be specified by adjusting the precision argument.
+ * can be specified by adjusting the precision argument, up to 18; the value is
+ * rounded to that many. The magnitude has to be below 2^63, and at most 40
+ * characters are written.
+ *
+ * A negative precision writes the double in full instead, for any finite
+ * value: its 17 significant digits, correctly rounded, in scientific notation
+ * and without trailing zeros (e.g. 4.9768535676304456e-2, or 5e-1). Parsing
+ * that gives back exactly the same double. At most 24 characters are written.
  * @param buf the buffer to store the stringified double in
  * @param x the double to stringify
+ * @param precision the number of digits after the point, or -1 for all of it
  * @returns the length of the stringified double.
  */
 int dtoa(char *buf, double x, int precision);
 
 /**
- * Seed the randomizer. Only in the C implementation, going to have to figure
- * out something else for asm.
+ * Returns the current time in seconds from a monotonic clock. Only differences
+ * between two calls are meaningful; used for timing.
  */
-void seed();
+double clock_seconds();
+
+/**
+ * Returns the peak resident set size of this process so far, in kilobytes:
+ * the most physical memory it has ever held at once.
+ */
+long peak_rss_kb();
+
+/**
+ * Asks for transparent huge pages for a fresh anonymous mapping, if it is big
+ * enough to hold one (2 MB). Working sets like a dataset's rows or a big
+ * network's weights then take far fewer TLB entries. Only has an effect on
+ * private mappings, when the system's THP setting allows madvise.
+ */
+void advise_huge_pages(void *ptr, size_t size);
+
+/**
+ * Writes all size bytes of buf to fd. write() may write less than asked for,
+ * so this keeps going until it's all out, and exits if writing fails.
+ */
+void write_all(int fd, const void *buf, size_t size);
+
+/**
+ * A buffered writer, for output made of many small pieces (a CSV cell, a log
+ * line). Numbers are formatted with itoa and dtoa straight into the buffer,
+ * and the buffer goes out with one write once it is full, or on writer_flush,
+ * instead of a write per piece.
+ */
+typedef struct writer {
+	// Where the output goes
+	int fd;
+	// The buffer, its size, and how much of it is filled
+	char *buf;
+	size_t size;
+	size_t len;
+	// Nonzero if the buffer was mapped by writer_init, and is ours to unmap
+	int _owned;
+} writer;
+
+/**
+ * Sets up a writer.
+ *
+ * @param w the uninitialized writer to set up
+ * @param fd the file descriptor to write to
+ * @param buf the buffer to use, e.g. on the stack for a single line, or NULL
+ * 	to have one mapped
+ * @param size the size of buf, or of the buffer to map (0 for 1 MB). A
+ * 	buffer has to hold at least 64 bytes.
+ */
+void writer_init(writer *w, int fd, char *buf, size_t size);
+
+/**
+ * Appends len bytes of s.
+ */
+void writer_str(writer *w, const char *s, size_t len);
+
+/**
+ * Appends an int, as itoa formats it.
+ */
+void writer_int(writer *w, int x);
+
+/**
+ * Appends a double, as dtoa formats it.
+ */
+void writer_double(writer *w, double x, int precision);
+
+/**
+ * Writes out everything appended so far.
+ */
+void writer_flush(writer *w);
+
+/**
+ * Flushes a writer, and unmaps its buffer if writer_init mapped it. The file
+ * descriptor is left open.
+ */
+void writer_destroy(writer *w);
 
 #endif